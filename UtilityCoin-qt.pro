@@ -124,8 +124,10 @@ contains(BITCOIN_NEED_QT_PLUGINS, 1) {
 INCLUDEPATH += src/leveldb/include src/leveldb/helpers
 LIBS += $$PWD/src/leveldb/libleveldb.a $$PWD/src/leveldb/libmemenv.a
 SOURCES += \
+    src/blockencodings.cpp \
     src/bloom.cpp \
     src/hash.cpp \
+    src/jsonwriter.cpp \
     src/aes_helper.c \
     src/blake.c \
     src/bmw.c \
@@ -269,10 +271,15 @@ HEADERS += src/qt/bitcoingui.h \
     src/version.h \
     src/netbase.h \
     src/clientversion.h \
+    src/addressindex.h \
+    src/blockencodings.h \
     src/bloom.h \
     src/checkqueue.h \
     src/hash.h \
     src/hashblock.h \
+    src/jsonwriter.h \
+    src/notifier.h \
+    src/secp256k1.h \
     src/limitedmap.h \
     src/sph_blake.h \
     src/sph_bmw.h \
@@ -346,6 +353,9 @@ SOURCES += \
     src/rpcwallet.cpp \
     src/rpcblockchain.cpp \
     src/rpcrawtransaction.cpp \
+    src/rest.cpp \
+    src/notifier.cpp \
+    src/secp256k1.cpp \
     src/qt/overviewpage.cpp \
     src/qt/csvmodelwriter.cpp \
     src/crypter.cpp \
@@ -0,0 +1,261 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "serialize.h"
+#include "script.h"
+#include "uint256.h"
+
+//
+// Optional indexes for explorers (-addressindex, -spentindex). They live in
+// the transaction LevelDB next to the tx index and are written in the same
+// batch as the block they come from.
+//
+
+enum
+{
+    ADDRESS_TYPE_NONE       = 0,
+    ADDRESS_TYPE_PUBKEYHASH = 1,
+    ADDRESS_TYPE_SCRIPTHASH = 2,
+};
+
+// Heights in keys are stored big-endian so that entries sort by height
+template<typename Stream>
+inline void WriteBE32(Stream& s, unsigned int n)
+{
+    unsigned char pch[4];
+    pch[0] = (n >> 24) & 0xff;
+    pch[1] = (n >> 16) & 0xff;
+    pch[2] = (n >> 8) & 0xff;
+    pch[3] = n & 0xff;
+    s.write((char*)pch, 4);
+}
+
+template<typename Stream>
+inline unsigned int ReadBE32(Stream& s)
+{
+    unsigned char pch[4];
+    s.read((char*)pch, 4);
+    return ((unsigned int)pch[0] << 24) | (pch[1] << 16) | (pch[2] << 8) | pch[3];
+}
+
+/** One credit or debit of an address: key of "addrtx" entries, the value
+ *  is the amount (negative when spending). */
+class CAddressIndexKey
+{
+public:
+    unsigned char nAddressType;
+    uint160 hashBytes;
+    int nHeight;
+    unsigned int nTxIndex; // position of the transaction in its block
+    uint256 txhash;
+    unsigned int nIndex;   // input or output number
+    bool fSpending;
+
+    CAddressIndexKey()
+    {
+        SetNull();
+    }
+
+    CAddressIndexKey(int nAddressTypeIn, const uint160& hashBytesIn, int nHeightIn, unsigned int nTxIndexIn,
+                     const uint256& txhashIn, unsigned int nIndexIn, bool fSpendingIn)
+    {
+        nAddressType = nAddressTypeIn;
+        hashBytes = hashBytesIn;
+        nHeight = nHeightIn;
+        nTxIndex = nTxIndexIn;
+        txhash = txhashIn;
+        nIndex = nIndexIn;
+        fSpending = fSpendingIn;
+    }
+
+    void SetNull()
+    {
+        nAddressType = ADDRESS_TYPE_NONE;
+        hashBytes = 0;
+        nHeight = 0;
+        nTxIndex = 0;
+        txhash = 0;
+        nIndex = 0;
+        fSpending = false;
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 1 + 20 + 4 + 4 + 32 + 4 + 1;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, nAddressType, nType, nVersion);
+        ::Serialize(s, hashBytes, nType, nVersion);
+        WriteBE32(s, nHeight);
+        WriteBE32(s, nTxIndex);
+        ::Serialize(s, txhash, nType, nVersion);
+        ::Serialize(s, nIndex, nType, nVersion);
+        ::Serialize(s, fSpending, nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        ::Unserialize(s, nAddressType, nType, nVersion);
+        ::Unserialize(s, hashBytes, nType, nVersion);
+        nHeight = ReadBE32(s);
+        nTxIndex = ReadBE32(s);
+        ::Unserialize(s, txhash, nType, nVersion);
+        ::Unserialize(s, nIndex, nType, nVersion);
+        ::Unserialize(s, fSpending, nType, nVersion);
+    }
+};
+
+/** Seek position for an address' "addrtx" entries from a given height on */
+class CAddressIndexIteratorKey
+{
+public:
+    unsigned char nAddressType;
+    uint160 hashBytes;
+    int nHeight;
+
+    CAddressIndexIteratorKey(int nAddressTypeIn, const uint160& hashBytesIn, int nHeightIn)
+    {
+        nAddressType = nAddressTypeIn;
+        hashBytes = hashBytesIn;
+        nHeight = nHeightIn;
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 1 + 20 + 4;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, nAddressType, nType, nVersion);
+        ::Serialize(s, hashBytes, nType, nVersion);
+        WriteBE32(s, nHeight);
+    }
+};
+
+/** An unspent output of an address: key of "addrutxo" entries */
+class CAddressUnspentKey
+{
+public:
+    unsigned char nAddressType;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int nIndex;
+
+    CAddressUnspentKey()
+    {
+        nAddressType = ADDRESS_TYPE_NONE;
+        hashBytes = 0;
+        txhash = 0;
+        nIndex = 0;
+    }
+
+    CAddressUnspentKey(int nAddressTypeIn, const uint160& hashBytesIn, const uint256& txhashIn, unsigned int nIndexIn)
+    {
+        nAddressType = nAddressTypeIn;
+        hashBytes = hashBytesIn;
+        txhash = txhashIn;
+        nIndex = nIndexIn;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nAddressType);
+        READWRITE(hashBytes);
+        READWRITE(txhash);
+        READWRITE(nIndex);
+    )
+};
+
+class CAddressUnspentValue
+{
+public:
+    int64_t nValue;
+    CScript script;
+    int nHeight;
+
+    CAddressUnspentValue()
+    {
+        SetNull();
+    }
+
+    CAddressUnspentValue(int64_t nValueIn, const CScript& scriptIn, int nHeightIn)
+    {
+        nValue = nValueIn;
+        script = scriptIn;
+        nHeight = nHeightIn;
+    }
+
+    void SetNull()
+    {
+        nValue = -1;
+        script.clear();
+        nHeight = 0;
+    }
+
+    // a null value in an update erases the entry
+    bool IsNull() const
+    {
+        return nValue == -1;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nValue);
+        READWRITE(script);
+        READWRITE(nHeight);
+    )
+};
+
+/** Where an output was spent: value of "spent" entries, keyed by COutPoint */
+class CSpentIndexValue
+{
+public:
+    uint256 txid;
+    unsigned int nInputIndex;
+    int nHeight;
+    int64_t nValue;
+    unsigned char nAddressType;
+    uint160 addressHash;
+
+    CSpentIndexValue()
+    {
+        txid = 0;
+        nInputIndex = 0;
+        nHeight = 0;
+        nValue = 0;
+        nAddressType = ADDRESS_TYPE_NONE;
+        addressHash = 0;
+    }
+
+    CSpentIndexValue(const uint256& txidIn, unsigned int nInputIndexIn, int nHeightIn, int64_t nValueIn,
+                     int nAddressTypeIn, const uint160& addressHashIn)
+    {
+        txid = txidIn;
+        nInputIndex = nInputIndexIn;
+        nHeight = nHeightIn;
+        nValue = nValueIn;
+        nAddressType = nAddressTypeIn;
+        addressHash = addressHashIn;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(txid);
+        READWRITE(nInputIndex);
+        READWRITE(nHeight);
+        READWRITE(nValue);
+        READWRITE(nAddressType);
+        READWRITE(addressHash);
+    )
+};
+
+#endif
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_ALLOCATORS_H
 #define BITCOIN_ALLOCATORS_H
 
+#include <stdint.h>
 #include <string.h>
 #include <string>
 #include <boost/thread/mutex.hpp>
@@ -220,6 +221,32 @@ struct secure_allocator : public std::allocator<T>
 };
 
 
+/**
+ * Thread-local pool of serialization buffers.
+ *
+ * Requests are rounded up to a size class and freed blocks are kept on a
+ * free list of the thread that frees them, so the short-lived streams built
+ * for every database record and network message are recycled instead of
+ * going to the heap each time. Requests past the largest class are passed
+ * straight to the heap.
+ */
+class CBufferPool
+{
+public:
+    // 64 bytes to 64 KB, by factors of 4
+    static const unsigned int SIZE_CLASSES = 6;
+    static const size_t MIN_CLASS_SIZE = 64;
+    // Free blocks kept per class and thread
+    static const unsigned int MAX_FREE = 16;
+
+    static void* Allocate(size_t nSize);
+    // fZero clears the block first, for buffers that may have held secrets
+    static void Free(void* p, size_t nSize, bool fZero);
+    // Totals over all threads: blocks handed out, how many of those had to
+    // come from the heap, and bytes cleared on free
+    static void GetStats(uint64_t& nAllocsRet, uint64_t& nHeapAllocsRet, uint64_t& nZeroedRet);
+};
+
 //
 // Allocator that clears its contents before deletion.
 //
@@ -243,11 +270,50 @@ struct zero_after_free_allocator : public std::allocator<T>
     template<typename _Other> struct rebind
     { typedef zero_after_free_allocator<_Other> other; };
 
+    T* allocate(std::size_t n, const void *hint = 0)
+    {
+        return static_cast<T*>(CBufferPool::Allocate(sizeof(T) * n));
+    }
+
     void deallocate(T* p, std::size_t n)
     {
         if (p != NULL)
-            memset(p, 0, sizeof(T) * n);
-        std::allocator<T>::deallocate(p, n);
+            CBufferPool::Free(p, sizeof(T) * n, true);
+    }
+};
+
+//
+// Allocator for buffers that never hold secrets: pooled like the above,
+// but freed without clearing.
+//
+template<typename T>
+struct pool_allocator : public std::allocator<T>
+{
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type  difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+    pool_allocator() throw() {}
+    pool_allocator(const pool_allocator& a) throw() : base(a) {}
+    template <typename U>
+    pool_allocator(const pool_allocator<U>& a) throw() : base(a) {}
+    ~pool_allocator() throw() {}
+    template<typename _Other> struct rebind
+    { typedef pool_allocator<_Other> other; };
+
+    T* allocate(std::size_t n, const void *hint = 0)
+    {
+        return static_cast<T*>(CBufferPool::Allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (p != NULL)
+            CBufferPool::Free(p, sizeof(T) * n, false);
     }
 };
 
@@ -10,6 +10,7 @@
 #include "base58.h"
 #include "bitcoinrpc.h"
 #include "db.h"
+#include "jsonwriter.h"
 
 #undef printf
 #include <boost/asio.hpp>
@@ -38,7 +39,19 @@ static std::string strRPCUserColonPass;
 
 const Object emptyobj;
 
-void ThreadRPCServer3(void* parg);
+void ThreadRPCWorker(void* parg);
+void ThreadRPCBatchWorker(void* parg);
+
+class AcceptedConnection;
+
+static const int DEFAULT_RPC_THREADS = 4;
+static const int DEFAULT_RPC_WORKQUEUE = 16;
+static const int DEFAULT_RPC_BATCH_THREADS = 4;
+static const int DEFAULT_RPC_SERVER_TIMEOUT = 30;
+// Longest request line and headers read before giving up on a request
+static const unsigned int MAX_HTTP_HEADERS_SIZE = 64 * 1024;
+static const int DEFAULT_RPC_MAX_BATCH = 1000;
+static const int DEFAULT_RPC_BATCH_TIMEOUT = 30;
 
 static inline unsigned short GetDefaultRPCPort()
 {
@@ -231,6 +244,152 @@ Value stop(const Array& params, bool fHelp)
 }
 
 
+//
+// Per-method call latency, recorded by CRPCTable::execute
+//
+
+// Upper bounds of the latency histogram buckets in microseconds, the last
+// bucket counts everything slower
+static const int64_t nRPCLatencyBounds[] = { 1000, 10000, 100000, 1000000, 10000000 };
+static const char* pszRPCLatencyBuckets[] = { "<1ms", "<10ms", "<100ms", "<1s", "<10s", ">=10s" };
+static const unsigned int RPC_LATENCY_BUCKETS = sizeof(pszRPCLatencyBuckets) / sizeof(pszRPCLatencyBuckets[0]);
+
+class CRPCMethodStats
+{
+public:
+    uint64_t nCalls;
+    uint64_t nErrors;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    uint64_t vBuckets[RPC_LATENCY_BUCKETS];
+
+    CRPCMethodStats()
+    {
+        nCalls = 0;
+        nErrors = 0;
+        nTotalMicros = 0;
+        nMaxMicros = 0;
+        for (unsigned int i = 0; i < RPC_LATENCY_BUCKETS; i++)
+            vBuckets[i] = 0;
+    }
+};
+
+static CCriticalSection cs_rpcStats;
+static map<string, CRPCMethodStats> mapRPCStats;
+
+// Work queue counters, guarded by mutexRPCQueue
+static boost::mutex mutexRPCQueue;
+static boost::condition_variable condRPCQueue;
+static deque<AcceptedConnection*> queueRPC;
+static unsigned int nRPCWorkQueue = DEFAULT_RPC_WORKQUEUE;
+static int nRPCThreads = 0;
+static int nRPCLongPolls = 0;
+static uint64_t nRPCRejected = 0;
+// Seconds a connection may take to send a whole request, or sit idle
+// between keep-alive requests, before it is closed
+static int nRPCServerTimeout = DEFAULT_RPC_SERVER_TIMEOUT;
+
+CRPCLongPollSlot::CRPCLongPollSlot()
+{
+    boost::unique_lock<boost::mutex> lock(mutexRPCQueue);
+    fHeld = (nRPCLongPolls + 1 < nRPCThreads);
+    if (fHeld)
+        nRPCLongPolls++;
+}
+
+CRPCLongPollSlot::~CRPCLongPollSlot()
+{
+    if (!fHeld)
+        return;
+    boost::unique_lock<boost::mutex> lock(mutexRPCQueue);
+    nRPCLongPolls--;
+}
+
+static void RecordRPCLatency(const string& strMethod, int64_t nMicros, bool fError)
+{
+    unsigned int nBucket = 0;
+    while (nBucket < RPC_LATENCY_BUCKETS - 1 && nMicros >= nRPCLatencyBounds[nBucket])
+        nBucket++;
+
+    LOCK(cs_rpcStats);
+    CRPCMethodStats& stats = mapRPCStats[strMethod];
+    stats.nCalls++;
+    if (fError)
+        stats.nErrors++;
+    stats.nTotalMicros += nMicros;
+    stats.nMaxMicros = max(stats.nMaxMicros, nMicros);
+    stats.vBuckets[nBucket]++;
+}
+
+Value getrpcstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcstats\n"
+            "Returns RPC server queue state and per-method call latency histograms.");
+
+    Object obj;
+    {
+        boost::unique_lock<boost::mutex> lock(mutexRPCQueue);
+        obj.push_back(Pair("threads",   nRPCThreads));
+        obj.push_back(Pair("longpolls", nRPCLongPolls));
+        obj.push_back(Pair("queue",     (int)queueRPC.size()));
+        obj.push_back(Pair("queuemax",  (int)nRPCWorkQueue));
+        obj.push_back(Pair("rejected",  (boost::uint64_t)nRPCRejected));
+    }
+
+    Object methods;
+    {
+        LOCK(cs_rpcStats);
+        for (map<string, CRPCMethodStats>::iterator it = mapRPCStats.begin(); it != mapRPCStats.end(); ++it)
+        {
+            const CRPCMethodStats& stats = (*it).second;
+            Object entry, histogram;
+            entry.push_back(Pair("calls",     (boost::uint64_t)stats.nCalls));
+            entry.push_back(Pair("errors",    (boost::uint64_t)stats.nErrors));
+            entry.push_back(Pair("totaltime", (double)stats.nTotalMicros / 1000000));
+            entry.push_back(Pair("avgtime",   (double)stats.nTotalMicros / 1000000 / stats.nCalls));
+            entry.push_back(Pair("maxtime",   (double)stats.nMaxMicros / 1000000));
+            for (unsigned int i = 0; i < RPC_LATENCY_BUCKETS; i++)
+                histogram.push_back(Pair(pszRPCLatencyBuckets[i], (boost::uint64_t)stats.vBuckets[i]));
+            entry.push_back(Pair("histogram", histogram));
+            methods.push_back(Pair((*it).first, entry));
+        }
+    }
+    obj.push_back(Pair("methods", methods));
+    return obj;
+}
+
+Value getlockstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getlockstats\n"
+            "Returns wait and hold times for each place a lock is taken, most waited on first.\n"
+            "Only counted when started with -lockstats.");
+
+    if (!fLockStats)
+        throw JSONRPCError(RPC_MISC_ERROR, "Lock statistics are off, restart with -lockstats");
+
+    vector<CLockSite> vSites = GetLockStats();
+    Array ret;
+    BOOST_FOREACH(const CLockSite& site, vSites)
+    {
+        Object entry;
+        entry.push_back(Pair("lock",        site.pszName));
+        entry.push_back(Pair("site",        strprintf("%s:%d", site.pszFile, site.nLine)));
+        entry.push_back(Pair("locks",       (boost::uint64_t)site.nLocks));
+        entry.push_back(Pair("contentions", (boost::uint64_t)site.nContentions));
+        entry.push_back(Pair("waittime",    (double)site.nWaitMicros / 1000000));
+        entry.push_back(Pair("maxwait",     (double)site.nMaxWaitMicros / 1000000));
+        entry.push_back(Pair("holdtime",    (double)site.nHoldMicros / 1000000));
+        entry.push_back(Pair("maxhold",     (double)site.nMaxHoldMicros / 1000000));
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
+
 
 //
 // Call Table
@@ -238,84 +397,103 @@ Value stop(const Array& params, bool fHelp)
 
 
 static const CRPCCommand vRPCCommands[] =
-{ //  name                      function                 safemd  unlocked
-  //  ------------------------  -----------------------  ------  --------
-    { "help",                   &help,                   true,   true },
-    { "stop",                   &stop,                   true,   true },
-    { "getbestblockhash",       &getbestblockhash,       true,   false },
-    { "getblockcount",          &getblockcount,          true,   false },
-    { "getconnectioncount",     &getconnectioncount,     true,   false },
-    { "getpeerinfo",            &getpeerinfo,            true,   false },
-    { "getdifficulty",          &getdifficulty,          true,   false },
-    { "getinfo",                &getinfo,                true,   false },
-    { "getsubsidy",             &getsubsidy,             true,   false },
-    { "getmininginfo",          &getmininginfo,          true,   false },
-    { "getstakinginfo",         &getstakinginfo,         true,   false },
-    { "getnewaddress",          &getnewaddress,          true,   false },
-    { "getnewpubkey",           &getnewpubkey,           true,   false },
-    { "getaccountaddress",      &getaccountaddress,      true,   false },
-    { "setaccount",             &setaccount,             true,   false },
-    { "getaccount",             &getaccount,             false,  false },
-    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,   false },
-    { "sendtoaddress",          &sendtoaddress,          false,  false },
-    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,  false },
-    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,  false },
-    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,  false },
-    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,  false },
-    { "backupwallet",           &backupwallet,           true,   false },
-    { "keypoolrefill",          &keypoolrefill,          true,   false },
-    { "walletpassphrase",       &walletpassphrase,       true,   false },
-    { "walletpassphrasechange", &walletpassphrasechange, false,  false },
-    { "walletlock",             &walletlock,             true,   false },
-    { "encryptwallet",          &encryptwallet,          false,  false },
-    { "validateaddress",        &validateaddress,        true,   false },
-    { "validatepubkey",         &validatepubkey,         true,   false },
-    { "getbalance",             &getbalance,             false,  false },
-    { "move",                   &movecmd,                false,  false },
-    { "sendfrom",               &sendfrom,               false,  false },
-    { "sendmany",               &sendmany,               false,  false },
-    { "addmultisigaddress",     &addmultisigaddress,     false,  false },
-    { "addredeemscript",        &addredeemscript,        false,  false },
-    { "getrawmempool",          &getrawmempool,          true,   false },
-    { "getblock",               &getblock,               false,  false },
-    { "getblockbynumber",       &getblockbynumber,       false,  false },
-    { "getblockhash",           &getblockhash,           false,  false },
-    { "gettransaction",         &gettransaction,         false,  false },
-    { "listtransactions",       &listtransactions,       false,  false },
-    { "listaddressgroupings",   &listaddressgroupings,   false,  false },
-    { "signmessage",            &signmessage,            false,  false },
-    { "verifymessage",          &verifymessage,          false,  false },
-    { "getwork",                &getwork,                true,   false },
-    { "getworkex",              &getworkex,              true,   false },
-    { "listaccounts",           &listaccounts,           false,  false },
-    { "settxfee",               &settxfee,               false,  false },
-    { "getblocktemplate",       &getblocktemplate,       true,   false },
-    { "submitblock",            &submitblock,            false,  false },
-    { "listsinceblock",         &listsinceblock,         false,  false },
-    { "dumpprivkey",            &dumpprivkey,            false,  false },
-    { "dumpwallet",             &dumpwallet,             true,   false },
-    { "importwallet",           &importwallet,           false,  false },
-    { "importprivkey",          &importprivkey,          false,  false },
-    { "listunspent",            &listunspent,            false,  false },
-    { "getrawtransaction",      &getrawtransaction,      false,  false },
-    { "createrawtransaction",   &createrawtransaction,   false,  false },
-    { "decoderawtransaction",   &decoderawtransaction,   false,  false },
-    { "decodescript",           &decodescript,           false,  false },
-    { "signrawtransaction",     &signrawtransaction,     false,  false },
-    { "sendrawtransaction",     &sendrawtransaction,     false,  false },
-    { "getcheckpoint",          &getcheckpoint,          true,   false },
-    { "reservebalance",         &reservebalance,         false,  true  },
-    { "checkwallet",            &checkwallet,            false,  true  },
-    { "repairwallet",           &repairwallet,           false,  true  },
-    { "resendtx",               &resendtx,               false,  true  },
-    { "makekeypair",            &makekeypair,            false,  true  },
-    { "sendalert",              &sendalert,              false,  false },
-    { "generatesharedkey",      &generatesharedkey,      false,  false },
-    { "startservicenodes",      &startservicenodes,      false,  true  },
-    { "stopservicenodes",       &stopservicenodes,       false,  true  },
-    { "listservicenodes",       &listservicenodes,       false,  false },
-    { "test",                   &test,                   false,  false },
+{ //  name                      function                 safemd  locks             rdonly
+  //  ------------------------  -----------------------  ------  ----------------  ------
+    { "help",                   &help,                   true,   RPC_LOCK_NONE,    false },
+    { "stop",                   &stop,                   true,   RPC_LOCK_NONE,    false },
+    { "getrpcstats",            &getrpcstats,            true,   RPC_LOCK_NONE,    true  },
+    { "getlockstats",           &getlockstats,           true,   RPC_LOCK_NONE,    true  },
+    { "getbestblockhash",       &getbestblockhash,       true,   RPC_LOCK_NONE,    true  },
+    { "getblockcount",          &getblockcount,          true,   RPC_LOCK_NONE,    true  },
+    { "getconnectioncount",     &getconnectioncount,     true,   RPC_LOCK_NONE,    true  },
+    { "getpeerinfo",            &getpeerinfo,            true,   RPC_LOCK_NONE,    true  },
+    { "getnettotals",           &getnettotals,           true,   RPC_LOCK_NONE,    true  },
+    { "getdifficulty",          &getdifficulty,          true,   RPC_LOCK_NONE,    true  },
+    { "getinfo",                &getinfo,                true,   RPC_LOCK_ALL,     true  },
+    { "getsubsidy",             &getsubsidy,             true,   RPC_LOCK_ALL,     true  },
+    { "getmininginfo",          &getmininginfo,          true,   RPC_LOCK_ALL,     true  },
+    { "getstakinginfo",         &getstakinginfo,         true,   RPC_LOCK_ALL,     true  },
+    { "getnewaddress",          &getnewaddress,          true,   RPC_LOCK_WALLET,  false },
+    { "getnewpubkey",           &getnewpubkey,           true,   RPC_LOCK_WALLET,  false },
+    { "getaccountaddress",      &getaccountaddress,      true,   RPC_LOCK_WALLET,  false },
+    { "setaccount",             &setaccount,             true,   RPC_LOCK_WALLET,  false },
+    { "getaccount",             &getaccount,             false,  RPC_LOCK_WALLET,  true  },
+    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,   RPC_LOCK_WALLET,  true  },
+    { "sendtoaddress",          &sendtoaddress,          false,  RPC_LOCK_ALL,     false },
+    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,  RPC_LOCK_ALL,     true  },
+    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,  RPC_LOCK_ALL,     true  },
+    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,  RPC_LOCK_ALL,     true  },
+    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,  RPC_LOCK_ALL,     true  },
+    { "backupwallet",           &backupwallet,           true,   RPC_LOCK_WALLET,  false },
+    { "keypoolrefill",          &keypoolrefill,          true,   RPC_LOCK_WALLET,  false },
+    { "walletpassphrase",       &walletpassphrase,       true,   RPC_LOCK_WALLET,  false },
+    { "walletpassphrasechange", &walletpassphrasechange, false,  RPC_LOCK_WALLET,  false },
+    { "walletlock",             &walletlock,             true,   RPC_LOCK_WALLET,  false },
+    { "encryptwallet",          &encryptwallet,          false,  RPC_LOCK_ALL,     false },
+    { "validateaddress",        &validateaddress,        true,   RPC_LOCK_WALLET,  true  },
+    { "validatepubkey",         &validatepubkey,         true,   RPC_LOCK_WALLET,  true  },
+    { "getbalance",             &getbalance,             false,  RPC_LOCK_ALL,     true  },
+    { "move",                   &movecmd,                false,  RPC_LOCK_ALL,     false },
+    { "sendfrom",               &sendfrom,               false,  RPC_LOCK_ALL,     false },
+    { "sendmany",               &sendmany,               false,  RPC_LOCK_ALL,     false },
+    { "addmultisigaddress",     &addmultisigaddress,     false,  RPC_LOCK_WALLET,  false },
+    { "addredeemscript",        &addredeemscript,        false,  RPC_LOCK_WALLET,  false },
+    { "getrawmempool",          &getrawmempool,          true,   RPC_LOCK_NONE,    true  },
+    { "getmempoolinfo",         &getmempoolinfo,         true,   RPC_LOCK_NONE,    true  },
+    { "getsigcacheinfo",        &getsigcacheinfo,        true,   RPC_LOCK_NONE,    true  },
+    { "getblock",               &getblock,               false,  RPC_LOCK_NONE,    true  },
+    { "getblockbynumber",       &getblockbynumber,       false,  RPC_LOCK_NONE,    true  },
+    { "getblockhash",           &getblockhash,           false,  RPC_LOCK_MAIN,    true  },
+    { "gettransaction",         &gettransaction,         false,  RPC_LOCK_ALL,     true  },
+    { "listtransactions",       &listtransactions,       false,  RPC_LOCK_ALL,     true  },
+    { "listaddressgroupings",   &listaddressgroupings,   false,  RPC_LOCK_ALL,     true  },
+    { "signmessage",            &signmessage,            false,  RPC_LOCK_WALLET,  false },
+    { "verifymessage",          &verifymessage,          false,  RPC_LOCK_NONE,    true  },
+    { "getwork",                &getwork,                true,   RPC_LOCK_ALL,     false },
+    { "getworkex",              &getworkex,              true,   RPC_LOCK_ALL,     false },
+    { "listaccounts",           &listaccounts,           false,  RPC_LOCK_ALL,     true  },
+    { "settxfee",               &settxfee,               false,  RPC_LOCK_WALLET,  false },
+    { "getblocktemplate",       &getblocktemplate,       true,   RPC_LOCK_NONE,    false },
+    { "submitblock",            &submitblock,            false,  RPC_LOCK_ALL,     false },
+    { "listsinceblock",         &listsinceblock,         false,  RPC_LOCK_ALL,     true  },
+    { "dumpprivkey",            &dumpprivkey,            false,  RPC_LOCK_WALLET,  false },
+    { "dumpwallet",             &dumpwallet,             true,   RPC_LOCK_ALL,     false },
+    { "importwallet",           &importwallet,           false,  RPC_LOCK_ALL,     false },
+    { "importprivkey",          &importprivkey,          false,  RPC_LOCK_ALL,     false },
+    { "listunspent",            &listunspent,            false,  RPC_LOCK_ALL,     true  },
+    { "getrawtransaction",      &getrawtransaction,      false,  RPC_LOCK_NONE,    true  },
+    { "createrawtransaction",   &createrawtransaction,   false,  RPC_LOCK_NONE,    true  },
+    { "decoderawtransaction",   &decoderawtransaction,   false,  RPC_LOCK_NONE,    true  },
+    { "decodescript",           &decodescript,           false,  RPC_LOCK_NONE,    true  },
+    { "signrawtransaction",     &signrawtransaction,     false,  RPC_LOCK_ALL,     false },
+    { "sendrawtransaction",     &sendrawtransaction,     false,  RPC_LOCK_ALL,     false },
+    { "getaddresstxids",        &getaddresstxids,        false,  RPC_LOCK_NONE,    true  },
+    { "getaddressbalance",      &getaddressbalance,      false,  RPC_LOCK_NONE,    true  },
+    { "getaddressutxos",        &getaddressutxos,        false,  RPC_LOCK_NONE,    true  },
+    { "getspentinfo",           &getspentinfo,           false,  RPC_LOCK_NONE,    true  },
+    { "getcheckpoint",          &getcheckpoint,          true,   RPC_LOCK_ALL,     true  },
+    { "reservebalance",         &reservebalance,         false,  RPC_LOCK_NONE,    false },
+    { "checkwallet",            &checkwallet,            false,  RPC_LOCK_NONE,    false },
+    { "repairwallet",           &repairwallet,           false,  RPC_LOCK_NONE,    false },
+    { "resendtx",               &resendtx,               false,  RPC_LOCK_NONE,    false },
+    { "makekeypair",            &makekeypair,            false,  RPC_LOCK_NONE,    false },
+    { "sendalert",              &sendalert,              false,  RPC_LOCK_ALL,     false },
+    { "generatesharedkey",      &generatesharedkey,      false,  RPC_LOCK_ALL,     false },
+    { "startservicenodes",      &startservicenodes,      false,  RPC_LOCK_NONE,    false },
+    { "stopservicenodes",       &stopservicenodes,       false,  RPC_LOCK_NONE,    false },
+    { "listservicenodes",       &listservicenodes,       false,  RPC_LOCK_ALL,     false },
+    { "test",                   &test,                   false,  RPC_LOCK_ALL,     false },
+
+};
 
+// Commands that can also write their result straight to the HTTP reply,
+// skipping the json_spirit tree. Same locks as their vRPCCommands entry.
+static const CRPCStreamCommand vRPCStreamCommands[] =
+{ //  name                      streamer
+  //  ------------------------  ---------------------------
+    { "getblock",               &getblock_stream },
+    { "getblockbynumber",       &getblockbynumber_stream },
+    { "getrawtransaction",      &getrawtransaction_stream },
 };
 
 CRPCTable::CRPCTable()
@@ -328,6 +506,8 @@ CRPCTable::CRPCTable()
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamCommands) / sizeof(vRPCStreamCommands[0])); vcidx++)
+        mapStreamers[vRPCStreamCommands[vcidx].name] = vRPCStreamCommands[vcidx].streamer;
 }
 
 const CRPCCommand *CRPCTable::operator[](string name) const
@@ -375,7 +555,7 @@ string rfc1123Time()
     return string(buffer);
 }
 
-static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
+static string HTTPReply(int nStatus, const string& strMsg, bool keepalive, const char* pszContentType = "application/json")
 {
     if (nStatus == HTTP_UNAUTHORIZED)
         return strprintf("HTTP/1.0 401 Authorization Required\r\n"
@@ -400,23 +580,24 @@ static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
     else if (nStatus == HTTP_FORBIDDEN) cStatus = "Forbidden";
     else if (nStatus == HTTP_NOT_FOUND) cStatus = "Not Found";
     else if (nStatus == HTTP_INTERNAL_SERVER_ERROR) cStatus = "Internal Server Error";
+    else if (nStatus == HTTP_SERVICE_UNAVAILABLE) cStatus = "Service Unavailable";
     else cStatus = "";
+    // the body is appended rather than formatted in, it may hold binary data
     return strprintf(
             "HTTP/1.1 %d %s\r\n"
             "Date: %s\r\n"
             "Connection: %s\r\n"
             "Content-Length: %"PRIszu"\r\n"
-            "Content-Type: application/json\r\n"
+            "Content-Type: %s\r\n"
             "Server: UtilityCoin-json-rpc/%s\r\n"
-            "\r\n"
-            "%s",
+            "\r\n",
         nStatus,
         cStatus,
         rfc1123Time().c_str(),
         keepalive ? "keep-alive" : "close",
         strMsg.size(),
-        FormatFullVersion().c_str(),
-        strMsg.c_str());
+        pszContentType,
+        FormatFullVersion().c_str()) + strMsg;
 }
 
 int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto)
@@ -459,15 +640,26 @@ int ReadHTTPHeader(std::basic_istream<char>& stream, map<string, string>& mapHea
     return nLen;
 }
 
-int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet)
+// Reads the request line of a request sent to the server
+static void ReadHTTPRequestLine(std::basic_istream<char>& stream, string& strMethod, string& strURI, int& proto)
+{
+    string str;
+    getline(stream, str);
+    vector<string> vWords;
+    boost::split(vWords, str, boost::is_any_of(" "));
+    strMethod = vWords[0];
+    strURI = vWords.size() > 1 ? vWords[1] : "";
+    proto = 0;
+    const char *ver = strstr(str.c_str(), "HTTP/1.");
+    if (ver != NULL)
+        proto = atoi(ver+7);
+}
+
+static int ReadHTTPMessage(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet, int nProto)
 {
     mapHeadersRet.clear();
     strMessageRet = "";
 
-    // Read status
-    int nProto = 0;
-    int nStatus = ReadHTTPStatus(stream, nProto);
-
     // Read header
     int nLen = ReadHTTPHeader(stream, mapHeadersRet);
     if (nLen < 0 || nLen > (int)MAX_SIZE)
@@ -491,9 +683,56 @@ int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRe
             mapHeadersRet["connection"] = "close";
     }
 
+    return HTTP_OK;
+}
+
+int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet)
+{
+    // Read status
+    int nProto = 0;
+    int nStatus = ReadHTTPStatus(stream, nProto);
+
+    if (ReadHTTPMessage(stream, mapHeadersRet, strMessageRet, nProto) != HTTP_OK)
+        return HTTP_INTERNAL_SERVER_ERROR;
     return nStatus;
 }
 
+static void ReadHTTPRequest(std::basic_istream<char>& stream, string& strMethod, string& strURI,
+                            map<string, string>& mapHeadersRet, string& strMessageRet)
+{
+    int nProto = 0;
+    ReadHTTPRequestLine(stream, strMethod, strURI, nProto);
+    ReadHTTPMessage(stream, mapHeadersRet, strMessageRet, nProto);
+}
+
+// Length of the first whole request in strBuffer, 0 if more has to be read
+// first, -1 if its headers or body are too large
+static int HTTPRequestLength(const string& strBuffer)
+{
+    // The headers end at the first empty line, as in ReadHTTPHeader
+    string::size_type nEnd = strBuffer.find("\n\n");
+    string::size_type nEndCRLF = strBuffer.find("\n\r\n");
+    if (nEnd != string::npos)
+        nEnd += 2;
+    if (nEndCRLF != string::npos && (nEnd == string::npos || nEndCRLF + 3 < nEnd))
+        nEnd = nEndCRLF + 3;
+    if (nEnd == string::npos)
+        return strBuffer.size() > MAX_HTTP_HEADERS_SIZE ? -1 : 0;
+    if (nEnd > MAX_HTTP_HEADERS_SIZE)
+        return -1;
+
+    map<string, string> mapHeaders;
+    std::istringstream ssHeaders(strBuffer.substr(0, nEnd));
+    string strRequestLine;
+    getline(ssHeaders, strRequestLine);
+    int nLen = ReadHTTPHeader(ssHeaders, mapHeaders);
+    if (nLen < 0 || nLen > (int)MAX_SIZE)
+        return -1;
+    if (strBuffer.size() < nEnd + nLen)
+        return 0;
+    return nEnd + nLen;
+}
+
 bool HTTPAuthorized(map<string, string>& mapHeaders)
 {
     string strAuth = mapHeaders["authorization"];
@@ -587,6 +826,12 @@ public:
         fNeedHandshake = fUseSSLIn;
     }
 
+    // The server side handshakes asynchronously before the stream is used
+    void handshake_done()
+    {
+        fNeedHandshake = false;
+    }
+
     void handshake(ssl::stream_base::handshake_type role)
     {
         if (!fNeedHandshake) return;
@@ -633,9 +878,17 @@ class AcceptedConnection
 public:
     virtual ~AcceptedConnection() {}
 
+    // Replies are written here, requests are read with async_read_request
     virtual std::iostream& stream() = 0;
     virtual std::string peer_address_to_string() const = 0;
     virtual void close() = 0;
+
+    // Reads until a whole request is buffered without holding a thread.
+    // handler runs on the listener's io_service, with false if the client
+    // went away, sent too much or took longer than nTimeout seconds.
+    virtual void async_read_request(int nTimeout, const boost::function<void (bool)>& handler) = 0;
+    // Moves the next buffered request to strRequest, false if there is none
+    virtual bool take_request(std::string& strRequest) = 0;
 };
 
 template <typename Protocol>
@@ -648,7 +901,13 @@ public:
             bool fUseSSL) :
         sslStream(io_service, context),
         _d(sslStream, fUseSSL),
-        _stream(_d)
+        _stream(_d),
+        fUseSSL(fUseSSL),
+        fNeedHandshake(fUseSSL),
+        timer(io_service),
+        nPendingOps(0),
+        fRequestOK(false),
+        fTimedOut(false)
     {
     }
 
@@ -667,14 +926,174 @@ public:
         _stream.close();
     }
 
+    virtual void async_read_request(int nTimeout, const boost::function<void (bool)>& handler)
+    {
+        // Workers park their connections from their own thread
+        sslStream.get_io_service().post(boost::bind(&AcceptedConnectionImpl::start_read_request, this, nTimeout, handler));
+    }
+
+    virtual bool take_request(std::string& strRequest)
+    {
+        int nLen = HTTPRequestLength(strBuffer);
+        if (nLen <= 0)
+            return false;
+        strRequest = strBuffer.substr(0, nLen);
+        strBuffer.erase(0, nLen);
+        return true;
+    }
+
     typename Protocol::endpoint peer;
     asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
     SSLIOStreamDevice<Protocol> _d;
     iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
+    bool fUseSSL;
+    bool fNeedHandshake;
+
+    // State of async_read_request. While a read is pending only the
+    // io_service thread touches it; once the handler has run, the worker
+    // that owns the connection takes the request out of strBuffer before
+    // parking it again. The read and the deadline each finish once, the
+    // handler runs after both.
+    asio::deadline_timer timer;
+    std::string strBuffer;
+    char pchRead[4096];
+    boost::function<void (bool)> handlerRequest;
+    int nPendingOps;
+    bool fRequestOK;
+    bool fTimedOut;
+
+    void start_read_request(int nTimeout, const boost::function<void (bool)>& handler)
+    {
+        handlerRequest = handler;
+        fRequestOK = false;
+        fTimedOut = false;
+        nPendingOps = 2;
+        timer.expires_from_now(posix_time::seconds(nTimeout));
+        timer.async_wait(boost::bind(&AcceptedConnectionImpl::handle_timeout, this, asio::placeholders::error));
+        if (fNeedHandshake)
+        {
+            fNeedHandshake = false;
+            sslStream.async_handshake(ssl::stream_base::server,
+                boost::bind(&AcceptedConnectionImpl::handle_handshake, this, asio::placeholders::error));
+        }
+        else
+            read_more();
+    }
+
+    void read_more()
+    {
+        int nLen = HTTPRequestLength(strBuffer);
+        if (nLen != 0)
+        {
+            fRequestOK = (nLen > 0);
+            finish_read();
+            return;
+        }
+        // A read that completed just as the deadline passed must not
+        // start another one with no deadline left to cancel it
+        if (fTimedOut)
+        {
+            finish_read();
+            return;
+        }
+        if (fUseSSL)
+            sslStream.async_read_some(asio::buffer(pchRead, sizeof(pchRead)),
+                boost::bind(&AcceptedConnectionImpl::handle_read, this, asio::placeholders::error, asio::placeholders::bytes_transferred));
+        else
+            sslStream.next_layer().async_read_some(asio::buffer(pchRead, sizeof(pchRead)),
+                boost::bind(&AcceptedConnectionImpl::handle_read, this, asio::placeholders::error, asio::placeholders::bytes_transferred));
+    }
+
+    void handle_handshake(const boost::system::error_code& error)
+    {
+        if (error)
+        {
+            finish_read();
+            return;
+        }
+        _stream->handshake_done();
+        read_more();
+    }
+
+    void handle_read(const boost::system::error_code& error, std::size_t nBytes)
+    {
+        if (error || fTimedOut)
+        {
+            finish_read();
+            return;
+        }
+        strBuffer.append(pchRead, nBytes);
+        read_more();
+    }
+
+    void handle_timeout(const boost::system::error_code& error)
+    {
+        // Out of time, make the pending read or handshake fail
+        if (error != asio::error::operation_aborted)
+        {
+            fTimedOut = true;
+            boost::system::error_code ec;
+            sslStream.lowest_layer().cancel(ec);
+        }
+        op_done();
+    }
+
+    void finish_read()
+    {
+        timer.cancel();
+        op_done();
+    }
+
+    void op_done()
+    {
+        // The handler may delete this connection
+        if (--nPendingOps == 0)
+            handlerRequest(fRequestOK);
+    }
 };
 
+// Returns false if the work queue is full
+static bool QueueRPCConnection(AcceptedConnection* conn)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutexRPCQueue);
+        if (queueRPC.size() >= nRPCWorkQueue)
+        {
+            nRPCRejected++;
+            return false;
+        }
+        queueRPC.push_back(conn);
+    }
+    condRPCQueue.notify_one();
+    return true;
+}
+
+// A whole request has arrived on a new or idle keep-alive connection
+static void RPCRequestReadHandler(AcceptedConnection* conn, bool fComplete)
+{
+    if (!fComplete || fShutdown)
+    {
+        conn->close();
+        delete conn;
+    }
+    else if (!QueueRPCConnection(conn))
+    {
+        printf("ThreadRPCServer work queue full, rejecting connection from %s\n", conn->peer_address_to_string().c_str());
+        conn->stream() << HTTPReply(HTTP_SERVICE_UNAVAILABLE, "", false) << std::flush;
+        conn->close();
+        delete conn;
+    }
+}
+
+// Connections only reach a worker once their request is read, so clients
+// that connect and send nothing, or go quiet, never hold one
+static void ReadRPCRequest(AcceptedConnection* conn)
+{
+    conn->async_read_request(nRPCServerTimeout, boost::bind(&RPCRequestReadHandler, conn, _1));
+}
+
 void ThreadRPCServer(void* parg)
 {
     // Make this thread recognisable as the RPC listener
@@ -763,11 +1182,9 @@ static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol,
         delete conn;
     }
 
-    // start HTTP client thread
-    else if (!NewThread(ThreadRPCServer3, conn)) {
-        printf("Failed to create RPC server client thread\n");
-        delete conn;
-    }
+    // hand it to the worker pool once the request is in
+    else
+        ReadRPCRequest(conn);
 
     vnThreadsRunning[THREAD_RPCLISTENER]--;
 }
@@ -896,6 +1313,26 @@ void ThreadRPCServer2(void* parg)
         return;
     }
 
+    // Start the worker pool, requests are read and idle keep-alive
+    // connections wait on io_service below rather than holding a worker
+    nRPCServerTimeout = max((int)GetArg("-rpcservertimeout", DEFAULT_RPC_SERVER_TIMEOUT), 1);
+    nRPCWorkQueue = max((int)GetArg("-rpcworkqueue", DEFAULT_RPC_WORKQUEUE), 1);
+    int nThreads = max((int)GetArg("-rpcthreads", DEFAULT_RPC_THREADS), 1);
+    for (int i = 0; i < nThreads; i++)
+    {
+        if (!NewThread(ThreadRPCWorker, NULL))
+            printf("Error: NewThread(ThreadRPCWorker) failed\n");
+        else
+        {
+            boost::unique_lock<boost::mutex> lock(mutexRPCQueue);
+            nRPCThreads++;
+        }
+    }
+    int nBatchThreads = GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS);
+    for (int i = 0; i < nBatchThreads; i++)
+        if (!NewThread(ThreadRPCBatchWorker, NULL))
+            printf("Error: NewThread(ThreadRPCBatchWorker) failed\n");
+
     vnThreadsRunning[THREAD_RPCLISTENER]--;
     while (!fShutdown)
         io_service.run_one();
@@ -968,117 +1405,345 @@ static Object JSONRPCExecOne(const Value& req)
     return rpc_result;
 }
 
-static string JSONRPCExecBatch(const Array& vReq)
-{
-    Array ret;
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+//
+// Batch execution. A batch made only of read-only commands is shared out
+// between the connection's worker and the -rpcbatchthreads batch threads,
+// and the replies are put back in request order. Anything else runs in
+// sequence as before. Requests still waiting when the batch time budget
+// runs out are answered with an error instead of being executed.
+//
 
-    return write_string(Value(ret), false) + "\n";
-}
+class CRPCBatchJob
+{
+public:
+    const Array& vReq;
+    vector<Object> vReply;
+    int64_t nDeadline;
+    unsigned int nNext;
+    unsigned int nDone;
+    int nHelpers;
+    boost::condition_variable condDone;
+
+    CRPCBatchJob(const Array& vReqIn, int64_t nDeadlineIn) : vReq(vReqIn), vReply(vReqIn.size())
+    {
+        nDeadline = nDeadlineIn;
+        nNext = 0;
+        nDone = 0;
+        nHelpers = 0;
+    }
+};
 
-static CCriticalSection cs_THREAD_RPCHANDLER;
+static boost::mutex mutexRPCBatch;
+static boost::condition_variable condRPCBatch;
+static deque<CRPCBatchJob*> queueRPCBatch;
 
-void ThreadRPCServer3(void* parg)
+static Object JSONRPCExecBatchItem(const Value& req, int64_t nDeadline)
 {
-    // Make this thread recognisable as the RPC handler
-    RenameThread("UtilityCoin-rpchand");
+    if (nDeadline && GetTimeMillis() > nDeadline)
+    {
+        Value id = (req.type() == obj_type) ? find_value(req.get_obj(), "id") : Value::null;
+        return JSONRPCReplyObj(Value::null, JSONRPCError(RPC_MISC_ERROR, "Batch time budget exceeded"), id);
+    }
+    return JSONRPCExecOne(req);
+}
 
+// Runs the next unclaimed request of the job, false when none are left
+static bool RunRPCBatchItem(CRPCBatchJob* pjob)
+{
+    unsigned int nIndex;
     {
-        LOCK(cs_THREAD_RPCHANDLER);
-        vnThreadsRunning[THREAD_RPCHANDLER]++;
+        boost::unique_lock<boost::mutex> lock(mutexRPCBatch);
+        if (pjob->nNext >= pjob->vReq.size())
+            return false;
+        nIndex = pjob->nNext++;
+        if (pjob->nNext == pjob->vReq.size())
+            queueRPCBatch.erase(std::find(queueRPCBatch.begin(), queueRPCBatch.end(), pjob));
     }
-    AcceptedConnection *conn = (AcceptedConnection *) parg;
 
-    bool fRun = true;
+    Object reply = JSONRPCExecBatchItem(pjob->vReq[nIndex], pjob->nDeadline);
+
+    boost::unique_lock<boost::mutex> lock(mutexRPCBatch);
+    pjob->vReply[nIndex].swap(reply);
+    if (++pjob->nDone == pjob->vReq.size())
+        pjob->condDone.notify_all();
+    return true;
+}
+
+void ThreadRPCBatchWorker(void* parg)
+{
+    RenameThread("UtilityCoin-rpcbatch");
+
     while (true)
     {
-        if (fShutdown || !fRun)
+        CRPCBatchJob* pjob;
         {
-            conn->close();
-            delete conn;
-            {
-                LOCK(cs_THREAD_RPCHANDLER);
-                --vnThreadsRunning[THREAD_RPCHANDLER];
-            }
-            return;
+            boost::unique_lock<boost::mutex> lock(mutexRPCBatch);
+            while (queueRPCBatch.empty() && !fShutdown)
+                condRPCBatch.timed_wait(lock, posix_time::milliseconds(500));
+            if (fShutdown)
+                break;
+            pjob = queueRPCBatch.front();
+            pjob->nHelpers++;
         }
-        map<string, string> mapHeaders;
-        string strRequest;
-
-        ReadHTTP(conn->stream(), mapHeaders, strRequest);
 
-        // Check authorization
-        if (mapHeaders.count("authorization") == 0)
+        try
         {
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
+            while (RunRPCBatchItem(pjob))
+                ;
+        }
+        catch (std::exception& e) {
+            PrintException(&e, "ThreadRPCBatchWorker()");
         }
-        if (!HTTPAuthorized(mapHeaders))
+
+        boost::unique_lock<boost::mutex> lock(mutexRPCBatch);
+        if (--pjob->nHelpers == 0)
+            pjob->condDone.notify_all();
+    }
+    printf("ThreadRPCBatchWorker exited\n");
+}
+
+static bool IsReadOnlyBatch(const Array& vReq)
+{
+    BOOST_FOREACH(const Value& req, vReq)
+    {
+        if (req.type() != obj_type)
+            return false;
+        const Value& valMethod = find_value(req.get_obj(), "method");
+        if (valMethod.type() != str_type)
+            return false;
+        const CRPCCommand *pcmd = tableRPC[valMethod.get_str()];
+        if (!pcmd || !pcmd->fReadOnly)
+            return false;
+    }
+    return true;
+}
+
+static string JSONRPCExecBatch(const Array& vReq)
+{
+    unsigned int nMaxBatch = GetArg("-rpcmaxbatch", DEFAULT_RPC_MAX_BATCH);
+    if (vReq.size() > nMaxBatch)
+        throw JSONRPCError(RPC_INVALID_REQUEST, strprintf("Batch of %"PRIszu" requests exceeds the limit of %u", vReq.size(), nMaxBatch));
+
+    int64_t nTimeout = GetArg("-rpcbatchtimeout", DEFAULT_RPC_BATCH_TIMEOUT);
+    int64_t nDeadline = nTimeout > 0 ? GetTimeMillis() + nTimeout * 1000 : 0;
+
+    Array ret;
+    if (vReq.size() > 1 && GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS) > 0 && IsReadOnlyBatch(vReq))
+    {
+        CRPCBatchJob job(vReq, nDeadline);
         {
-            printf("ThreadRPCServer incorrect password attempt from %s\n", conn->peer_address_to_string().c_str());
-            /* Deter brute-forcing short passwords.
-               If this results in a DOS the user really
-               shouldn't have their RPC port exposed.*/
-            if (mapArgs["-rpcpassword"].size() < 20)
-                MilliSleep(250);
-
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
+            boost::unique_lock<boost::mutex> lock(mutexRPCBatch);
+            queueRPCBatch.push_back(&job);
         }
-        if (mapHeaders["connection"] == "close")
-            fRun = false;
+        condRPCBatch.notify_all();
+
+        // Work on it ourselves too, so a busy pool only costs parallelism
+        while (RunRPCBatchItem(&job))
+            ;
 
-        JSONRequest jreq;
-        try
         {
-            // Parse request
-            Value valRequest;
-            if (!read_string(strRequest, valRequest))
-                throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+            boost::unique_lock<boost::mutex> lock(mutexRPCBatch);
+            while (job.nDone < vReq.size() || job.nHelpers > 0)
+                job.condDone.wait(lock);
+        }
+
+        ret.reserve(vReq.size());
+        BOOST_FOREACH(const Object& reply, job.vReply)
+            ret.push_back(reply);
+    }
+    else
+    {
+        for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
+            ret.push_back(JSONRPCExecBatchItem(vReq[reqIdx], nDeadline));
+    }
+
+    return write_string(Value(ret), false) + "\n";
+}
 
-            string strReply;
+static CCriticalSection cs_THREAD_RPCHANDLER;
+
+// Answers one request already read off conn. Returns false if the connection
+// must be closed, fKeepAlive tells whether the client wants to send more.
+static bool HandleRPCRequest(AcceptedConnection* conn, const string& strHTTPRequest, bool& fKeepAlive)
+{
+    fKeepAlive = false;
 
-            // singleton request
-            if (valRequest.type() == obj_type) {
-                jreq.parse(valRequest);
+    map<string, string> mapHeaders;
+    string strMethod, strURI, strRequest;
+
+    std::istringstream ssRequest(strHTTPRequest);
+    ReadHTTPRequest(ssRequest, strMethod, strURI, mapHeaders, strRequest);
 
+    // REST requests only read public chain data and carry no credentials,
+    // -rpcallowip still applies
+    if (strMethod == "GET" && boost::starts_with(strURI, "/rest/") && GetBoolArg("-rest"))
+    {
+        fKeepAlive = (mapHeaders["connection"] != "close");
+        string strReply, strContentType;
+        int nStatus = HandleRESTRequest(strURI, strReply, strContentType);
+        conn->stream() << HTTPReply(nStatus, strReply, fKeepAlive, strContentType.c_str()) << std::flush;
+        return true;
+    }
+
+    // Check authorization
+    if (mapHeaders.count("authorization") == 0)
+    {
+        conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
+        return false;
+    }
+    if (!HTTPAuthorized(mapHeaders))
+    {
+        printf("ThreadRPCServer incorrect password attempt from %s\n", conn->peer_address_to_string().c_str());
+        /* Deter brute-forcing short passwords.
+           If this results in a DOS the user really
+           shouldn't have their RPC port exposed.*/
+        if (mapArgs["-rpcpassword"].size() < 20)
+            MilliSleep(250);
+
+        conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
+        return false;
+    }
+    fKeepAlive = (mapHeaders["connection"] != "close");
+
+    JSONRequest jreq;
+    try
+    {
+        // Parse request
+        Value valRequest;
+        if (!read_string(strRequest, valRequest))
+            throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+
+        string strReply;
+
+        // singleton request
+        if (valRequest.type() == obj_type) {
+            jreq.parse(valRequest);
+
+            if (GetBoolArg("-rpcstreamjson", true))
+            {
+                // Write the reply without building or copying a json_spirit
+                // tree around the result, blocks and transactions skip the
+                // tree altogether
+                string strResult;
+                CJSONWriter writer(strReply);
+                writer.BeginObject();
+                writer.Key("result");
+                if (tableRPC.executeStream(jreq.strMethod, jreq.params, strResult))
+                    writer.WriteRaw(strResult);
+                else
+                    writer.WriteValue(tableRPC.execute(jreq.strMethod, jreq.params));
+                writer.Key("error");
+                writer.WriteNull();
+                writer.Key("id");
+                writer.WriteValue(jreq.id);
+                writer.EndObject();
+                strReply += "\n";
+            }
+            else
+            {
                 Value result = tableRPC.execute(jreq.strMethod, jreq.params);
 
                 // Send reply
                 strReply = JSONRPCReply(result, Value::null, jreq.id);
+            }
 
-            // array of requests
-            } else if (valRequest.type() == array_type)
-                strReply = JSONRPCExecBatch(valRequest.get_array());
-            else
-                throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
+        // array of requests
+        } else if (valRequest.type() == array_type)
+            strReply = JSONRPCExecBatch(valRequest.get_array());
+        else
+            throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
-            conn->stream() << HTTPReply(HTTP_OK, strReply, fRun) << std::flush;
-        }
-        catch (Object& objError)
-        {
-            ErrorReply(conn->stream(), objError, jreq.id);
-            break;
-        }
-        catch (std::exception& e)
+        conn->stream() << HTTPReply(HTTP_OK, strReply, fKeepAlive) << std::flush;
+    }
+    catch (Object& objError)
+    {
+        ErrorReply(conn->stream(), objError, jreq.id);
+        return false;
+    }
+    catch (std::exception& e)
+    {
+        ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+        return false;
+    }
+    return true;
+}
+
+// Serves the requests buffered on conn, then parks the connection on the
+// acceptor's io_service to read the next one, or closes it
+static void ServeRPCConnection(AcceptedConnection* conn)
+{
+    string strRequest;
+    // Pipelined requests are answered in order on this worker
+    while (!fShutdown && conn->take_request(strRequest))
+    {
+        bool fKeepAlive;
+        if (!HandleRPCRequest(conn, strRequest, fKeepAlive) || !fKeepAlive)
         {
-            ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
-            break;
+            conn->close();
+            delete conn;
+            return;
         }
     }
 
-    delete conn;
+    if (fShutdown)
     {
-        LOCK(cs_THREAD_RPCHANDLER);
-        vnThreadsRunning[THREAD_RPCHANDLER]--;
+        conn->close();
+        delete conn;
+        return;
     }
+    ReadRPCRequest(conn);
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+void ThreadRPCWorker(void* parg)
+{
+    // Make this thread recognisable as an RPC handler
+    RenameThread("UtilityCoin-rpchand");
+
+    while (true)
+    {
+        AcceptedConnection* conn = NULL;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexRPCQueue);
+            while (queueRPC.empty() && !fShutdown)
+                condRPCQueue.timed_wait(lock, posix_time::milliseconds(500));
+            if (fShutdown)
+            {
+                // the last worker out drops whatever is still queued
+                if (--nRPCThreads == 0)
+                {
+                    BOOST_FOREACH(AcceptedConnection* pconn, queueRPC)
+                        delete pconn;
+                    queueRPC.clear();
+                }
+                break;
+            }
+            conn = queueRPC.front();
+            queueRPC.pop_front();
+        }
+
+        {
+            LOCK(cs_THREAD_RPCHANDLER);
+            vnThreadsRunning[THREAD_RPCHANDLER]++;
+        }
+        try
+        {
+            ServeRPCConnection(conn);
+        }
+        catch (std::exception& e) {
+            PrintException(&e, "ThreadRPCWorker()");
+        }
+        {
+            LOCK(cs_THREAD_RPCHANDLER);
+            vnThreadsRunning[THREAD_RPCHANDLER]--;
+        }
+    }
+    printf("ThreadRPCWorker exited\n");
+}
+
+const CRPCCommand* CRPCTable::find(const std::string& strMethod) const
 {
     // Find method
-    const CRPCCommand *pcmd = tableRPC[strMethod];
+    const CRPCCommand *pcmd = (*this)[strMethod];
     if (!pcmd)
         throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
 
@@ -1088,22 +1753,100 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    return pcmd;
+}
+
+// Runs f with the locks the command declares
+static void RunRPCLocked(int nLocks, const boost::function<void ()>& f)
+{
+    switch (nLocks)
+    {
+    case RPC_LOCK_ALL:
+        {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            f();
+        }
+        break;
+    case RPC_LOCK_MAIN:
+        {
+            LOCK(cs_main);
+            f();
+        }
+        break;
+    case RPC_LOCK_WALLET:
+        {
+            // must not take cs_main, that would invert the lock order
+            LOCK(pwalletMain->cs_wallet);
+            f();
+        }
+        break;
+    default:
+        f();
+    }
+}
+
+static void CallRPCActor(rpcfn_type actor, const Array& params, Value& result)
+{
+    result = actor(params, false);
+}
+
+static void CallRPCStreamer(rpcstreamfn_type streamer, const Array& params, string& strResult, bool& fHandled)
+{
+    CJSONWriter writer(strResult);
+    fHandled = streamer(params, writer);
+}
+
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+{
+    const CRPCCommand *pcmd = find(strMethod);
+
+    int64_t nStart = GetTimeMicros();
     try
     {
         // Execute
         Value result;
-        {
-            if (pcmd->unlocked)
-                result = pcmd->actor(params, false);
-            else {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                result = pcmd->actor(params, false);
-            }
-        }
+        RunRPCLocked(pcmd->nLocks, boost::bind(&CallRPCActor, pcmd->actor, boost::cref(params), boost::ref(result)));
+        RecordRPCLatency(strMethod, GetTimeMicros() - nStart, false);
         return result;
     }
+    catch (Object& objError)
+    {
+        RecordRPCLatency(strMethod, GetTimeMicros() - nStart, true);
+        throw;
+    }
+    catch (std::exception& e)
+    {
+        RecordRPCLatency(strMethod, GetTimeMicros() - nStart, true);
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+}
+
+bool CRPCTable::executeStream(const std::string &strMethod, const json_spirit::Array &params, std::string &strResult) const
+{
+    map<string, rpcstreamfn_type>::const_iterator it = mapStreamers.find(strMethod);
+    if (it == mapStreamers.end())
+        return false;
+    const CRPCCommand *pcmd = find(strMethod);
+
+    int64_t nStart = GetTimeMicros();
+    try
+    {
+        bool fHandled = false;
+        RunRPCLocked(pcmd->nLocks, boost::bind(&CallRPCStreamer, (*it).second, boost::cref(params), boost::ref(strResult), boost::ref(fHandled)));
+        if (fHandled)
+            RecordRPCLatency(strMethod, GetTimeMicros() - nStart, false);
+        else
+            strResult.clear();
+        return fHandled;
+    }
+    catch (Object& objError)
+    {
+        RecordRPCLatency(strMethod, GetTimeMicros() - nStart, true);
+        throw;
+    }
     catch (std::exception& e)
     {
+        RecordRPCLatency(strMethod, GetTimeMicros() - nStart, true);
         throw JSONRPCError(RPC_MISC_ERROR, e.what());
     }
 }
@@ -1237,12 +1980,18 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "listunspent"            && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "listunspent"            && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "listunspent"            && n > 2) ConvertTo<Array>(params[2]);
+    if (strMethod == "getrawmempool"          && n > 0) ConvertTo<bool>(params[0]);
     if (strMethod == "getrawtransaction"      && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "createrawtransaction"   && n > 0) ConvertTo<Array>(params[0]);
     if (strMethod == "createrawtransaction"   && n > 1) ConvertTo<Object>(params[1]);
     if (strMethod == "signrawtransaction"     && n > 1) ConvertTo<Array>(params[1], true);
     if (strMethod == "signrawtransaction"     && n > 2) ConvertTo<Array>(params[2], true);
     if (strMethod == "keypoolrefill"          && n > 0) ConvertTo<boost::int64_t>(params[0]);
+    if (strMethod == "getspentinfo"           && n > 0) ConvertTo<Object>(params[0]);
+    // the address index calls take either an address or an object
+    if ((strMethod == "getaddresstxids" || strMethod == "getaddressbalance" || strMethod == "getaddressutxos")
+        && n > 0 && boost::starts_with(params[0].get_str(), "{"))
+        ConvertTo<Object>(params[0]);
 
     if (strMethod == "listservicenodes"       && n > 0) ConvertTo<bool>(params[0]);
 
@@ -28,6 +28,7 @@ enum HTTPStatusCode
     HTTP_FORBIDDEN             = 403,
     HTTP_NOT_FOUND             = 404,
     HTTP_INTERNAL_SERVER_ERROR = 500,
+    HTTP_SERVICE_UNAVAILABLE   = 503,
 };
 
 // Bitcoin RPC error codes
@@ -88,15 +89,42 @@ void RPCTypeCheck(const json_spirit::Array& params,
 void RPCTypeCheck(const json_spirit::Object& o,
                   const std::map<std::string, json_spirit::Value_type>& typesExpected, bool fAllowNull=false);
 
+class CJSONWriter;
+
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
 
+/** Writes a command's result straight to JSON text. Returns false, having
+ *  written nothing, to leave the call to the command's regular actor
+ *  (bad parameters, help).
+ */
+typedef bool(*rpcstreamfn_type)(const json_spirit::Array& params, CJSONWriter& writer);
+
+/** Locks CRPCTable::execute takes before running a command. Commands that
+ *  only need the chain tip read it from GetChainTip() and take none.
+ */
+enum RPCLocks
+{
+    RPC_LOCK_NONE   = 0,
+    RPC_LOCK_MAIN   = (1 << 0), // cs_main
+    RPC_LOCK_WALLET = (1 << 1), // pwalletMain->cs_wallet
+    RPC_LOCK_ALL    = RPC_LOCK_MAIN | RPC_LOCK_WALLET,
+};
+
 class CRPCCommand
 {
 public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
-    bool unlocked;
+    int nLocks;
+    bool fReadOnly; // no side effects, may run alongside others in a batch
+};
+
+class CRPCStreamCommand
+{
+public:
+    std::string name;
+    rpcstreamfn_type streamer;
 };
 
 /**
@@ -106,6 +134,9 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamers;
+
+    const CRPCCommand* find(const std::string& strMethod) const;
 public:
     CRPCTable();
     const CRPCCommand* operator[](std::string name) const;
@@ -119,10 +150,36 @@ public:
      * @throws an exception (json_spirit::Value) when an error happens.
      */
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+
+    /**
+     * Execute a method that has a streaming writer, appending its result
+     * as JSON text to strResult.
+     * @returns false if the method has no streaming writer or left the
+     *          call to execute().
+     */
+    bool executeStream(const std::string &method, const json_spirit::Array &params, std::string &strResult) const;
 };
 
 extern const CRPCTable tableRPC;
 
+/** Held by a call that waits on its worker for a long time (getblocktemplate
+ *  long polls). At most -rpcthreads - 1 are handed out, so such calls can
+ *  never take every worker and keep out the call that would end their wait.
+ */
+class CRPCLongPollSlot
+{
+public:
+    CRPCLongPollSlot();
+    ~CRPCLongPollSlot();
+    bool IsHeld() const { return fHeld; }
+
+private:
+    bool fHeld;
+};
+
+/** Answer a GET /rest/... request, returns the HTTP status (in rest.cpp) */
+int HandleRESTRequest(const std::string& strURI, std::string& strReply, std::string& strContentType);
+
 extern int64_t nWalletUnlockTime;
 extern int64_t AmountFromValue(const json_spirit::Value& value);
 extern json_spirit::Value ValueFromAmount(int64_t amount);
@@ -146,6 +203,7 @@ extern std::vector<unsigned char> ParseHexO(const json_spirit::Object& o, std::s
 
 extern json_spirit::Value getconnectioncount(const json_spirit::Array& params, bool fHelp); // in rpcnet.cpp
 extern json_spirit::Value getpeerinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getnettotals(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value dumpwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value importwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value dumpprivkey(const json_spirit::Array& params, bool fHelp); // in rpcdump.cpp
@@ -201,21 +259,30 @@ extern json_spirit::Value validatepubkey(const json_spirit::Array& params, bool
 extern json_spirit::Value getnewpubkey(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
+extern bool getrawtransaction_stream(const json_spirit::Array& params, CJSONWriter& writer);
 extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createrawtransaction(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value decoderawtransaction(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value decodescript(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value signrawtransaction(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value sendrawtransaction(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddresstxids(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressbalance(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressutxos(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getspentinfo(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getbestblockhash(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
 extern json_spirit::Value getblockcount(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
 extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getmempoolinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getsigcacheinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockbynumber(const json_spirit::Array& params, bool fHelp);
+extern bool getblock_stream(const json_spirit::Array& params, CJSONWriter& writer);
+extern bool getblockbynumber_stream(const json_spirit::Array& params, CJSONWriter& writer);
 extern json_spirit::Value getcheckpoint(const json_spirit::Array& params, bool fHelp);
 
 // in rpcutility.cpp
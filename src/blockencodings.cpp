@@ -0,0 +1,179 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "blockencodings.h"
+#include "hash.h"
+#include "main.h"
+
+#include <limits>
+
+using namespace std;
+
+// Smallest possible serialized transaction, used to bound the tx count a
+// compact block may claim before we allocate anything for it.
+static const unsigned int MIN_TRANSACTION_SIZE = 60;
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block)
+{
+    header.nVersion = block.nVersion;
+    header.hashPrevBlock = block.hashPrevBlock;
+    header.hashMerkleRoot = block.hashMerkleRoot;
+    header.nTime = block.nTime;
+    header.nBits = block.nBits;
+    header.nNonce = block.nNonce;
+    header.vchBlockSig = block.vchBlockSig;
+    nNonce = GetRand(std::numeric_limits<uint64_t>::max());
+    fShortIDKeysSet = false;
+
+    // The coinbase is never in a peer's mempool, nor is the coinstake
+    unsigned int nPrefilled = block.IsProofOfStake() ? 2 : 1;
+    if (nPrefilled > block.vtx.size())
+        nPrefilled = block.vtx.size();
+    for (unsigned int i = 0; i < nPrefilled; i++)
+        vPrefilledTxn.push_back(CPrefilledTransaction(i, block.vtx[i]));
+
+    vShortTxIDs.reserve(block.vtx.size() - nPrefilled);
+    for (unsigned int i = nPrefilled; i < block.vtx.size(); i++)
+        vShortTxIDs.push_back(CShortTxID(GetShortID(block.vtx[i].GetHash())));
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << header << nNonce;
+    uint256 hashKeys = ss.GetHash();
+    nShortIDKey0 = hashKeys.Get64(0);
+    nShortIDKey1 = hashKeys.Get64(1);
+    fShortIDKeysSet = true;
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const
+{
+    if (!fShortIDKeysSet)
+        FillShortTxIDSelector();
+    return SipHashUint256(nShortIDKey0, nShortIDKey1, txhash) & 0xffffffffffffULL;
+}
+
+
+ReadStatus CPartialBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, CTxMemPool& pool)
+{
+    if (cmpctblock.header.IsNull() || cmpctblock.BlockTxCount() == 0)
+        return READ_STATUS_INVALID;
+    if (cmpctblock.BlockTxCount() > MAX_BLOCK_SIZE / MIN_TRANSACTION_SIZE)
+        return READ_STATUS_INVALID;
+
+    header = cmpctblock.header;
+    unsigned int nTxCount = cmpctblock.BlockTxCount();
+    vtxAvailable.assign(nTxCount, CTransaction());
+    vHave.assign(nTxCount, false);
+
+    BOOST_FOREACH(const CPrefilledTransaction& prefilled, cmpctblock.vPrefilledTxn)
+    {
+        if (prefilled.nIndex >= nTxCount || vHave[prefilled.nIndex])
+            return READ_STATUS_INVALID;
+        vtxAvailable[prefilled.nIndex] = prefilled.tx;
+        vHave[prefilled.nIndex] = true;
+    }
+
+    // Assign the short ids, in order, to the slots not taken by prefilled txns
+    map<uint64_t, unsigned int> mapShortIDs;
+    unsigned int nSlot = 0;
+    BOOST_FOREACH(const CShortTxID& shortid, cmpctblock.vShortTxIDs)
+    {
+        while (vHave[nSlot])
+            nSlot++;
+        if (!mapShortIDs.insert(make_pair(shortid.nID, nSlot)).second)
+        {
+            // Two transactions of the block share a short id, just ask for
+            // the full block instead
+            return READ_STATUS_FAILED;
+        }
+        nSlot++;
+    }
+
+    // Match against the mempool. A slot hit twice is an ambiguous collision
+    // and is left empty so it gets requested explicitly.
+    vector<bool> vCollision(nTxCount, false);
+    {
+        LOCK(pool.cs);
+        for (map<uint256, CTransaction>::const_iterator mi = pool.mapTx.begin(); mi != pool.mapTx.end(); ++mi)
+        {
+            map<uint64_t, unsigned int>::const_iterator it = mapShortIDs.find(cmpctblock.GetShortID((*mi).first));
+            if (it == mapShortIDs.end())
+                continue;
+            unsigned int nIndex = (*it).second;
+            if (vCollision[nIndex])
+                continue;
+            if (vHave[nIndex])
+            {
+                vtxAvailable[nIndex].SetNull();
+                vHave[nIndex] = false;
+                vCollision[nIndex] = true;
+                continue;
+            }
+            vtxAvailable[nIndex] = (*mi).second;
+            vHave[nIndex] = true;
+        }
+    }
+
+    if (fDebug)
+    {
+        unsigned int nMissing = count(vHave.begin(), vHave.end(), false);
+        printf("CPartialBlock::InitData() : block %s, %u txns, %u from mempool, %u missing\n",
+            GetHash().ToString().substr(0,20).c_str(), nTxCount,
+            nTxCount - nMissing - (unsigned int)cmpctblock.vPrefilledTxn.size(), nMissing);
+    }
+
+    return READ_STATUS_OK;
+}
+
+bool CPartialBlock::IsTxAvailable(unsigned int nIndex) const
+{
+    return nIndex < vHave.size() && vHave[nIndex];
+}
+
+void CPartialBlock::GetMissing(vector<unsigned short>& vIndexes) const
+{
+    vIndexes.clear();
+    for (unsigned int i = 0; i < vHave.size(); i++)
+        if (!vHave[i])
+            vIndexes.push_back(i);
+}
+
+ReadStatus CPartialBlock::FillBlock(CBlock& block, const vector<CTransaction>& vtxMissing) const
+{
+    if (header.IsNull())
+        return READ_STATUS_INVALID;
+
+    block.SetNull();
+    block.nVersion = header.nVersion;
+    block.hashPrevBlock = header.hashPrevBlock;
+    block.hashMerkleRoot = header.hashMerkleRoot;
+    block.nTime = header.nTime;
+    block.nBits = header.nBits;
+    block.nNonce = header.nNonce;
+    block.vchBlockSig = header.vchBlockSig;
+    block.vtx.resize(vtxAvailable.size());
+
+    unsigned int nNext = 0;
+    for (unsigned int i = 0; i < vtxAvailable.size(); i++)
+    {
+        if (vHave[i])
+            block.vtx[i] = vtxAvailable[i];
+        else
+        {
+            if (nNext >= vtxMissing.size())
+                return READ_STATUS_INVALID;
+            block.vtx[i] = vtxMissing[nNext++];
+        }
+    }
+    if (nNext != vtxMissing.size())
+        return READ_STATUS_INVALID;
+
+    // A short id collision with a mempool transaction gives a block with
+    // the right header but the wrong content
+    if (block.BuildMerkleTree() != block.hashMerkleRoot)
+        return READ_STATUS_FAILED;
+
+    return READ_STATUS_OK;
+}
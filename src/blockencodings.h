@@ -0,0 +1,174 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_BLOCKENCODINGS_H
+#define BITCOIN_BLOCKENCODINGS_H
+
+#include "main.h"
+
+#include <vector>
+
+class CTxMemPool;
+
+// Compact block relay: a block is announced as its header plus a 6-byte
+// salted short id per transaction. The receiver rebuilds the block from its
+// own mempool and only asks for the transactions it is missing.
+
+/** Transaction short id, serialized as 6 little-endian bytes */
+class CShortTxID
+{
+public:
+    uint64_t nID;
+
+    CShortTxID() : nID(0) { }
+    CShortTxID(uint64_t nIDIn) : nID(nIDIn & 0xffffffffffffULL) { }
+
+    unsigned int GetSerializeSize(int, int=0) const
+    {
+        return 6;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int, int=0) const
+    {
+        uint32_t lsb = nID & 0xffffffff;
+        uint16_t msb = (nID >> 32) & 0xffff;
+        WRITEDATA(s, lsb);
+        WRITEDATA(s, msb);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int, int=0)
+    {
+        uint32_t lsb;
+        uint16_t msb;
+        READDATA(s, lsb);
+        READDATA(s, msb);
+        nID = ((uint64_t)msb << 32) | (uint64_t)lsb;
+    }
+};
+
+/** A transaction sent in full along with a compact block, usually the
+ *  coinbase and (for proof-of-stake blocks) the coinstake.
+ */
+class CPrefilledTransaction
+{
+public:
+    // absolute position of the transaction in the block
+    unsigned short nIndex;
+    CTransaction tx;
+
+    CPrefilledTransaction() : nIndex(0) { }
+    CPrefilledTransaction(unsigned short nIndexIn, const CTransaction& txIn) : nIndex(nIndexIn), tx(txIn) { }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nIndex);
+        READWRITE(tx);
+    )
+};
+
+/** "cmpctblock" message payload */
+class CBlockHeaderAndShortTxIDs
+{
+public:
+    // header fields and block signature only, vtx is left empty
+    CBlock header;
+    uint64_t nNonce;
+    std::vector<CShortTxID> vShortTxIDs;
+    std::vector<CPrefilledTransaction> vPrefilledTxn;
+
+    CBlockHeaderAndShortTxIDs()
+    {
+        nNonce = 0;
+        fShortIDKeysSet = false;
+    }
+
+    CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(header.nVersion);
+        READWRITE(header.hashPrevBlock);
+        READWRITE(header.hashMerkleRoot);
+        READWRITE(header.nTime);
+        READWRITE(header.nBits);
+        READWRITE(header.nNonce);
+        READWRITE(header.vchBlockSig);
+        READWRITE(nNonce);
+        READWRITE(vShortTxIDs);
+        READWRITE(vPrefilledTxn);
+    )
+
+    uint64_t GetShortID(const uint256& txhash) const;
+
+    unsigned int BlockTxCount() const
+    {
+        return vShortTxIDs.size() + vPrefilledTxn.size();
+    }
+
+private:
+    mutable uint64_t nShortIDKey0, nShortIDKey1;
+    mutable bool fShortIDKeysSet;
+
+    void FillShortTxIDSelector() const;
+};
+
+/** "getblocktxn" message payload: positions of the transactions still missing */
+class CBlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<unsigned short> vIndexes;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(blockhash);
+        READWRITE(vIndexes);
+    )
+};
+
+/** "blocktxn" message payload: the transactions asked for, in request order */
+class CBlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> vtx;
+
+    CBlockTransactions() { }
+    CBlockTransactions(const CBlockTransactionsRequest& req) : blockhash(req.blockhash), vtx(req.vIndexes.size()) { }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(blockhash);
+        READWRITE(vtx);
+    )
+};
+
+enum ReadStatus
+{
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, // peer sent an invalid object, punish
+    READ_STATUS_FAILED,  // could not rebuild, fall back to the full block
+};
+
+/** A block being rebuilt from a compact announcement */
+class CPartialBlock
+{
+private:
+    std::vector<CTransaction> vtxAvailable;
+    std::vector<bool> vHave;
+    CBlock header;
+
+public:
+    uint256 GetHash() const { return header.GetHash(); }
+
+    // Allocates a slot per transaction the block claims, so the header is
+    // checked before this is called
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, CTxMemPool& pool);
+    bool IsTxAvailable(unsigned int nIndex) const;
+    void GetMissing(std::vector<unsigned short>& vIndexes) const;
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing) const;
+};
+
+#endif
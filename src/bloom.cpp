@@ -39,7 +39,7 @@ inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const std::vector<
 
 void CBloomFilter::insert(const vector<unsigned char>& vKey)
 {
-    if (isFull)
+    if (isFull || vData.empty())
         return;
     for (unsigned int i = 0; i < nHashFuncs; i++)
     {
@@ -66,7 +66,7 @@ void CBloomFilter::insert(const uint256& hash)
 
 bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
 {
-    if (isFull)
+    if (isFull || vData.empty())
         return true;
     if (isEmpty)
         return false;
@@ -123,4 +123,10 @@
 
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+/** SipHash-2-4 of a 256-bit value with the 128-bit key (k0, k1).
+ *  Used where a fast keyed hash is needed to resist collision grinding,
+ *  e.g. compact block short transaction ids.
+ */
+uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
+
 #endif
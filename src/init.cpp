@@ -11,6 +11,8 @@
 #include "util.h"
 #include "ui_interface.h"
 #include "checkpoints.h"
+#include "notifier.h"
+#include "secp256k1.h"
 #include "utilitynode.h"
 #include "utilitycontrolnode.h"
 #include "utilityservicenode.h"
@@ -89,9 +91,12 @@ void Shutdown(void* parg)
     {
         fShutdown = true;
         nTransactionsUpdated++;
+        StopNotifier();
 //        CTxDB().Close();
         bitdb.Flush(false);
         StopNode();
+        if (fLockStats)
+            PrintLockStats();
         bitdb.Flush(true);
         boost::filesystem::remove(GetPidFile());
         UnregisterWallet(pwalletMain);
@@ -241,6 +246,8 @@ std::string HelpMessage()
         "  -datadir=<dir>         " + _("Specify data directory") + "\n" +
         "  -wallet=<dir>          " + _("Specify wallet file (within data directory)") + "\n" +
         "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n" +
+        "  -addressindex          " + _("Maintain an index of transactions and unspent outputs by address, used by the getaddress* RPC calls (default: 0)") + "\n" +
+        "  -spentindex            " + _("Maintain an index of the inputs spending each output, used by getspentinfo (default: 0)") + "\n" +
         "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n" +
         "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n" +
         "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n" +
@@ -266,6 +273,7 @@ std::string HelpMessage()
         "  -bantime=<n>           " + _("Number of seconds to keep misbehaving peers from reconnecting (default: 86400)") + "\n" +
         "  -maxreceivebuffer=<n>  " + _("Maximum per-connection receive buffer, <n>*1000 bytes (default: 5000)") + "\n" +
         "  -maxsendbuffer=<n>     " + _("Maximum per-connection send buffer, <n>*1000 bytes (default: 1000)") + "\n" +
+        "  -compactblocks         " + _("Ask peers to relay new blocks as compact blocks (default: 1)") + "\n" +
 #ifdef USE_UPNP
 #if USE_UPNP
         "  -upnp                  " + _("Use UPnP to map the listening port (default: 1 when listening)") + "\n" +
@@ -276,6 +284,11 @@ std::string HelpMessage()
         "  -detachdb              " + _("Detach block and address databases. Increases shutdown time (default: 0)") + "\n" +
         "  -paytxfee=<amt>        " + _("Fee per KB to add to transactions you send") + "\n" +
         "  -mininput=<amt>        " + _("When creating transactions, ignore inputs with value less than this (default: 0.01)") + "\n" +
+        "  -maxmempool=<n>        " + _("Keep the transaction memory pool below <n> megabytes, evicting the lowest fee rate transactions (default: 300)") + "\n" +
+        "  -mempoolexpiry=<n>     " + _("Do not keep transactions in the memory pool longer than <n> hours (default: 72)") + "\n" +
+        "  -limitancestorcount=<n> " + _("Do not accept transactions with more than <n> unconfirmed ancestors in the pool, itself included (default: 25)") + "\n" +
+        "  -limitancestorsize=<n> " + _("Do not accept transactions whose unconfirmed ancestors in the pool, itself included, exceed <n> kilobytes (default: 101)") + "\n" +
+        "  -maxorphansize=<n>     " + _("Keep at most <n> kilobytes of transactions waiting for missing inputs (default: 5000)") + "\n" +
 #ifdef QT_GUI
         "  -server                " + _("Accept command line and JSON-RPC commands") + "\n" +
 #endif
@@ -285,6 +298,7 @@ std::string HelpMessage()
         "  -testnet               " + _("Use the test network") + "\n" +
         "  -debug                 " + _("Output extra debugging information. Implies all other -debug* options") + "\n" +
         "  -debugnet              " + _("Output extra network debugging information") + "\n" +
+        "  -lockstats             " + _("Time waits on and holds of each lock, reported by getlockstats and at shutdown") + "\n" +
         "  -logtimestamps         " + _("Prepend debug output with timestamp") + "\n" +
         "  -shrinkdebugfile       " + _("Shrink debug.log file on client startup (default: 1 when no -debug)") + "\n" +
         "  -printtoconsole        " + _("Send trace/debug info to console instead of debug.log file") + "\n" +
@@ -295,8 +309,17 @@ std::string HelpMessage()
         "  -rpcpassword=<pw>      " + _("Password for JSON-RPC connections") + "\n" +
         "  -rpcport=<port>        " + _("Listen for JSON-RPC connections on <port> (default: 39122 or testnet: 27942)") + "\n" +
         "  -rpcallowip=<ip>       " + _("Allow JSON-RPC connections from specified IP address") + "\n" +
+        "  -rpcthreads=<n>        " + _("Number of threads serving JSON-RPC requests (default: 4)") + "\n" +
+        "  -rpcworkqueue=<n>      " + _("Number of JSON-RPC connections that can wait for a thread before new ones get a 503 (default: 16)") + "\n" +
+        "  -rpcservertimeout=<n>  " + _("Seconds a JSON-RPC connection may take to send a request or stay idle between requests (default: 30)") + "\n" +
+        "  -rpcbatchthreads=<n>   " + _("Number of extra threads running read-only JSON-RPC batch requests in parallel (default: 4)") + "\n" +
+        "  -rpcmaxbatch=<n>       " + _("Maximum number of requests in a JSON-RPC batch (default: 1000)") + "\n" +
+        "  -rpcbatchtimeout=<n>   " + _("Seconds a JSON-RPC batch may run before its remaining requests fail (default: 30, 0 = no limit)") + "\n" +
+        "  -rpcstreamjson         " + _("Write block and transaction RPC replies without building an intermediate JSON tree (default: 1)") + "\n" +
+        "  -rest                  " + _("Accept public REST requests for blocks, transactions and headers on the JSON-RPC port (default: 0)") + "\n" +
         "  -rpcconnect=<ip>       " + _("Send commands to node running on <ip> (default: 127.0.0.1)") + "\n" +
         "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n" +
+        "  -notifyport=<port>     " + _("Push hashblock and hashtx events to local clients connecting on <port>") + "\n" +
         "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n" +
         "  -confchange            " + _("Require a confirmations for change (default: 0)") + "\n" +
         "  -enforcecanonical      " + _("Enforce transaction scripts to use canonical PUSH operators (default: 1)") + "\n" +
@@ -307,6 +330,9 @@ std::string HelpMessage()
         "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n" +
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 2500, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n" +
+        "  -par=<n>               " + _("Set the number of signature verification threads for blocks (default: 0 = one per core)") + "\n" +
+        "  -maxsigcachesize=<n>   " + _("Keep at most <n> MB of verified signatures cached (default: 32, 0 disables)") + "\n" +
+        "  -sigbackend=<name>     " + _("Signature verification backend: secp256k1, openssl or crosscheck (default: secp256k1 where available)") + "\n" +
         "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n" +
 
         "\n" + _("Block creation options:") + "\n" +
@@ -374,6 +400,8 @@ bool AppInit2()
 
     nNodeLifespan = GetArg("-addrlifespan", 7);
     fUseFastIndex = GetBoolArg("-fastindex", true);
+    fAddressIndex = GetBoolArg("-addressindex");
+    fSpentIndex = GetBoolArg("-spentindex");
     nMinerSleep = GetArg("-minersleep", 500);
 
     CheckpointsMode = Checkpoints::STRICT;
@@ -388,6 +416,28 @@ bool AppInit2()
     if(strCpMode == "permissive")
         CheckpointsMode = Checkpoints::PERMISSIVE;
 
+    nScriptCheckThreads = GetArg("-par", 0);
+    if (nScriptCheckThreads < 0)
+        nScriptCheckThreads = 0;
+
+    // -maxsigcachesize used to count entries, a value left over from then
+    // is clamped rather than taken as gigabytes
+    int64_t nSigCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE);
+    nSigCacheSize = std::max(std::min(nSigCacheSize, (int64_t)MAX_SIG_CACHE_SIZE), (int64_t)0);
+    signatureCache.Resize(nSigCacheSize * 1000000);
+
+    std::string strSigBackend = GetArg("-sigbackend", nSigBackend == SIG_BACKEND_SECP256K1 ? "secp256k1" : "openssl");
+    if (strSigBackend == "openssl")
+        nSigBackend = SIG_BACKEND_OPENSSL;
+#ifdef HAVE_SECP256K1_VERIFY
+    else if (strSigBackend == "secp256k1")
+        nSigBackend = SIG_BACKEND_SECP256K1;
+    else if (strSigBackend == "crosscheck")
+        nSigBackend = SIG_BACKEND_CROSSCHECK;
+#endif
+    else
+        return InitError(strprintf(_("Unknown -sigbackend: '%s'"), strSigBackend.c_str()));
+
     nDerivationMethodIndex = 0;
 
     fTestNet = GetBoolArg("-testnet");
@@ -431,6 +481,7 @@ bool AppInit2()
 
     // ********************************************************* Step 3: parameter-to-internal-flags
 
+    fLockStats = GetBoolArg("-lockstats");
     fDebug = GetBoolArg("-debug");
 
     // -debug implies fDebug*
@@ -729,6 +780,15 @@ bool AppInit2()
     }
     printf(" block index %15"PRId64"ms\n", GetTimeMillis() - nStart);
 
+    uiInterface.InitMessage(_("Checking address index..."));
+    if (!InitExplorerIndexes())
+        return InitError(_("Error building address index"));
+    if (fRequestShutdown)
+    {
+        printf("Shutdown requested. Exiting.\n");
+        return false;
+    }
+
     if (GetBoolArg("-printblockindex") || GetBoolArg("-printblocktree"))
     {
         PrintBlockTree();
@@ -903,6 +963,9 @@ bool AppInit2()
     if (fServer)
         NewThread(ThreadRPCServer, NULL);
 
+    if (mapArgs.count("-notifyport"))
+        NewThread(ThreadNotifier, NULL);
+
     // ********************************************************* Step 12: node configurations
 
     if (GetBoolArg("-controlnode"))
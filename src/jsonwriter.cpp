@@ -0,0 +1,196 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "jsonwriter.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+using namespace json_spirit;
+
+void CJSONWriter::Separator()
+{
+    if (fAfterKey)
+    {
+        fAfterKey = false;
+        return;
+    }
+    if (vFirst.empty())
+        return;
+    if (vFirst.back())
+        vFirst.back() = false;
+    else
+        strOut += ',';
+}
+
+void CJSONWriter::AppendEscaped(const char* psz, size_t nLen)
+{
+    static const char* pszHex = "0123456789ABCDEF";
+
+    strOut += '"';
+    for (size_t i = 0; i < nLen; i++)
+    {
+        unsigned char c = psz[i];
+        switch (c)
+        {
+        case '"':  strOut += "\\\""; break;
+        case '\\': strOut += "\\\\"; break;
+        case '\b': strOut += "\\b";  break;
+        case '\f': strOut += "\\f";  break;
+        case '\n': strOut += "\\n";  break;
+        case '\r': strOut += "\\r";  break;
+        case '\t': strOut += "\\t";  break;
+        default:
+            // same rule as json_spirit in the C locale
+            if (c >= 0x20 && c < 0x7f)
+                strOut += (char)c;
+            else
+            {
+                strOut += "\\u00";
+                strOut += pszHex[c >> 4];
+                strOut += pszHex[c & 0xf];
+            }
+        }
+    }
+    strOut += '"';
+}
+
+void CJSONWriter::BeginObject()
+{
+    Separator();
+    strOut += '{';
+    vFirst.push_back(true);
+}
+
+void CJSONWriter::EndObject()
+{
+    assert(!vFirst.empty());
+    vFirst.pop_back();
+    strOut += '}';
+}
+
+void CJSONWriter::BeginArray()
+{
+    Separator();
+    strOut += '[';
+    vFirst.push_back(true);
+}
+
+void CJSONWriter::EndArray()
+{
+    assert(!vFirst.empty());
+    vFirst.pop_back();
+    strOut += ']';
+}
+
+void CJSONWriter::Key(const char* pszKey)
+{
+    Separator();
+    AppendEscaped(pszKey, strlen(pszKey));
+    strOut += ':';
+    fAfterKey = true;
+}
+
+void CJSONWriter::WriteString(const std::string& str)
+{
+    Separator();
+    AppendEscaped(str.data(), str.size());
+}
+
+void CJSONWriter::WriteString(const char* psz)
+{
+    Separator();
+    AppendEscaped(psz, strlen(psz));
+}
+
+void CJSONWriter::WriteInt(int64_t n)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%"PRId64, n);
+    Separator();
+    strOut += buf;
+}
+
+void CJSONWriter::WriteUInt(uint64_t n)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%"PRIu64, n);
+    Separator();
+    strOut += buf;
+}
+
+void CJSONWriter::WriteBool(bool f)
+{
+    Separator();
+    strOut += f ? "true" : "false";
+}
+
+void CJSONWriter::WriteReal(double d)
+{
+    // json_spirit writes reals with std::fixed and precision 8
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%.8f", d);
+    Separator();
+    strOut += buf;
+}
+
+void CJSONWriter::WriteNull()
+{
+    Separator();
+    strOut += "null";
+}
+
+void CJSONWriter::WriteAmount(int64_t nAmount)
+{
+    // matches ValueFromAmount()
+    WriteReal((double)nAmount / (double)COIN);
+}
+
+void CJSONWriter::WriteRaw(const std::string& strJSON)
+{
+    Separator();
+    strOut += strJSON;
+}
+
+void CJSONWriter::WriteValue(const Value& value)
+{
+    switch (value.type())
+    {
+    case obj_type:
+        BeginObject();
+        BOOST_FOREACH(const Pair& pair, value.get_obj())
+        {
+            Key(pair.name_);
+            WriteValue(pair.value_);
+        }
+        EndObject();
+        break;
+    case array_type:
+        BeginArray();
+        BOOST_FOREACH(const Value& v, value.get_array())
+            WriteValue(v);
+        EndArray();
+        break;
+    case str_type:
+        WriteString(value.get_str());
+        break;
+    case bool_type:
+        WriteBool(value.get_bool());
+        break;
+    case int_type:
+        if (value.is_uint64())
+            WriteUInt(value.get_uint64());
+        else
+            WriteInt(value.get_int64());
+        break;
+    case real_type:
+        WriteReal(value.get_real());
+        break;
+    default:
+        WriteNull();
+    }
+}
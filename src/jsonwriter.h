@@ -0,0 +1,76 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_JSONWRITER_H
+#define BITCOIN_JSONWRITER_H
+
+#include "json/json_spirit_value.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Streaming JSON writer. Appends compact JSON text straight to a string
+ *  without building a json_spirit tree first. The output is byte for byte
+ *  what json_spirit::write_string(value, false) gives for the same
+ *  document, so callers can switch between the two freely.
+ *
+ *  Usage:
+ *      writer.BeginObject();
+ *      writer.Key("height"); writer.WriteInt(nHeight);
+ *      writer.EndObject();
+ */
+class CJSONWriter
+{
+private:
+    std::string& strOut;
+    // one entry per open object/array, true until its first member is written
+    std::vector<bool> vFirst;
+    bool fAfterKey;
+
+    void Separator();
+    void AppendEscaped(const char* psz, size_t nLen);
+
+public:
+    CJSONWriter(std::string& strOutIn) : strOut(strOutIn), fAfterKey(false) { }
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+
+    void Key(const char* pszKey);
+    void Key(const std::string& strKey) { Key(strKey.c_str()); }
+
+    void WriteString(const std::string& str);
+    void WriteString(const char* psz);
+    template<typename T>
+    void WriteHex(const T itbegin, const T itend)
+    {
+        static const char* pszHex = "0123456789abcdef";
+
+        Separator();
+        strOut.reserve(strOut.size() + (itend - itbegin) * 2 + 2);
+        strOut += '"';
+        for (T it = itbegin; it != itend; ++it)
+        {
+            unsigned char c = (unsigned char)(*it);
+            strOut += pszHex[c >> 4];
+            strOut += pszHex[c & 0xf];
+        }
+        strOut += '"';
+    }
+    void WriteInt(int64_t n);
+    void WriteUInt(uint64_t n);
+    void WriteBool(bool f);
+    void WriteReal(double d);
+    void WriteNull();
+    void WriteAmount(int64_t nAmount);
+    // already encoded JSON text for one value
+    void WriteRaw(const std::string& strJSON);
+
+    // json_spirit values can be mixed in, e.g. for small sub-objects
+    void WriteValue(const json_spirit::Value& value);
+};
+
+#endif
@@ -8,6 +8,16 @@
 #include <openssl/obj_mac.h>
 
 #include "key.h"
+#include "secp256k1.h"
+#include "sync.h"
+
+#ifdef HAVE_SECP256K1_VERIFY
+int nSigBackend = SIG_BACKEND_SECP256K1;
+#else
+int nSigBackend = SIG_BACKEND_OPENSSL;
+#endif
+uint64_t nSigBackendMismatches = 0;
+static CCriticalSection cs_sigbackend;
 
 // Generate a private key from just the secret parameter
 int EC_KEY_regenerate_key(EC_KEY *eckey, BIGNUM *priv_key)
@@ -391,6 +401,41 @@ bool CKey::SetCompactSignature(uint256 hash, const std::vector<unsigned char>& v
 
 bool CKey::Verify(uint256 hash, const std::vector<unsigned char>& vchSig)
 {
+#ifdef HAVE_SECP256K1_VERIFY
+    if (nSigBackend == SIG_BACKEND_SECP256K1)
+    {
+        if (!fSet)
+            return false;
+        return GetPubKey().Verify(hash, vchSig);
+    }
+    if (nSigBackend == SIG_BACKEND_CROSSCHECK)
+    {
+        bool fValid = VerifyOpenSSL(hash, vchSig);
+        if (fSet && !vchSig.empty())
+        {
+            std::vector<unsigned char> vchPubKey = GetPubKey().Raw();
+            bool fValidSecp = Secp256k1Verify((unsigned char*)&hash, &vchSig[0], vchSig.size(), &vchPubKey[0], vchPubKey.size());
+            if (fValidSecp != fValid)
+            {
+                {
+                    LOCK(cs_sigbackend);
+                    nSigBackendMismatches++;
+                }
+                printf("CKey::Verify() : signature backends disagree (openssl %d, secp256k1 %d) hash=%s sig=%s pubkey=%s\n",
+                       fValid, fValidSecp, hash.ToString().c_str(), HexStr(vchSig).c_str(), HexStr(vchPubKey).c_str());
+            }
+        }
+        return fValid;
+    }
+#endif
+    return VerifyOpenSSL(hash, vchSig);
+}
+
+bool CKey::VerifyOpenSSL(uint256 hash, const std::vector<unsigned char>& vchSig)
+{
+    if (vchSig.empty())
+        return false;
+
     // -1 = error, 0 = bad sig, 1 = good
     if (ECDSA_verify(0, (unsigned char*)&hash, sizeof(hash), &vchSig[0], vchSig.size(), pkey) != 1)
         return false;
@@ -398,6 +443,22 @@ bool CKey::Verify(uint256 hash, const std::vector<unsigned char>& vchSig)
     return true;
 }
 
+bool CPubKey::Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const
+{
+#ifdef HAVE_SECP256K1_VERIFY
+    if (nSigBackend == SIG_BACKEND_SECP256K1)
+    {
+        if (vchSig.empty() || vchPubKey.empty())
+            return false;
+        return Secp256k1Verify((const unsigned char*)&hash, &vchSig[0], vchSig.size(), &vchPubKey[0], vchPubKey.size());
+    }
+#endif
+    CKey key;
+    if (!key.SetPubKey(*this))
+        return false;
+    return key.Verify(hash, vchSig);
+}
+
 bool CKey::VerifyCompact(uint256 hash, const std::vector<unsigned char>& vchSig)
 {
     CKey key;
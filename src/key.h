@@ -44,6 +44,18 @@ public:
     explicit key_error(const std::string& str) : std::runtime_error(str) {}
 };
 
+/** Which code verifies ECDSA signatures (-sigbackend) */
+enum
+{
+    SIG_BACKEND_OPENSSL    = 0,
+    SIG_BACKEND_SECP256K1  = 1,
+    // run both and log disagreements, OpenSSL's answer stands
+    SIG_BACKEND_CROSSCHECK = 2,
+};
+
+extern int nSigBackend;
+extern uint64_t nSigBackendMismatches;
+
 /** A reference to a CKey: the Hash160 of its serialized public key */
 class CKeyID : public uint160
 {
@@ -97,6 +109,10 @@ public:
         return vchPubKey;
     }
 
+    // Verify a DER signature without setting up an OpenSSL key where the
+    // backend allows it
+    bool Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const;
+
     std::string ToString()
     {
         return std::string(vchPubKey.begin(), vchPubKey.end());
@@ -157,6 +173,7 @@ public:
     bool SetCompactSignature(uint256 hash, const std::vector<unsigned char>& vchSig);
 
     bool Verify(uint256 hash, const std::vector<unsigned char>& vchSig);
+    bool VerifyOpenSSL(uint256 hash, const std::vector<unsigned char>& vchSig);
 
     // Verify a compact signature
     bool VerifyCompact(uint256 hash, const std::vector<unsigned char>& vchSig);
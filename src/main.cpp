@@ -4,6 +4,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "alert.h"
+#include "blockencodings.h"
+#include "bloom.h"
 #include "checkpoints.h"
 #include "db.h"
 #include "txdb.h"
@@ -11,9 +13,11 @@
 #include "init.h"
 #include "ui_interface.h"
 #include "kernel.h"
+#include "notifier.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/scoped_ptr.hpp>
 
 
 using namespace std;
@@ -37,10 +41,10 @@ unsigned int nTransactionsUpdated = 0;
 map<uint256, CBlockIndex*> mapBlockIndex;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
 
-CBigNum bnProofOfWorkLimit(~uint256(0) >> 20); // PoW starting difficulty = 0.0002441
-CBigNum bnProofOfStakeLimit(~uint256(0) >> 20);//  PoS starting difficulty = 0.0002441
-CBigNum bnProofOfWorkLimitTestNet(~uint256(0) >> 16); // PoW starting difficulty on Testnet
-CBigNum bnProofOfWorkFirstBlock(~uint256(0) >> 30);
+uint256 bnProofOfWorkLimit(~uint256(0) >> 20); // PoW starting difficulty = 0.0002441
+uint256 bnProofOfStakeLimit(~uint256(0) >> 20);//  PoS starting difficulty = 0.0002441
+uint256 bnProofOfWorkLimitTestNet(~uint256(0) >> 16); // PoW starting difficulty on Testnet
+uint256 bnProofOfWorkFirstBlock(~uint256(0) >> 30);
 
 unsigned int nTargetSpacing = 1 * 60; // 60 seconds
 unsigned int nRetarget = 30;
@@ -70,8 +74,25 @@ map<uint256, CBlock*> mapOrphanBlocks;
 multimap<uint256, CBlock*> mapOrphanBlocksByPrev;
 set<pair<COutPoint, unsigned int> > setStakeSeenOrphan;
 
-map<uint256, CTransaction> mapOrphanTransactions;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
+map<uint256, COrphanTx> mapOrphanTransactions;
+map<COutPoint, set<uint256> > mapOrphanTransactionsByPrev;
+// (expiry time, txid), soonest first
+set<pair<int64_t, uint256> > setOrphanTransactionsByExpiry;
+uint64_t nOrphanTransactionsSize = 0;
+
+// Compact blocks waiting for the "blocktxn" reply with their missing transactions,
+// owned by the id of the peer asked
+struct CPartialBlockRequest
+{
+    int nodeid;
+    int64_t nTime;
+    CPartialBlock partial;
+};
+static map<uint256, CPartialBlockRequest> mapPartialBlocks;
+static const int64_t PARTIAL_BLOCK_TIMEOUT = 2 * 60;
+// Beyond these the full block is asked for instead
+static const unsigned int MAX_PARTIAL_BLOCKS_PER_PEER = 2;
+static const unsigned int MAX_PARTIAL_BLOCKS = 16;
 
 // Constant stuff for coinbase transactions we create:
 CScript COINBASE_FLAGS;
@@ -82,6 +103,8 @@ const string strMessageMagic = "UtilityCoin Signed Message:\n";
 int64_t nTransactionFee = MIN_TX_FEE;
 int64_t nReserveBalance = 0;
 int64_t nMinimumInputValue = 0;
+bool fAddressIndex = false;
+bool fSpentIndex = false;
 
 extern enum Checkpoints::CPMode CheckpointsMode;
 
@@ -215,7 +238,7 @@ void ResendWalletTransactions(bool fForce)
 // mapOrphanTransactions
 //
 
-bool AddOrphanTx(const CTransaction& tx)
+bool AddOrphanTx(const CTransaction& tx, const CService& addrFrom)
 {
     uint256 hash = tx.GetHash();
     if (mapOrphanTransactions.count(hash))
@@ -226,48 +249,67 @@ bool AddOrphanTx(const CTransaction& tx)
     // large transaction with a missing parent then we assume
     // it will rebroadcast it later, after the parent transaction(s)
     // have been mined or received.
-    // 10,000 orphans, each of which is at most 5,000 bytes big is
-    // at most 500 megabytes of orphans:
+    unsigned int nSize = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
 
-    size_t nSize = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
-
-    if (nSize > 5000)
+    if (nSize > MAX_ORPHAN_TX_SIZE)
     {
-        printf("ignoring large orphan tx (size: %"PRIszu", hash: %s)\n", nSize, hash.ToString().substr(0,10).c_str());
+        printf("ignoring large orphan tx (size: %u, hash: %s)\n", nSize, hash.ToString().substr(0,10).c_str());
         return false;
     }
 
-    mapOrphanTransactions[hash] = tx;
+    COrphanTx& orphan = mapOrphanTransactions[hash];
+    orphan.tx = tx;
+    orphan.addrFrom = addrFrom;
+    orphan.nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
+    orphan.nTxSize = nSize;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
+        mapOrphanTransactionsByPrev[txin.prevout].insert(hash);
+    setOrphanTransactionsByExpiry.insert(make_pair(orphan.nTimeExpire, hash));
+    nOrphanTransactionsSize += nSize;
 
-    printf("stored orphan tx %s (mapsz %"PRIszu")\n", hash.ToString().substr(0,10).c_str(),
-        mapOrphanTransactions.size());
+    printf("stored orphan tx %s (mapsz %"PRIszu", %"PRIu64" bytes)\n", hash.ToString().substr(0,10).c_str(),
+        mapOrphanTransactions.size(), nOrphanTransactionsSize);
     return true;
 }
 
 void static EraseOrphanTx(uint256 hash)
 {
-    if (!mapOrphanTransactions.count(hash))
+    map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
+    if (it == mapOrphanTransactions.end())
         return;
-    const CTransaction& tx = mapOrphanTransactions[hash];
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    const COrphanTx& orphan = (*it).second;
+    BOOST_FOREACH(const CTxIn& txin, orphan.tx.vin)
     {
-        mapOrphanTransactionsByPrev[txin.prevout.hash].erase(hash);
-        if (mapOrphanTransactionsByPrev[txin.prevout.hash].empty())
-            mapOrphanTransactionsByPrev.erase(txin.prevout.hash);
+        map<COutPoint, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
+        if (itPrev == mapOrphanTransactionsByPrev.end())
+            continue;
+        (*itPrev).second.erase(hash);
+        if ((*itPrev).second.empty())
+            mapOrphanTransactionsByPrev.erase(itPrev);
     }
-    mapOrphanTransactions.erase(hash);
+    setOrphanTransactionsByExpiry.erase(make_pair(orphan.nTimeExpire, hash));
+    nOrphanTransactionsSize -= orphan.nTxSize;
+    mapOrphanTransactions.erase(it);
 }
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, uint64_t nMaxBytes)
 {
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+
+    // Drop the ones whose parents never came
+    int64_t nNow = GetTime();
+    while (!setOrphanTransactionsByExpiry.empty() && setOrphanTransactionsByExpiry.begin()->first <= nNow)
+    {
+        EraseOrphanTx(setOrphanTransactionsByExpiry.begin()->second);
+        ++nEvicted;
+    }
+
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanTransactionsSize > nMaxBytes)
     {
-        // Evict a random orphan:
+        // Evict a random orphan, so a flood can't predictably push out
+        // the ones from other peers
         uint256 randomhash = GetRandHash();
-        map<uint256, CTransaction>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
+        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
         if (it == mapOrphanTransactions.end())
             it = mapOrphanTransactions.begin();
         EraseOrphanTx(it->first);
@@ -276,6 +318,16 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
     return nEvicted;
 }
 
+// Orphans are only checked once their parents arrive, maybe from another
+// peer, so the peer that sent the orphan is looked up again
+void static MisbehavingOrphanSource(const CService& addrFrom, int nDoS)
+{
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes)
+        if ((CService)pnode->addr == addrFrom)
+            pnode->Misbehaving(nDoS);
+}
+
 
 
 
@@ -564,6 +616,30 @@ int64_t CTransaction::GetMinFee(unsigned int nBlockSize, enum GetMinFee_mode mod
 }
 
 
+// Priority of tx from its fetched inputs; inputs still in the memory pool
+// (a null position from FetchInputs, or the (1,1,1) placeholder of the
+// proposed-changes pool) have no confirmations and add nothing
+void GetInputPriority(const CTransaction& tx, MapPrevTx& mapInputs, unsigned int nSize,
+                             double& dPriority, int64_t& nInChainInputValue)
+{
+    dPriority = 0;
+    nInChainInputValue = 0;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        MapPrevTx::iterator mi = mapInputs.find(txin.prevout.hash);
+        if (mi == mapInputs.end())
+            continue;
+        const CTxIndex& txindex = (*mi).second.first;
+        if (txindex.pos.IsNull() || txindex.pos == CDiskTxPos(1,1,1))
+            continue;
+        int64_t nValueIn = (*mi).second.second.vout[txin.prevout.n].nValue;
+        nInChainInputValue += nValueIn;
+        dPriority += (double)nValueIn * txindex.GetDepthInMainChain();
+    }
+    if (nSize)
+        dPriority /= nSize;
+}
+
 bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
                         bool* pfMissingInputs)
 {
@@ -628,6 +704,10 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
         }
     }
 
+    int64_t nFees = 0;
+    unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    double dPriority = 0;
+    int64_t nInChainInputValue = 0;
     if (fCheckInputs)
     {
         MapPrevTx mapInputs;
@@ -650,8 +730,8 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
         // you should add code here to check that the transaction does a
         // reasonable number of ECDSA signature verifications.
 
-        int64_t nFees = tx.GetValueIn(mapInputs)-tx.GetValueOut();
-        unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        nFees = tx.GetValueIn(mapInputs)-tx.GetValueOut();
+        GetInputPriority(tx, mapInputs, nSize, dPriority, nInChainInputValue);
 
         // Don't accept it if it can't get into a block
         int64_t txMinFee = tx.GetMinFee(1000, GMF_RELAY, nSize);
@@ -692,6 +772,19 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
             return error("CTxMemPool::accept() : ConnectInputs failed %s", hash.ToString().substr(0,10).c_str());
         }
     }
+    else
+    {
+        // Transactions put back from disconnected blocks still need a fee
+        // to be ranked by, if their inputs are at hand
+        MapPrevTx mapInputs;
+        map<uint256, CTxIndex> mapUnused;
+        bool fInvalid = false;
+        if (tx.FetchInputs(txdb, mapUnused, false, false, mapInputs, fInvalid))
+        {
+            nFees = tx.GetValueIn(mapInputs)-tx.GetValueOut();
+            GetInputPriority(tx, mapInputs, nSize, dPriority, nInChainInputValue);
+        }
+    }
 
     // Store transaction in memory
     {
@@ -701,7 +794,23 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
             printf("CTxMemPool::accept() : replacing tx %s with new version\n", ptxOld->GetHash().ToString().c_str());
             remove(*ptxOld);
         }
-        addUnchecked(hash, tx);
+        addUnchecked(hash, tx, CTxMemPoolEntry(nFees, nSize, GetTime(), nBestHeight, dPriority, nInChainInputValue));
+
+        if (fCheckInputs)
+        {
+            const CTxMemPoolEntry& entry = mapEntry[hash];
+            if (entry.nCountWithAncestors > GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT) ||
+                entry.nSizeWithAncestors > GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000)
+            {
+                remove(tx);
+                return error("CTxMemPool::accept() : %s has too many unconfirmed ancestors", hash.ToString().substr(0,10).c_str());
+            }
+        }
+
+        Expire(GetTime() - GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        if (!mapTx.count(hash))
+            return error("CTxMemPool::accept() : mempool full, %s not accepted", hash.ToString().substr(0,10).c_str());
     }
 
     ///// are we sure this is ok when loading transactions or restoring block txes
@@ -709,9 +818,10 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
     if (ptxOld)
         EraseFromWallets(ptxOld->GetHash());
 
-    printf("CTxMemPool::accept() : accepted %s (poolsz %"PRIszu")\n",
+    printf("CTxMemPool::accept() : accepted %s (poolsz %"PRIszu", %"PRIu64" bytes)\n",
            hash.ToString().substr(0,10).c_str(),
-           mapTx.size());
+           mapTx.size(), nTotalTxSize);
+    NotifyTransaction(hash);
     return true;
 }
 
@@ -721,18 +831,89 @@ bool CTransaction::AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs, bool* pfMi
 }
 
 bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
+{
+    return addUnchecked(hash, tx, CTxMemPoolEntry(0, ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION), GetTime(), nBestHeight));
+}
+
+bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx, const CTxMemPoolEntry& entryIn)
 {
     // Add to memory pool without checking anything.  Don't call this directly,
     // call CTxMemPool::accept to properly check the transaction first.
     {
+        set<uint256> setAncestors;
+        CalculateAncestors(tx, setAncestors);
+
         mapTx[hash] = tx;
         for (unsigned int i = 0; i < tx.vin.size(); i++)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&mapTx[hash], i);
+
+        CTxMemPoolEntry& entry = mapEntry[hash];
+        entry = CTxMemPoolEntry(entryIn.nFee, entryIn.nTxSize, entryIn.nTime, entryIn.nHeight,
+                                entryIn.dPriority, entryIn.nInChainInputValue);
+        BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+        {
+            const CTxMemPoolEntry& ancestor = mapEntry[hashAncestor];
+            entry.nCountWithAncestors++;
+            entry.nSizeWithAncestors += ancestor.nTxSize;
+            entry.nFeesWithAncestors += ancestor.nFee;
+        }
+        // Children already in the pool, e.g. when a reorganize puts a
+        // disconnected parent back, gain tx as an ancestor
+        set<uint256> setDescendants;
+        CalculateDescendants(hash, setDescendants);
+        BOOST_FOREACH(const uint256& hashDescendant, setDescendants)
+        {
+            CTxMemPoolEntry& descendant = mapEntry[hashDescendant];
+            descendant.nCountWithAncestors++;
+            descendant.nSizeWithAncestors += entry.nTxSize;
+            descendant.nFeesWithAncestors += entry.nFee;
+        }
+        setByFeeRate.insert(make_pair(entry.GetFeeRate(), hash));
+        setByTime.insert(make_pair(entry.nTime, hash));
+        setByPriority.insert(make_pair(entry.GetPriority(nPriorityHeight), hash));
+        nTotalTxSize += entry.nTxSize;
         nTransactionsUpdated++;
     }
     return true;
 }
 
+void CTxMemPool::CalculateAncestors(const CTransaction& tx, set<uint256>& setAncestors) const
+{
+    vector<const CTransaction*> vStack(1, &tx);
+    while (!vStack.empty())
+    {
+        const CTransaction* ptx = vStack.back();
+        vStack.pop_back();
+        BOOST_FOREACH(const CTxIn& txin, ptx->vin)
+        {
+            map<uint256, CTransaction>::const_iterator mi = mapTx.find(txin.prevout.hash);
+            if (mi != mapTx.end() && setAncestors.insert(txin.prevout.hash).second)
+                vStack.push_back(&(*mi).second);
+        }
+    }
+}
+
+void CTxMemPool::CalculateDescendants(const uint256& hash, set<uint256>& setDescendants) const
+{
+    vector<uint256> vStack(1, hash);
+    while (!vStack.empty())
+    {
+        uint256 hashTx = vStack.back();
+        vStack.pop_back();
+        map<uint256, CTransaction>::const_iterator mi = mapTx.find(hashTx);
+        if (mi == mapTx.end())
+            continue;
+        for (unsigned int i = 0; i < (*mi).second.vout.size(); i++)
+        {
+            map<COutPoint, CInPoint>::const_iterator it = mapNextTx.find(COutPoint(hashTx, i));
+            if (it == mapNextTx.end())
+                continue;
+            uint256 hashChild = it->second.ptx->GetHash();
+            if (setDescendants.insert(hashChild).second)
+                vStack.push_back(hashChild);
+        }
+    }
+}
 
 bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
 {
@@ -749,6 +930,28 @@ bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
                         remove(*it->second.ptx, true);
                 }
             }
+
+            map<uint256, CTxMemPoolEntry>::iterator ie = mapEntry.find(hash);
+            if (ie != mapEntry.end())
+            {
+                // Descendants left behind, e.g. when tx got mined, lose it as an ancestor
+                const CTxMemPoolEntry& entry = (*ie).second;
+                set<uint256> setDescendants;
+                CalculateDescendants(hash, setDescendants);
+                BOOST_FOREACH(const uint256& hashDescendant, setDescendants)
+                {
+                    CTxMemPoolEntry& descendant = mapEntry[hashDescendant];
+                    descendant.nCountWithAncestors--;
+                    descendant.nSizeWithAncestors -= entry.nTxSize;
+                    descendant.nFeesWithAncestors -= entry.nFee;
+                }
+                setByFeeRate.erase(make_pair(entry.GetFeeRate(), hash));
+                setByTime.erase(make_pair(entry.nTime, hash));
+                setByPriority.erase(make_pair(entry.GetPriority(nPriorityHeight), hash));
+                nTotalTxSize -= entry.nTxSize;
+                mapEntry.erase(ie);
+            }
+
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
                 mapNextTx.erase(txin.prevout);
             mapTx.erase(hash);
@@ -758,6 +961,50 @@ bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
     return true;
 }
 
+int CTxMemPool::Expire(int64_t nCutoff)
+{
+    LOCK(cs);
+    unsigned int nSizeBefore = mapTx.size();
+    while (!setByTime.empty() && setByTime.begin()->first < nCutoff)
+    {
+        // copy, remove() erases the pool's own instance
+        CTransaction tx = mapTx[setByTime.begin()->second];
+        remove(tx, true);
+    }
+    int nRemoved = nSizeBefore - mapTx.size();
+    if (nRemoved > 0)
+        printf("CTxMemPool::Expire() : removed %d transactions\n", nRemoved);
+    return nRemoved;
+}
+
+int CTxMemPool::TrimToSize(uint64_t nMaxBytes)
+{
+    LOCK(cs);
+    unsigned int nSizeBefore = mapTx.size();
+    while (nTotalTxSize > nMaxBytes && !setByFeeRate.empty())
+    {
+        CTransaction tx = mapTx[setByFeeRate.begin()->second];
+        remove(tx, true);
+    }
+    int nRemoved = nSizeBefore - mapTx.size();
+    if (nRemoved > 0)
+        printf("CTxMemPool::TrimToSize() : evicted %d transactions, %"PRIu64" bytes left\n", nRemoved, nTotalTxSize);
+    return nRemoved;
+}
+
+void CTxMemPool::UpdatePriorities(int nHeight)
+{
+    LOCK(cs);
+    if (nHeight == nPriorityHeight)
+        return;
+    // Priorities grow at different rates, the order has to be redone once
+    // per block rather than adjusted
+    nPriorityHeight = nHeight;
+    setByPriority.clear();
+    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapEntry.begin(); mi != mapEntry.end(); ++mi)
+        setByPriority.insert(make_pair((*mi).second.GetPriority(nHeight), (*mi).first));
+}
+
 bool CTxMemPool::removeConflicts(const CTransaction &tx)
 {
     // Remove transactions which depend on inputs of tx, recursively
@@ -778,6 +1025,11 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    mapEntry.clear();
+    setByFeeRate.clear();
+    setByTime.clear();
+    setByPriority.clear();
+    nTotalTxSize = 0;
     ++nTransactionsUpdated;
 }
 
@@ -904,7 +1156,6 @@ int CTxIndex::GetDepthInMainChain() const
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
 {
     {
-        LOCK(cs_main);
         {
             LOCK(mempool.cs);
             if (mempool.exists(hash))
@@ -913,6 +1164,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
                 return true;
             }
         }
+        // The tx index and block files are read without cs_main, a
+        // concurrent reorg at worst makes the lookup fail
         CTxDB txdb("r");
         CTxIndex txindex;
         if (tx.ReadFromDisk(txdb, COutPoint(hash, 0), txindex))
@@ -970,6 +1223,32 @@ bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CBlockIndex* pindex)
+{
+    // WriteToDisk puts the message start and the size in front of the block
+    if (pindex->nBlockPos < sizeof(pchMessageStart) + sizeof(unsigned int))
+        return error("ReadRawBlockFromDisk() : bad block position");
+    CAutoFile filein = CAutoFile(OpenBlockFile(pindex->nFile, pindex->nBlockPos - sizeof(pchMessageStart) - sizeof(unsigned int), "rb"), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("ReadRawBlockFromDisk() : OpenBlockFile failed");
+
+    try {
+        unsigned char pchMagic[sizeof(pchMessageStart)];
+        unsigned int nSize;
+        filein >> FLATDATA(pchMagic) >> nSize;
+        if (memcmp(pchMagic, pchMessageStart, sizeof(pchMessageStart)) != 0)
+            return error("ReadRawBlockFromDisk() : no message start before block %s", pindex->GetBlockHash().ToString().c_str());
+        if (nSize < 80 || nSize > MAX_SIZE)
+            return error("ReadRawBlockFromDisk() : bad block size %u", nSize);
+        vchBlock.resize(nSize);
+        filein.read(&vchBlock[0], nSize);
+    }
+    catch (std::exception &e) {
+        return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+    }
+    return true;
+}
+
 uint256 static GetOrphanRoot(const CBlock* pblock)
 {
     // Work back to the first block in the orphan chain
@@ -1063,10 +1342,13 @@ int64_t GetProofOfStakeReward(int64_t nCoinAge, int64_t nFees)
 //
 // maximum nBits value could possible be required nTime after
 //
-unsigned int ComputeMaxBits(CBigNum bnTargetLimit, unsigned int nBase, int64_t nTime)
+unsigned int ComputeMaxBits(const uint256& bnTargetLimit, unsigned int nBase, int64_t nTime)
 {
-    CBigNum bnResult;
-    bnResult.SetCompact(nBase);
+    bool fOverflow;
+    uint256 bnResult;
+    bnResult.SetCompact(nBase, NULL, &fOverflow);
+    if (fOverflow || bnResult > bnTargetLimit)
+        return bnTargetLimit.GetCompact();
     bnResult *= 2;
     while (nTime > 0 && bnResult < bnTargetLimit)
     {
@@ -1141,26 +1423,27 @@ unsigned int static GetNextWorkRequired_legacy(const CBlockIndex* pindexLast)
     if (nActualTimespan > nTargetTimespan*4)
         nActualTimespan = nTargetTimespan*4;
 
-    // Retarget
-    CBigNum bnNew;
+    // Retarget, in 512 bits so the product cannot wrap
+    uint512 bnNew;
     bnNew.SetCompact(pindexLast->nBits);
-    bnNew *= nActualTimespan;
-    bnNew /= nTargetTimespan;
+    bnNew *= uint512(nActualTimespan);
+    bnNew /= uint512(nTargetTimespan);
 
-    if (bnNew > bnProofOfWorkLimit)
-        bnNew = bnProofOfWorkLimit;
+    if (bnNew > uint512(bnProofOfWorkLimit))
+        bnNew = uint512(bnProofOfWorkLimit);
+    uint256 bnResult = bnNew.trim256();
 
     /// debug print
     printf("GetNextWorkRequired (legacy) RETARGET\n");
-    printf("Before: %08x  %s\n", pindexLast->nBits, CBigNum().SetCompact(pindexLast->nBits).getuint256().ToString().c_str());
-    printf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.getuint256().ToString().c_str());
+    printf("Before: %08x  %s\n", pindexLast->nBits, uint256().SetCompact(pindexLast->nBits).ToString().c_str());
+    printf("After:  %08x  %s\n", bnResult.GetCompact(), bnResult.ToString().c_str());
 
-    return bnNew.GetCompact();
+    return bnResult.GetCompact();
 }
 
 static unsigned int GetNextTargetRequired_(const CBlockIndex* pindexLast, bool fProofOfStake)
 {
-    CBigNum bnTargetLimit = fProofOfStake ? bnProofOfStakeLimit : bnProofOfWorkLimit;
+    const uint256& bnTargetLimit = fProofOfStake ? bnProofOfStakeLimit : bnProofOfWorkLimit;
 
     if (pindexLast == NULL)
         return bnTargetLimit.GetCompact(); // genesis block
@@ -1180,14 +1463,15 @@ static unsigned int GetNextTargetRequired_(const CBlockIndex* pindexLast, bool f
     // retarget with exponential moving toward target spacing
     // Includes UtilityCoin fix for wrong retargeting difficulty by Mammix2
 
-    CBigNum bnNew;
+    // the product is taken in 512 bits, a long enough gap would wrap 256
+    uint512 bnNew;
     bnNew.SetCompact(pindexPrev->nBits);
     int64_t nInterval = nTargetTimespan / nTargetSpacing;
-    bnNew *= ((nInterval - 1) * nTargetSpacing + nActualSpacing + nActualSpacing);
-    bnNew /= ((nInterval + 1) * nTargetSpacing);
+    bnNew *= uint512((nInterval - 1) * nTargetSpacing + nActualSpacing + nActualSpacing);
+    bnNew /= uint512((nInterval + 1) * nTargetSpacing);
 
-    if (bnNew <= 0 || bnNew > bnTargetLimit)
-        bnNew = bnTargetLimit;
+    if (bnNew == 0 || bnNew > uint512(bnTargetLimit))
+        return bnTargetLimit.GetCompact();
     return bnNew.GetCompact();
 }
 
@@ -1206,15 +1490,16 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits)
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative, fOverflow;
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
     // Check range
-    if (bnTarget <= 0 || bnTarget > bnProofOfWorkLimit)
+    if (fNegative || fOverflow || bnTarget == 0 || bnTarget > bnProofOfWorkLimit)
         return error("CheckProofOfWork() : nBits below minimum work");
 
     // Check proof of work matches claimed amount
-    if (hash > bnTarget.getuint256())
+    if (hash > bnTarget)
         return error("CheckProofOfWork() : hash doesn't match nBits");
 
     return true;
@@ -1434,7 +1719,7 @@ unsigned int CTransaction::GetP2SHSigOpCount(const MapPrevTx& inputs) const
 }
 
 bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-    const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool bSkipSignatureCheck)
+    const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool bSkipSignatureCheck, CSigBatch* pbatch)
 {
     // Take over previous transactions' spent pointers
     // fBlock is true when this is called from AcceptBlock when a new best-block is added to the blockchain
@@ -1473,6 +1758,18 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
+
+        // Skip ECDSA signature verification when connecting blocks (fBlock=true)
+        // before the last blockchain checkpoint. This is safe because block merkle hashes are
+        // still computed and checked, and any change will be caught at the next checkpoint.
+        bool fCheckSignatures = !bSkipSignatureCheck && !(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate()));
+
+        // The inputs' SIGHASH_ALL digests are streamed from one serialization
+        // of the transaction rather than each re-serializing a copy
+        boost::scoped_ptr<CSigHashCache> psighashcache;
+        if (fCheckSignatures)
+            psighashcache.reset(new CSigHashCache(*this));
+
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             COutPoint prevout = vin[i].prevout;
@@ -1486,13 +1783,25 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
             if (!txindex.vSpent[prevout.n].IsNull())
                 return fMiner ? false : error("ConnectInputs() : %s prev tx already used at %s", GetHash().ToString().substr(0,10).c_str(), txindex.vSpent[prevout.n].ToString().c_str());
 
-            // Skip ECDSA signature verification when connecting blocks (fBlock=true)
-            // before the last blockchain checkpoint. This is safe because block merkle hashes are
-            // still computed and checked, and any change will be caught at the next checkpoint.
-            if (!bSkipSignatureCheck && !(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
+            if (fCheckSignatures)
             {
                 // Verify signature
-                if (!VerifySignature(txPrev, *this, i, 0))
+                bool fValid;
+                if (pbatch)
+                {
+                    // queued checks count as good here, a script that fails
+                    // on that is run again with real ones
+                    pbatch->BeginInput(*this, i, txPrev.vout[prevout.n].scriptPubKey);
+                    fValid = VerifySignature(txPrev, *this, i, 0, pbatch, psighashcache.get());
+                    if (!fValid)
+                    {
+                        pbatch->AbortInput();
+                        fValid = VerifySignature(txPrev, *this, i, 0, NULL, psighashcache.get());
+                    }
+                }
+                else
+                    fValid = VerifySignature(txPrev, *this, i, 0, NULL, psighashcache.get());
+                if (!fValid)
                 {
                     return DoS(100,error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString().substr(0,10).c_str()));
                 }
@@ -1581,8 +1890,183 @@ bool CTransaction::ClientConnectInputs()
 
 
 
+//
+// -addressindex and -spentindex
+//
+
+static bool GetIndexAddress(const CScript& scriptPubKey, int& nAddressType, uint160& hashBytes)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(scriptPubKey, dest))
+        return false;
+    if (const CKeyID* pkeyID = boost::get<CKeyID>(&dest))
+    {
+        nAddressType = ADDRESS_TYPE_PUBKEYHASH;
+        hashBytes = *pkeyID;
+        return true;
+    }
+    if (const CScriptID* pscriptID = boost::get<CScriptID>(&dest))
+    {
+        nAddressType = ADDRESS_TYPE_SCRIPTHASH;
+        hashBytes = *pscriptID;
+        return true;
+    }
+    return false;
+}
+
+// The output an input spends, from the block itself or from disk. The height
+// of the block holding it is only looked up when pnHeight is given.
+static bool GetIndexPrevOutput(CTxDB& txdb, const map<uint256, const CTransaction*>& mapBlockTx, const COutPoint& prevout,
+                               int nBlockHeight, CTxOut& txoutRet, int* pnHeight)
+{
+    map<uint256, const CTransaction*>::const_iterator mi = mapBlockTx.find(prevout.hash);
+    if (mi != mapBlockTx.end())
+    {
+        if (prevout.n >= (*mi).second->vout.size())
+            return false;
+        txoutRet = (*mi).second->vout[prevout.n];
+        if (pnHeight)
+            *pnHeight = nBlockHeight;
+        return true;
+    }
+
+    CTransaction txPrev;
+    CTxIndex txindex;
+    if (!txdb.ReadDiskTx(prevout.hash, txPrev, txindex) || prevout.n >= txPrev.vout.size())
+        return false;
+    txoutRet = txPrev.vout[prevout.n];
+    if (pnHeight)
+    {
+        CBlock blockPrev;
+        if (!blockPrev.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
+            return false;
+        map<uint256, CBlockIndex*>::iterator mbi = mapBlockIndex.find(blockPrev.GetHash());
+        if (mbi == mapBlockIndex.end())
+            return false;
+        *pnHeight = (*mbi).second->nHeight;
+    }
+    return true;
+}
+
+// Adds (fConnect) or removes the block's address and spent index entries.
+// Runs in the caller's txdb batch, so the entries commit with the block.
+static bool UpdateExplorerIndexes(CTxDB& txdb, const CBlock& block, const CBlockIndex* pindex, bool fConnect)
+{
+    map<uint256, const CTransaction*> mapBlockTx;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        mapBlockTx[tx.GetHash()] = &tx;
+
+    vector<pair<CAddressIndexKey, int64_t> > vAddressIndex;
+    vector<pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspent;
+    vector<pair<COutPoint, CSpentIndexValue> > vSpentIndex;
+
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        const CTransaction& tx = block.vtx[i];
+        uint256 hashTx = tx.GetHash();
+
+        if (!tx.IsCoinBase())
+        {
+            for (unsigned int j = 0; j < tx.vin.size(); j++)
+            {
+                const COutPoint& prevout = tx.vin[j].prevout;
+                CTxOut txoutPrev;
+                int nPrevHeight = 0;
+                // a disconnect has to restore the spent output's entry, height included
+                if (!GetIndexPrevOutput(txdb, mapBlockTx, prevout, pindex->nHeight, txoutPrev, (fConnect || !fAddressIndex) ? NULL : &nPrevHeight))
+                    return error("UpdateExplorerIndexes() : prevout %s not found", prevout.ToString().c_str());
+
+                int nAddressType = ADDRESS_TYPE_NONE;
+                uint160 hashBytes = 0;
+                if (GetIndexAddress(txoutPrev.scriptPubKey, nAddressType, hashBytes) && fAddressIndex)
+                {
+                    vAddressIndex.push_back(make_pair(CAddressIndexKey(nAddressType, hashBytes, pindex->nHeight, i, hashTx, j, true), -txoutPrev.nValue));
+                    vAddressUnspent.push_back(make_pair(CAddressUnspentKey(nAddressType, hashBytes, prevout.hash, prevout.n),
+                                                        fConnect ? CAddressUnspentValue() : CAddressUnspentValue(txoutPrev.nValue, txoutPrev.scriptPubKey, nPrevHeight)));
+                }
+                if (fSpentIndex)
+                    vSpentIndex.push_back(make_pair(prevout, CSpentIndexValue(hashTx, j, pindex->nHeight, txoutPrev.nValue, nAddressType, hashBytes)));
+            }
+        }
+
+        if (!fAddressIndex)
+            continue;
+        for (unsigned int k = 0; k < tx.vout.size(); k++)
+        {
+            const CTxOut& txout = tx.vout[k];
+            int nAddressType;
+            uint160 hashBytes;
+            if (!GetIndexAddress(txout.scriptPubKey, nAddressType, hashBytes))
+                continue;
+            vAddressIndex.push_back(make_pair(CAddressIndexKey(nAddressType, hashBytes, pindex->nHeight, i, hashTx, k, false), txout.nValue));
+            vAddressUnspent.push_back(make_pair(CAddressUnspentKey(nAddressType, hashBytes, hashTx, k),
+                                                fConnect ? CAddressUnspentValue(txout.nValue, txout.scriptPubKey, pindex->nHeight) : CAddressUnspentValue()));
+        }
+    }
+
+    if (fConnect)
+        return txdb.WriteAddressIndex(vAddressIndex) &&
+               txdb.UpdateAddressUnspentIndex(vAddressUnspent) &&
+               txdb.WriteSpentIndex(vSpentIndex);
+
+    // Undo in reverse so that outputs created and spent inside this block
+    // end up erased rather than restored
+    reverse(vAddressUnspent.begin(), vAddressUnspent.end());
+    return txdb.EraseAddressIndex(vAddressIndex) &&
+           txdb.UpdateAddressUnspentIndex(vAddressUnspent) &&
+           txdb.EraseSpentIndex(vSpentIndex);
+}
+
+bool InitExplorerIndexes()
+{
+    CTxDB txdb;
+    bool fHadAddressIndex, fHadSpentIndex;
+    txdb.ReadFlag("addressindex", fHadAddressIndex);
+    txdb.ReadFlag("spentindex", fHadSpentIndex);
+    if (fHadAddressIndex == fAddressIndex && fHadSpentIndex == fSpentIndex)
+        return true;
+
+    // Switching either index on or off drops both and rebuilds what is
+    // wanted from the blk files
+    printf("InitExplorerIndexes() : rebuilding address index %d, spent index %d\n", fAddressIndex, fSpentIndex);
+    if (!txdb.WriteFlag("addressindex", false) || !txdb.WriteFlag("spentindex", false))
+        return false;
+    if (!txdb.ErasePrefix("addrtx") || !txdb.ErasePrefix("addrutxo") || !txdb.ErasePrefix("spent"))
+        return false;
+
+    if (fAddressIndex || fSpentIndex)
+    {
+        int64_t nStart = GetTimeMillis();
+        for (CBlockIndex* pindex = pindexGenesisBlock; pindex; pindex = pindex->pnext)
+        {
+            if (fRequestShutdown)
+                return true; // flags stay off, the rebuild starts over next time
+            CBlock block;
+            if (!block.ReadFromDisk(pindex))
+                return error("InitExplorerIndexes() : ReadFromDisk failed at height %d", pindex->nHeight);
+            if (!txdb.TxnBegin())
+                return false;
+            if (!UpdateExplorerIndexes(txdb, block, pindex, true))
+            {
+                txdb.TxnAbort();
+                return false;
+            }
+            if (!txdb.TxnCommit())
+                return false;
+            if (pindex->nHeight % 10000 == 0)
+                printf("InitExplorerIndexes() : height %d\n", pindex->nHeight);
+        }
+        printf("InitExplorerIndexes() : done in %"PRId64"ms\n", GetTimeMillis() - nStart);
+    }
+
+    return txdb.WriteFlag("addressindex", fAddressIndex) && txdb.WriteFlag("spentindex", fSpentIndex);
+}
+
 bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 {
+    if ((fAddressIndex || fSpentIndex) && !UpdateExplorerIndexes(txdb, *this, pindex, false))
+        return error("DisconnectBlock() : UpdateExplorerIndexes failed");
+
     // Disconnect in reverse order
     for (int i = vtx.size()-1; i >= 0; i--)
         if (!vtx[i].DisconnectInputs(txdb))
@@ -1621,6 +2105,7 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
         nTxPos = pindex->nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) - (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(vtx.size());
 
     map<uint256, CTxIndex> mapQueuedChanges;
+    CSigBatch batch;
     int64_t nFees = 0;
     int64_t nValueIn = 0;
     int64_t nValueOut = 0;
@@ -1682,13 +2167,28 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             if (tx.IsCoinStake())
                 nStakeReward = nTxValueOut - nTxValueIn;
 
-            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false))
+            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, false, &batch))
                 return false;
         }
 
         mapQueuedChanges[hashTx] = CTxIndex(posThisTx, tx.vout.size());
     }
 
+    // Verify the signatures queued by ConnectInputs all at once. Should one
+    // be bad, run its input's script on its own to find out whether the
+    // script needed it.
+    vector<unsigned int> vFailed;
+    if (!batch.empty() && !batch.Verify(vFailed))
+    {
+        BOOST_FOREACH(unsigned int nInput, vFailed)
+        {
+            const CSigBatch::CInput& input = batch.vInputs[nInput];
+            const CTransaction& txTo = *input.ptxTo;
+            if (!VerifyScript(txTo.vin[input.nIn].scriptSig, input.scriptPubKey, txTo, input.nIn, 0))
+                return DoS(100, error("ConnectBlock() : %s input %u VerifySignature failed", txTo.GetHash().ToString().substr(0,10).c_str(), input.nIn));
+        }
+    }
+
     if (IsProofOfWork())
     {
         int64_t nReward = GetProofOfWorkReward(nFees);
@@ -1739,6 +2239,9 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             return error("ConnectBlock() : UpdateTxIndex failed");
     }
 
+    if ((fAddressIndex || fSpentIndex) && !UpdateExplorerIndexes(txdb, *this, pindex, true))
+        return error("ConnectBlock() : UpdateExplorerIndexes failed");
+
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
     if (pindex->pprev)
@@ -1961,6 +2464,8 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     nBestChainTrust = pindexNew->nChainTrust;
     nTimeBestReceived = GetTime();
     nTransactionsUpdated++;
+    UpdateChainTip(pindexBest);
+    NotifyBlockTip(hashBestChain);
 
     uint256 nBestBlockTrust = pindexBest->nHeight != 0 ? (pindexBest->nChainTrust - pindexBest->pprev->nChainTrust) : pindexBest->nChainTrust;
 
@@ -2303,10 +2808,31 @@ bool CBlock::AcceptBlock()
     int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
     if (hashBestChain == hash)
     {
+        CInv inv(MSG_BLOCK, hash);
+        CBlockHeaderAndShortTxIDs* pcmpctblock = NULL;
         LOCK(cs_vNodes);
         BOOST_FOREACH(CNode* pnode, vNodes)
-            if (nBestHeight > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                pnode->PushInventory(CInv(MSG_BLOCK, hash));
+        {
+            if (nBestHeight <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                continue;
+            if (pnode->fPreferCompactBlocks)
+            {
+                // Push the block straight away as a compact block, built once for all peers.
+                // PushMessage takes cs_vSend, which SendMessages locks before cs_inventory,
+                // so it must not be called while cs_inventory is held.
+                {
+                    LOCK(pnode->cs_inventory);
+                    if (!pnode->setInventoryKnown.insert(inv).second)
+                        continue;
+                }
+                if (!pcmpctblock)
+                    pcmpctblock = new CBlockHeaderAndShortTxIDs(*this);
+                pnode->PushMessage("cmpctblock", *pcmpctblock);
+            }
+            else
+                pnode->PushInventory(inv);
+        }
+        delete pcmpctblock;
     }
 
     // UtilityCoin: check pending sync-checkpoint
@@ -2317,13 +2843,16 @@ bool CBlock::AcceptBlock()
 
 uint256 CBlockIndex::GetBlockTrust() const
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative, fOverflow;
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
-    if (bnTarget <= 0)
+    if (fNegative || fOverflow || bnTarget == 0)
         return 0;
 
-    return ((CBigNum(1)<<256) / (bnTarget+1)).getuint256();
+    // 2**256 / (bnTarget+1) does not fit in 256 bits, but it is the same as
+    // ~bnTarget / (bnTarget+1) + 1
+    return (~bnTarget / (bnTarget + uint256(1))) + uint256(1);
 }
 
 bool CBlockIndex::IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned int nRequired, unsigned int nToCheck)
@@ -2362,16 +2891,17 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
     {
         // Extra checks to prevent "fill up memory by spamming with bogus blocks"
         int64_t deltaTime = pblock->GetBlockTime() - pcheckpoint->nTime;
-        CBigNum bnNewBlock;
-        bnNewBlock.SetCompact(pblock->nBits);
-        CBigNum bnRequired;
+        bool fNegative, fOverflow;
+        uint256 bnNewBlock;
+        bnNewBlock.SetCompact(pblock->nBits, &fNegative, &fOverflow);
+        uint256 bnRequired;
 
         if (pblock->IsProofOfStake())
             bnRequired.SetCompact(ComputeMinStake(GetLastBlockIndex(pcheckpoint, true)->nBits, deltaTime, pblock->nTime));
         else
             bnRequired.SetCompact(ComputeMinWork(GetLastBlockIndex(pcheckpoint, false)->nBits, deltaTime));
 
-        if (bnNewBlock > bnRequired)
+        if (fOverflow || (!fNegative && bnNewBlock > bnRequired))
         {
             if (pfrom)
                 pfrom->Misbehaving(100);
@@ -2657,7 +3187,7 @@ bool LoadBlockIndex(bool fAllowNew)
 
         // This will figure out a valid hash and Nonce if you're
         // creating a different genesis block:
-            uint256 hashTarget = CBigNum().SetCompact(block.nBits).getuint256();
+            uint256 hashTarget = uint256().SetCompact(block.nBits);
             while (block.GetHash() > hashTarget)
                {
                    ++block.nNonce;
@@ -2944,6 +3474,165 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
 // a large 4-byte int at any alignment.
 unsigned char pchMessageStart[4] = { 0x2d, 0x3f, 0xa2, 0xf5 };
 
+// Answer queued getdata requests until the peer's bulk send queue is full;
+// whatever is left waits in vRecvGetData until the queue drains.
+void static ProcessGetData(CNode* pfrom)
+{
+    std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
+
+    while (it != pfrom->vRecvGetData.end())
+    {
+        // Don't bother if send buffer is too full to respond anyway
+        if (pfrom->nSendQueueSize[SEND_PRIORITY_BULK] >= SendBufferSize())
+            break;
+        if (fShutdown)
+            break;
+
+        const CInv &inv = *it;
+        it++;
+
+        if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+        {
+            // Send block from disk
+            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+            if (mi != mapBlockIndex.end())
+            {
+                CBlock block;
+                block.ReadFromDisk((*mi).second);
+                if (inv.type == MSG_BLOCK)
+                    pfrom->PushMessage("block", block);
+                else // MSG_FILTERED_BLOCK)
+                {
+                    LOCK(pfrom->cs_filter);
+                    if (pfrom->pfilter)
+                    {
+                        int64_t nStart = GetTimeMicros();
+                        CMerkleBlock merkleBlock(block, *pfrom->pfilter);
+                        pfrom->nFilterTimeMicros += GetTimeMicros() - nStart;
+                        pfrom->nFilterChecks += block.vtx.size();
+                        pfrom->PushMessage("merkleblock", merkleBlock);
+                        // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                        // This avoids hurting performance by pointlessly requiring a round-trip
+                        // Note that there is currently no way for a node to request any single transactions we didnt send here -
+                        // they must either disconnect and retry or request the full block.
+                        // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                        // however we MUST always provide at least what the remote peer needs
+                        typedef std::pair<unsigned int, uint256> PairType;
+                        vector<unsigned int> vToPush;
+                        {
+                            LOCK(pfrom->cs_inventory);
+                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
+                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                    vToPush.push_back(pair.first);
+                        }
+                        BOOST_FOREACH(unsigned int nTx, vToPush)
+                            pfrom->PushMessage("tx", block.vtx[nTx]);
+                    }
+                    // else
+                        // no response
+                }
+
+                // Trigger them to send a getblocks request for the next batch of inventory
+                if (inv.hash == pfrom->hashContinue)
+                {
+                    // UtilityCoin: send latest proof-of-work block to allow the
+                    // download node to accept as orphan (proof-of-stake 
+                    // block might be rejected by stake connection check)
+                    vector<CInv> vInv;
+                    vInv.push_back(CInv(MSG_BLOCK, GetLastBlockIndex(pindexBest, false)->GetBlockHash()));
+                    // Queue it behind the block replies it continues rather
+                    // than ahead of them as a block announcement
+                    LOCK(pfrom->cs_vSend);
+                    pfrom->nSendPriorityNext = SEND_PRIORITY_BULK;
+                    pfrom->PushMessage("inv", vInv);
+                    pfrom->hashContinue = 0;
+                }
+            }
+        }
+        else if (inv.IsKnownType())
+        {
+            // Send stream from relay memory
+            bool pushed = false;
+            {
+                LOCK(cs_mapRelay);
+                map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                if (mi != mapRelay.end()) {
+                    pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                    pushed = true;
+                }
+            }
+            if (!pushed && inv.type == MSG_TX) {
+                LOCK(mempool.cs);
+                if (mempool.exists(inv.hash)) {
+                    CTransaction tx = mempool.lookup(inv.hash);
+                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                    ss.reserve(1000);
+                    ss << tx;
+                    pfrom->PushMessage("tx", ss);
+                }
+            }
+        }
+
+        // Track requests for our stuff
+        Inventory(inv.hash);
+    }
+
+    pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
+}
+
+
+// The checks AcceptBlock makes on the header and, for proof-of-stake, the
+// coinstake, done on a compact block before it is rebuilt. nDoSRet is left at
+// 0 for a failed kernel check, which is expected during initial download.
+bool static CheckCompactBlockHeader(const CBlockHeaderAndShortTxIDs& cmpctblock, const CBlockIndex* pindexPrev, int& nDoSRet)
+{
+    const CBlock& header = cmpctblock.header;
+    uint256 hash = header.GetHash();
+    nDoSRet = 0;
+
+    // The coinstake, if any, is always sent prefilled right after the coinbase
+    const CTransaction* ptxCoinStake = NULL;
+    BOOST_FOREACH(const CPrefilledTransaction& prefilled, cmpctblock.vPrefilledTxn)
+        if (prefilled.nIndex == 1 && prefilled.tx.IsCoinStake())
+            ptxCoinStake = &prefilled.tx;
+    bool fProofOfStake = (ptxCoinStake != NULL);
+
+    if (!fProofOfStake)
+    {
+        if (pindexPrev->nHeight + 1 > LAST_POW_BLOCK)
+        {
+            nDoSRet = 100;
+            return error("CheckCompactBlockHeader() : reject proof-of-work at height %d", pindexPrev->nHeight + 1);
+        }
+        if (!CheckProofOfWork(hash, header.nBits))
+        {
+            nDoSRet = 50;
+            return error("CheckCompactBlockHeader() : proof of work failed");
+        }
+    }
+
+    if (header.nBits != GetNextTargetRequired(pindexPrev, fProofOfStake))
+    {
+        nDoSRet = 100;
+        return error("CheckCompactBlockHeader() : incorrect %s", fProofOfStake ? "proof-of-stake" : "proof-of-work");
+    }
+
+    if (header.GetBlockTime() > FutureDrift(GetAdjustedTime()))
+        return error("CheckCompactBlockHeader() : block timestamp too far in the future");
+    if (header.GetBlockTime() <= pindexPrev->GetPastTimeLimit() || FutureDrift(header.GetBlockTime()) < pindexPrev->GetBlockTime())
+        return error("CheckCompactBlockHeader() : block's timestamp is too early");
+
+    if (fProofOfStake)
+    {
+        uint256 hashProofOfStake = 0, targetProofOfStake = 0;
+        if (!CheckProofOfStake(*ptxCoinStake, header.nBits, hashProofOfStake, targetProofOfStake))
+            return error("CheckCompactBlockHeader() : check proof-of-stake failed for block %s", hash.ToString().c_str());
+    }
+
+    return true;
+}
+
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 {
     static map<CService, CPubKey> mapReuseKey;
@@ -2987,6 +3676,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             vRecv >> pfrom->strSubVer;
         if (!vRecv.empty())
             vRecv >> pfrom->nStartingHeight;
+        if (!vRecv.empty())
+            vRecv >> pfrom->fRelayTxes; // set to true after we get the first filter* message
+        else
+            pfrom->fRelayTxes = true;
 
         if (pfrom->fInbound && addrMe.IsRoutable())
         {
@@ -3093,6 +3786,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     else if (strCommand == "verack")
     {
         pfrom->vRecv.SetVersion(min(pfrom->nVersion, PROTOCOL_VERSION));
+
+        // Ask to be sent new blocks as compact blocks
+        if (pfrom->nVersion >= COMPACTBLOCKS_VERSION && GetBoolArg("-compactblocks", true))
+            pfrom->PushMessage("sendcmpct", true);
     }
 
 
@@ -3225,63 +3922,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (fDebugNet || (vInv.size() != 1))
             printf("received getdata (%"PRIszu" invsz)\n", vInv.size());
 
-        BOOST_FOREACH(const CInv& inv, vInv)
-        {
-            if (fShutdown)
-                return true;
-            if (fDebugNet || (vInv.size() == 1))
+        if (fDebugNet)
+            BOOST_FOREACH(const CInv& inv, vInv)
                 printf("received getdata for: %s\n", inv.ToString().c_str());
+        else if (vInv.size() == 1)
+            printf("received getdata for: %s\n", vInv[0].ToString().c_str());
 
-            if (inv.type == MSG_BLOCK)
-            {
-                // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
-                {
-                    CBlock block;
-                    block.ReadFromDisk((*mi).second);
-                    pfrom->PushMessage("block", block);
-
-                    // Trigger them to send a getblocks request for the next batch of inventory
-                    if (inv.hash == pfrom->hashContinue)
-                    {
-                        // UtilityCoin: send latest proof-of-work block to allow the
-                        // download node to accept as orphan (proof-of-stake 
-                        // block might be rejected by stake connection check)
-                        vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, GetLastBlockIndex(pindexBest, false)->GetBlockHash()));
-                        pfrom->PushMessage("inv", vInv);
-                        pfrom->hashContinue = 0;
-                    }
-                }
-            }
-            else if (inv.IsKnownType())
-            {
-                // Send stream from relay memory
-                bool pushed = false;
-                {
-                    LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
-                    if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
-                        pushed = true;
-                    }
-                }
-                if (!pushed && inv.type == MSG_TX) {
-                    LOCK(mempool.cs);
-                    if (mempool.exists(inv.hash)) {
-                        CTransaction tx = mempool.lookup(inv.hash);
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << tx;
-                        pfrom->PushMessage("tx", ss);
-                    }
-                }
-            }
-
-            // Track requests for our stuff
-            Inventory(inv.hash);
-        }
+        pfrom->vRecvGetData.insert(pfrom->vRecvGetData.end(), vInv.begin(), vInv.end());
+        ProcessGetData(pfrom);
     }
 
 
@@ -3393,22 +4041,30 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             vWorkQueue.push_back(inv.hash);
             vEraseQueue.push_back(inv.hash);
 
-            // Recursively process any orphan transactions that depended on this one
+            // Recursively process the orphans spending outputs of this one
             for (unsigned int i = 0; i < vWorkQueue.size(); i++)
             {
                 uint256 hashPrev = vWorkQueue[i];
-                for (set<uint256>::iterator mi = mapOrphanTransactionsByPrev[hashPrev].begin();
-                     mi != mapOrphanTransactionsByPrev[hashPrev].end();
-                     ++mi)
+                vector<uint256> vDependants;
+                for (map<COutPoint, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.lower_bound(COutPoint(hashPrev, 0));
+                     itPrev != mapOrphanTransactionsByPrev.end() && (*itPrev).first.hash == hashPrev;
+                     ++itPrev)
+                {
+                    vDependants.insert(vDependants.end(), (*itPrev).second.begin(), (*itPrev).second.end());
+                }
+
+                BOOST_FOREACH(const uint256& orphanTxHash, vDependants)
                 {
-                    const uint256& orphanTxHash = *mi;
-                    CTransaction& orphanTx = mapOrphanTransactions[orphanTxHash];
+                    map<uint256, COrphanTx>::iterator itOrphan = mapOrphanTransactions.find(orphanTxHash);
+                    if (itOrphan == mapOrphanTransactions.end() || count(vEraseQueue.begin(), vEraseQueue.end(), orphanTxHash))
+                        continue;
+                    CTransaction& orphanTx = (*itOrphan).second.tx;
                     bool fMissingInputs2 = false;
 
                     if (orphanTx.AcceptToMemoryPool(txdb, true, &fMissingInputs2))
                     {
                         printf("   accepted orphan tx %s\n", orphanTxHash.ToString().substr(0,10).c_str());
-                        SyncWithWallets(tx, NULL, true);
+                        SyncWithWallets(orphanTx, NULL, true);
                         RelayTransaction(orphanTx, orphanTxHash);
                         mapAlreadyAskedFor.erase(CInv(MSG_TX, orphanTxHash));
                         vWorkQueue.push_back(orphanTxHash);
@@ -3417,6 +4073,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                     else if (!fMissingInputs2)
                     {
                         // invalid orphan
+                        if (orphanTx.nDoS)
+                            MisbehavingOrphanSource((*itOrphan).second.addrFrom, orphanTx.nDoS);
                         vEraseQueue.push_back(orphanTxHash);
                         printf("   removed invalid orphan tx %s\n", orphanTxHash.ToString().substr(0,10).c_str());
                     }
@@ -3428,10 +4086,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         }
         else if (fMissingInputs)
         {
-            AddOrphanTx(tx);
+            AddOrphanTx(tx, pfrom->addr);
 
             // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nEvicted = LimitOrphanTxSize(MAX_ORPHAN_TRANSACTIONS);
+            unsigned int nEvicted = LimitOrphanTxSize(MAX_ORPHAN_TRANSACTIONS, GetArg("-maxorphansize", DEFAULT_MAX_ORPHAN_SIZE) * 1000);
             if (nEvicted > 0)
                 printf("mapOrphan overflow, removed %u tx\n", nEvicted);
         }
@@ -3451,6 +4109,172 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         CInv inv(MSG_BLOCK, hashBlock);
         pfrom->AddInventoryKnown(inv);
 
+        // A full block supersedes any compact reconstruction in progress
+        mapPartialBlocks.erase(hashBlock);
+
+        if (ProcessBlock(pfrom, &block))
+            mapAlreadyAskedFor.erase(inv);
+        if (block.nDoS) pfrom->Misbehaving(block.nDoS);
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounce = false;
+        vRecv >> fAnnounce;
+        pfrom->fPreferCompactBlocks = fAnnounce;
+    }
+
+
+    else if (strCommand == "cmpctblock")
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        uint256 hashBlock = cmpctblock.header.GetHash();
+
+        printf("received cmpctblock %s (%u txns)\n", hashBlock.ToString().substr(0,20).c_str(), cmpctblock.BlockTxCount());
+
+        CInv inv(MSG_BLOCK, hashBlock);
+        pfrom->AddInventoryKnown(inv);
+
+        if (mapBlockIndex.count(hashBlock) || mapOrphanBlocks.count(hashBlock) || mapPartialBlocks.count(hashBlock))
+            return true;
+
+        // Expire reconstructions whose peer never answered
+        int64_t nNow = GetTime();
+        for (map<uint256, CPartialBlockRequest>::iterator mi = mapPartialBlocks.begin(); mi != mapPartialBlocks.end();)
+        {
+            if ((*mi).second.nTime < nNow - PARTIAL_BLOCK_TIMEOUT)
+                mapPartialBlocks.erase(mi++);
+            else
+                mi++;
+        }
+
+        // Blocks that don't connect to our chain go through the regular
+        // orphan handling, which needs the full block
+        map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(cmpctblock.header.hashPrevBlock);
+        if (miPrev == mapBlockIndex.end())
+        {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+
+        // Nothing is allocated for the transactions until the header has
+        // passed the work or stake checks
+        int nDoS = 0;
+        if (!CheckCompactBlockHeader(cmpctblock, (*miPrev).second, nDoS))
+        {
+            if (nDoS > 0)
+                pfrom->Misbehaving(nDoS);
+            return error("ProcessMessage() : cmpctblock %s failed header checks", hashBlock.ToString().substr(0,20).c_str());
+        }
+
+        unsigned int nFromPeer = 0;
+        for (map<uint256, CPartialBlockRequest>::iterator it = mapPartialBlocks.begin(); it != mapPartialBlocks.end(); it++)
+            if ((*it).second.nodeid == pfrom->id)
+                nFromPeer++;
+        if (nFromPeer >= MAX_PARTIAL_BLOCKS_PER_PEER || mapPartialBlocks.size() >= MAX_PARTIAL_BLOCKS)
+        {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+
+        CPartialBlock partial;
+        ReadStatus status = partial.InitData(cmpctblock, mempool);
+        if (status == READ_STATUS_INVALID)
+        {
+            pfrom->Misbehaving(100);
+            return error("ProcessMessage() : invalid cmpctblock %s", hashBlock.ToString().substr(0,20).c_str());
+        }
+        if (status == READ_STATUS_FAILED)
+        {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+
+        CBlockTransactionsRequest req;
+        req.blockhash = hashBlock;
+        partial.GetMissing(req.vIndexes);
+        if (!req.vIndexes.empty())
+        {
+            CPartialBlockRequest& pending = mapPartialBlocks[hashBlock];
+            pending.nodeid = pfrom->id;
+            pending.nTime = nNow;
+            pending.partial = partial;
+            pfrom->PushMessage("getblocktxn", req);
+            return true;
+        }
+
+        CBlock block;
+        if (partial.FillBlock(block, vector<CTransaction>()) != READ_STATUS_OK)
+        {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+        if (ProcessBlock(pfrom, &block))
+            mapAlreadyAskedFor.erase(inv);
+        if (block.nDoS) pfrom->Misbehaving(block.nDoS);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        CBlockTransactionsRequest req;
+        vRecv >> req;
+
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end())
+        {
+            printf("getblocktxn for unknown block %s from peer=%s\n", req.blockhash.ToString().substr(0,20).c_str(), pfrom->addr.ToString().c_str());
+            return true;
+        }
+
+        CBlock block;
+        if (!block.ReadFromDisk((*mi).second))
+            return error("ProcessMessage() : getblocktxn failed to read block %s", req.blockhash.ToString().substr(0,20).c_str());
+
+        CBlockTransactions resp(req);
+        for (unsigned int i = 0; i < req.vIndexes.size(); i++)
+        {
+            if (req.vIndexes[i] >= block.vtx.size())
+            {
+                pfrom->Misbehaving(100);
+                return error("ProcessMessage() : getblocktxn index %u out of range", req.vIndexes[i]);
+            }
+            resp.vtx[i] = block.vtx[req.vIndexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn")
+    {
+        CBlockTransactions resp;
+        vRecv >> resp;
+
+        map<uint256, CPartialBlockRequest>::iterator mi = mapPartialBlocks.find(resp.blockhash);
+        if (mi == mapPartialBlocks.end() || (*mi).second.nodeid != pfrom->id)
+        {
+            printf("unsolicited blocktxn for %s from peer=%s\n", resp.blockhash.ToString().substr(0,20).c_str(), pfrom->addr.ToString().c_str());
+            return true;
+        }
+
+        CBlock block;
+        ReadStatus status = (*mi).second.partial.FillBlock(block, resp.vtx);
+        mapPartialBlocks.erase(mi);
+
+        CInv inv(MSG_BLOCK, resp.blockhash);
+        if (status == READ_STATUS_INVALID)
+        {
+            pfrom->Misbehaving(100);
+            return error("ProcessMessage() : invalid blocktxn for %s", resp.blockhash.ToString().substr(0,20).c_str());
+        }
+        if (status == READ_STATUS_FAILED)
+        {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+
         if (ProcessBlock(pfrom, &block))
             mapAlreadyAskedFor.erase(inv);
         if (block.nDoS) pfrom->Misbehaving(block.nDoS);
@@ -3472,19 +4296,69 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     else if (strCommand == "mempool")
     {
         std::vector<uint256> vtxid;
+        LOCK2(mempool.cs, pfrom->cs_filter);
         mempool.queryHashes(vtxid);
         vector<CInv> vInv;
-        for (unsigned int i = 0; i < vtxid.size(); i++) {
-            CInv inv(MSG_TX, vtxid[i]);
-            vInv.push_back(inv);
-            if (i == (MAX_INV_SZ - 1))
-                    break;
+        BOOST_FOREACH(uint256& hash, vtxid) {
+            CInv inv(MSG_TX, hash);
+            if (!pfrom->pfilter || pfrom->IsRelevantToFilter(mempool.lookup(hash), hash))
+                vInv.push_back(inv);
+            if (vInv.size() == MAX_INV_SZ)
+                break;
         }
         if (vInv.size() > 0)
             pfrom->PushMessage("inv", vInv);
     }
 
 
+    else if (strCommand == "filterload")
+    {
+        CBloomFilter filter;
+        vRecv >> filter;
+
+        if (!filter.IsWithinSizeConstraints())
+            // There is no excuse for sending a too-large filter
+            pfrom->Misbehaving(100);
+        else
+        {
+            LOCK(pfrom->cs_filter);
+            delete pfrom->pfilter;
+            pfrom->pfilter = new CBloomFilter(filter);
+            pfrom->pfilter->UpdateEmptyFull();
+        }
+        pfrom->fRelayTxes = true;
+    }
+
+
+    else if (strCommand == "filteradd")
+    {
+        vector<unsigned char> vData;
+        vRecv >> vData;
+
+        // Nodes must NEVER send a data item > 520 bytes (the max size for a script data object,
+        // and thus, the maximum size any matched object can have) in a filteradd message
+        if (vData.size() > MAX_SCRIPT_ELEMENT_SIZE)
+        {
+            pfrom->Misbehaving(100);
+        } else {
+            LOCK(pfrom->cs_filter);
+            if (pfrom->pfilter)
+                pfrom->pfilter->insert(vData);
+            else
+                pfrom->Misbehaving(100);
+        }
+    }
+
+
+    else if (strCommand == "filterclear")
+    {
+        LOCK(pfrom->cs_filter);
+        delete pfrom->pfilter;
+        pfrom->pfilter = new CBloomFilter();
+        pfrom->fRelayTxes = true;
+    }
+
+
     else if (strCommand == "checkorder")
     {
         uint256 hashReply;
@@ -3602,6 +4476,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 
 bool ProcessMessages(CNode* pfrom)
 {
+    if (!pfrom->vRecvGetData.empty())
+    {
+        LOCK(cs_main);
+        ProcessGetData(pfrom);
+    }
+
     CDataStream& vRecv = pfrom->vRecv;
     if (vRecv.empty())
         return true;
@@ -3620,7 +4500,11 @@ bool ProcessMessages(CNode* pfrom)
     while (true)
     {
         // Don't bother if send buffer is too full to respond anyway
-        if (pfrom->vSend.size() >= SendBufferSize())
+        if (pfrom->nSendSize >= SendBufferSize())
+            break;
+
+        // Answer earlier getdata first, so replies go out in request order
+        if (!pfrom->vRecvGetData.empty())
             break;
 
         // Scan for message start
@@ -3681,10 +4565,12 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nProcessStart = 0;
         try
         {
             {
                 LOCK(cs_main);
+                nProcessStart = GetTimeMicros();
                 fRet = ProcessMessage(pfrom, strCommand, vMsg);
             }
             if (fShutdown)
@@ -3713,11 +4599,14 @@ bool ProcessMessages(CNode* pfrom)
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        pfrom->RecordMessageRecv(strCommand, nHeaderSize + nMessageSize, nProcessStart ? GetTimeMicros() - nProcessStart : 0);
+
         if (!fRet)
             printf("ProcessMessage(%s, %u bytes) FAILED\n", strCommand.c_str(), nMessageSize);
     }
 
     vRecv.Compact();
+    pfrom->nRecvSize = vRecv.size();
     return true;
 }
 
@@ -3732,7 +4621,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 
         // Keep-alive ping. We send a nonce of zero because we don't use it anywhere
         // right now.
-        if (pto->nLastSend && GetTime() - pto->nLastSend > 30 * 60 && pto->vSend.empty()) {
+        if (pto->nLastSend && GetTime() - pto->nLastSend > 30 * 60 && pto->nSendSize == 0) {
             uint64_t nonce = 0;
             if (pto->nVersion > BIP0031_VERSION)
                 pto->PushMessage("ping", nonce);
@@ -3797,8 +4686,12 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         // Message: inventory
         //
+        // Block invs go in their own messages, which are sent ahead of tx invs.
+        // Tx invs are held back while the peer isn't draining its tx queue.
         vector<CInv> vInv;
+        vector<CInv> vInvBlock;
         vector<CInv> vInvWait;
+        bool fTxBackpressure = (pto->nSendQueueSize[SEND_PRIORITY_TX] >= SendBufferSize());
         {
             LOCK(pto->cs_inventory);
             vInv.reserve(pto->vInventoryToSend.size());
@@ -3808,6 +4701,26 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                 if (pto->setInventoryKnown.count(inv))
                     continue;
 
+                if (inv.type == MSG_TX && fTxBackpressure)
+                {
+                    vInvWait.push_back(inv);
+                    continue;
+                }
+
+                if (inv.type == MSG_BLOCK)
+                {
+                    if (pto->setInventoryKnown.insert(inv).second)
+                    {
+                        vInvBlock.push_back(inv);
+                        if (vInvBlock.size() >= 1000)
+                        {
+                            pto->PushMessage("inv", vInvBlock);
+                            vInvBlock.clear();
+                        }
+                    }
+                    continue;
+                }
+
                 // trickle out tx inv to protect privacy
                 if (inv.type == MSG_TX && !fSendTrickle)
                 {
@@ -3848,6 +4761,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             }
             pto->vInventoryToSend = vInvWait;
         }
+        if (!vInvBlock.empty())
+            pto->PushMessage("inv", vInvBlock);
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
 
@@ -3881,3 +4796,235 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
     }
     return true;
 }
+
+
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// CMerkleBlock and CPartialMerkleTree
+//
+
+CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
+{
+    header.nVersion = block.nVersion;
+    header.hashPrevBlock = block.hashPrevBlock;
+    header.hashMerkleRoot = block.hashMerkleRoot;
+    header.nTime = block.nTime;
+    header.nBits = block.nBits;
+    header.nNonce = block.nNonce;
+
+    vector<bool> vMatch;
+    vector<uint256> vHashes;
+
+    vMatch.reserve(block.vtx.size());
+    vHashes.reserve(block.vtx.size());
+
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        uint256 hash = block.vtx[i].GetHash();
+        if (filter.IsRelevantAndUpdate(block.vtx[i], hash))
+        {
+            vMatch.push_back(true);
+            vMatchedTxn.push_back(make_pair(i, hash));
+        }
+        else
+            vMatch.push_back(false);
+        vHashes.push_back(hash);
+    }
+
+    txn = CPartialMerkleTree(vHashes, vMatch);
+}
+
+uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTxid)
+{
+    if (height == 0) {
+        // hash at height 0 is the txids themself
+        return vTxid[pos];
+    } else {
+        // calculate left hash
+        uint256 left = CalcHash(height-1, pos*2, vTxid), right;
+        // calculate right hash if not beyong the end of the array - copy left hash otherwise1
+        if (pos*2+1 < CalcTreeWidth(height-1))
+            right = CalcHash(height-1, pos*2+1, vTxid);
+        else
+            right = left;
+        // combine subhashes
+        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+    }
+}
+
+void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch)
+{
+    // determine whether this node is the parent of at least one matched txid
+    bool fParentOfMatch = false;
+    for (unsigned int p = pos << height; p < (pos+1) << height && p < nTransactions; p++)
+        fParentOfMatch |= vMatch[p];
+    // store as flag bit
+    vBits.push_back(fParentOfMatch);
+    if (height==0 || !fParentOfMatch) {
+        // if at height 0, or nothing interesting below, store hash and stop
+        vHash.push_back(CalcHash(height, pos, vTxid));
+    } else {
+        // otherwise, don't store any hash, but descend into the subtrees
+        TraverseAndBuild(height-1, pos*2, vTxid, vMatch);
+        if (pos*2+1 < CalcTreeWidth(height-1))
+            TraverseAndBuild(height-1, pos*2+1, vTxid, vMatch);
+    }
+}
+
+uint256 CPartialMerkleTree::TraverseAndExtract(int height, unsigned int pos, unsigned int &nBitsUsed, unsigned int &nHashUsed, std::vector<uint256> &vMatch)
+{
+    if (nBitsUsed >= vBits.size()) {
+        // overflowed the bits array - failure
+        fBad = true;
+        return 0;
+    }
+    bool fParentOfMatch = vBits[nBitsUsed++];
+    if (height==0 || !fParentOfMatch) {
+        // if at height 0, or nothing interesting below, use stored hash and do not descend
+        if (nHashUsed >= vHash.size()) {
+            // overflowed the hash array - failure
+            fBad = true;
+            return 0;
+        }
+        const uint256 &hash = vHash[nHashUsed++];
+        if (height==0 && fParentOfMatch) // in case of height 0, we have a matched txid
+            vMatch.push_back(hash);
+        return hash;
+    } else {
+        // otherwise, descend into the subtrees to extract matched txids and hashes
+        uint256 left = TraverseAndExtract(height-1, pos*2, nBitsUsed, nHashUsed, vMatch), right;
+        if (pos*2+1 < CalcTreeWidth(height-1))
+            right = TraverseAndExtract(height-1, pos*2+1, nBitsUsed, nHashUsed, vMatch);
+        else
+            right = left;
+        // and combine them before returning
+        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+    }
+}
+
+CPartialMerkleTree::CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch) : nTransactions(vTxid.size()), fBad(false)
+{
+    // reset state
+    vBits.clear();
+    vHash.clear();
+
+    // calculate height of tree
+    int nHeight = 0;
+    while (CalcTreeWidth(nHeight) > 1)
+        nHeight++;
+
+    // traverse the partial tree
+    TraverseAndBuild(nHeight, 0, vTxid, vMatch);
+}
+
+CPartialMerkleTree::CPartialMerkleTree() : nTransactions(0), fBad(true) {}
+
+uint256 CPartialMerkleTree::ExtractMatches(std::vector<uint256> &vMatch)
+{
+    vMatch.clear();
+    // An empty set will not work
+    if (nTransactions == 0)
+        return 0;
+    // check for excessively high numbers of transactions
+    if (nTransactions > MAX_BLOCK_SIZE / 60) // 60 is the lower bound for the size of a serialized CTransaction
+        return 0;
+    // there can never be more hashes provided than one for every txid
+    if (vHash.size() > nTransactions)
+        return 0;
+    // there must be at least one bit per node in the partial tree, and at least one node per hash
+    if (vBits.size() < vHash.size())
+        return 0;
+    // calculate height of tree
+    int nHeight = 0;
+    while (CalcTreeWidth(nHeight) > 1)
+        nHeight++;
+    // traverse the partial tree
+    unsigned int nBitsUsed = 0, nHashUsed = 0;
+    uint256 hashMerkleRoot = TraverseAndExtract(nHeight, 0, nBitsUsed, nHashUsed, vMatch);
+    // verify that no problems occured during the tree traversal
+    if (fBad)
+        return 0;
+    // verify that all bits were consumed (except for the padding caused by serializing it as a byte sequence)
+    if ((nBitsUsed+7)/8 != (vBits.size()+7)/8)
+        return 0;
+    // verify that all hashes were consumed
+    if (nHashUsed != vHash.size())
+        return 0;
+    return hashMerkleRoot;
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// CChainTip
+//
+
+static CCriticalSection cs_chainTip;
+static boost::shared_ptr<const CChainTip> pchainTip(new CChainTip());
+// signalled on every new tip, for long polling RPC calls
+static boost::mutex mutexTipChange;
+static boost::condition_variable condTipChange;
+
+CChainTip::CChainTip()
+{
+    nHeight = -1;
+    hashBlock = 0;
+    nTime = 0;
+    nMoneySupply = 0;
+    nChainTrust = 0;
+    pindex = NULL;
+    pindexLastPoW = NULL;
+    pindexLastPoS = NULL;
+}
+
+CChainTip::CChainTip(const CBlockIndex* pindexIn)
+{
+    nHeight = pindexIn->nHeight;
+    hashBlock = pindexIn->GetBlockHash();
+    nTime = pindexIn->GetBlockTime();
+    nMoneySupply = pindexIn->nMoneySupply;
+    nChainTrust = pindexIn->nChainTrust;
+    pindex = pindexIn;
+    pindexLastPoW = GetLastBlockIndex(pindexIn, false);
+    pindexLastPoS = GetLastBlockIndex(pindexIn, true);
+}
+
+void UpdateChainTip(const CBlockIndex* pindex)
+{
+    // Build the new snapshot outside the lock, readers only ever wait for
+    // the pointer swap
+    boost::shared_ptr<const CChainTip> ptip(new CChainTip(pindex));
+    {
+        LOCK(cs_chainTip);
+        pchainTip.swap(ptip);
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(mutexTipChange);
+    }
+    condTipChange.notify_all();
+}
+
+bool WaitForChainTipChange(const uint256& hashTip, int64_t nMillis)
+{
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(nMillis);
+    boost::unique_lock<boost::mutex> lock(mutexTipChange);
+    while (GetChainTip()->hashBlock == hashTip && !fShutdown)
+    {
+        if (!condTipChange.timed_wait(lock, deadline))
+            break;
+    }
+    return GetChainTip()->hashBlock != hashTip;
+}
+
+boost::shared_ptr<const CChainTip> GetChainTip()
+{
+    LOCK(cs_chainTip);
+    return pchainTip;
+}
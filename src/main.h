@@ -14,6 +14,8 @@
 
 #include <list>
 
+#include <boost/shared_ptr.hpp>
+
 class CWallet;
 //class CUtilityNode;
 class CBlock;
@@ -29,6 +31,7 @@ class CNode;
 
 class CTxDB;
 class CTxIndex;
+class CBloomFilter;
 
 static const int LAST_POW_BLOCK = 5000;
 
@@ -36,9 +39,22 @@ static const unsigned int MAX_BLOCK_SIZE = 1000000;
 static const unsigned int MAX_BLOCK_SIZE_GEN = MAX_BLOCK_SIZE/2;
 static const unsigned int MAX_BLOCK_SIGOPS = MAX_BLOCK_SIZE/50;
 static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE/100;
+/** Largest orphan transaction kept */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** Default for -maxorphansize, total kB of orphan transactions kept */
+static const unsigned int DEFAULT_MAX_ORPHAN_SIZE = 5000;
+/** Seconds an orphan waits for its parents before being dropped */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 static const unsigned int MAX_INV_SZ = 50000;
 static const int64_t MIN_TX_FEE = 10000;
 static const int64_t MIN_RELAY_TX_FEE = MIN_TX_FEE;
+/** Default for -maxmempool, maximum size of the memory pool in megabytes */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, hours a transaction may wait in the memory pool */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Defaults for -limitancestorcount and -limitancestorsize (kilobytes) */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
 static const int64_t MAX_MONEY = 5000000 * COIN;
 static const int64_t MAX_MINT_PROOF_OF_STAKE = 0.15 * COIN;	// 10%
 static const int64_t COIN_YEAR_REWARD = 10 * CENT; // 10% per year (output to console will be updated)
@@ -96,6 +112,8 @@ extern int64_t nTransactionFee;
 extern int64_t nReserveBalance;
 extern int64_t nMinimumInputValue;
 extern bool fUseFastIndex;
+extern bool fAddressIndex;
+extern bool fSpentIndex;
 extern unsigned int nDerivationMethodIndex;
 
 extern bool fEnforceCanonical;
@@ -112,7 +130,11 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock);
 bool CheckDiskSpace(uint64_t nAdditionalBytes=0);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
 FILE* AppendBlockFile(unsigned int& nFileRet);
+/** Read a block's serialized bytes straight from its blk file, without decoding it */
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CBlockIndex* pindex);
 bool LoadBlockIndex(bool fAllowNew=true);
+/** Build or drop the -addressindex/-spentindex entries after a change of either option */
+bool InitExplorerIndexes();
 void PrintBlockTree();
 CBlockIndex* FindBlockByHeight(int nHeight);
 bool ProcessMessages(CNode* pfrom);
@@ -196,6 +218,8 @@ public:
     }
 };
 
+IMPLEMENT_FIXED_SERIALIZE_SIZE(CDiskTxPos)
+
 
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -252,6 +276,8 @@ public:
     }
 };
 
+IMPLEMENT_FIXED_SERIALIZE_SIZE(COutPoint)
+
 
 
 
@@ -433,6 +459,10 @@ enum GetMinFee_mode
 
 typedef std::map<uint256, std::pair<CTxIndex, CTransaction> > MapPrevTx;
 
+/** Coin-age priority of tx and the value of its confirmed inputs */
+void GetInputPriority(const CTransaction& tx, MapPrevTx& mapInputs, unsigned int nSize,
+                      double& dPriority, int64_t& nInChainInputValue);
+
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks.  A transaction can contain multiple inputs and outputs.
  */
@@ -694,11 +724,13 @@ public:
         @param[in] pindexBlock
         @param[in] fBlock	true if called from ConnectBlock
         @param[in] fMiner	true if called from CreateNewBlock
+        @param[in] pbatch	if set, signature checks are queued there for the caller to verify
         @return Returns true if all checks succeed
      */
     bool ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
                        std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool bSkipSignatureCheck = false);
+                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool bSkipSignatureCheck = false,
+                       CSigBatch* pbatch = NULL);
     bool ClientConnectInputs();
     bool CheckTransaction() const;
     bool AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs=true, bool* pfMissingInputs=NULL);
@@ -1580,27 +1612,136 @@ public:
 
 
 
+/** A transaction waiting for its inputs to show up */
+class COrphanTx
+{
+public:
+    CTransaction tx;
+    CService addrFrom;      // peer that sent it, charged if it turns out invalid
+    int64_t nTimeExpire;
+    unsigned int nTxSize;
+};
+
+/** What the memory pool keeps about a transaction besides the transaction */
+class CTxMemPoolEntry
+{
+public:
+    int64_t nFee;
+    unsigned int nTxSize;
+    int64_t nTime;   // when it entered the pool
+    int nHeight;     // best height at that time
+    double dPriority;            // sum(value in * confirmations) / size at nHeight
+    int64_t nInChainInputValue;  // value of the inputs already in the chain
+
+    // Totals over the transaction and its ancestors in the pool
+    unsigned int nCountWithAncestors;
+    unsigned int nSizeWithAncestors;
+    int64_t nFeesWithAncestors;
+
+    CTxMemPoolEntry()
+    {
+        nFee = 0;
+        nTxSize = 0;
+        nTime = 0;
+        nHeight = 0;
+        dPriority = 0;
+        nInChainInputValue = 0;
+        nCountWithAncestors = 1;
+        nSizeWithAncestors = 0;
+        nFeesWithAncestors = 0;
+    }
+
+    CTxMemPoolEntry(int64_t nFeeIn, unsigned int nTxSizeIn, int64_t nTimeIn, int nHeightIn,
+                    double dPriorityIn = 0, int64_t nInChainInputValueIn = 0)
+    {
+        nFee = nFeeIn;
+        nTxSize = nTxSizeIn;
+        nTime = nTimeIn;
+        nHeight = nHeightIn;
+        dPriority = dPriorityIn;
+        nInChainInputValue = nInChainInputValueIn;
+        nCountWithAncestors = 1;
+        nSizeWithAncestors = nTxSizeIn;
+        nFeesWithAncestors = nFeeIn;
+    }
+
+    // satoshis per 1000 bytes
+    int64_t GetFeeRate() const
+    {
+        return nTxSize ? nFee * 1000 / nTxSize : 0;
+    }
+
+    int64_t GetAncestorFeeRate() const
+    {
+        return nSizeWithAncestors ? nFeesWithAncestors * 1000 / nSizeWithAncestors : 0;
+    }
+
+    // Priority once the best chain is at nCurrentHeight: every block adds
+    // one confirmation to each input that was in the chain on entry
+    double GetPriority(int nCurrentHeight) const
+    {
+        if (nTxSize == 0)
+            return dPriority;
+        return dPriority + (double)nInChainInputValue * (nCurrentHeight - nHeight) / nTxSize;
+    }
+};
+
 class CTxMemPool
 {
 public:
     mutable CCriticalSection cs;
     std::map<uint256, CTransaction> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
+    std::map<uint256, CTxMemPoolEntry> mapEntry;
+    // (fee rate, txid), lowest first: eviction order
+    std::set<std::pair<int64_t, uint256> > setByFeeRate;
+    // (entry time, txid), oldest first: expiry order
+    std::set<std::pair<int64_t, uint256> > setByTime;
+    // (priority at nPriorityHeight, txid), lowest first: block assembly
+    // order for the high-priority area
+    std::set<std::pair<double, uint256> > setByPriority;
+    int nPriorityHeight;
+    uint64_t nTotalTxSize;
+
+    CTxMemPool()
+    {
+        nPriorityHeight = 0;
+        nTotalTxSize = 0;
+    }
 
     bool accept(CTxDB& txdb, CTransaction &tx,
                 bool fCheckInputs, bool* pfMissingInputs);
     bool addUnchecked(const uint256& hash, CTransaction &tx);
+    bool addUnchecked(const uint256& hash, CTransaction &tx, const CTxMemPoolEntry& entry);
     bool remove(const CTransaction &tx, bool fRecursive = false);
     bool removeConflicts(const CTransaction &tx);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
 
+    /** In-pool ancestors of tx, which need not be in the pool itself */
+    void CalculateAncestors(const CTransaction& tx, std::set<uint256>& setAncestors) const;
+    /** In-pool descendants of hash, not including hash */
+    void CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const;
+    /** Remove transactions that entered before nCutoff, and their descendants */
+    int Expire(int64_t nCutoff);
+    /** Evict the lowest fee rate transactions, with their descendants, until
+     *  the pool holds at most nMaxBytes */
+    int TrimToSize(uint64_t nMaxBytes);
+    /** Re-rank setByPriority for a best chain at nHeight, if it isn't already */
+    void UpdatePriorities(int nHeight);
+
     unsigned long size()
     {
         LOCK(cs);
         return mapTx.size();
     }
 
+    uint64_t GetTotalTxSize()
+    {
+        LOCK(cs);
+        return nTotalTxSize;
+    }
+
     bool exists(uint256 hash)
     {
         return (mapTx.count(hash) != 0);
@@ -1610,8 +1751,189 @@ public:
     {
         return mapTx[hash];
     }
+
+    bool lookupEntry(uint256 hash, CTxMemPoolEntry& entry)
+    {
+        LOCK(cs);
+        std::map<uint256, CTxMemPoolEntry>::iterator it = mapEntry.find(hash);
+        if (it == mapEntry.end())
+            return false;
+        entry = (*it).second;
+        return true;
+    }
 };
 
 extern CTxMemPool mempool;
 
+
+/** Immutable view of the best chain tip, replaced as a whole every time the
+ *  best chain changes. RPC calls that only need the tip read it through
+ *  GetChainTip() without taking cs_main. The block index entries it points
+ *  to are never freed, and the fields read from them don't change.
+ */
+class CChainTip
+{
+public:
+    int nHeight;
+    uint256 hashBlock;
+    int64_t nTime;
+    int64_t nMoneySupply;
+    uint256 nChainTrust;
+    const CBlockIndex* pindex;
+    // last proof-of-work and proof-of-stake blocks, for the difficulties
+    const CBlockIndex* pindexLastPoW;
+    const CBlockIndex* pindexLastPoS;
+
+    CChainTip();
+    CChainTip(const CBlockIndex* pindexIn);
+};
+
+void UpdateChainTip(const CBlockIndex* pindex);
+boost::shared_ptr<const CChainTip> GetChainTip();
+/** Wait up to nMillis for the best chain to move off hashTip. Returns true
+ *  if it did. Must not be called with cs_main held. */
+bool WaitForChainTipChange(const uint256& hashTip, int64_t nMillis);
+
+
+
+
+
+/** Data structure that represents a partial merkle tree.
+ *
+ * It respresents a subset of the txid's of a known block, in a way that
+ * allows recovery of the list of txid's and the merkle root, in an
+ * authenticated way.
+ *
+ * The encoding works as follows: we traverse the tree in depth-first order,
+ * storing a bit for each traversed node, signifying whether the node is the
+ * parent of at least one matched leaf txid (or a matched txid itself). In
+ * case we are at the leaf level, or this bit is 0, its merkle node hash is
+ * stored, and its children are not explorer further. Otherwise, no hash is
+ * stored, but we recurse into both (or the only) child branch. During
+ * decoding, the same depth-first traversal is performed, consuming bits and
+ * hashes as they written during encoding.
+ *
+ * The serialization is fixed and provides a hard guarantee about the
+ * encoded size:
+ *
+ *   SIZE <= 10 + ceil(32.25*N)
+ *
+ * Where N represents the number of leaf nodes of the partial tree. N itself
+ * is bounded by:
+ *
+ *   N <= total_transactions
+ *   N <= 1 + matched_transactions*tree_height
+ *
+ * The serialization format:
+ *  - uint32     total_transactions (4 bytes)
+ *  - varint     number of hashes   (1-3 bytes)
+ *  - uint256[]  hashes in depth-first order (<= 32*N bytes)
+ *  - varint     number of bytes of flag bits (1-3 bytes)
+ *  - byte[]     flag bits, packed per 8 in a byte, least significant bit first (<= 2*N-1 bits)
+ * The size constraints follow from this.
+ */
+class CPartialMerkleTree
+{
+protected:
+    // the total number of transactions in the block
+    unsigned int nTransactions;
+
+    // node-is-parent-of-matched-txid bits
+    std::vector<bool> vBits;
+
+    // txids and internal hashes
+    std::vector<uint256> vHash;
+
+    // flag set when encountering invalid data
+    bool fBad;
+
+    // helper function to efficiently calculate the number of nodes at given height in the merkle tree
+    unsigned int CalcTreeWidth(int height)
+    {
+        return (nTransactions+(1 << height)-1) >> height;
+    }
+
+    // calculate the hash of a node in the merkle tree (at leaf level: the txid's themself)
+    uint256 CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTxid);
+
+    // recursive function that traverses tree nodes, storing the data as bits and hashes
+    void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
+
+    // recursive function that traverses tree nodes, consuming the bits and hashes produced by TraverseAndBuild.
+    // it returns the hash of the respective node.
+    uint256 TraverseAndExtract(int height, unsigned int pos, unsigned int &nBitsUsed, unsigned int &nHashUsed, std::vector<uint256> &vMatch);
+
+public:
+
+    // serialization implementation
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nTransactions);
+        READWRITE(vHash);
+        std::vector<unsigned char> vBytes;
+        if (fRead)
+        {
+            READWRITE(vBytes);
+            CPartialMerkleTree &us = *(const_cast<CPartialMerkleTree*>(this));
+            us.vBits.resize(vBytes.size() * 8);
+            for (unsigned int p = 0; p < us.vBits.size(); p++)
+                us.vBits[p] = (vBytes[p / 8] & (1 << (p % 8))) != 0;
+            us.fBad = false;
+        }
+        else
+        {
+            vBytes.resize((vBits.size()+7)/8);
+            for (unsigned int p = 0; p < vBits.size(); p++)
+                vBytes[p / 8] |= vBits[p] << (p % 8);
+            READWRITE(vBytes);
+        }
+    )
+
+    // Construct a partial merkle tree from a list of transaction id's, and a mask that selects a subset of them
+    CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
+
+    CPartialMerkleTree();
+
+    // extract the matching txid's represented by this partial merkle tree.
+    // returns the merkle root, or 0 in case of failure
+    uint256 ExtractMatches(std::vector<uint256> &vMatch);
+};
+
+
+
+/** Used to relay blocks as header + vector<merkle branch>
+ * to filtered nodes.
+ */
+class CMerkleBlock
+{
+public:
+    // Public only for unit testing
+    // header fields only, vtx and vchBlockSig are left empty
+    CBlock header;
+    CPartialMerkleTree txn;
+
+public:
+    // Public only for unit testing and relay testing
+    // (not relayed)
+    std::vector<std::pair<unsigned int, uint256> > vMatchedTxn;
+
+    // Create from a CBlock, filtering transactions according to filter
+    // Note that this will call IsRelevantAndUpdate on the filter for each transaction,
+    // thus the filter will likely be modified.
+    CMerkleBlock(const CBlock& block, CBloomFilter& filter);
+
+    CMerkleBlock() { }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(header.nVersion);
+        READWRITE(header.hashPrevBlock);
+        READWRITE(header.hashMerkleRoot);
+        READWRITE(header.nTime);
+        READWRITE(header.nBits);
+        READWRITE(header.nNonce);
+        READWRITE(txn);
+    )
+};
+
 #endif
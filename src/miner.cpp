@@ -54,58 +54,179 @@ void SHA256Transform(void* pstate, void* pinput, const void* pinit)
         ((uint32_t*)pstate)[i] = ctx.h[i];
 }
 
-// Some explaining would be appreciated
-class COrphan
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+int64_t nLastCoinStakeSearchInterval = 0;
+
+// Fills a block from the memory pool's priority and fee rate indexes,
+// best candidates first. Only the candidates looked at cost anything, so
+// the work follows the size of the block rather than that of the pool.
+// Use with cs_main and mempool.cs held.
+class CBlockAssembler
 {
+private:
+    CBlock* pblock;
+    CTxDB& txdb;
+    CBlockIndex* pindexPrev;
+    bool fProofOfStake;
+    unsigned int nBlockMaxSize;
+    map<uint256, CTxIndex> mapTestPool;
+    set<uint256> setInBlock;
+    // transactions waiting for an in-pool parent to get into the block
+    map<uint256, vector<uint256> > mapWaiting;
+    int nConsecutiveFailed;
+
 public:
-    CTransaction* ptx;
-    set<uint256> setDependsOn;
-    double dPriority;
-    double dFeePerKb;
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    int64_t nFees;
 
-    COrphan(CTransaction* ptxIn)
+    CBlockAssembler(CBlock* pblockIn, CTxDB& txdbIn, CBlockIndex* pindexPrevIn, bool fProofOfStakeIn, unsigned int nBlockMaxSizeIn)
+        : pblock(pblockIn), txdb(txdbIn), pindexPrev(pindexPrevIn), fProofOfStake(fProofOfStakeIn), nBlockMaxSize(nBlockMaxSizeIn)
     {
-        ptx = ptxIn;
-        dPriority = dFeePerKb = 0;
+        nConsecutiveFailed = 0;
+        nBlockSize = 1000;
+        nBlockTx = 0;
+        nBlockSigOps = 100;
+        nFees = 0;
     }
 
-    void print() const
+    bool TryAdd(const uint256& hash);
+    void AddByPriority(unsigned int nBlockPrioritySize);
+    void AddByFee(int64_t nMinTxFee, unsigned int nBlockMinSize);
+
+    // Nearly full and nothing has fit for a while
+    bool IsFull() const
     {
-        printf("COrphan(hash=%s, dPriority=%.1f, dFeePerKb=%.1f)\n",
-               ptx->GetHash().ToString().substr(0,10).c_str(), dPriority, dFeePerKb);
-        BOOST_FOREACH(uint256 hash, setDependsOn)
-            printf("   setDependsOn %s\n", hash.ToString().substr(0,10).c_str());
+        return nBlockSize + 4000 > nBlockMaxSize && nConsecutiveFailed > 1000;
     }
 };
 
-
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
-int64_t nLastCoinStakeSearchInterval = 0;
- 
-// We want to sort transactions by priority and fee, so:
-typedef boost::tuple<double, double, CTransaction*> TxPriority;
-class TxPriorityCompare
+// Add a pool transaction if it fits and connects on top of what the block
+// has so far. One whose in-pool parents are not in yet is parked and tried
+// again as soon as they are.
+bool CBlockAssembler::TryAdd(const uint256& hash)
 {
-    bool byFee;
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    if (setInBlock.count(hash))
+        return false;
+    map<uint256, CTransaction>::iterator mi = mempool.mapTx.find(hash);
+    if (mi == mempool.mapTx.end())
+        return false;
+    CTransaction& tx = (*mi).second;
+    if (tx.IsCoinBase() || tx.IsCoinStake() || !tx.IsFinal())
+        return false;
+
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
-        if (byFee)
+        if (mempool.mapTx.count(txin.prevout.hash) && !setInBlock.count(txin.prevout.hash))
         {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        }
-        else
-        {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+            mapWaiting[txin.prevout.hash].push_back(hash);
+            return false;
         }
     }
-};
+
+    nConsecutiveFailed++;
+
+    // Size limits
+    unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    if (nBlockSize + nTxSize >= nBlockMaxSize)
+        return false;
+
+    // Legacy limits on sigOps:
+    unsigned int nTxSigOps = tx.GetLegacySigOpCount();
+    if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    // Timestamp limit
+    if (tx.nTime > GetAdjustedTime() || (fProofOfStake && tx.nTime > pblock->vtx[0].nTime))
+        return false;
+
+    // Transaction fee
+    int64_t nMinFee = tx.GetMinFee(nBlockSize, GMF_BLOCK);
+
+    // Inputs come from the chain, the pool or earlier block transactions;
+    // ConnectInputs only touches the entries of this transaction's inputs,
+    // so those are all that need undoing if it fails
+    MapPrevTx mapInputs;
+    bool fInvalid;
+    if (!tx.FetchInputs(txdb, mapTestPool, false, true, mapInputs, fInvalid))
+        return false;
+
+    int64_t nTxFees = tx.GetValueIn(mapInputs)-tx.GetValueOut();
+    if (nTxFees < nMinFee)
+        return false;
+
+    nTxSigOps += tx.GetP2SHSigOpCount(mapInputs);
+    if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    map<uint256, CTxIndex> mapTestPoolTmp;
+    if (!tx.ConnectInputs(txdb, mapInputs, mapTestPoolTmp, CDiskTxPos(1,1,1), pindexPrev, false, true))
+        return false;
+
+    for (map<uint256, CTxIndex>::iterator it = mapTestPoolTmp.begin(); it != mapTestPoolTmp.end(); ++it)
+        mapTestPool[(*it).first] = (*it).second;
+    mapTestPool[hash] = CTxIndex(CDiskTxPos(1,1,1), tx.vout.size());
+
+    // Added
+    pblock->vtx.push_back(tx);
+    setInBlock.insert(hash);
+    nBlockSize += nTxSize;
+    ++nBlockTx;
+    nBlockSigOps += nTxSigOps;
+    nFees += nTxFees;
+    nConsecutiveFailed = 0;
+
+    if (fDebug && GetBoolArg("-printpriority"))
+    {
+        const CTxMemPoolEntry& entry = mempool.mapEntry[hash];
+        printf("priority %.1f feeperkb %"PRId64" txid %s\n",
+               entry.GetPriority(pindexPrev->nHeight), entry.GetFeeRate(), hash.ToString().c_str());
+    }
+
+    // Children were passed over earlier in the same order, so they rank at
+    // least as high as whatever comes next and are tried right away
+    map<uint256, vector<uint256> >::iterator itWaiting = mapWaiting.find(hash);
+    if (itWaiting != mapWaiting.end())
+    {
+        vector<uint256> vChildren;
+        vChildren.swap((*itWaiting).second);
+        mapWaiting.erase(itWaiting);
+        BOOST_FOREACH(const uint256& hashChild, vChildren)
+            TryAdd(hashChild);
+    }
+    return true;
+}
+
+// High-priority area, included regardless of the fees paid
+void CBlockAssembler::AddByPriority(unsigned int nBlockPrioritySize)
+{
+    for (set<pair<double, uint256> >::reverse_iterator it = mempool.setByPriority.rbegin();
+         it != mempool.setByPriority.rend(); ++it)
+    {
+        if (nBlockSize >= nBlockPrioritySize || (*it).first < COIN * 144 / 250 || IsFull())
+            break;
+        TryAdd((*it).second);
+    }
+    // what is still waiting gets its turn again by fee rate
+    mapWaiting.clear();
+}
+
+void CBlockAssembler::AddByFee(int64_t nMinTxFee, unsigned int nBlockMinSize)
+{
+    for (set<pair<int64_t, uint256> >::reverse_iterator it = mempool.setByFeeRate.rbegin();
+         it != mempool.setByFeeRate.rend(); ++it)
+    {
+        // Skip free transactions if we're past the minimum block size, all
+        // the rest pay less
+        if ((*it).first < nMinTxFee && nBlockSize >= nBlockMinSize)
+            break;
+        if (IsFull())
+            break;
+        TryAdd((*it).second);
+    }
+}
 
 // CreateNewBlock: create new block (without proof-of-work/proof-of-stake)
 CBlock* CreateNewBlock(CWallet* pwallet, bool fProofOfStake, int64_t* pFees)
@@ -175,185 +296,16 @@ CBlock* CreateNewBlock(CWallet* pwallet, bool fProofOfStake, int64_t* pFees)
         LOCK2(cs_main, mempool.cs);
         CTxDB txdb("r");
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
-        {
-            CTransaction& tx = (*mi).second;
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !tx.IsFinal())
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            int64_t nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                CTransaction txPrev;
-                CTxIndex txindex;
-                if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        printf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                int64_t nValueIn = txPrev.vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = txindex.GetDepthInMainChain();
-                dPriority += (double)nValueIn * nConf;
-            }
-            if (fMissingInputs) continue;
+        mempool.UpdatePriorities(pindexPrev->nHeight);
 
-            // Priority is sum(valuein * age) / txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority /= nTxSize;
+        CBlockAssembler assembler(pblock.get(), txdb, pindexPrev, fProofOfStake, nBlockMaxSize);
+        if (nBlockPrioritySize > 0)
+            assembler.AddByPriority(nBlockPrioritySize);
+        assembler.AddByFee(nMinTxFee, nBlockMinSize);
 
-            // This is a more accurate fee-per-kilobyte than is used by the client code, because the
-            // client code rounds up the size to the nearest 1K. That's good, because it gives an
-            // incentive to create smaller transactions.
-            double dFeePerKb =  double(nTotalIn-tx.GetValueOut()) / (double(nTxSize)/1000.0);
-
-            if (porphan)
-            {
-                porphan->dPriority = dPriority;
-                porphan->dFeePerKb = dFeePerKb;
-            }
-            else
-                vecPriority.push_back(TxPriority(dPriority, dFeePerKb, &(*mi).second));
-        }
-
-        // Collect transactions into block
-        map<uint256, CTxIndex> mapTestPool;
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            double dFeePerKb = vecPriority.front().get<1>();
-            CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = tx.GetLegacySigOpCount();
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Timestamp limit
-            if (tx.nTime > GetAdjustedTime() || (fProofOfStake && tx.nTime > pblock->vtx[0].nTime))
-                continue;
-
-            // Transaction fee
-            int64_t nMinFee = tx.GetMinFee(nBlockSize, GMF_BLOCK);
-
-            // Skip free transactions if we're past the minimum block size:
-            if (fSortedByFee && (dFeePerKb < nMinTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritize by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || (dPriority < COIN * 144 / 250)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            // Connecting shouldn't fail due to dependency on other memory pool transactions
-            // because we're already processing them in order of dependency
-            map<uint256, CTxIndex> mapTestPoolTmp(mapTestPool);
-            MapPrevTx mapInputs;
-            bool fInvalid;
-            if (!tx.FetchInputs(txdb, mapTestPoolTmp, false, true, mapInputs, fInvalid))
-                continue;
-
-            int64_t nTxFees = tx.GetValueIn(mapInputs)-tx.GetValueOut();
-            if (nTxFees < nMinFee)
-                continue;
-
-            nTxSigOps += tx.GetP2SHSigOpCount(mapInputs);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            if (!tx.ConnectInputs(txdb, mapInputs, mapTestPoolTmp, CDiskTxPos(1,1,1), pindexPrev, false, true))
-                continue;
-
-            mapTestPoolTmp[tx.GetHash()] = CTxIndex(CDiskTxPos(1,1,1), tx.vout.size());
-            swap(mapTestPool, mapTestPoolTmp);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fDebug && GetBoolArg("-printpriority"))
-            {
-                printf("priority %.1f feeperkb %.1f txid %s\n",
-                       dPriority, dFeePerKb, tx.GetHash().ToString().c_str());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            uint256 hash = tx.GetHash();
-            if (mapDependers.count(hash))
-            {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->dFeePerKb, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        uint64_t nBlockSize = assembler.nBlockSize;
+        uint64_t nBlockTx = assembler.nBlockTx;
+        nFees = assembler.nFees;
 
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
@@ -451,7 +403,7 @@ void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash
 bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
 {
     uint256 hashBlock = pblock->GetHash();
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
     if(!pblock->IsProofOfWork())
         return error("CheckWork() : %s is not a proof-of-work block", hashBlock.GetHex().c_str());
@@ -26,6 +26,8 @@ using namespace std;
 using namespace boost;
 
 static const int MAX_OUTBOUND_CONNECTIONS = 16;
+// Outbound connection attempts allowed to be waiting on connect() at once
+static const int MAX_CONNECT_ATTEMPTS = 8;
 
 void ThreadMessageHandler2(void* parg);
 void ThreadSocketHandler2(void* parg);
@@ -75,6 +77,12 @@ set<CNetAddr> setservAddNodeAddresses;
 CCriticalSection cs_setservAddNodeAddresses;
 
 static CSemaphore *semOutbound = NULL;
+static CSemaphore *semConnectAttempts = NULL;
+
+// Destinations and network groups of the connection attempts in flight
+static CCriticalSection cs_setPendingConnect;
+static set<string> setPendingConnect;
+static multiset<vector<unsigned char> > setPendingGroups;
 
 void AddOneShot(string strDest)
 {
@@ -558,6 +566,8 @@ void CNode::PushVersion()
 
 std::map<CNetAddr, int64_t> CNode::setBanned;
 CCriticalSection CNode::cs_setBanned;
+CCriticalSection CNode::cs_nLastNodeId;
+int CNode::nLastNodeId = 0;
 
 void CNode::ClearBanned()
 {
@@ -619,10 +629,227 @@ void CNode::copyStats(CNodeStats &stats)
     X(fInbound);
     X(nStartingHeight);
     X(nMisbehavior);
+    X(fRelayTxes);
+    X(nFilterChecks);
+    X(nFilterTimeMicros);
+    X(nSendBytes);
+    X(nRecvBytes);
+    X(nSendSize);
+    X(nRecvSize);
+    X(nProcessMicros);
+    {
+        LOCK(cs_msgCost);
+        X(mapMsgCost);
+    }
 }
 #undef X
 
 
+int CNode::GetSendPriority() const
+{
+    if (nSendPriorityNext >= 0)
+        return nSendPriorityNext;
+    const std::string& strCommand = strSendCommand;
+    if (strCommand == "inv")
+    {
+        // SendMessages keeps block and tx invs in separate messages, so the
+        // first entry tells which kind this is
+        unsigned int nPos = nMessageStart;
+        if (nPos < vSend.size())
+        {
+            unsigned char chSize = vSend[nPos];
+            nPos += (chSize < 253 ? 1 : chSize == 253 ? 3 : chSize == 254 ? 5 : 9);
+        }
+        int nType = 0;
+        if (nPos + sizeof(nType) <= vSend.size())
+            memcpy(&nType, &vSend[nPos], sizeof(nType));
+        return (nType == MSG_BLOCK ? SEND_PRIORITY_BLOCK_ANNOUNCE : SEND_PRIORITY_TX);
+    }
+    if (strCommand == "version" || strCommand == "verack" || strCommand == "ping" || strCommand == "pong" ||
+        strCommand == "getdata" || strCommand == "getblocks" || strCommand == "getheaders" ||
+        strCommand == "getaddr" || strCommand == "mempool" || strCommand == "sendcmpct" ||
+        strCommand == "getblocktxn")
+        return SEND_PRIORITY_CONTROL;
+    if (strCommand == "cmpctblock" || strCommand == "blocktxn" || strCommand == "checkpoint" || strCommand == "alert")
+        return SEND_PRIORITY_BLOCK_ANNOUNCE;
+    // tx is only sent in reply to getdata, and must stay behind a merkleblock
+    if (strCommand == "block" || strCommand == "merkleblock" || strCommand == "tx" || strCommand == "headers")
+        return SEND_PRIORITY_BULK;
+    return SEND_PRIORITY_TX;
+}
+
+int CNode::SelectSendQueue()
+{
+    // Most urgent non-empty queue, unless a less urgent one has waited too long
+    int nSelected = -1;
+    for (int i = 0; i < SEND_PRIORITY_MAX; i++)
+    {
+        if (vSendMsg[i].empty())
+            continue;
+        if (nSelected == -1)
+            nSelected = i;
+        else if (nSendSkipped[i] >= SEND_STARVATION_LIMIT)
+        {
+            nSelected = i;
+            break;
+        }
+    }
+    if (nSelected == -1)
+        return -1;
+
+    for (int i = 0; i < SEND_PRIORITY_MAX; i++)
+    {
+        if (i == nSelected || vSendMsg[i].empty())
+            nSendSkipped[i] = 0;
+        else
+            nSendSkipped[i]++;
+    }
+    return nSelected;
+}
+
+// Write queued messages to the socket, caller must hold cs_vSend
+static void SocketSendData(CNode* pnode)
+{
+    unsigned int nBurst = 0;
+    while (nBurst < SEND_BURST_SIZE)
+    {
+        if (pnode->nSendQueueCurrent == -1)
+        {
+            pnode->nSendQueueCurrent = pnode->SelectSendQueue();
+            pnode->nSendOffset = 0;
+            if (pnode->nSendQueueCurrent == -1)
+                break;
+        }
+
+        // A message is always finished before switching queues
+        int nQueue = pnode->nSendQueueCurrent;
+        const CSerializeData& data = pnode->vSendMsg[nQueue].front();
+        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (nBytes > 0)
+        {
+            pnode->nLastSend = GetTime();
+            pnode->nSendBytes += nBytes;
+            pnode->nSendOffset += nBytes;
+            pnode->nSendQueueSize[nQueue] -= nBytes;
+            pnode->nSendSize -= nBytes;
+            CNode::RecordBytesSent(nBytes);
+            nBurst += nBytes;
+            if (pnode->nSendOffset == data.size())
+            {
+                pnode->vSendMsg[nQueue].pop_front();
+                pnode->nSendQueueCurrent = -1;
+                pnode->nSendOffset = 0;
+            }
+            else
+            {
+                // could not send full message; stop sending more
+                break;
+            }
+        }
+        else
+        {
+            if (nBytes < 0)
+            {
+                // error
+                int nErr = WSAGetLastError();
+                if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+                {
+                    printf("socket send error %d\n", nErr);
+                    pnode->CloseSocketDisconnect();
+                }
+            }
+            // couldn't send anything at all
+            break;
+        }
+    }
+}
+
+
+// Peers choose the command strings they send us, so only track this many
+// distinct ones per map and lump the rest together.
+static const unsigned int MAX_MSGCOST_TYPES = 64;
+
+static CMessageCost& MsgCostEntry(std::map<std::string, CMessageCost>& mapCost, const std::string& strCommand)
+{
+    std::map<std::string, CMessageCost>::iterator mi = mapCost.find(strCommand);
+    if (mi != mapCost.end())
+        return (*mi).second;
+    if (mapCost.size() >= MAX_MSGCOST_TYPES)
+        return mapCost["*other*"];
+    return mapCost[strCommand];
+}
+
+std::map<std::string, CMessageCost> CNode::mapTotalMsgCost;
+uint64_t CNode::nTotalBytesRecv = 0;
+uint64_t CNode::nTotalBytesSent = 0;
+CCriticalSection CNode::cs_totalBytes;
+
+void CNode::RecordMessageRecv(const std::string& strCommand, unsigned int nBytes, int64_t nMicros)
+{
+    nProcessMicros += nMicros;
+    {
+        LOCK(cs_msgCost);
+        CMessageCost& cost = MsgCostEntry(mapMsgCost, strCommand);
+        cost.nMsgsRecv++;
+        cost.nBytesRecv += nBytes;
+        cost.nProcessMicros += nMicros;
+    }
+    {
+        LOCK(cs_totalBytes);
+        CMessageCost& cost = MsgCostEntry(mapTotalMsgCost, strCommand);
+        cost.nMsgsRecv++;
+        cost.nBytesRecv += nBytes;
+        cost.nProcessMicros += nMicros;
+    }
+}
+
+void CNode::RecordMessageSent(const std::string& strCommand, unsigned int nBytes)
+{
+    {
+        LOCK(cs_msgCost);
+        CMessageCost& cost = MsgCostEntry(mapMsgCost, strCommand);
+        cost.nMsgsSent++;
+        cost.nBytesSent += nBytes;
+    }
+    {
+        LOCK(cs_totalBytes);
+        CMessageCost& cost = MsgCostEntry(mapTotalMsgCost, strCommand);
+        cost.nMsgsSent++;
+        cost.nBytesSent += nBytes;
+    }
+}
+
+void CNode::RecordBytesRecv(uint64_t nBytes)
+{
+    LOCK(cs_totalBytes);
+    nTotalBytesRecv += nBytes;
+}
+
+void CNode::RecordBytesSent(uint64_t nBytes)
+{
+    LOCK(cs_totalBytes);
+    nTotalBytesSent += nBytes;
+}
+
+uint64_t CNode::GetTotalBytesRecv()
+{
+    LOCK(cs_totalBytes);
+    return nTotalBytesRecv;
+}
+
+uint64_t CNode::GetTotalBytesSent()
+{
+    LOCK(cs_totalBytes);
+    return nTotalBytesSent;
+}
+
+void CNode::GetTotalMsgCost(std::map<std::string, CMessageCost>& mapMsgCostRet)
+{
+    LOCK(cs_totalBytes);
+    mapMsgCostRet = mapTotalMsgCost;
+}
+
+
 
 
 
@@ -670,7 +897,7 @@ void ThreadSocketHandler2(void* parg)
             BOOST_FOREACH(CNode* pnode, vNodesCopy)
             {
                 if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecv.empty() && pnode->vSend.empty()))
+                    (pnode->GetRefCount() <= 0 && pnode->vRecv.empty() && pnode->nSendSize == 0))
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
@@ -762,7 +989,7 @@ void ThreadSocketHandler2(void* parg)
                 have_fds = true;
                 {
                     TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSend.empty())
+                    if (lockSend && pnode->nSendSize > 0)
                         FD_SET(pnode->hSocket, &fdsetSend);
                 }
             }
@@ -886,6 +1113,9 @@ void ThreadSocketHandler2(void* parg)
                             vRecv.resize(nPos + nBytes);
                             memcpy(&vRecv[nPos], pchBuf, nBytes);
                             pnode->nLastRecv = GetTime();
+                            pnode->nRecvBytes += nBytes;
+                            pnode->nRecvSize = vRecv.size();
+                            CNode::RecordBytesRecv(nBytes);
                         }
                         else if (nBytes == 0)
                         {
@@ -919,33 +1149,23 @@ void ThreadSocketHandler2(void* parg)
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
                 {
-                    CDataStream& vSend = pnode->vSend;
-                    if (!vSend.empty())
+                    // Producers stop at SendBufferSize(), so only a peer that
+                    // stopped reading gets this far behind
+                    if (pnode->nSendSize > 4 * SendBufferSize())
                     {
-                        int nBytes = send(pnode->hSocket, &vSend[0], vSend.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            vSend.erase(vSend.begin(), vSend.begin() + nBytes);
-                            pnode->nLastSend = GetTime();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                printf("socket send error %d\n", nErr);
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
+                        if (!pnode->fDisconnect)
+                            printf("socket send flood control disconnect (%u bytes)\n", pnode->nSendSize);
+                        pnode->CloseSocketDisconnect();
                     }
+                    else
+                        SocketSendData(pnode);
                 }
             }
 
             //
             // Inactivity checking
             //
-            if (pnode->vSend.empty())
+            if (pnode->nSendSize == 0)
                 pnode->nLastSendEmpty = GetTime();
             if (GetTime() - pnode->nTimeConnected > 60)
             {
@@ -1163,6 +1383,26 @@ void ThreadDNSAddressSeed(void* parg)
     printf("ThreadDNSAddressSeed exited\n");
 }
 
+void static LookupDNSSeed(unsigned int seed_idx, int* pnFound, CCriticalSection* pcsFound)
+{
+    vector<CNetAddr> vaddr;
+    vector<CAddress> vAdd;
+    if (LookupHost(strDNSSeed[seed_idx][1], vaddr))
+    {
+        BOOST_FOREACH(CNetAddr& ip, vaddr)
+        {
+            int nOneDay = 24*3600;
+            CAddress addr = CAddress(CService(ip, GetDefaultPort()));
+            addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
+            vAdd.push_back(addr);
+        }
+    }
+    addrman.Add(vAdd, CNetAddr(strDNSSeed[seed_idx][0], true));
+
+    LOCK(*pcsFound);
+    *pnFound += vAdd.size();
+}
+
 void ThreadDNSAddressSeed2(void* parg)
 {
     printf("ThreadDNSAddressSeed started\n");
@@ -1172,25 +1412,16 @@ void ThreadDNSAddressSeed2(void* parg)
     {
         printf("Loading addresses from DNS seeds (could take a while)\n");
 
-        for (unsigned int seed_idx = 0; seed_idx < ARRAYLEN(strDNSSeed); seed_idx++) {
-            if (HaveNameProxy()) {
+        if (HaveNameProxy()) {
+            for (unsigned int seed_idx = 0; seed_idx < ARRAYLEN(strDNSSeed); seed_idx++)
                 AddOneShot(strDNSSeed[seed_idx][1]);
-            } else {
-                vector<CNetAddr> vaddr;
-                vector<CAddress> vAdd;
-                if (LookupHost(strDNSSeed[seed_idx][1], vaddr))
-                {
-                    BOOST_FOREACH(CNetAddr& ip, vaddr)
-                    {
-                        int nOneDay = 24*3600;
-                        CAddress addr = CAddress(CService(ip, GetDefaultPort()));
-                        addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
-                        vAdd.push_back(addr);
-                        found++;
-                    }
-                }
-                addrman.Add(vAdd, CNetAddr(strDNSSeed[seed_idx][0], true));
-            }
+        } else {
+            // Resolve all seeds at once so one slow or dead seed doesn't hold up the rest
+            CCriticalSection cs_found;
+            thread_group threads;
+            for (unsigned int seed_idx = 0; seed_idx < ARRAYLEN(strDNSSeed); seed_idx++)
+                threads.create_thread(boost::bind(&LookupDNSSeed, seed_idx, &found, &cs_found));
+            threads.join_all();
         }
     }
 
@@ -1280,6 +1511,73 @@ void ThreadOpenConnections(void* parg)
     printf("ThreadOpenConnections exited\n");
 }
 
+struct CConnectAttempt
+{
+    CAddress addr;
+    string strDest;
+    bool fOneShot;
+    CSemaphoreGrant grantOutbound;
+    CSemaphoreGrant grantAttempt;
+};
+
+void static ThreadConnectAttempt(void* parg)
+{
+    CConnectAttempt* pattempt = (CConnectAttempt*)parg;
+    const string& strDest = pattempt->strDest;
+    string strKey = strDest.empty() ? pattempt->addr.ToStringIPPort() : strDest;
+
+    vnThreadsRunning[THREAD_OPENCONNECTIONS]++;
+    try
+    {
+        if (!OpenNetworkConnection(pattempt->addr, &pattempt->grantOutbound, strDest.empty() ? NULL : strDest.c_str(), pattempt->fOneShot) && pattempt->fOneShot)
+            AddOneShot(strDest);
+    }
+    catch (std::exception& e) {
+        PrintException(&e, "ThreadConnectAttempt()");
+    }
+    vnThreadsRunning[THREAD_OPENCONNECTIONS]--;
+
+    {
+        LOCK(cs_setPendingConnect);
+        setPendingConnect.erase(strKey);
+        if (strDest.empty())
+            setPendingGroups.erase(setPendingGroups.find(pattempt->addr.GetGroup()));
+    }
+    // releases any grant OpenNetworkConnection didn't move to a node
+    delete pattempt;
+}
+
+// Hands the connection attempt to its own thread so that an address that
+// never answers only ties up one of MAX_CONNECT_ATTEMPTS slots instead of
+// the thread filling the outbound slots. Both grants are moved into the
+// attempt and released when it finishes.
+void static StartConnectAttempt(const CAddress& addrConnect, CSemaphoreGrant& grantOutbound, CSemaphoreGrant& grantAttempt, const char* strDest = NULL, bool fOneShot = false)
+{
+    string strKey = strDest ? strDest : addrConnect.ToStringIPPort();
+    {
+        LOCK(cs_setPendingConnect);
+        if (!setPendingConnect.insert(strKey).second)
+            return;
+        if (!strDest)
+            setPendingGroups.insert(addrConnect.GetGroup());
+    }
+
+    CConnectAttempt* pattempt = new CConnectAttempt();
+    pattempt->addr = addrConnect;
+    pattempt->strDest = strDest ? strDest : "";
+    pattempt->fOneShot = fOneShot;
+    grantOutbound.MoveTo(pattempt->grantOutbound);
+    grantAttempt.MoveTo(pattempt->grantAttempt);
+
+    if (!NewThread(ThreadConnectAttempt, pattempt))
+    {
+        printf("Error: NewThread(ThreadConnectAttempt) failed\n");
+        vnThreadsRunning[THREAD_OPENCONNECTIONS]--;
+        ThreadConnectAttempt(pattempt);
+        vnThreadsRunning[THREAD_OPENCONNECTIONS]++;
+    }
+}
+
 void static ProcessOneShot()
 {
     string strDest;
@@ -1292,10 +1590,11 @@ void static ProcessOneShot()
     }
     CAddress addr;
     CSemaphoreGrant grant(*semOutbound, true);
-    if (grant) {
-        if (!OpenNetworkConnection(addr, &grant, strDest.c_str(), true))
-            AddOneShot(strDest);
-    }
+    CSemaphoreGrant grantAttempt(*semConnectAttempts, true);
+    if (grant && grantAttempt)
+        StartConnectAttempt(addr, grant, grantAttempt, strDest.c_str(), true);
+    else
+        AddOneShot(strDest);
 }
 
 void static ThreadStakeMiner(void* parg)
@@ -1358,6 +1657,7 @@ void ThreadOpenConnections2(void* parg)
 
         vnThreadsRunning[THREAD_OPENCONNECTIONS]--;
         CSemaphoreGrant grant(*semOutbound);
+        CSemaphoreGrant grantAttempt(*semConnectAttempts);
         vnThreadsRunning[THREAD_OPENCONNECTIONS]++;
         if (fShutdown)
             return;
@@ -1400,6 +1700,11 @@ void ThreadOpenConnections2(void* parg)
                 }
             }
         }
+        {
+            // nor to a group we are already trying to connect to
+            LOCK(cs_setPendingConnect);
+            setConnected.insert(setPendingGroups.begin(), setPendingGroups.end());
+        }
 
         int64_t nANow = GetAdjustedTime();
 
@@ -1436,7 +1741,7 @@ void ThreadOpenConnections2(void* parg)
         }
 
         if (addrConnect.IsValid())
-            OpenNetworkConnection(addrConnect, &grant);
+            StartConnectAttempt(addrConnect, grant, grantAttempt);
     }
 }
 
@@ -1831,6 +2136,7 @@ void StartNode(void* parg)
         // initialize semaphore
         int nMaxOutbound = min(MAX_OUTBOUND_CONNECTIONS, (int)GetArg("-maxconnections", 125));
         semOutbound = new CSemaphore(nMaxOutbound);
+        semConnectAttempts = new CSemaphore(MAX_CONNECT_ATTEMPTS);
     }
 
     if (pnodeLocalHost == NULL)
@@ -1893,6 +2199,9 @@ bool StopNode()
     if (semOutbound)
         for (int i=0; i<MAX_OUTBOUND_CONNECTIONS; i++)
             semOutbound->post();
+    if (semConnectAttempts)
+        for (int i=0; i<MAX_CONNECT_ATTEMPTS; i++)
+            semConnectAttempts->post();
     do
     {
         int nThreadsRunning = 0;
@@ -1973,5 +2282,18 @@ void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataSt
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
 
-    RelayInventory(inv);
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes)
+    {
+        if (!pnode->fRelayTxes)
+            continue;
+        LOCK(pnode->cs_filter);
+        if (pnode->pfilter)
+        {
+            if (pnode->IsRelevantToFilter(tx, hash))
+                pnode->PushInventory(inv);
+        }
+        else
+            pnode->PushInventory(inv);
+    }
 }
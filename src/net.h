@@ -14,6 +14,7 @@
 #include <arpa/inet.h>
 #endif
 
+#include "bloom.h"
 #include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
@@ -72,6 +73,9 @@ enum
 {
     MSG_TX = 1,
     MSG_BLOCK,
+    // Nodes may always request a MSG_FILTERED_BLOCK in a getdata, however,
+    // MSG_FILTERED_BLOCK should not appear in any invs except as a part of getdata.
+    MSG_FILTERED_BLOCK,
 };
 
 class CRequestTracker
@@ -129,6 +133,39 @@ extern std::map<CInv, int64_t> mapAlreadyAskedFor;
 
 
 
+/** Send queue priorities, most urgent first. Each finished message goes to
+ *  one per-peer queue and the socket thread drains the most urgent queue
+ *  first, see CNode::GetSendPriority and CNode::SelectSendQueue.
+ */
+enum
+{
+    SEND_PRIORITY_CONTROL = 0,      // handshake, ping and requests
+    SEND_PRIORITY_BLOCK_ANNOUNCE,   // block inv, cmpctblock, blocktxn, alerts
+    SEND_PRIORITY_TX,               // tx inv, addr and everything else
+    SEND_PRIORITY_BULK,             // getdata replies: block, merkleblock, tx
+
+    SEND_PRIORITY_MAX
+};
+
+// a non-empty queue passed over this many times gets the next turn
+static const unsigned int SEND_STARVATION_LIMIT = 16;
+// most bytes written to one peer per socket handler pass, so a fast peer
+// can't hog the loop
+static const unsigned int SEND_BURST_SIZE = 256 * 1000;
+
+/** Traffic and processing cost of one message type */
+class CMessageCost
+{
+public:
+    uint64_t nMsgsRecv;
+    uint64_t nBytesRecv;
+    uint64_t nMsgsSent;
+    uint64_t nBytesSent;
+    int64_t nProcessMicros; // time spent in ProcessMessage
+
+    CMessageCost() : nMsgsRecv(0), nBytesRecv(0), nMsgsSent(0), nBytesSent(0), nProcessMicros(0) {}
+};
+
 class CNodeStats
 {
 public:
@@ -142,6 +179,15 @@ public:
     bool fInbound;
     int nStartingHeight;
     int nMisbehavior;
+    bool fRelayTxes;
+    uint64_t nFilterChecks;
+    int64_t nFilterTimeMicros;
+    uint64_t nSendBytes;
+    uint64_t nRecvBytes;
+    unsigned int nSendSize;
+    unsigned int nRecvSize;
+    int64_t nProcessMicros;
+    std::map<std::string, CMessageCost> mapMsgCost;
 };
 
 
@@ -155,13 +201,25 @@ public:
     // socket
     uint64_t nServices;
     SOCKET hSocket;
-    CDataStream vSend;
+    CDataStream vSend; // message being built by BeginMessage/EndMessage
+    std::deque<CSerializeData> vSendMsg[SEND_PRIORITY_MAX];
+    unsigned int nSendQueueSize[SEND_PRIORITY_MAX];
+    unsigned int nSendSkipped[SEND_PRIORITY_MAX];
+    int nSendQueueCurrent; // queue whose front message is partly sent, or -1
+    unsigned int nSendOffset;
     CDataStream vRecv;
     CCriticalSection cs_vSend;
     CCriticalSection cs_vRecv;
     int64_t nLastSend;
     int64_t nLastRecv;
     int64_t nLastSendEmpty;
+    uint64_t nSendBytes;
+    uint64_t nRecvBytes;
+    unsigned int nSendSize; // bytes queued in vSendMsg
+    unsigned int nRecvSize; // bytes waiting in vRecv
+    int64_t nProcessMicros;
+    CCriticalSection cs_msgCost;
+    std::map<std::string, CMessageCost> mapMsgCost;
     int64_t nTimeConnected;
     int nHeaderStart;
     unsigned int nMessageStart;
@@ -176,9 +234,23 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    // We use fRelayTxes for two purposes -
+    // a) it allows us to not relay tx invs before receiving the peer's version message
+    // b) the peer may tell us in their version message that we should not relay tx invs
+    //    until they have initialized their bloom filter.
+    bool fRelayTxes;
     CSemaphoreGrant grantOutbound;
+    CCriticalSection cs_filter;
+    CBloomFilter* pfilter;
+    // CPU spent running the peer's bloom filter over transactions
+    uint64_t nFilterChecks;
+    int64_t nFilterTimeMicros;
     int nRefCount;
+    // never reused, unlike the CNode pointer once the node is deleted
+    int id;
 protected:
+    static CCriticalSection cs_nLastNodeId;
+    static int nLastNodeId;
 
     // Denial-of-service detection/prevention
     // Key is IP address, value is banned-until-time
@@ -186,7 +258,23 @@ protected:
     static CCriticalSection cs_setBanned;
     int nMisbehavior;
 
+    // Node-wide traffic totals
+    static CCriticalSection cs_totalBytes;
+    static uint64_t nTotalBytesRecv;
+    static uint64_t nTotalBytesSent;
+    static std::map<std::string, CMessageCost> mapTotalMsgCost;
+
+    // command of the message being built in vSend, for accounting
+    std::string strSendCommand;
+
 public:
+    // queue for the next message instead of classifying it by command,
+    // or -1; set under cs_vSend and cleared when the message ends
+    int nSendPriorityNext;
+
+    // getdata items not answered yet, see ProcessGetData
+    std::deque<CInv> vRecvGetData;
+
     std::map<uint256, CRequestTracker> mapRequests;
     CCriticalSection cs_mapRequests;
     uint256 hashContinue;
@@ -207,6 +295,9 @@ public:
     CCriticalSection cs_inventory;
     std::multimap<int64_t, CInv> mapAskFor;
 
+    // compact block relay: peer asked to be sent "cmpctblock" instead of block inv
+    bool fPreferCompactBlocks;
+
     CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false) : vSend(SER_NETWORK, MIN_PROTO_VERSION), vRecv(SER_NETWORK, MIN_PROTO_VERSION)
     {
         nServices = 0;
@@ -214,6 +305,19 @@ public:
         nLastSend = 0;
         nLastRecv = 0;
         nLastSendEmpty = GetTime();
+        nSendBytes = 0;
+        nRecvBytes = 0;
+        nSendSize = 0;
+        nRecvSize = 0;
+        for (int i = 0; i < SEND_PRIORITY_MAX; i++)
+        {
+            nSendQueueSize[i] = 0;
+            nSendSkipped[i] = 0;
+        }
+        nSendQueueCurrent = -1;
+        nSendOffset = 0;
+        nSendPriorityNext = -1;
+        nProcessMicros = 0;
         nTimeConnected = GetTime();
         nHeaderStart = -1;
         nMessageStart = -1;
@@ -227,7 +331,15 @@ public:
         fNetworkNode = false;
         fSuccessfullyConnected = false;
         fDisconnect = false;
+        fRelayTxes = false;
+        pfilter = new CBloomFilter();
+        nFilterChecks = 0;
+        nFilterTimeMicros = 0;
         nRefCount = 0;
+        {
+            LOCK(cs_nLastNodeId);
+            id = nLastNodeId++;
+        }
         hashContinue = 0;
         pindexLastGetBlocksBegin = 0;
         hashLastGetBlocksEnd = 0;
@@ -236,6 +348,7 @@ public:
         nMisbehavior = 0;
         hashCheckpointKnown = 0;
         setInventoryKnown.max_size(SendBufferSize() / 1000);
+        fPreferCompactBlocks = false;
 
         // Be shy and don't send version until we hear
         if (hSocket != INVALID_SOCKET && !fInbound)
@@ -249,6 +362,8 @@ public:
             closesocket(hSocket);
             hSocket = INVALID_SOCKET;
         }
+        if (pfilter)
+            delete pfilter;
     }
 
 private:
@@ -291,6 +406,17 @@ public:
     }
 
 
+    // Check a transaction against the peer's bloom filter, accounting the time
+    // spent. Caller must hold cs_filter.
+    bool IsRelevantToFilter(const CTransaction& tx, const uint256& hash)
+    {
+        int64_t nStart = GetTimeMicros();
+        bool fMatch = pfilter->IsRelevantAndUpdate(tx, hash);
+        nFilterTimeMicros += GetTimeMicros() - nStart;
+        nFilterChecks++;
+        return fMatch;
+    }
+
     void AddInventoryKnown(const CInv& inv)
     {
         {
@@ -338,6 +464,7 @@ public:
         nHeaderStart = vSend.size();
         vSend << CMessageHeader(pszCommand, 0);
         nMessageStart = vSend.size();
+        strSendCommand = pszCommand;
         if (fDebug)
             printf("sending: %s ", pszCommand);
     }
@@ -349,6 +476,7 @@ public:
         vSend.resize(nHeaderStart);
         nHeaderStart = -1;
         nMessageStart = -1;
+        nSendPriorityNext = -1;
         LEAVE_CRITICAL_SECTION(cs_vSend);
 
         if (fDebug)
@@ -382,8 +510,18 @@ public:
             printf("(%d bytes)\n", nSize);
         }
 
+        RecordMessageSent(strSendCommand, vSend.size() - nHeaderStart);
+
+        // Move the finished message to its send queue
+        int nPriority = GetSendPriority();
+        nSendQueueSize[nPriority] += vSend.size();
+        nSendSize += vSend.size();
+        vSendMsg[nPriority].push_back(CSerializeData());
+        vSend.GetAndClear(vSendMsg[nPriority].back());
+
         nHeaderStart = -1;
         nMessageStart = -1;
+        nSendPriorityNext = -1;
         LEAVE_CRITICAL_SECTION(cs_vSend);
     }
 
@@ -634,6 +772,19 @@ public:
     static bool IsBanned(CNetAddr ip);
     bool Misbehaving(int howmuch); // 1 == a little, 100 == a lot
     void copyStats(CNodeStats &stats);
+
+    // Send queue scheduling, caller must hold cs_vSend
+    int GetSendPriority() const;
+    int SelectSendQueue();
+
+    // Traffic accounting
+    void RecordMessageRecv(const std::string& strCommand, unsigned int nBytes, int64_t nMicros);
+    void RecordMessageSent(const std::string& strCommand, unsigned int nBytes);
+    static void RecordBytesRecv(uint64_t nBytes);
+    static void RecordBytesSent(uint64_t nBytes);
+    static uint64_t GetTotalBytesRecv();
+    static uint64_t GetTotalBytesSent();
+    static void GetTotalMsgCost(std::map<std::string, CMessageCost>& mapMsgCostRet);
 };
 
 inline void RelayInventory(const CInv& inv)
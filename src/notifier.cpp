@@ -0,0 +1,194 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "notifier.h"
+#include "util.h"
+#include "sync.h"
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <deque>
+#include <list>
+
+using namespace std;
+using namespace boost::asio;
+
+// Bytes a client may have waiting to be sent before it is dropped
+static const size_t MAX_NOTIFY_BACKLOG = 1000000;
+
+class CNotifyClient
+{
+public:
+    ip::tcp::socket socket;
+    deque<string> queue;
+    size_t nQueued;
+    bool fWriting;
+
+    CNotifyClient(io_service& io_service) : socket(io_service)
+    {
+        nQueued = 0;
+        fWriting = false;
+    }
+};
+
+typedef boost::shared_ptr<CNotifyClient> NotifyClientPtr;
+
+static CCriticalSection cs_notifier;
+static io_service* pNotifyService = NULL;
+
+// Only touched on the notifier thread
+static list<NotifyClientPtr> lNotifyClients;
+
+static void NotifierRemove(NotifyClientPtr pclient)
+{
+    boost::system::error_code ec;
+    pclient->socket.close(ec);
+    lNotifyClients.remove(pclient);
+}
+
+static void NotifierWrite(NotifyClientPtr pclient);
+
+static void NotifierHandleWrite(NotifyClientPtr pclient, const boost::system::error_code& error)
+{
+    pclient->fWriting = false;
+    if (error)
+    {
+        NotifierRemove(pclient);
+        return;
+    }
+    pclient->nQueued -= pclient->queue.front().size();
+    pclient->queue.pop_front();
+    NotifierWrite(pclient);
+}
+
+static void NotifierWrite(NotifyClientPtr pclient)
+{
+    if (pclient->fWriting || pclient->queue.empty() || !pclient->socket.is_open())
+        return;
+    // deque::push_back leaves references to the front element valid
+    pclient->fWriting = true;
+    async_write(pclient->socket, buffer(pclient->queue.front()),
+                boost::bind(&NotifierHandleWrite, pclient, boost::asio::placeholders::error));
+}
+
+static void NotifierPublish(const string& strMessage)
+{
+    vector<NotifyClientPtr> vDrop;
+    BOOST_FOREACH(NotifyClientPtr pclient, lNotifyClients)
+    {
+        if (pclient->nQueued + strMessage.size() > MAX_NOTIFY_BACKLOG)
+        {
+            vDrop.push_back(pclient);
+            continue;
+        }
+        pclient->queue.push_back(strMessage);
+        pclient->nQueued += strMessage.size();
+        NotifierWrite(pclient);
+    }
+    BOOST_FOREACH(NotifyClientPtr pclient, vDrop)
+    {
+        printf("ThreadNotifier() : dropping client that fell behind\n");
+        NotifierRemove(pclient);
+    }
+}
+
+static void NotifierStartAccept(ip::tcp::acceptor& acceptor, io_service& io_service);
+
+static void NotifierHandleAccept(ip::tcp::acceptor* pacceptor, io_service* pio_service, NotifyClientPtr pclient,
+                                 const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::operation_aborted)
+        return;
+    if (!error)
+        lNotifyClients.push_back(pclient);
+    NotifierStartAccept(*pacceptor, *pio_service);
+}
+
+static void NotifierStartAccept(ip::tcp::acceptor& acceptor, io_service& io_service)
+{
+    NotifyClientPtr pclient(new CNotifyClient(io_service));
+    acceptor.async_accept(pclient->socket,
+                          boost::bind(&NotifierHandleAccept, &acceptor, &io_service, pclient, boost::asio::placeholders::error));
+}
+
+static void ThreadNotifier2(void* parg)
+{
+    printf("ThreadNotifier started\n");
+
+    int nPort = GetArg("-notifyport", 0);
+    io_service io_service;
+    ip::tcp::endpoint endpoint(ip::address_v4::loopback(), nPort);
+    ip::tcp::acceptor acceptor(io_service);
+    boost::system::error_code ec;
+    acceptor.open(endpoint.protocol(), ec);
+    if (!ec)
+        acceptor.set_option(ip::tcp::acceptor::reuse_address(true), ec);
+    if (!ec)
+        acceptor.bind(endpoint, ec);
+    if (!ec)
+        acceptor.listen(socket_base::max_connections, ec);
+    if (ec)
+    {
+        printf("ThreadNotifier() : unable to listen on port %d: %s\n", nPort, ec.message().c_str());
+        return;
+    }
+
+    NotifierStartAccept(acceptor, io_service);
+    {
+        LOCK(cs_notifier);
+        pNotifyService = &io_service;
+    }
+    printf("Notifications on 127.0.0.1:%d\n", nPort);
+
+    while (!fShutdown)
+        io_service.run_one();
+
+    LOCK(cs_notifier);
+    pNotifyService = NULL;
+}
+
+void ThreadNotifier(void* parg)
+{
+    // Make this thread recognisable as the notifier
+    RenameThread("UtilityCoin-notify");
+
+    try
+    {
+        ThreadNotifier2(parg);
+    }
+    catch (std::exception& e) {
+        PrintException(&e, "ThreadNotifier()");
+    } catch (...) {
+        PrintException(NULL, "ThreadNotifier()");
+    }
+    printf("ThreadNotifier exited\n");
+}
+
+void StopNotifier()
+{
+    LOCK(cs_notifier);
+    if (pNotifyService)
+        pNotifyService->stop();
+}
+
+// Hand the message to the notifier thread, never waits on clients
+static void Notify(const string& strMessage)
+{
+    LOCK(cs_notifier);
+    if (pNotifyService)
+        pNotifyService->post(boost::bind(&NotifierPublish, strMessage));
+}
+
+void NotifyBlockTip(const uint256& hashBlock)
+{
+    Notify("hashblock " + hashBlock.GetHex() + "\n");
+}
+
+void NotifyTransaction(const uint256& hashTx)
+{
+    Notify("hashtx " + hashTx.GetHex() + "\n");
+}
@@ -0,0 +1,26 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_NOTIFIER_H
+#define BITCOIN_NOTIFIER_H
+
+#include "uint256.h"
+
+//
+// Local push notifications (-notifyport). Clients connecting on the
+// loopback interface get one line per event:
+//
+//   hashblock <hash>   the best chain has a new tip
+//   hashtx <txid>      a transaction entered the memory pool
+//
+// Clients that don't keep up are disconnected rather than slowing the
+// node down.
+//
+
+void ThreadNotifier(void* parg);
+/** Wake the notifier thread so it sees fShutdown */
+void StopNotifier();
+void NotifyBlockTip(const uint256& hashBlock);
+void NotifyTransaction(const uint256& hashTx);
+
+#endif
@@ -134,4 +134,6 @@ class CInv
         uint256 hash;
 };
 
+IMPLEMENT_FIXED_SERIALIZE_SIZE(CInv)
+
 #endif // __INCLUDED_PROTOCOL_H__
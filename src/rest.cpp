@@ -0,0 +1,276 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "bitcoinrpc.h"
+#include "jsonwriter.h"
+
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+using namespace json_spirit;
+
+extern void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail, CJSONWriter& writer);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, CJSONWriter& writer);
+
+//
+// Read-only REST interface on the RPC port:
+//
+//   GET /rest/block/<hash>.<bin|hex|json>
+//   GET /rest/tx/<txid>.<bin|hex|json>
+//   GET /rest/headers/<count>/<hash>.<bin|hex|json>
+//
+// bin is the raw network serialization, hex the same as one hex line and
+// json the document getblock/getrawtransaction would return.
+//
+
+enum RESTFormat
+{
+    RF_BINARY,
+    RF_HEX,
+    RF_JSON,
+};
+
+static const struct
+{
+    RESTFormat rf;
+    const char* pszExt;
+    const char* pszContentType;
+} rfNames[] =
+{
+    { RF_BINARY, "bin",  "application/octet-stream" },
+    { RF_HEX,    "hex",  "text/plain" },
+    { RF_JSON,   "json", "application/json" },
+};
+
+static const int MAX_REST_HEADERS = 2000;
+
+// Splits "<param>.<ext>" into the parameter and the output format
+static bool ParseRESTFormat(const string& strPart, string& strParam, RESTFormat& rf)
+{
+    string::size_type nDot = strPart.rfind('.');
+    if (nDot == string::npos)
+        return false;
+    strParam = strPart.substr(0, nDot);
+    string strExt = strPart.substr(nDot + 1);
+    for (unsigned int i = 0; i < sizeof(rfNames) / sizeof(rfNames[0]); i++)
+    {
+        if (strExt == rfNames[i].pszExt)
+        {
+            rf = rfNames[i].rf;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ParseRESTHash(const string& str, uint256& hash)
+{
+    if (str.size() != 64 || !IsHex(str))
+        return false;
+    hash.SetHex(str);
+    return true;
+}
+
+static int RESTError(int nStatus, const string& strMessage, string& strReply, string& strContentType)
+{
+    strReply = strMessage + "\n";
+    strContentType = "text/plain";
+    return nStatus;
+}
+
+template<typename T>
+static void RESTWriteBytes(RESTFormat rf, const T itbegin, const T itend, string& strReply)
+{
+    if (rf == RF_BINARY)
+        strReply.assign(itbegin, itend);
+    else
+        strReply = HexStr(itbegin, itend) + "\n";
+}
+
+static int RESTGetBlock(const string& strHash, RESTFormat rf, string& strReply)
+{
+    uint256 hash;
+    if (!ParseRESTHash(strHash, hash))
+        return HTTP_BAD_REQUEST;
+
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            return HTTP_NOT_FOUND;
+        pindex = (*mi).second;
+    }
+
+    if (rf == RF_JSON)
+    {
+        CBlock block;
+        if (!block.ReadFromDisk(pindex, true))
+            return HTTP_NOT_FOUND;
+        CJSONWriter writer(strReply);
+        blockToJSON(block, pindex, true, writer);
+        strReply += "\n";
+        return HTTP_OK;
+    }
+
+    // The bytes on disk are the network serialization already
+    vector<char> vchBlock;
+    if (!ReadRawBlockFromDisk(vchBlock, pindex))
+        return HTTP_NOT_FOUND;
+    RESTWriteBytes(rf, vchBlock.begin(), vchBlock.end(), strReply);
+    return HTTP_OK;
+}
+
+static int RESTGetTx(const string& strHash, RESTFormat rf, string& strReply)
+{
+    uint256 hash;
+    if (!ParseRESTHash(strHash, hash))
+        return HTTP_BAD_REQUEST;
+
+    CTransaction tx;
+    uint256 hashBlock = 0;
+    if (!GetTransaction(hash, tx, hashBlock))
+        return HTTP_NOT_FOUND;
+
+    if (rf == RF_JSON)
+    {
+        CJSONWriter writer(strReply);
+        writer.BeginObject();
+        TxToJSON(tx, hashBlock, writer);
+        writer.EndObject();
+        strReply += "\n";
+        return HTTP_OK;
+    }
+
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+    RESTWriteBytes(rf, ssTx.begin(), ssTx.end(), strReply);
+    return HTTP_OK;
+}
+
+static void HeaderToJSON(const CBlockIndex* pindex, CJSONWriter& writer)
+{
+    writer.BeginObject();
+    writer.Key("hash");
+    writer.WriteString(pindex->GetBlockHash().GetHex());
+    writer.Key("confirmations");
+    writer.WriteInt(pindex->IsInMainChain() ? nBestHeight - pindex->nHeight + 1 : 0);
+    writer.Key("height");
+    writer.WriteInt(pindex->nHeight);
+    writer.Key("version");
+    writer.WriteInt(pindex->nVersion);
+    writer.Key("merkleroot");
+    writer.WriteString(pindex->hashMerkleRoot.GetHex());
+    writer.Key("time");
+    writer.WriteInt(pindex->GetBlockTime());
+    writer.Key("nonce");
+    writer.WriteUInt(pindex->nNonce);
+    writer.Key("bits");
+    writer.WriteString(HexBits(pindex->nBits));
+    writer.Key("difficulty");
+    writer.WriteReal(GetDifficulty(pindex));
+    writer.Key("chaintrust");
+    writer.WriteString(leftTrim(pindex->nChainTrust.GetHex(), '0'));
+    if (pindex->pprev)
+    {
+        writer.Key("previousblockhash");
+        writer.WriteString(pindex->pprev->GetBlockHash().GetHex());
+    }
+    if (pindex->pnext)
+    {
+        writer.Key("nextblockhash");
+        writer.WriteString(pindex->pnext->GetBlockHash().GetHex());
+    }
+    writer.Key("flags");
+    writer.WriteString(pindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work");
+    writer.EndObject();
+}
+
+// Up to nCount main chain headers starting at the given block. Headers
+// come from the block index, the blk files are not touched.
+static int RESTGetHeaders(const string& strCount, const string& strHash, RESTFormat rf, string& strReply)
+{
+    int nCount = atoi(strCount);
+    if (nCount < 1 || nCount > MAX_REST_HEADERS)
+        return HTTP_BAD_REQUEST;
+    uint256 hash;
+    if (!ParseRESTHash(strHash, hash))
+        return HTTP_BAD_REQUEST;
+
+    LOCK(cs_main);
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    if (mi == mapBlockIndex.end())
+        return HTTP_NOT_FOUND;
+
+    vector<const CBlockIndex*> vHeaders;
+    for (const CBlockIndex* pindex = (*mi).second; pindex && pindex->IsInMainChain(); pindex = pindex->pnext)
+    {
+        vHeaders.push_back(pindex);
+        if ((int)vHeaders.size() == nCount)
+            break;
+    }
+
+    if (rf == RF_JSON)
+    {
+        CJSONWriter writer(strReply);
+        writer.BeginArray();
+        BOOST_FOREACH(const CBlockIndex* pindex, vHeaders)
+            HeaderToJSON(pindex, writer);
+        writer.EndArray();
+        strReply += "\n";
+        return HTTP_OK;
+    }
+
+    // 80 bytes each, without the empty transaction list and signature
+    // the p2p headers message carries
+    CDataStream ssHeaders(SER_NETWORK | SER_BLOCKHEADERONLY, PROTOCOL_VERSION);
+    BOOST_FOREACH(const CBlockIndex* pindex, vHeaders)
+        ssHeaders << pindex->GetBlockHeader();
+    RESTWriteBytes(rf, ssHeaders.begin(), ssHeaders.end(), strReply);
+    return HTTP_OK;
+}
+
+int HandleRESTRequest(const string& strURI, string& strReply, string& strContentType)
+{
+    strReply.clear();
+
+    string strPath = strURI.substr(0, strURI.find('?'));
+    vector<string> vParts;
+    boost::split(vParts, strPath, boost::is_any_of("/"));
+    // vParts[0] is empty and vParts[1] is "rest"
+    if (vParts.size() < 4)
+        return RESTError(HTTP_NOT_FOUND, "unknown REST request", strReply, strContentType);
+
+    string strParam;
+    RESTFormat rf;
+    if (!ParseRESTFormat(vParts.back(), strParam, rf))
+        return RESTError(HTTP_NOT_FOUND, "output format not found (available: .bin, .hex, .json)", strReply, strContentType);
+    strContentType = rfNames[rf].pszContentType;
+
+    int nStatus = HTTP_NOT_FOUND;
+    try
+    {
+        const string& strCommand = vParts[2];
+        if (strCommand == "block" && vParts.size() == 4)
+            nStatus = RESTGetBlock(strParam, rf, strReply);
+        else if (strCommand == "tx" && vParts.size() == 4)
+            nStatus = RESTGetTx(strParam, rf, strReply);
+        else if (strCommand == "headers" && vParts.size() == 5)
+            nStatus = RESTGetHeaders(vParts[3], strParam, rf, strReply);
+        else
+            return RESTError(HTTP_NOT_FOUND, "unknown REST request", strReply, strContentType);
+    }
+    catch (std::exception& e)
+    {
+        printf("REST request %s failed: %s\n", strPath.c_str(), e.what());
+        return RESTError(HTTP_INTERNAL_SERVER_ERROR, "internal error", strReply, strContentType);
+    }
+
+    if (nStatus == HTTP_BAD_REQUEST)
+        return RESTError(nStatus, "invalid request " + strPath, strReply, strContentType);
+    if (nStatus == HTTP_NOT_FOUND)
+        return RESTError(nStatus, strPath + " not found", strReply, strContentType);
+    return nStatus;
+}
@@ -5,11 +5,13 @@
 
 #include "main.h"
 #include "bitcoinrpc.h"
+#include "jsonwriter.h"
 
 using namespace json_spirit;
 using namespace std;
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, json_spirit::Object& entry);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, CJSONWriter& writer);
 extern enum Checkpoints::CPMode CheckpointsMode;
 
 double GetDifficulty(const CBlockIndex* blockindex)
@@ -95,13 +97,29 @@ double GetPoSKernelPS()
     return nStakesTime ? dStakeKernelsTriedAvg / nStakesTime : 0;
 }
 
+// Only the depth and the successor depend on the current chain, the
+// rest of the block index entry never changes once it is created
+static void GetBlockChainPosition(const CBlock& block, const CBlockIndex* blockindex, int& nDepth, uint256& hashNext)
+{
+    CMerkleTx txGen(block.vtx[0]);
+    txGen.SetMerkleBranch(&block);
+    hashNext = 0;
+
+    LOCK(cs_main);
+    nDepth = txGen.GetDepthInMainChain();
+    if (blockindex->pnext)
+        hashNext = blockindex->pnext->GetBlockHash();
+}
+
 Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail)
 {
+    int nDepth;
+    uint256 hashNext;
+    GetBlockChainPosition(block, blockindex, nDepth, hashNext);
+
     Object result;
     result.push_back(Pair("hash", block.GetHash().GetHex()));
-    CMerkleTx txGen(block.vtx[0]);
-    txGen.SetMerkleBranch(&block);
-    result.push_back(Pair("confirmations", (int)txGen.GetDepthInMainChain()));
+    result.push_back(Pair("confirmations", nDepth));
     result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
     result.push_back(Pair("height", blockindex->nHeight));
     result.push_back(Pair("version", block.nVersion));
@@ -115,8 +133,8 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPri
     result.push_back(Pair("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0')));
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    if (blockindex->pnext)
-        result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
+    if (hashNext != 0)
+        result.push_back(Pair("nextblockhash", hashNext.GetHex()));
 
     result.push_back(Pair("flags", strprintf("%s%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier()? " stake-modifier": "")));
     result.push_back(Pair("proofhash", blockindex->IsProofOfStake()? blockindex->hashProofOfStake.GetHex() : blockindex->GetBlockHash().GetHex()));
@@ -147,6 +165,86 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPri
     return result;
 }
 
+// Same document as above, written straight out. Keep the two in step.
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail, CJSONWriter& writer)
+{
+    int nDepth;
+    uint256 hashNext;
+    GetBlockChainPosition(block, blockindex, nDepth, hashNext);
+
+    writer.BeginObject();
+    writer.Key("hash");
+    writer.WriteString(block.GetHash().GetHex());
+    writer.Key("confirmations");
+    writer.WriteInt(nDepth);
+    writer.Key("size");
+    writer.WriteInt(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.Key("height");
+    writer.WriteInt(blockindex->nHeight);
+    writer.Key("version");
+    writer.WriteInt(block.nVersion);
+    writer.Key("merkleroot");
+    writer.WriteString(block.hashMerkleRoot.GetHex());
+    writer.Key("mint");
+    writer.WriteAmount(blockindex->nMint);
+    writer.Key("time");
+    writer.WriteInt(block.GetBlockTime());
+    writer.Key("nonce");
+    writer.WriteUInt(block.nNonce);
+    writer.Key("bits");
+    writer.WriteString(HexBits(block.nBits));
+    writer.Key("difficulty");
+    writer.WriteReal(GetDifficulty(blockindex));
+    writer.Key("blocktrust");
+    writer.WriteString(leftTrim(blockindex->GetBlockTrust().GetHex(), '0'));
+    writer.Key("chaintrust");
+    writer.WriteString(leftTrim(blockindex->nChainTrust.GetHex(), '0'));
+    if (blockindex->pprev)
+    {
+        writer.Key("previousblockhash");
+        writer.WriteString(blockindex->pprev->GetBlockHash().GetHex());
+    }
+    if (hashNext != 0)
+    {
+        writer.Key("nextblockhash");
+        writer.WriteString(hashNext.GetHex());
+    }
+
+    writer.Key("flags");
+    writer.WriteString(strprintf("%s%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier()? " stake-modifier": ""));
+    writer.Key("proofhash");
+    writer.WriteString(blockindex->IsProofOfStake()? blockindex->hashProofOfStake.GetHex() : blockindex->GetBlockHash().GetHex());
+    writer.Key("entropybit");
+    writer.WriteInt(blockindex->GetStakeEntropyBit());
+    writer.Key("modifier");
+    writer.WriteString(strprintf("%016"PRIx64, blockindex->nStakeModifier));
+    writer.Key("modifierchecksum");
+    writer.WriteString(strprintf("%08x", blockindex->nStakeModifierChecksum));
+    writer.Key("tx");
+    writer.BeginArray();
+    BOOST_FOREACH (const CTransaction& tx, block.vtx)
+    {
+        if (fPrintTransactionDetail)
+        {
+            writer.BeginObject();
+            writer.Key("txid");
+            writer.WriteString(tx.GetHash().GetHex());
+            TxToJSON(tx, 0, writer);
+            writer.EndObject();
+        }
+        else
+            writer.WriteString(tx.GetHash().GetHex());
+    }
+    writer.EndArray();
+
+    if (block.IsProofOfStake())
+    {
+        writer.Key("signature");
+        writer.WriteHex(block.vchBlockSig.begin(), block.vchBlockSig.end());
+    }
+    writer.EndObject();
+}
+
 Value getbestblockhash(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -154,7 +252,7 @@ Value getbestblockhash(const Array& params, bool fHelp)
             "getbestblockhash\n"
             "Returns the hash of the best block in the longest block chain.");
 
-    return hashBestChain.GetHex();
+    return GetChainTip()->hashBlock.GetHex();
 }
 
 Value getblockcount(const Array& params, bool fHelp)
@@ -164,7 +262,7 @@ Value getblockcount(const Array& params, bool fHelp)
             "getblockcount\n"
             "Returns the number of blocks in the longest block chain.");
 
-    return nBestHeight;
+    return GetChainTip()->nHeight;
 }
 
 
@@ -175,9 +273,10 @@ Value getdifficulty(const Array& params, bool fHelp)
             "getdifficulty\n"
             "Returns the difficulty as a multiple of the minimum difficulty.");
 
+    boost::shared_ptr<const CChainTip> ptip = GetChainTip();
     Object obj;
-    obj.push_back(Pair("proof-of-work",        GetDifficulty()));
-    obj.push_back(Pair("proof-of-stake",       GetDifficulty(GetLastBlockIndex(pindexBest, true))));
+    obj.push_back(Pair("proof-of-work",        GetDifficulty(ptip->pindexLastPoW)));
+    obj.push_back(Pair("proof-of-stake",       GetDifficulty(ptip->pindexLastPoS)));
     obj.push_back(Pair("search-interval",      (int)nLastCoinStakeSearchInterval));
     return obj;
 }
@@ -198,10 +297,32 @@ Value settxfee(const Array& params, bool fHelp)
 
 Value getrawmempool(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "getrawmempool\n"
-            "Returns all transaction ids in memory pool.");
+            "getrawmempool [verbose=false]\n"
+            "Returns all transaction ids in memory pool.\n"
+            "With verbose, returns an object with the pool's data for each of them.");
+
+    bool fVerbose = params.size() > 0 && params[0].get_bool();
+    if (fVerbose)
+    {
+        LOCK(mempool.cs);
+        Object o;
+        for (map<uint256, CTxMemPoolEntry>::iterator it = mempool.mapEntry.begin(); it != mempool.mapEntry.end(); ++it)
+        {
+            const CTxMemPoolEntry& entry = (*it).second;
+            Object info;
+            info.push_back(Pair("size", (int)entry.nTxSize));
+            info.push_back(Pair("fee", ValueFromAmount(entry.nFee)));
+            info.push_back(Pair("time", entry.nTime));
+            info.push_back(Pair("height", entry.nHeight));
+            info.push_back(Pair("ancestorcount", (int)entry.nCountWithAncestors));
+            info.push_back(Pair("ancestorsize", (int)entry.nSizeWithAncestors));
+            info.push_back(Pair("ancestorfees", ValueFromAmount(entry.nFeesWithAncestors)));
+            o.push_back(Pair((*it).first.GetHex(), info));
+        }
+        return o;
+    }
 
     vector<uint256> vtxid;
     mempool.queryHashes(vtxid);
@@ -213,6 +334,41 @@ Value getrawmempool(const Array& params, bool fHelp)
     return a;
 }
 
+Value getmempoolinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getmempoolinfo\n"
+            "Returns details on the memory pool.");
+
+    LOCK(mempool.cs);
+    Object ret;
+    ret.push_back(Pair("size", (boost::int64_t)mempool.mapTx.size()));
+    ret.push_back(Pair("bytes", (boost::int64_t)mempool.nTotalTxSize));
+    ret.push_back(Pair("maxmempool", (boost::int64_t)GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000));
+    if (!mempool.setByFeeRate.empty())
+        ret.push_back(Pair("minfeerate", ValueFromAmount(mempool.setByFeeRate.begin()->first)));
+    return ret;
+}
+
+Value getsigcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "Returns details on the verified signature cache.");
+
+    uint64_t nEntries, nCapacity, nHits, nMisses;
+    signatureCache.GetStats(nEntries, nCapacity, nHits, nMisses);
+    Object ret;
+    ret.push_back(Pair("entries", (boost::int64_t)nEntries));
+    ret.push_back(Pair("capacity", (boost::int64_t)nCapacity));
+    ret.push_back(Pair("bytes", (boost::int64_t)(nCapacity * sizeof(uint256))));
+    ret.push_back(Pair("hits", (boost::int64_t)nHits));
+    ret.push_back(Pair("misses", (boost::int64_t)nMisses));
+    return ret;
+}
+
 Value getblockhash(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -228,6 +384,45 @@ Value getblockhash(const Array& params, bool fHelp)
     return pblockindex->phashBlock->GetHex();
 }
 
+// Block index entries are never freed, the read and the encoding run
+// without cs_main so batched calls can overlap
+static CBlockIndex* ReadBlockByHash(const Array& params, CBlock& block)
+{
+    std::string strHash = params[0].get_str();
+    uint256 hash(strHash);
+
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = (*mi).second;
+    }
+
+    block.ReadFromDisk(pblockindex, true);
+    return pblockindex;
+}
+
+static CBlockIndex* ReadBlockByNumber(const Array& params, CBlock& block)
+{
+    int nHeight = params[0].get_int();
+
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        if (nHeight < 0 || nHeight > nBestHeight)
+            throw runtime_error("Block number out of range.");
+
+        pblockindex = pindexBest;
+        while (pblockindex->nHeight > nHeight)
+            pblockindex = pblockindex->pprev;
+    }
+
+    block.ReadFromDisk(pblockindex, true);
+    return pblockindex;
+}
+
 Value getblock(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -236,17 +431,22 @@ Value getblock(const Array& params, bool fHelp)
             "txinfo optional to print more detailed tx info\n"
             "Returns details of a block with given block-hash.");
 
-    std::string strHash = params[0].get_str();
-    uint256 hash(strHash);
+    CBlock block;
+    CBlockIndex* pblockindex = ReadBlockByHash(params, block);
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+}
+
+bool getblock_stream(const Array& params, CJSONWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 2)
+        return false;
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-    block.ReadFromDisk(pblockindex, true);
+    CBlockIndex* pblockindex = ReadBlockByHash(params, block);
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false, writer);
+    return true;
 }
 
 Value getblockbynumber(const Array& params, bool fHelp)
@@ -257,21 +457,22 @@ Value getblockbynumber(const Array& params, bool fHelp)
             "txinfo optional to print more detailed tx info\n"
             "Returns details of a block with given block-number.");
 
-    int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > nBestHeight)
-        throw runtime_error("Block number out of range.");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hashBestChain];
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
+    CBlockIndex* pblockindex = ReadBlockByNumber(params, block);
 
-    uint256 hash = *pblockindex->phashBlock;
+    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+}
 
-    pblockindex = mapBlockIndex[hash];
-    block.ReadFromDisk(pblockindex, true);
+bool getblockbynumber_stream(const Array& params, CJSONWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 2)
+        return false;
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    CBlock block;
+    CBlockIndex* pblockindex = ReadBlockByNumber(params, block);
+
+    blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false, writer);
+    return true;
 }
 
 // UtilityCoin: get information of sync-checkpoint
@@ -26,7 +26,7 @@ Value getsubsidy(const Array& params, bool fHelp)
 
     if (params.size() != 0)
     {
-        CBigNum bnTarget(uint256(params[0].get_str()));
+        uint256 bnTarget(params[0].get_str());
         nBits = bnTarget.GetCompact();
     }
     else
@@ -176,7 +176,7 @@ Value getworkex(const Array& params, bool fHelp)
         char phash1[64];
         FormatHashBuffers(pblock, pmidstate, pdata, phash1);
 
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
         CTransaction coinbaseTx = pblock->vtx[0];
         std::vector<uint256> merkle = pblock->GetMerkleBranch(0);
@@ -318,7 +318,7 @@ Value getwork(const Array& params, bool fHelp)
         char phash1[64];
         FormatHashBuffers(pblock, pmidstate, pdata, phash1);
 
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
         Object result;
         result.push_back(Pair("midstate", HexStr(BEGIN(pmidstate), END(pmidstate)))); // deprecated
@@ -374,9 +374,11 @@ Value getblocktemplate(const Array& params, bool fHelp)
             "  \"sizelimit\" : limit of block size\n"
             "  \"bits\" : compressed target of next block\n"
             "  \"height\" : height of the next block\n"
+            "  \"longpollid\" : pass back as \"longpollid\" in [params] to wait for the next template\n"
             "See https://en.bitcoin.it/wiki/BIP_0022 for full specification.");
 
     std::string strMode = "template";
+    Value lpval = Value::null;
     if (params.size() > 0)
     {
         const Object& oparam = params[0].get_obj();
@@ -389,6 +391,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
         }
         else
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid mode");
+        lpval = find_value(oparam, "longpollid");
     }
 
     if (strMode != "template")
@@ -400,6 +403,40 @@ Value getblocktemplate(const Array& params, bool fHelp)
     if (IsInitialBlockDownload())
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "UtilityCoin is downloading blocks...");
 
+    if (GetChainTip()->nHeight >= LAST_POW_BLOCK)
+        throw JSONRPCError(RPC_MISC_ERROR, "No more PoW blocks");
+
+    if (lpval.type() == str_type)
+    {
+        // Long polling (BIP22): the id is the tip and transaction update
+        // count the last template was made from. A new tip answers at
+        // once, pool changes only after a minute and then every 10 seconds,
+        // so that templates aren't redone for every transaction.
+        std::string strLongPollId = lpval.get_str();
+        uint256 hashWatched;
+        hashWatched.SetHex(strLongPollId.substr(0, 64));
+        unsigned int nTransactionsUpdatedWatched = strLongPollId.size() > 64 ? atoi64(strLongPollId.substr(64)) : 0;
+
+        CRPCLongPollSlot slot;
+        if (!slot.IsHeld())
+            throw JSONRPCError(RPC_MISC_ERROR, "Too many long polls waiting, raise -rpcthreads");
+
+        int64_t nWait = 60 * 1000;
+        while (!WaitForChainTipChange(hashWatched, nWait))
+        {
+            if (fShutdown)
+                throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+            if (nTransactionsUpdated != nTransactionsUpdatedWatched)
+                break;
+            nWait = 10 * 1000;
+        }
+    }
+    else if (lpval.type() != null_type)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid longpollid");
+
+    // Called without locks so that long polls don't hold them while waiting
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
     if (pindexBest->nHeight >= LAST_POW_BLOCK)
         throw JSONRPCError(RPC_MISC_ERROR, "No more PoW blocks");
 
@@ -411,7 +448,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
     static int64_t nStart;
     static CBlock* pblock;
     if (pindexPrev != pindexBest ||
-        (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 5))
+        (nTransactionsUpdated != nTransactionsUpdatedLast && (lpval.type() == str_type || GetTime() - nStart > 5)))
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
         pindexPrev = NULL;
@@ -485,7 +522,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
     Object aux;
     aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
 
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
     static Array aMutable;
     if (aMutable.empty())
@@ -511,6 +548,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
     result.push_back(Pair("curtime", (int64_t)pblock->nTime));
     result.push_back(Pair("bits", HexBits(pblock->nBits)));
     result.push_back(Pair("height", (int64_t)(pindexPrev->nHeight+1)));
+    result.push_back(Pair("longpollid", pindexPrev->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
 
     return result;
 }
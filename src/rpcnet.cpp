@@ -36,12 +36,32 @@ static void CopyNodeStats(std::vector<CNodeStats>& vstats)
     }
 }
 
+static Object MsgCostToJSON(const map<string, CMessageCost>& mapMsgCost)
+{
+    Object ret;
+    for (map<string, CMessageCost>::const_iterator mi = mapMsgCost.begin(); mi != mapMsgCost.end(); ++mi)
+    {
+        const CMessageCost& cost = (*mi).second;
+        Object obj;
+        obj.push_back(Pair("msgsrecv", (boost::uint64_t)cost.nMsgsRecv));
+        obj.push_back(Pair("bytesrecv", (boost::uint64_t)cost.nBytesRecv));
+        obj.push_back(Pair("msgssent", (boost::uint64_t)cost.nMsgsSent));
+        obj.push_back(Pair("bytessent", (boost::uint64_t)cost.nBytesSent));
+        obj.push_back(Pair("processtime", (boost::int64_t)cost.nProcessMicros));
+        ret.push_back(Pair((*mi).first, obj));
+    }
+    return ret;
+}
+
 Value getpeerinfo(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
         throw runtime_error(
             "getpeerinfo\n"
-            "Returns data about each connected network node.");
+            "Returns data about each connected network node.\n"
+            "filterchecks and filtertime (in microseconds) account the CPU spent matching\n"
+            "transactions against the peer's bloom filter. messages breaks traffic and\n"
+            "ProcessMessage time (processtime, in microseconds) down by message type.");
 
     vector<CNodeStats> vstats;
     CopyNodeStats(vstats);
@@ -61,12 +81,41 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("inbound", stats.fInbound));
         obj.push_back(Pair("startingheight", stats.nStartingHeight));
         obj.push_back(Pair("banscore", stats.nMisbehavior));
+        obj.push_back(Pair("relaytxes", stats.fRelayTxes));
+        obj.push_back(Pair("filterchecks", (boost::int64_t)stats.nFilterChecks));
+        obj.push_back(Pair("filtertime", (boost::int64_t)stats.nFilterTimeMicros));
+        obj.push_back(Pair("bytessent", (boost::uint64_t)stats.nSendBytes));
+        obj.push_back(Pair("bytesrecv", (boost::uint64_t)stats.nRecvBytes));
+        obj.push_back(Pair("sendqueue", (boost::int64_t)stats.nSendSize));
+        obj.push_back(Pair("recvqueue", (boost::int64_t)stats.nRecvSize));
+        obj.push_back(Pair("processtime", (boost::int64_t)stats.nProcessMicros));
+        obj.push_back(Pair("messages", MsgCostToJSON(stats.mapMsgCost)));
 
         ret.push_back(obj);
     }
 
     return ret;
 }
+
+Value getnettotals(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getnettotals\n"
+            "Returns node-wide network traffic since startup: bytes in and out,\n"
+            "the current time, and per message type counts, bytes and\n"
+            "ProcessMessage time (processtime, in microseconds).");
+
+    map<string, CMessageCost> mapMsgCost;
+    CNode::GetTotalMsgCost(mapMsgCost);
+
+    Object obj;
+    obj.push_back(Pair("totalbytesrecv", (boost::uint64_t)CNode::GetTotalBytesRecv()));
+    obj.push_back(Pair("totalbytessent", (boost::uint64_t)CNode::GetTotalBytesSent()));
+    obj.push_back(Pair("timemillis", (boost::int64_t)GetTimeMillis()));
+    obj.push_back(Pair("messages", MsgCostToJSON(mapMsgCost)));
+    return obj;
+}
  
 // UtilityCoin: send alert.
 // There is a known deadlock situation with ThreadMessageHandler
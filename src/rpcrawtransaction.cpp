@@ -9,6 +9,7 @@
 #include "bitcoinrpc.h"
 #include "txdb.h"
 #include "init.h"
+#include "jsonwriter.h"
 #include "main.h"
 #include "net.h"
 #include "wallet.h"
@@ -44,6 +45,123 @@ void ScriptPubKeyToJSON(const CScript& scriptPubKey, Object& out, bool fIncludeH
     out.push_back(Pair("addresses", a));
 }
 
+// Streaming versions of the two encoders above write the members of the
+// currently open object, in the same order as the Object versions
+void ScriptPubKeyToJSON(const CScript& scriptPubKey, CJSONWriter& writer, bool fIncludeHex)
+{
+    txnouttype type;
+    vector<CTxDestination> addresses;
+    int nRequired;
+
+    writer.Key("asm");
+    writer.WriteString(scriptPubKey.ToString());
+
+    if (fIncludeHex)
+    {
+        writer.Key("hex");
+        writer.WriteHex(scriptPubKey.begin(), scriptPubKey.end());
+    }
+
+    if (!ExtractDestinations(scriptPubKey, type, addresses, nRequired))
+    {
+        writer.Key("type");
+        writer.WriteString(GetTxnOutputType(TX_NONSTANDARD));
+        return;
+    }
+
+    writer.Key("reqSigs");
+    writer.WriteInt(nRequired);
+    writer.Key("type");
+    writer.WriteString(GetTxnOutputType(type));
+
+    writer.Key("addresses");
+    writer.BeginArray();
+    BOOST_FOREACH(const CTxDestination& addr, addresses)
+        writer.WriteString(CBitcoinAddress(addr).ToString());
+    writer.EndArray();
+}
+
+void TxToJSON(const CTransaction& tx, const uint256 hashBlock, CJSONWriter& writer)
+{
+    writer.Key("txid");
+    writer.WriteString(tx.GetHash().GetHex());
+    writer.Key("version");
+    writer.WriteInt(tx.nVersion);
+    writer.Key("time");
+    writer.WriteInt(tx.nTime);
+    writer.Key("locktime");
+    writer.WriteInt(tx.nLockTime);
+    writer.Key("vin");
+    writer.BeginArray();
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        writer.BeginObject();
+        if (tx.IsCoinBase())
+        {
+            writer.Key("coinbase");
+            writer.WriteHex(txin.scriptSig.begin(), txin.scriptSig.end());
+        }
+        else
+        {
+            writer.Key("txid");
+            writer.WriteString(txin.prevout.hash.GetHex());
+            writer.Key("vout");
+            writer.WriteInt(txin.prevout.n);
+            writer.Key("scriptSig");
+            writer.BeginObject();
+            writer.Key("asm");
+            writer.WriteString(txin.scriptSig.ToString());
+            writer.Key("hex");
+            writer.WriteHex(txin.scriptSig.begin(), txin.scriptSig.end());
+            writer.EndObject();
+        }
+        writer.Key("sequence");
+        writer.WriteInt(txin.nSequence);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.Key("vout");
+    writer.BeginArray();
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        const CTxOut& txout = tx.vout[i];
+        writer.BeginObject();
+        writer.Key("value");
+        writer.WriteAmount(txout.nValue);
+        writer.Key("n");
+        writer.WriteInt(i);
+        writer.Key("scriptPubKey");
+        writer.BeginObject();
+        ScriptPubKeyToJSON(txout.scriptPubKey, writer, false);
+        writer.EndObject();
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    if (hashBlock != 0)
+    {
+        writer.Key("blockhash");
+        writer.WriteString(hashBlock.GetHex());
+        LOCK(cs_main);
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi != mapBlockIndex.end() && (*mi).second)
+        {
+            CBlockIndex* pindex = (*mi).second;
+            writer.Key("confirmations");
+            if (pindex->IsInMainChain())
+            {
+                writer.WriteInt(1 + nBestHeight - pindex->nHeight);
+                writer.Key("time");
+                writer.WriteInt(pindex->nTime);
+                writer.Key("blocktime");
+                writer.WriteInt(pindex->nTime);
+            }
+            else
+                writer.WriteInt(0);
+        }
+    }
+}
+
 void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
 {
     entry.push_back(Pair("txid", tx.GetHash().GetHex()));
@@ -86,6 +204,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
     if (hashBlock != 0)
     {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
+        LOCK(cs_main);
         map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end() && (*mi).second)
         {
@@ -102,6 +221,22 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
     }
 }
 
+// Parses getrawtransaction's parameters and fetches the transaction,
+// returns the verbose flag
+static bool LookupRawTransaction(const Array& params, CTransaction& tx, uint256& hashBlock)
+{
+    uint256 hash;
+    hash.SetHex(params[0].get_str());
+
+    bool fVerbose = false;
+    if (params.size() > 1)
+        fVerbose = (params[1].get_int() != 0);
+
+    if (!GetTransaction(hash, tx, hashBlock))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
+    return fVerbose;
+}
+
 Value getrawtransaction(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -112,17 +247,9 @@ Value getrawtransaction(const Array& params, bool fHelp)
             "If verbose is non-zero, returns an Object\n"
             "with information about <txid>.");
 
-    uint256 hash;
-    hash.SetHex(params[0].get_str());
-
-    bool fVerbose = false;
-    if (params.size() > 1)
-        fVerbose = (params[1].get_int() != 0);
-
     CTransaction tx;
     uint256 hashBlock = 0;
-    if (!GetTransaction(hash, tx, hashBlock))
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
+    bool fVerbose = LookupRawTransaction(params, tx, hashBlock);
 
     CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
     ssTx << tx;
@@ -137,6 +264,32 @@ Value getrawtransaction(const Array& params, bool fHelp)
     return result;
 }
 
+bool getrawtransaction_stream(const Array& params, CJSONWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 2)
+        return false;
+
+    CTransaction tx;
+    uint256 hashBlock = 0;
+    bool fVerbose = LookupRawTransaction(params, tx, hashBlock);
+
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+
+    if (!fVerbose)
+    {
+        writer.WriteHex(ssTx.begin(), ssTx.end());
+        return true;
+    }
+
+    writer.BeginObject();
+    writer.Key("hex");
+    writer.WriteHex(ssTx.begin(), ssTx.end());
+    TxToJSON(tx, hashBlock, writer);
+    writer.EndObject();
+    return true;
+}
+
 Value listunspent(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 3)
@@ -562,3 +715,200 @@ Value sendrawtransaction(const Array& params, bool fHelp)
 
     return hashTx.GetHex();
 }
+
+//
+// Address and spent-output index queries (-addressindex, -spentindex)
+//
+
+static string IndexAddressToString(int nAddressType, const uint160& hashBytes)
+{
+    if (nAddressType == ADDRESS_TYPE_SCRIPTHASH)
+        return CBitcoinAddress(CScriptID(hashBytes)).ToString();
+    return CBitcoinAddress(CKeyID(hashBytes)).ToString();
+}
+
+// Accepts "address" or {"addresses":["address",...]}
+static void ParseIndexAddresses(const Value& param, vector<pair<int, uint160> >& vAddresses)
+{
+    vector<string> vstrAddresses;
+    if (param.type() == str_type)
+        vstrAddresses.push_back(param.get_str());
+    else if (param.type() == obj_type)
+    {
+        const Value& addresses = find_value(param.get_obj(), "addresses");
+        if (addresses.type() != array_type)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "addresses must be an array");
+        BOOST_FOREACH(const Value& address, addresses.get_array())
+            vstrAddresses.push_back(address.get_str());
+    }
+    else
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected an address or an object");
+
+    BOOST_FOREACH(const string& strAddress, vstrAddresses)
+    {
+        CBitcoinAddress address(strAddress);
+        if (!address.IsValid())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, string("Invalid UtilityCoin address: ") + strAddress);
+        CTxDestination dest = address.Get();
+        if (const CKeyID* pkeyID = boost::get<CKeyID>(&dest))
+            vAddresses.push_back(make_pair((int)ADDRESS_TYPE_PUBKEYHASH, (uint160)*pkeyID));
+        else if (const CScriptID* pscriptID = boost::get<CScriptID>(&dest))
+            vAddresses.push_back(make_pair((int)ADDRESS_TYPE_SCRIPTHASH, (uint160)*pscriptID));
+    }
+}
+
+static void EnsureAddressIndex()
+{
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, restart with -addressindex");
+}
+
+static bool AddressIndexHeightLess(const pair<CAddressIndexKey, int64_t>& a, const pair<CAddressIndexKey, int64_t>& b)
+{
+    if (a.first.nHeight != b.first.nHeight)
+        return a.first.nHeight < b.first.nHeight;
+    return a.first.nTxIndex < b.first.nTxIndex;
+}
+
+Value getaddresstxids(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddresstxids <address> or {\"addresses\":[\"address\",...],\"start\":height,\"end\":height}\n"
+            "Returns the txids touching the addresses, in block order.\n"
+            "Requires -addressindex.");
+
+    EnsureAddressIndex();
+    vector<pair<int, uint160> > vAddresses;
+    ParseIndexAddresses(params[0], vAddresses);
+
+    int nStart = 0, nEnd = 0;
+    if (params[0].type() == obj_type)
+    {
+        const Value& start = find_value(params[0].get_obj(), "start");
+        const Value& end = find_value(params[0].get_obj(), "end");
+        if (start.type() == int_type && end.type() == int_type)
+        {
+            nStart = start.get_int();
+            nEnd = end.get_int();
+            if (nEnd < nStart)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "end must be at least start");
+        }
+    }
+
+    CTxDB txdb("r");
+    vector<pair<CAddressIndexKey, int64_t> > vEntries;
+    for (vector<pair<int, uint160> >::iterator it = vAddresses.begin(); it != vAddresses.end(); ++it)
+        if (!txdb.ReadAddressIndex(it->first, it->second, vEntries, nStart, nEnd))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+
+    // Entries come sorted per address, merge them into block order
+    if (vAddresses.size() > 1)
+        stable_sort(vEntries.begin(), vEntries.end(), AddressIndexHeightLess);
+
+    Array result;
+    set<uint256> setSeen;
+    for (vector<pair<CAddressIndexKey, int64_t> >::iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+        if (setSeen.insert(it->first.txhash).second)
+            result.push_back(it->first.txhash.GetHex());
+    return result;
+}
+
+Value getaddressbalance(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance <address> or {\"addresses\":[\"address\",...]}\n"
+            "Returns the balance and the total received of the addresses, in satoshis.\n"
+            "Requires -addressindex.");
+
+    EnsureAddressIndex();
+    vector<pair<int, uint160> > vAddresses;
+    ParseIndexAddresses(params[0], vAddresses);
+
+    CTxDB txdb("r");
+    int64_t nBalance = 0, nReceived = 0;
+    for (vector<pair<int, uint160> >::iterator it = vAddresses.begin(); it != vAddresses.end(); ++it)
+    {
+        vector<pair<CAddressIndexKey, int64_t> > vEntries;
+        if (!txdb.ReadAddressIndex(it->first, it->second, vEntries))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        for (vector<pair<CAddressIndexKey, int64_t> >::iterator ie = vEntries.begin(); ie != vEntries.end(); ++ie)
+        {
+            nBalance += ie->second;
+            if (ie->second > 0)
+                nReceived += ie->second;
+        }
+    }
+
+    Object result;
+    result.push_back(Pair("balance", (boost::int64_t)nBalance));
+    result.push_back(Pair("received", (boost::int64_t)nReceived));
+    return result;
+}
+
+Value getaddressutxos(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos <address> or {\"addresses\":[\"address\",...]}\n"
+            "Returns the confirmed unspent outputs of the addresses, amounts in satoshis.\n"
+            "Requires -addressindex.");
+
+    EnsureAddressIndex();
+    vector<pair<int, uint160> > vAddresses;
+    ParseIndexAddresses(params[0], vAddresses);
+
+    CTxDB txdb("r");
+    Array result;
+    for (vector<pair<int, uint160> >::iterator it = vAddresses.begin(); it != vAddresses.end(); ++it)
+    {
+        vector<pair<CAddressUnspentKey, CAddressUnspentValue> > vEntries;
+        if (!txdb.ReadAddressUnspentIndex(it->first, it->second, vEntries))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+
+        string strAddress = IndexAddressToString(it->first, it->second);
+        for (vector<pair<CAddressUnspentKey, CAddressUnspentValue> >::iterator iu = vEntries.begin(); iu != vEntries.end(); ++iu)
+        {
+            Object output;
+            output.push_back(Pair("address", strAddress));
+            output.push_back(Pair("txid", iu->first.txhash.GetHex()));
+            output.push_back(Pair("outputIndex", (boost::int64_t)iu->first.nIndex));
+            output.push_back(Pair("script", HexStr(iu->second.script.begin(), iu->second.script.end())));
+            output.push_back(Pair("satoshis", (boost::int64_t)iu->second.nValue));
+            output.push_back(Pair("height", iu->second.nHeight));
+            result.push_back(output);
+        }
+    }
+    return result;
+}
+
+Value getspentinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1 || params[0].type() != obj_type)
+        throw runtime_error(
+            "getspentinfo {\"txid\":\"txid\",\"index\":n}\n"
+            "Returns the txid and input number spending the output, and the block height.\n"
+            "Requires -spentindex.");
+
+    if (!fSpentIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Spent index not enabled, restart with -spentindex");
+
+    const Value& txid = find_value(params[0].get_obj(), "txid");
+    const Value& index = find_value(params[0].get_obj(), "index");
+    if (txid.type() != str_type || index.type() != int_type)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected txid and index");
+
+    uint256 hash;
+    hash.SetHex(txid.get_str());
+    CSpentIndexValue value;
+    CTxDB txdb("r");
+    if (!txdb.ReadSpentIndex(COutPoint(hash, index.get_int()), value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+
+    Object result;
+    result.push_back(Pair("txid", value.txid.GetHex()));
+    result.push_back(Pair("index", (boost::int64_t)value.nInputIndex));
+    result.push_back(Pair("height", value.nHeight));
+    return result;
+}
@@ -4,8 +4,6 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <boost/foreach.hpp>
-#include <boost/tuple/tuple.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
 using namespace std;
 using namespace boost;
@@ -18,27 +16,15 @@ using namespace boost;
 #include "sync.h"
 #include "util.h"
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool CheckSig(const CScriptValue& vchSig, const CScriptValue& vchPubKey, const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+              CSigBatch* pbatch = NULL, const CSigHashCache* psighashcache = NULL);
 
-static const valtype vchFalse(0);
-static const valtype vchZero(0);
-static const valtype vchTrue(1, 1);
-static const CBigNum bnZero(0);
-static const CBigNum bnOne(1);
-static const CBigNum bnFalse(0);
-static const CBigNum bnTrue(1);
-static const size_t nMaxNumSize = 4;
+static const unsigned char pchTrue[] = { 1 };
+static const CScriptValue vchFalse;
+static const CScriptValue vchTrue(pchTrue, pchTrue + 1);
 
 
-CBigNum CastToBigNum(const valtype& vch)
-{
-    if (vch.size() > nMaxNumSize)
-        throw runtime_error("CastToBigNum() : overflow");
-    // Get rid of extra leading zeros
-    return CBigNum(CBigNum(vch).getvch());
-}
-
-bool CastToBool(const valtype& vch)
+bool CastToBool(const CScriptValue& vch)
 {
     for (unsigned int i = 0; i < vch.size(); i++)
     {
@@ -53,41 +39,13 @@ bool CastToBool(const valtype& vch)
     return false;
 }
 
-//
-// WARNING: This does not work as expected for signed integers; the sign-bit
-// is left in place as the integer is zero-extended. The correct behavior
-// would be to move the most significant bit of the last byte during the
-// resize process. MakeSameSize() is currently only used by the disabled
-// opcodes OP_AND, OP_OR, and OP_XOR.
-//
-void MakeSameSize(valtype& vch1, valtype& vch2)
-{
-    // Lengthen the shorter one
-    if (vch1.size() < vch2.size())
-        // PATCH:
-        // +unsigned char msb = vch1[vch1.size()-1];
-        // +vch1[vch1.size()-1] &= 0x7f;
-        //  vch1.resize(vch2.size(), 0);
-        // +vch1[vch1.size()-1] = msb;
-        vch1.resize(vch2.size(), 0);
-    if (vch2.size() < vch1.size())
-        // PATCH:
-        // +unsigned char msb = vch2[vch2.size()-1];
-        // +vch2[vch2.size()-1] &= 0x7f;
-        //  vch2.resize(vch1.size(), 0);
-        // +vch2[vch2.size()-1] = msb;
-        vch2.resize(vch1.size(), 0);
-}
-
-
-
 //
 // Script is a stack machine (like Forth) that evaluates a predicate
 // returning a bool indicating valid or not.  There are no loops.
 //
 #define stacktop(i)  (stack.at(stack.size()+(i)))
 #define altstacktop(i)  (altstack.at(altstack.size()+(i)))
-static inline void popstack(vector<valtype>& stack)
+static inline void popstack(vector<CScriptValue>& stack)
 {
     if (stack.empty())
         throw runtime_error("popstack() : stack empty");
@@ -252,7 +210,7 @@ const char* GetOpName(opcodetype opcode)
     }
 }
 
-static bool IsCanonicalPubKey(const valtype &vchPubKey) {
+static bool IsCanonicalPubKey(const CScriptValue &vchPubKey) {
     if (vchPubKey.size() < 33)
         return error("Non-canonical public key: too short");
     if (vchPubKey[0] == 0x04) {
@@ -267,7 +225,7 @@ static bool IsCanonicalPubKey(const valtype &vchPubKey) {
     return true;
 }
 
-static bool IsCanonicalSignature(const valtype &vchSig) {
+static bool IsCanonicalSignature(const CScriptValue &vchSig) {
     // See https://bitcointalk.org/index.php?topic=8392.msg127623#msg127623
     // A canonical signature exists of: <30> <total len> <02> <len R> <R> <02> <len S> <S> <hashtype>
     // Where R and S are not negative (their first byte has its highest bit not set), and not
@@ -291,7 +249,7 @@ static bool IsCanonicalSignature(const valtype &vchSig) {
     if ((unsigned long)(nLenR+nLenS+7) != vchSig.size())
         return error("Non-canonical signature: R+S length mismatch");
 
-    const unsigned char *R = &vchSig[4];
+    const unsigned char *R = vchSig.begin() + 4;
     if (R[-2] != 0x02)
         return error("Non-canonical signature: R value type mismatch");
     if (nLenR == 0)
@@ -301,7 +259,7 @@ static bool IsCanonicalSignature(const valtype &vchSig) {
     if (nLenR > 1 && (R[0] == 0x00) && !(R[1] & 0x80))
         return error("Non-canonical signature: R value excessively padded");
 
-    const unsigned char *S = &vchSig[6+nLenR];
+    const unsigned char *S = vchSig.begin() + 6 + nLenR;
     if (S[-2] != 0x02)
         return error("Non-canonical signature: S value type mismatch");
     if (nLenS == 0)
@@ -320,16 +278,39 @@ static bool IsCanonicalSignature(const valtype &vchSig) {
     return true;
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType)
+// true if the bytes of vch occur anywhere in [pbegin, pend), an empty value
+// (pushed as OP_0) is taken to always occur
+static bool ContainsBytes(CScript::const_iterator pbegin, CScript::const_iterator pend, const CScriptValue& vch)
+{
+    return vch.empty() || search(pbegin, pend, vch.begin(), vch.end()) != pend;
+}
+
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                CSigBatch* pbatch, const CSigHashCache* psighashcache)
+{
+    vector<CScriptValue> stackValues;
+    stackValues.reserve(stack.size());
+    BOOST_FOREACH(const valtype& vch, stack)
+        stackValues.push_back(CScriptValue(vch));
+
+    bool fResult = EvalScript(stackValues, script, txTo, nIn, nHashType, pbatch, psighashcache);
+
+    stack.clear();
+    BOOST_FOREACH(const CScriptValue& vch, stackValues)
+        stack.push_back(vch.getvch());
+    return fResult;
+}
+
+bool EvalScript(vector<CScriptValue>& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                CSigBatch* pbatch, const CSigHashCache* psighashcache)
 {
-    CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
     valtype vchPushValue;
     vector<bool> vfExec;
-    vector<valtype> altstack;
+    vector<CScriptValue> altstack;
     if (script.size() > 10000)
         return false;
     int nOpCount = 0;
@@ -346,7 +327,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
             //
             if (!script.GetOp(pc, opcode, vchPushValue))
                 return false;
-            if (vchPushValue.size() > 520)
+            if (vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE)
                 return false;
             if (opcode > OP_16 && ++nOpCount > 201)
                 return false;
@@ -369,7 +350,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 return false;
 
             if (fExec && 0 <= opcode && opcode <= OP_PUSHDATA4)
-                stack.push_back(vchPushValue);
+                stack.push_back(CScriptValue(vchPushValue));
             else if (fExec || (OP_IF <= opcode && opcode <= OP_ENDIF))
             switch (opcode)
             {
@@ -395,8 +376,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_16:
                 {
                     // ( -- value)
-                    CBigNum bn((int)opcode - (int)(OP_1 - 1));
-                    stack.push_back(bn.getvch());
+                    CScriptNum bn((int)opcode - (int)(OP_1 - 1));
+                    stack.push_back(bn.getvalue());
                 }
                 break;
 
@@ -418,8 +399,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     {
                         if (stack.size() < 1)
                             return false;
-                        valtype& vch = stacktop(-1);
-                        fValue = CastToBool(vch);
+                        fValue = CastToBool(stacktop(-1));
                         if (opcode == OP_NOTIF)
                             fValue = !fValue;
                         popstack(stack);
@@ -501,8 +481,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
+                    CScriptValue vch1 = stacktop(-2);
+                    CScriptValue vch2 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -513,9 +493,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 -- x1 x2 x3 x1 x2 x3)
                     if (stack.size() < 3)
                         return false;
-                    valtype vch1 = stacktop(-3);
-                    valtype vch2 = stacktop(-2);
-                    valtype vch3 = stacktop(-1);
+                    CScriptValue vch1 = stacktop(-3);
+                    CScriptValue vch2 = stacktop(-2);
+                    CScriptValue vch3 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                     stack.push_back(vch3);
@@ -527,8 +507,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 -- x1 x2 x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return false;
-                    valtype vch1 = stacktop(-4);
-                    valtype vch2 = stacktop(-3);
+                    CScriptValue vch1 = stacktop(-4);
+                    CScriptValue vch2 = stacktop(-3);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -539,8 +519,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
                     if (stack.size() < 6)
                         return false;
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
+                    CScriptValue vch1 = stacktop(-6);
+                    CScriptValue vch2 = stacktop(-5);
                     stack.erase(stack.end()-6, stack.end()-4);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
@@ -562,7 +542,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x - 0 | x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     if (CastToBool(vch))
                         stack.push_back(vch);
                 }
@@ -571,8 +551,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_DEPTH:
                 {
                     // -- stacksize
-                    CBigNum bn(stack.size());
-                    stack.push_back(bn.getvch());
+                    CScriptNum bn(stack.size());
+                    stack.push_back(bn.getvalue());
                 }
                 break;
 
@@ -590,7 +570,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x -- x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     stack.push_back(vch);
                 }
                 break;
@@ -609,7 +589,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-2);
+                    CScriptValue vch = stacktop(-2);
                     stack.push_back(vch);
                 }
                 break;
@@ -621,11 +601,11 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (xn ... x2 x1 x0 n - ... x2 x1 x0 xn)
                     if (stack.size() < 2)
                         return false;
-                    int n = CastToBigNum(stacktop(-1)).getint();
+                    int n = CScriptNum(stacktop(-1)).getint();
                     popstack(stack);
                     if (n < 0 || n >= (int)stack.size())
                         return false;
-                    valtype vch = stacktop(-n-1);
+                    CScriptValue vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
                         stack.erase(stack.end()-n-1);
                     stack.push_back(vch);
@@ -658,126 +638,23 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     stack.insert(stack.end()-2, vch);
                 }
                 break;
 
 
                 //
-                // Splice ops
+                // Splice ops and bitwise logic, other than OP_SIZE and
+                // OP_EQUAL(VERIFY), are disabled and rejected above
                 //
-                case OP_CAT:
-                {
-                    // (x1 x2 -- out)
-                    if (stack.size() < 2)
-                        return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
-                    vch1.insert(vch1.end(), vch2.begin(), vch2.end());
-                    popstack(stack);
-                    if (stacktop(-1).size() > 520)
-                        return false;
-                }
-                break;
-
-                case OP_SUBSTR:
-                {
-                    // (in begin size -- out)
-                    if (stack.size() < 3)
-                        return false;
-                    valtype& vch = stacktop(-3);
-                    int nBegin = CastToBigNum(stacktop(-2)).getint();
-                    int nEnd = nBegin + CastToBigNum(stacktop(-1)).getint();
-                    if (nBegin < 0 || nEnd < nBegin)
-                        return false;
-                    if (nBegin > (int)vch.size())
-                        nBegin = vch.size();
-                    if (nEnd > (int)vch.size())
-                        nEnd = vch.size();
-                    vch.erase(vch.begin() + nEnd, vch.end());
-                    vch.erase(vch.begin(), vch.begin() + nBegin);
-                    popstack(stack);
-                    popstack(stack);
-                }
-                break;
-
-                case OP_LEFT:
-                case OP_RIGHT:
-                {
-                    // (in size -- out)
-                    if (stack.size() < 2)
-                        return false;
-                    valtype& vch = stacktop(-2);
-                    int nSize = CastToBigNum(stacktop(-1)).getint();
-                    if (nSize < 0)
-                        return false;
-                    if (nSize > (int)vch.size())
-                        nSize = vch.size();
-                    if (opcode == OP_LEFT)
-                        vch.erase(vch.begin() + nSize, vch.end());
-                    else
-                        vch.erase(vch.begin(), vch.end() - nSize);
-                    popstack(stack);
-                }
-                break;
-
                 case OP_SIZE:
                 {
                     // (in -- in size)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn(stacktop(-1).size());
-                    stack.push_back(bn.getvch());
-                }
-                break;
-
-
-                //
-                // Bitwise logic
-                //
-                case OP_INVERT:
-                {
-                    // (in - out)
-                    if (stack.size() < 1)
-                        return false;
-                    valtype& vch = stacktop(-1);
-                    for (unsigned int i = 0; i < vch.size(); i++)
-                        vch[i] = ~vch[i];
-                }
-                break;
-
-                //
-                // WARNING: These disabled opcodes exhibit unexpected behavior
-                // when used on signed integers due to a bug in MakeSameSize()
-                // [see definition of MakeSameSize() above].
-                //
-                case OP_AND:
-                case OP_OR:
-                case OP_XOR:
-                {
-                    // (x1 x2 - out)
-                    if (stack.size() < 2)
-                        return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
-                    MakeSameSize(vch1, vch2); // <-- NOT SAFE FOR SIGNED VALUES
-                    if (opcode == OP_AND)
-                    {
-                        for (unsigned int i = 0; i < vch1.size(); i++)
-                            vch1[i] &= vch2[i];
-                    }
-                    else if (opcode == OP_OR)
-                    {
-                        for (unsigned int i = 0; i < vch1.size(); i++)
-                            vch1[i] |= vch2[i];
-                    }
-                    else if (opcode == OP_XOR)
-                    {
-                        for (unsigned int i = 0; i < vch1.size(); i++)
-                            vch1[i] ^= vch2[i];
-                    }
-                    popstack(stack);
+                    CScriptNum bn(stacktop(-1).size());
+                    stack.push_back(bn.getvalue());
                 }
                 break;
 
@@ -788,9 +665,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 - bool)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
-                    bool fEqual = (vch1 == vch2);
+                    bool fEqual = (stacktop(-2) == stacktop(-1));
                     // OP_NOTEQUAL is disabled because it would be too easy to say
                     // something like n != 1 and have some wiseguy pass in 1 with extra
                     // zero bytes after it (numerically, 0x01 == 0x0001 == 0x000001)
@@ -815,8 +690,6 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 //
                 case OP_1ADD:
                 case OP_1SUB:
-                case OP_2MUL:
-                case OP_2DIV:
                 case OP_NEGATE:
                 case OP_ABS:
                 case OP_NOT:
@@ -825,31 +698,24 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- out)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn = CastToBigNum(stacktop(-1));
+                    CScriptNum bn(stacktop(-1));
                     switch (opcode)
                     {
-                    case OP_1ADD:       bn += bnOne; break;
-                    case OP_1SUB:       bn -= bnOne; break;
-                    case OP_2MUL:       bn <<= 1; break;
-                    case OP_2DIV:       bn >>= 1; break;
+                    case OP_1ADD:       bn = bn + CScriptNum(1); break;
+                    case OP_1SUB:       bn = bn - CScriptNum(1); break;
                     case OP_NEGATE:     bn = -bn; break;
-                    case OP_ABS:        if (bn < bnZero) bn = -bn; break;
-                    case OP_NOT:        bn = (bn == bnZero); break;
-                    case OP_0NOTEQUAL:  bn = (bn != bnZero); break;
+                    case OP_ABS:        if (bn < CScriptNum(0)) bn = -bn; break;
+                    case OP_NOT:        bn = CScriptNum(bn == CScriptNum(0)); break;
+                    case OP_0NOTEQUAL:  bn = CScriptNum(bn != CScriptNum(0)); break;
                     default:            assert(!"invalid opcode"); break;
                     }
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    stack.push_back(bn.getvalue());
                 }
                 break;
 
                 case OP_ADD:
                 case OP_SUB:
-                case OP_MUL:
-                case OP_DIV:
-                case OP_MOD:
-                case OP_LSHIFT:
-                case OP_RSHIFT:
                 case OP_BOOLAND:
                 case OP_BOOLOR:
                 case OP_NUMEQUAL:
@@ -865,9 +731,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- out)
                     if (stack.size() < 2)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-2));
-                    CBigNum bn2 = CastToBigNum(stacktop(-1));
-                    CBigNum bn;
+                    CScriptNum bn1(stacktop(-2));
+                    CScriptNum bn2(stacktop(-1));
+                    CScriptNum bn(0);
                     switch (opcode)
                     {
                     case OP_ADD:
@@ -878,49 +744,22 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         bn = bn1 - bn2;
                         break;
 
-                    case OP_MUL:
-                        if (!BN_mul(&bn, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_DIV:
-                        if (!BN_div(&bn, NULL, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_MOD:
-                        if (!BN_mod(&bn, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_LSHIFT:
-                        if (bn2 < bnZero || bn2 > CBigNum(2048))
-                            return false;
-                        bn = bn1 << bn2.getulong();
-                        break;
-
-                    case OP_RSHIFT:
-                        if (bn2 < bnZero || bn2 > CBigNum(2048))
-                            return false;
-                        bn = bn1 >> bn2.getulong();
-                        break;
-
-                    case OP_BOOLAND:             bn = (bn1 != bnZero && bn2 != bnZero); break;
-                    case OP_BOOLOR:              bn = (bn1 != bnZero || bn2 != bnZero); break;
-                    case OP_NUMEQUAL:            bn = (bn1 == bn2); break;
-                    case OP_NUMEQUALVERIFY:      bn = (bn1 == bn2); break;
-                    case OP_NUMNOTEQUAL:         bn = (bn1 != bn2); break;
-                    case OP_LESSTHAN:            bn = (bn1 < bn2); break;
-                    case OP_GREATERTHAN:         bn = (bn1 > bn2); break;
-                    case OP_LESSTHANOREQUAL:     bn = (bn1 <= bn2); break;
-                    case OP_GREATERTHANOREQUAL:  bn = (bn1 >= bn2); break;
+                    case OP_BOOLAND:             bn = CScriptNum(bn1 != CScriptNum(0) && bn2 != CScriptNum(0)); break;
+                    case OP_BOOLOR:              bn = CScriptNum(bn1 != CScriptNum(0) || bn2 != CScriptNum(0)); break;
+                    case OP_NUMEQUAL:            bn = CScriptNum(bn1 == bn2); break;
+                    case OP_NUMEQUALVERIFY:      bn = CScriptNum(bn1 == bn2); break;
+                    case OP_NUMNOTEQUAL:         bn = CScriptNum(bn1 != bn2); break;
+                    case OP_LESSTHAN:            bn = CScriptNum(bn1 < bn2); break;
+                    case OP_GREATERTHAN:         bn = CScriptNum(bn1 > bn2); break;
+                    case OP_LESSTHANOREQUAL:     bn = CScriptNum(bn1 <= bn2); break;
+                    case OP_GREATERTHANOREQUAL:  bn = CScriptNum(bn1 >= bn2); break;
                     case OP_MIN:                 bn = (bn1 < bn2 ? bn1 : bn2); break;
                     case OP_MAX:                 bn = (bn1 > bn2 ? bn1 : bn2); break;
                     default:                     assert(!"invalid opcode"); break;
                     }
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    stack.push_back(bn.getvalue());
 
                     if (opcode == OP_NUMEQUALVERIFY)
                     {
@@ -937,9 +776,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x min max -- out)
                     if (stack.size() < 3)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-3));
-                    CBigNum bn2 = CastToBigNum(stacktop(-2));
-                    CBigNum bn3 = CastToBigNum(stacktop(-1));
+                    CScriptNum bn1(stacktop(-3));
+                    CScriptNum bn2(stacktop(-2));
+                    CScriptNum bn3(stacktop(-1));
                     bool fValue = (bn2 <= bn1 && bn1 < bn3);
                     popstack(stack);
                     popstack(stack);
@@ -961,26 +800,25 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- hash)
                     if (stack.size() < 1)
                         return false;
-                    valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    CScriptValue& vch = stacktop(-1);
+                    CScriptValue vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
                     if (opcode == OP_RIPEMD160)
-                        RIPEMD160(&vch[0], vch.size(), &vchHash[0]);
+                        RIPEMD160(vch.begin(), vch.size(), vchHash.begin());
                     else if (opcode == OP_SHA1)
-                        SHA1(&vch[0], vch.size(), &vchHash[0]);
+                        SHA1(vch.begin(), vch.size(), vchHash.begin());
                     else if (opcode == OP_SHA256)
-                        SHA256(&vch[0], vch.size(), &vchHash[0]);
+                        SHA256(vch.begin(), vch.size(), vchHash.begin());
                     else if (opcode == OP_HASH160)
                     {
-                        uint160 hash160 = Hash160(vch);
-                        memcpy(&vchHash[0], &hash160, sizeof(hash160));
+                        uint160 hash160 = Hash160(vch.begin(), vch.end());
+                        memcpy(vchHash.begin(), &hash160, sizeof(hash160));
                     }
                     else if (opcode == OP_HASH256)
                     {
                         uint256 hash = Hash(vch.begin(), vch.end());
-                        memcpy(&vchHash[0], &hash, sizeof(hash));
+                        memcpy(vchHash.begin(), &hash, sizeof(hash));
                     }
-                    popstack(stack);
-                    stack.push_back(vchHash);
+                    vch = vchHash;
                 }
                 break;
 
@@ -998,21 +836,28 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if (stack.size() < 2)
                         return false;
 
-                    valtype& vchSig    = stacktop(-2);
-                    valtype& vchPubKey = stacktop(-1);
+                    CScriptValue& vchSig    = stacktop(-2);
+                    CScriptValue& vchPubKey = stacktop(-1);
 
                     ////// debug print
                     //PrintHex(vchSig.begin(), vchSig.end(), "sig: %s\n");
                     //PrintHex(vchPubKey.begin(), vchPubKey.end(), "pubkey: %s\n");
 
-                    // Subset of script starting at the most recent codeseparator
-                    CScript scriptCode(pbegincodehash, pend);
+                    // Subset of script starting at the most recent codeseparator,
+                    // the script itself unless that has to be copied
+                    CScript scriptCodeCopy;
+                    const CScript* pscriptCode = &script;
+                    if (pbegincodehash != script.begin() || ContainsBytes(pbegincodehash, pend, vchSig))
+                    {
+                        scriptCodeCopy = CScript(pbegincodehash, pend);
 
-                    // Drop the signature, since there's no way for a signature to sign itself
-                    scriptCode.FindAndDelete(CScript(vchSig));
+                        // Drop the signature, since there's no way for a signature to sign itself
+                        scriptCodeCopy.FindAndDelete(CScript(vchSig.getvch()));
+                        pscriptCode = &scriptCodeCopy;
+                    }
 
                     bool fSuccess = IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey) &&
-                        CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType);
+                        CheckSig(vchSig, vchPubKey, *pscriptCode, txTo, nIn, nHashType, pbatch, psighashcache);
 
                     popstack(stack);
                     popstack(stack);
@@ -1036,7 +881,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nKeysCount = CastToBigNum(stacktop(-i)).getint();
+                    int nKeysCount = CScriptNum(stacktop(-i)).getint();
                     if (nKeysCount < 0 || nKeysCount > 20)
                         return false;
                     nOpCount += nKeysCount;
@@ -1047,7 +892,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nSigsCount = CastToBigNum(stacktop(-i)).getint();
+                    int nSigsCount = CScriptNum(stacktop(-i)).getint();
                     if (nSigsCount < 0 || nSigsCount > nKeysCount)
                         return false;
                     int isig = ++i;
@@ -1055,25 +900,32 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    // Subset of script starting at the most recent codeseparator
-                    CScript scriptCode(pbegincodehash, pend);
-
-                    // Drop the signatures, since there's no way for a signature to sign itself
-                    for (int k = 0; k < nSigsCount; k++)
+                    // Subset of script starting at the most recent codeseparator,
+                    // as for OP_CHECKSIG
+                    CScript scriptCodeCopy;
+                    const CScript* pscriptCode = &script;
+                    bool fCopy = (pbegincodehash != script.begin());
+                    for (int k = 0; k < nSigsCount && !fCopy; k++)
+                        fCopy = ContainsBytes(pbegincodehash, pend, stacktop(-isig-k));
+                    if (fCopy)
                     {
-                        valtype& vchSig = stacktop(-isig-k);
-                        scriptCode.FindAndDelete(CScript(vchSig));
+                        scriptCodeCopy = CScript(pbegincodehash, pend);
+
+                        // Drop the signatures, since there's no way for a signature to sign itself
+                        for (int k = 0; k < nSigsCount; k++)
+                            scriptCodeCopy.FindAndDelete(CScript(stacktop(-isig-k).getvch()));
+                        pscriptCode = &scriptCodeCopy;
                     }
 
                     bool fSuccess = true;
                     while (fSuccess && nSigsCount > 0)
                     {
-                        valtype& vchSig    = stacktop(-isig);
-                        valtype& vchPubKey = stacktop(-ikey);
+                        CScriptValue& vchSig    = stacktop(-isig);
+                        CScriptValue& vchPubKey = stacktop(-ikey);
 
                         // Check signature
                         bool fOk = IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey) &&
-                            CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType);
+                            CheckSig(vchSig, vchPubKey, *pscriptCode, txTo, nIn, nHashType, NULL, psighashcache);
 
                         if (fOk)
                         {
@@ -1188,10 +1040,76 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
     }
 
     // Serialize and hash
-    CDataStream ss(SER_GETHASH, 0);
-    ss.reserve(10000);
+    CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
-    return Hash(ss.begin(), ss.end());
+    return ss.GetHash();
+}
+
+CSigHashCache::CSigHashCache(const CTransaction& txTo)
+{
+    CTransaction txTmp(txTo);
+    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+        txTmp.vin[i].scriptSig = CScript();
+
+    CDataStream ss(SER_GETHASH, 0);
+    ss << txTmp;
+    vchData.assign(ss.begin(), ss.end());
+
+    // a blanked input is its prevout, an empty script and nSequence
+    static const unsigned int nBlankedSize = 36 + 1 + 4;
+    unsigned int nPos = vchData.size() - sizeof(txTmp.nLockTime) - ::GetSerializeSize(txTmp.vout, SER_GETHASH, 0) -
+                        nBlankedSize * txTmp.vin.size();
+    vInputPos.resize(txTmp.vin.size());
+    vMidstate.resize(txTmp.vin.size());
+
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    unsigned int nHashed = 0;
+    for (unsigned int i = 0; i < txTmp.vin.size(); i++, nPos += nBlankedSize)
+    {
+        SHA256_Update(&ctx, &vchData[nHashed], nPos - nHashed);
+        nHashed = nPos;
+        vInputPos[i] = nPos;
+        vMidstate[i] = ctx;
+    }
+}
+
+bool CSigHashCache::SignatureHash(const CScript& scriptCodeIn, unsigned int nIn, int nHashType, uint256& hashRet) const
+{
+    // only SIGHASH_ALL leaves the other inputs and the outputs as they are
+    if ((nHashType & 0x1f) == SIGHASH_NONE || (nHashType & 0x1f) == SIGHASH_SINGLE || (nHashType & SIGHASH_ANYONECANPAY))
+        return false;
+    if (nIn >= vInputPos.size())
+        return false;
+
+    // Only a script with the byte in it can have a codeseparator to drop
+    CScript scriptCodeCopy;
+    const CScript* pscriptCode = &scriptCodeIn;
+    if (find(scriptCodeIn.begin(), scriptCodeIn.end(), (unsigned char)OP_CODESEPARATOR) != scriptCodeIn.end())
+    {
+        scriptCodeCopy = scriptCodeIn;
+        scriptCodeCopy.FindAndDelete(CScript(OP_CODESEPARATOR));
+        pscriptCode = &scriptCodeCopy;
+    }
+    const CScript& scriptCode = *pscriptCode;
+
+    // prevout, the script in place of the blank one, then the rest as cached
+    const unsigned char* pInput = &vchData[vInputPos[nIn]];
+    CFixedDataStream<9> ssSize(SER_GETHASH, 0);
+    WriteCompactSize(ssSize, scriptCode.size());
+
+    SHA256_CTX ctx = vMidstate[nIn];
+    SHA256_Update(&ctx, pInput, 36);
+    SHA256_Update(&ctx, ssSize.data(), ssSize.size());
+    if (!scriptCode.empty())
+        SHA256_Update(&ctx, &scriptCode[0], scriptCode.size());
+    SHA256_Update(&ctx, pInput + 37, vchData.size() - vInputPos[nIn] - 37);
+    SHA256_Update(&ctx, &nHashType, sizeof(nHashType));
+
+    uint256 hash1;
+    SHA256_Final((unsigned char*)&hash1, &ctx);
+    SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hashRet);
+    return true;
 }
 
 
@@ -1199,88 +1117,215 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
 // twice for every transaction (once when accepted into memory pool, and
 // again when accepted into the block chain)
 
-class CSignatureCache
+// Sized by AppInit2 from -maxsigcachesize
+CSignatureCache signatureCache;
+
+CSignatureCache::CSignatureCache(size_t nBytes)
 {
-private:
-     // sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, std::vector<unsigned char> > sigdata_type;
-    std::set< sigdata_type> setValid;
-    CCriticalSection cs_sigcache;
+    Resize(nBytes);
+}
 
-public:
-    bool
-    Get(uint256 hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& pubKey)
+void CSignatureCache::Resize(size_t nBytes)
+{
+    // Only called before the cache is in use, so the salt is never read
+    // while it changes
+    salt = GetRandHash();
+    size_t nBuckets = nBytes / (sizeof(uint256) * BUCKET_ENTRIES * SHARDS);
+    for (unsigned int i = 0; i < SHARDS; i++)
     {
-        LOCK(cs_sigcache);
-
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+        CShard& shard = shards[i];
+        LOCK(shard.cs);
+        shard.vEntries.assign(nBuckets * BUCKET_ENTRIES, 0);
+        shard.nEntries = 0;
+        shard.nHits = 0;
+        shard.nMisses = 0;
+        shard.nNextEvict = 0;
     }
+}
 
-    void Set(uint256 hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& pubKey)
-    {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
+uint256 CSignatureCache::EntryHash(const uint256& sighash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey) const
+{
+    // hashed outside the shard locks
+    uint256 entry;
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, salt.begin(), sizeof(salt));
+    SHA256_Update(&ctx, sighash.begin(), sizeof(sighash));
+    SHA256_Update(&ctx, vchPubKey.empty() ? NULL : &vchPubKey[0], vchPubKey.size());
+    SHA256_Update(&ctx, vchSig.empty() ? NULL : &vchSig[0], vchSig.size());
+    SHA256_Final(entry.begin(), &ctx);
+    return entry;
+}
+
+// The entry is already uniformly random, its words pick the shard and the bucket
+CSignatureCache::CShard& CSignatureCache::ShardFor(const uint256& entry, unsigned int& nBucketRet)
+{
+    nBucketRet = (unsigned int)(entry.Get64(1) >> 32);
+    return shards[entry.Get64(0) % SHARDS];
+}
 
-        LOCK(cs_sigcache);
+bool CSignatureCache::Get(const uint256& sighash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey)
+{
+    uint256 entry = EntryHash(sighash, vchSig, vchPubKey);
+    unsigned int nBucket;
+    CShard& shard = ShardFor(entry, nBucket);
 
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
+    LOCK(shard.cs);
+    if (shard.vEntries.empty())
+        return false;
+    unsigned int nFirst = (nBucket % (shard.vEntries.size() / BUCKET_ENTRIES)) * BUCKET_ENTRIES;
+    for (unsigned int i = nFirst; i < nFirst + BUCKET_ENTRIES; i++)
+    {
+        if (shard.vEntries[i] == entry)
         {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+            shard.nHits++;
+            return true;
         }
+    }
+    shard.nMisses++;
+    return false;
+}
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+void CSignatureCache::Set(const uint256& sighash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey)
+{
+    uint256 entry = EntryHash(sighash, vchSig, vchPubKey);
+    unsigned int nBucket;
+    CShard& shard = ShardFor(entry, nBucket);
+
+    LOCK(shard.cs);
+    if (shard.vEntries.empty())
+        return;
+    unsigned int nFirst = (nBucket % (shard.vEntries.size() / BUCKET_ENTRIES)) * BUCKET_ENTRIES;
+    for (unsigned int i = nFirst; i < nFirst + BUCKET_ENTRIES; i++)
+    {
+        if (shard.vEntries[i] == entry)
+            return;
+        if (shard.vEntries[i] == 0)
+        {
+            shard.vEntries[i] = entry;
+            shard.nEntries++;
+            return;
+        }
     }
-};
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType)
+    // Bucket full, overwrite one of its slots. Which bucket an entry lands
+    // in depends on the salt, so signatures pre-generated to crowd out
+    // others cannot be aimed at the same slots.
+    shard.vEntries[nFirst + shard.nNextEvict++ % BUCKET_ENTRIES] = entry;
+}
+
+void CSignatureCache::GetStats(uint64_t& nEntriesRet, uint64_t& nCapacityRet, uint64_t& nHitsRet, uint64_t& nMissesRet)
 {
-    static CSignatureCache signatureCache;
+    nEntriesRet = nCapacityRet = nHitsRet = nMissesRet = 0;
+    for (unsigned int i = 0; i < SHARDS; i++)
+    {
+        CShard& shard = shards[i];
+        LOCK(shard.cs);
+        nEntriesRet += shard.nEntries;
+        nCapacityRet += shard.vEntries.size();
+        nHitsRet += shard.nHits;
+        nMissesRet += shard.nMisses;
+    }
+}
 
+bool CheckSig(const CScriptValue& vchSigIn, const CScriptValue& vchPubKeyIn, const CScript& scriptCode,
+              const CTransaction& txTo, unsigned int nIn, int nHashType, CSigBatch* pbatch, const CSigHashCache* psighashcache)
+{
     // Hash type is one byte tacked on to the end of the signature
-    if (vchSig.empty())
+    if (vchSigIn.empty())
         return false;
     if (nHashType == 0)
-        nHashType = vchSig.back();
-    else if (nHashType != vchSig.back())
+        nHashType = vchSigIn.back();
+    else if (nHashType != vchSigIn.back())
         return false;
-    vchSig.pop_back();
+    valtype vchSig(vchSigIn.begin(), vchSigIn.end() - 1);
+    valtype vchPubKey(vchPubKeyIn.getvch());
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash;
+    if (!psighashcache || !psighashcache->SignatureHash(scriptCode, nIn, nHashType, sighash))
+        sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
 
-    if (signatureCache.Get(sighash, vchSig, vchPubKey))
+    // a cache hit would hide a backend disagreement
+    if (nSigBackend != SIG_BACKEND_CROSSCHECK && signatureCache.Get(sighash, vchSig, vchPubKey))
         return true;
 
-    CKey key;
-    if (!key.SetPubKey(vchPubKey))
-        return false;
+    if (pbatch)
+    {
+        pbatch->Add(sighash, vchSig, vchPubKey);
+        return true;
+    }
 
-    if (!key.Verify(sighash, vchSig))
+    if (!CPubKey(vchPubKey).Verify(sighash, vchSig))
         return false;
 
     signatureCache.Set(sighash, vchSig, vchPubKey);
     return true;
 }
 
+int nScriptCheckThreads = 0;
+
+// Below this many checks per thread starting threads costs more than it saves
+static const unsigned int MIN_SIG_BATCH_PER_THREAD = 16;
+
+void CSigBatch::BeginInput(const CTransaction& txTo, unsigned int nIn, const CScript& scriptPubKey)
+{
+    CInput input;
+    input.ptxTo = &txTo;
+    input.nIn = nIn;
+    input.scriptPubKey = scriptPubKey;
+    vInputs.push_back(input);
+}
+
+void CSigBatch::AbortInput()
+{
+    assert(!vInputs.empty());
+    unsigned int nInput = vInputs.size() - 1;
+    while (!vChecks.empty() && vChecks.back().nInput == nInput)
+        vChecks.pop_back();
+    vInputs.pop_back();
+}
+
+void CSigBatch::Add(const uint256& sighash, const vector<unsigned char>& vchSig, const vector<unsigned char>& vchPubKey)
+{
+    assert(!vInputs.empty());
+    CCheck check;
+    check.sighash = sighash;
+    check.vchSig = vchSig;
+    check.vchPubKey = vchPubKey;
+    check.nInput = vInputs.size() - 1;
+    vChecks.push_back(check);
+}
+
+void CSigBatch::VerifyRange(unsigned int nStart, unsigned int nStep, vector<char>* pvValid) const
+{
+    for (unsigned int i = nStart; i < vChecks.size(); i += nStep)
+        (*pvValid)[i] = CPubKey(vChecks[i].vchPubKey).Verify(vChecks[i].sighash, vChecks[i].vchSig);
+}
+
+bool CSigBatch::Verify(vector<unsigned int>& vFailedRet) const
+{
+    vFailedRet.clear();
+    vector<char> vValid(vChecks.size(), 0);
+
+    unsigned int nThreads = nScriptCheckThreads > 0 ? nScriptCheckThreads : boost::thread::hardware_concurrency();
+    nThreads = std::min(nThreads, (unsigned int)(vChecks.size() / MIN_SIG_BATCH_PER_THREAD));
+    if (nThreads <= 1)
+        VerifyRange(0, 1, &vValid);
+    else
+    {
+        boost::thread_group threads;
+        for (unsigned int i = 1; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CSigBatch::VerifyRange, this, i, nThreads, &vValid));
+        VerifyRange(0, nThreads, &vValid);
+        threads.join_all();
+    }
+
+    for (unsigned int i = 0; i < vChecks.size(); i++)
+        if (!vValid[i] && (vFailedRet.empty() || vFailedRet.back() != vChecks[i].nInput))
+            vFailedRet.push_back(vChecks[i].nInput);
+    return vFailedRet.empty();
+}
+
 
 
 
@@ -1292,6 +1337,99 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
 //
 // Return public keys or hashes from scriptPubKey, for 'standard' transaction types.
 //
+// The standard outputs as wallets write them, recognised byte for byte:
+// direct pushes of a 20 byte hash or of 33 or 65 byte public keys. The
+// matched data is left in place in the script. Solver's template matcher
+// also takes other push encodings and key sizes, so a script that is not
+// matched here still goes to it.
+class CStandardMatch
+{
+public:
+    txnouttype type;
+    unsigned int nRequired; // multisig only
+    unsigned int nData;
+    const unsigned char* vpData[16]; // the hash, or each public key
+    unsigned int vnDataSize[16];
+
+    valtype GetData(unsigned int i) const { return valtype(vpData[i], vpData[i] + vnDataSize[i]); }
+
+    uint160 GetHash160(unsigned int i) const
+    {
+        // a pushed hash is the ID, a public key is hashed to its ID
+        if (type == TX_PUBKEYHASH || type == TX_SCRIPTHASH)
+        {
+            uint160 hash;
+            memcpy(hash.begin(), vpData[i], sizeof(hash));
+            return hash;
+        }
+        return Hash160(vpData[i], vpData[i] + vnDataSize[i]);
+    }
+};
+
+static bool MatchStandard(const CScript& script, CStandardMatch& match)
+{
+    unsigned int nSize = script.size();
+    if (nSize == 0)
+        return false;
+    const unsigned char* p = &script[0];
+    match.nData = 0;
+
+    // OP_HASH160 <20 bytes> OP_EQUAL
+    if (script.IsPayToScriptHash())
+    {
+        match.type = TX_SCRIPTHASH;
+        match.vpData[0] = p + 2;
+        match.vnDataSize[0] = 20;
+        match.nData = 1;
+        return true;
+    }
+
+    // OP_DUP OP_HASH160 <20 bytes> OP_EQUALVERIFY OP_CHECKSIG
+    if (nSize == 25 && p[0] == OP_DUP && p[1] == OP_HASH160 && p[2] == 20 &&
+        p[23] == OP_EQUALVERIFY && p[24] == OP_CHECKSIG)
+    {
+        match.type = TX_PUBKEYHASH;
+        match.vpData[0] = p + 3;
+        match.vnDataSize[0] = 20;
+        match.nData = 1;
+        return true;
+    }
+
+    // <pubkey> OP_CHECKSIG
+    if (((nSize == 35 && p[0] == 33) || (nSize == 67 && p[0] == 65)) && p[nSize - 1] == OP_CHECKSIG)
+    {
+        match.type = TX_PUBKEY;
+        match.vpData[0] = p + 1;
+        match.vnDataSize[0] = p[0];
+        match.nData = 1;
+        return true;
+    }
+
+    // OP_m <pubkey> ... OP_n OP_CHECKMULTISIG
+    if (nSize >= 3 && p[0] >= OP_1 && p[0] <= OP_16 && p[nSize - 2] >= OP_1 && p[nSize - 2] <= OP_16 &&
+        p[nSize - 1] == OP_CHECKMULTISIG)
+    {
+        unsigned int nKeys = p[nSize - 2] - (OP_1 - 1);
+        unsigned int nPos = 1;
+        while (nPos < nSize - 2)
+        {
+            if ((p[nPos] != 33 && p[nPos] != 65) || nPos + 1 + p[nPos] > nSize - 2 || match.nData == nKeys)
+                return false;
+            match.vpData[match.nData] = p + nPos + 1;
+            match.vnDataSize[match.nData] = p[nPos];
+            match.nData++;
+            nPos += 1 + p[nPos];
+        }
+        match.nRequired = p[0] - (OP_1 - 1);
+        if (match.nData != nKeys || match.nRequired > nKeys)
+            return false;
+        match.type = TX_MULTISIG;
+        return true;
+    }
+
+    return false;
+}
+
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsigned char> >& vSolutionsRet)
 {
     // Templates
@@ -1318,6 +1456,20 @@ bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsi
         return true;
     }
 
+    CStandardMatch match;
+    if (MatchStandard(scriptPubKey, match))
+    {
+        typeRet = match.type;
+        vSolutionsRet.clear();
+        if (typeRet == TX_MULTISIG)
+            vSolutionsRet.push_back(valtype(1, (unsigned char)match.nRequired));
+        for (unsigned int i = 0; i < match.nData; i++)
+            vSolutionsRet.push_back(match.GetData(i));
+        if (typeRet == TX_MULTISIG)
+            vSolutionsRet.push_back(valtype(1, (unsigned char)match.nData));
+        return true;
+    }
+
     // Scan templates
     const CScript& script1 = scriptPubKey;
     BOOST_FOREACH(const PAIRTYPE(txnouttype, CScript)& tplate, mTemplates)
@@ -1499,6 +1651,13 @@ int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned c
 
 bool IsStandard(const CScript& scriptPubKey)
 {
+    CStandardMatch match;
+    if (MatchStandard(scriptPubKey, match))
+    {
+        // Support up to x-of-3 multisig txns as standard
+        return match.type != TX_MULTISIG || (match.nData <= 3 && match.nRequired >= 1);
+    }
+
     vector<valtype> vSolutions;
     txnouttype whichType;
     if (!Solver(scriptPubKey, whichType, vSolutions))
@@ -1550,6 +1709,33 @@ bool IsMine(const CKeyStore &keystore, const CTxDestination &dest)
 
 bool IsMine(const CKeyStore &keystore, const CScript& scriptPubKey)
 {
+    CStandardMatch match;
+    if (MatchStandard(scriptPubKey, match))
+    {
+        switch (match.type)
+        {
+        case TX_PUBKEY:
+        case TX_PUBKEYHASH:
+            return keystore.HaveKey(CKeyID(match.GetHash160(0)));
+        case TX_SCRIPTHASH:
+        {
+            CScript subscript;
+            if (!keystore.GetCScript(CScriptID(match.GetHash160(0)), subscript))
+                return false;
+            return IsMine(keystore, subscript);
+        }
+        case TX_MULTISIG:
+            // all the keys, as below
+            for (unsigned int i = 0; i < match.nData; i++)
+                if (!keystore.HaveKey(CKeyID(match.GetHash160(i))))
+                    return false;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Odd encodings of the standard forms
     vector<valtype> vSolutions;
     txnouttype whichType;
     if (!Solver(scriptPubKey, whichType, vSolutions))
@@ -1589,6 +1775,18 @@ bool IsMine(const CKeyStore &keystore, const CScript& scriptPubKey)
 
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet)
 {
+    CStandardMatch match;
+    if (MatchStandard(scriptPubKey, match))
+    {
+        if (match.type == TX_PUBKEY || match.type == TX_PUBKEYHASH)
+            addressRet = CKeyID(match.GetHash160(0));
+        else if (match.type == TX_SCRIPTHASH)
+            addressRet = CScriptID(match.GetHash160(0));
+        else
+            return false;
+        return true;
+    }
+
     vector<valtype> vSolutions;
     txnouttype whichType;
     if (!Solver(scriptPubKey, whichType, vSolutions))
@@ -1654,6 +1852,17 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
 {
     addressRet.clear();
     typeRet = TX_NONSTANDARD;
+
+    CStandardMatch match;
+    if (MatchStandard(scriptPubKey, match) && match.type == TX_MULTISIG)
+    {
+        typeRet = TX_MULTISIG;
+        nRequiredRet = match.nRequired;
+        for (unsigned int i = 0; i < match.nData; i++)
+            addressRet.push_back(CKeyID(match.GetHash160(i)));
+        return true;
+    }
+
     vector<valtype> vSolutions;
     if (!Solver(scriptPubKey, typeRet, vSolutions))
         return false;
@@ -1680,15 +1889,16 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
 }
 
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  int nHashType)
+                  int nHashType, CSigBatch* pbatch, const CSigHashCache* psighashcache)
 {
-    vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, nHashType))
+    vector<CScriptValue> stack, stackCopy;
+    if (!EvalScript(stack, scriptSig, txTo, nIn, nHashType, pbatch, psighashcache))
         return false;
 
-    stackCopy = stack;
+    if (scriptPubKey.IsPayToScriptHash())
+        stackCopy = stack;
 
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType, pbatch, psighashcache))
         return false;
     if (stack.empty())
         return false;
@@ -1702,11 +1912,11 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         if (!scriptSig.IsPushOnly()) // scriptSig must be literals-only
             return false;            // or validation fails
 
-        const valtype& pubKeySerialized = stackCopy.back();
+        const CScriptValue& pubKeySerialized = stackCopy.back();
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, nHashType, pbatch, psighashcache))
             return false;
         if (stackCopy.empty())
             return false;
@@ -1763,7 +1973,8 @@ bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTrans
     return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType);
 }
 
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType)
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                     CSigBatch* pbatch, const CSigHashCache* psighashcache)
 {
     assert(nIn < txTo.vin.size());
     const CTxIn& txin = txTo.vin[nIn];
@@ -1774,7 +1985,7 @@ bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsig
     if (txin.prevout.hash != txFrom.GetHash())
         return false;
 
-    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, nHashType);
+    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, nHashType, pbatch, psighashcache);
 }
 
 static CScript PushAll(const vector<valtype>& values)
@@ -1815,7 +2026,7 @@ static CScript CombineMultisig(CScript scriptPubKey, const CTransaction& txTo, u
             if (sigs.count(pubkey))
                 continue; // Already got a sig for this pubkey
 
-            if (CheckSig(sig, pubkey, scriptPubKey, txTo, nIn, 0))
+            if (CheckSig(CScriptValue(sig), CScriptValue(pubkey), scriptPubKey, txTo, nIn, 0))
             {
                 sigs[pubkey] = sig;
                 break;
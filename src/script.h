@@ -21,6 +21,8 @@ typedef std::vector<unsigned char> valtype;
 
 class CTransaction;
 
+static const unsigned int MAX_SCRIPT_ELEMENT_SIZE = 520; // bytes
+
 /** Signature hash types/flags */
 enum
 {
@@ -229,7 +231,147 @@ inline std::string StackString(const std::vector<std::vector<unsigned char> >& v
 
 
 
+/** An element of the script interpreter's stacks. Values up to INLINE_SIZE
+ *  bytes, which covers signatures, public keys, hashes and numbers, are
+ *  kept inside the element, so pushing, duplicating and dropping them does
+ *  not allocate. Longer ones (P2SH redeem scripts) go to the heap. */
+class CScriptValue
+{
+public:
+    static const unsigned int INLINE_SIZE = 76;
+
+    typedef const unsigned char* const_iterator;
+
+    CScriptValue() : nSize(0) { }
+    explicit CScriptValue(unsigned int nSizeIn) : nSize(0) { resize(nSizeIn); }
+    CScriptValue(const unsigned char* pbegin, const unsigned char* pend) : nSize(0) { assign(pbegin, pend - pbegin); }
+    explicit CScriptValue(const std::vector<unsigned char>& vch) : nSize(0) { assign(vch.empty() ? NULL : &vch[0], vch.size()); }
+    CScriptValue(const CScriptValue& b) : nSize(0) { assign(b.begin(), b.size()); }
+    ~CScriptValue() { if (nSize > INLINE_SIZE) delete[] pchHeap; }
+
+    CScriptValue& operator=(const CScriptValue& b)
+    {
+        if (this != &b)
+            assign(b.begin(), b.size());
+        return *this;
+    }
+
+    unsigned int size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+    const unsigned char* begin() const { return nSize > INLINE_SIZE ? pchHeap : pchInline; }
+    const unsigned char* end() const { return begin() + nSize; }
+    unsigned char* begin() { return nSize > INLINE_SIZE ? pchHeap : pchInline; }
+    unsigned char* end() { return begin() + nSize; }
+    unsigned char operator[](unsigned int i) const { return begin()[i]; }
+    unsigned char back() const { return begin()[nSize - 1]; }
+
+    std::vector<unsigned char> getvch() const { return std::vector<unsigned char>(begin(), end()); }
+
+    // Contents are left undefined
+    void resize(unsigned int nSizeIn)
+    {
+        if (nSize > INLINE_SIZE)
+            delete[] pchHeap;
+        nSize = 0;
+        if (nSizeIn > INLINE_SIZE)
+            pchHeap = new unsigned char[nSizeIn];
+        nSize = nSizeIn;
+    }
+
+    friend bool operator==(const CScriptValue& a, const CScriptValue& b)
+    {
+        return a.nSize == b.nSize && (a.nSize == 0 || memcmp(a.begin(), b.begin(), a.nSize) == 0);
+    }
+
+private:
+    unsigned int nSize;
+    union
+    {
+        unsigned char pchInline[INLINE_SIZE];
+        unsigned char* pchHeap;
+    };
+
+    void assign(const unsigned char* pch, unsigned int nSizeIn)
+    {
+        if (nSizeIn != nSize)
+            resize(nSizeIn);
+        if (nSizeIn)
+            memmove(begin(), pch, nSizeIn);
+    }
+};
+
+class scriptnum_error : public std::runtime_error
+{
+public:
+    explicit scriptnum_error(const std::string& str) : std::runtime_error(str) { }
+};
+
+/** Numeric operand of the arithmetic opcodes. Operands are at most 4 bytes
+ *  of little-endian sign and magnitude, so results (at most 5 bytes) fit
+ *  in 64 bits and the encoding is the same minimal one CBigNum produces,
+ *  without an OpenSSL BIGNUM per value. */
+class CScriptNum
+{
+public:
+    static const size_t MAX_SIZE = 4;
+
+    explicit CScriptNum(int64_t n) : nValue(n) { }
+
+    explicit CScriptNum(const CScriptValue& vch)
+    {
+        if (vch.size() > MAX_SIZE)
+            throw scriptnum_error("CScriptNum() : overflow");
+        nValue = 0;
+        for (unsigned int i = 0; i < vch.size(); i++)
+            nValue |= (int64_t)vch[i] << (8 * i);
+        // The most significant bit of the last byte is the sign
+        if (!vch.empty() && (vch.back() & 0x80))
+            nValue = -(nValue & ~((int64_t)0x80 << (8 * (vch.size() - 1))));
+    }
+
+    bool operator==(const CScriptNum& b) const { return nValue == b.nValue; }
+    bool operator!=(const CScriptNum& b) const { return nValue != b.nValue; }
+    bool operator<(const CScriptNum& b) const { return nValue < b.nValue; }
+    bool operator>(const CScriptNum& b) const { return nValue > b.nValue; }
+    bool operator<=(const CScriptNum& b) const { return nValue <= b.nValue; }
+    bool operator>=(const CScriptNum& b) const { return nValue >= b.nValue; }
+
+    CScriptNum operator+(const CScriptNum& b) const { return CScriptNum(nValue + b.nValue); }
+    CScriptNum operator-(const CScriptNum& b) const { return CScriptNum(nValue - b.nValue); }
+    CScriptNum operator-() const { return CScriptNum(-nValue); }
+
+    int getint() const
+    {
+        if (nValue > std::numeric_limits<int>::max())
+            return std::numeric_limits<int>::max();
+        if (nValue < std::numeric_limits<int>::min())
+            return std::numeric_limits<int>::min();
+        return (int)nValue;
+    }
+
+    CScriptValue getvalue() const
+    {
+        unsigned char pch[9];
+        unsigned int nSize = 0;
+        uint64_t nAbs = nValue < 0 ? -(uint64_t)nValue : nValue;
+        while (nAbs)
+        {
+            pch[nSize++] = nAbs & 0xff;
+            nAbs >>= 8;
+        }
+        // Room for the sign bit, in an extra byte if the top one is taken
+        if (nSize > 0 && (pch[nSize - 1] & 0x80))
+            pch[nSize++] = nValue < 0 ? 0x80 : 0;
+        else if (nValue < 0)
+            pch[nSize - 1] |= 0x80;
+        return CScriptValue(pch, pch + nSize);
+    }
+
+    std::vector<unsigned char> getvch() const { return getvalue().getvch(); }
 
+private:
+    int64_t nValue;
+};
 
 
 
@@ -590,7 +732,128 @@ public:
 
 
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/** A transaction's serialization as SignatureHash sees it with every
+ *  scriptSig blanked, plus the SHA-256 state at the start of each input.
+ *  The SIGHASH_ALL digest of an input then resumes from its midstate and
+ *  streams its own script and the cached tail, instead of copying and
+ *  re-serializing the whole transaction for every input. */
+class CSigHashCache
+{
+public:
+    explicit CSigHashCache(const CTransaction& txTo);
+
+    // false if nHashType is not one the cache covers, the caller falls
+    // back to ::SignatureHash
+    bool SignatureHash(const CScript& scriptCode, unsigned int nIn, int nHashType, uint256& hashRet) const;
+
+private:
+    std::vector<unsigned char> vchData;
+    std::vector<unsigned int> vInputPos;
+    std::vector<SHA256_CTX> vMidstate;
+};
+
+/** Signature checks put off by OP_CHECKSIG(VERIFY) so that all of a block's
+ *  can be verified together, spread over -par threads (see
+ *  CBlock::ConnectBlock). A queued check counts as good while its script
+ *  runs; an input with a check that turns out bad is run again on its own,
+ *  since its script may not have needed the signature to be valid. */
+class CSigBatch
+{
+public:
+    class CInput
+    {
+    public:
+        const CTransaction* ptxTo;
+        unsigned int nIn;
+        CScript scriptPubKey;
+    };
+
+    class CCheck
+    {
+    public:
+        uint256 sighash;
+        std::vector<unsigned char> vchSig;
+        std::vector<unsigned char> vchPubKey;
+        unsigned int nInput;
+    };
+
+    std::vector<CInput> vInputs;
+    std::vector<CCheck> vChecks;
+
+    // Checks queued from here on belong to input nIn of txTo, which must
+    // outlive the batch
+    void BeginInput(const CTransaction& txTo, unsigned int nIn, const CScript& scriptPubKey);
+    // Drop the current input and its checks, it is verified without the batch
+    void AbortInput();
+    void Add(const uint256& sighash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey);
+
+    bool empty() const { return vChecks.empty(); }
+
+    // Verify all queued checks, vFailedRet gets the inputs with a bad one
+    bool Verify(std::vector<unsigned int>& vFailedRet) const;
+
+private:
+    void VerifyRange(unsigned int nStart, unsigned int nStep, std::vector<char>* pvValid) const;
+};
+
+extern int nScriptCheckThreads;
+
+/** Signatures already found valid, so a transaction checked on its way into
+ *  the memory pool costs no ECDSA work when its block arrives. An entry is
+ *  the SHA-256 of a per-process random salt and (sighash, pubkey, sig), the
+ *  salt keeping peers from aiming entries at one bucket. Entries live in a
+ *  fixed table of four-slot buckets split over shards with a lock each, so
+ *  threads looking up different signatures rarely meet on a lock. */
+class CSignatureCache
+{
+public:
+    static const unsigned int SHARDS = 16;
+    static const unsigned int BUCKET_ENTRIES = 4;
+
+    // Starts empty, and so disabled, until Resize gives it room
+    CSignatureCache() {}
+    explicit CSignatureCache(size_t nBytes);
+
+    // Drops every entry and the counters and picks a new salt,
+    // nBytes == 0 disables the cache
+    void Resize(size_t nBytes);
+
+    bool Get(const uint256& sighash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey);
+    void Set(const uint256& sighash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey);
+
+    void GetStats(uint64_t& nEntriesRet, uint64_t& nCapacityRet, uint64_t& nHitsRet, uint64_t& nMissesRet);
+
+private:
+    class CShard
+    {
+    public:
+        CCriticalSection cs;
+        std::vector<uint256> vEntries; // an all-zero entry is an empty slot
+        uint64_t nEntries;
+        uint64_t nHits;
+        uint64_t nMisses;
+        unsigned int nNextEvict;
+
+        CShard() : nEntries(0), nHits(0), nMisses(0), nNextEvict(0) {}
+    };
+
+    uint256 salt;
+    CShard shards[SHARDS];
+
+    uint256 EntryHash(const uint256& sighash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey) const;
+    CShard& ShardFor(const uint256& entry, unsigned int& nBucketRet);
+};
+
+static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32; // MB
+static const unsigned int MAX_SIG_CACHE_SIZE = 4096; // MB
+
+extern CSignatureCache signatureCache;
+
+bool EvalScript(std::vector<CScriptValue>& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                CSigBatch* pbatch = NULL, const CSigHashCache* psighashcache = NULL);
+// Same, converting the stack to and from CScriptValue
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                CSigBatch* pbatch = NULL, const CSigHashCache* psighashcache = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey);
@@ -602,8 +865,9 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  int nHashType);
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType);
+                  int nHashType, CSigBatch* pbatch = NULL, const CSigHashCache* psighashcache = NULL);
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                     CSigBatch* pbatch = NULL, const CSigHashCache* psighashcache = NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
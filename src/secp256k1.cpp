@@ -0,0 +1,1019 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// Field normalization and the endomorphism split follow the approach of
+// Pieter Wuille's libsecp256k1 (MIT licensed).
+
+#include "secp256k1.h"
+
+#ifdef HAVE_SECP256K1_VERIFY
+
+#include <stdint.h>
+#include <string.h>
+
+typedef unsigned __int128 uint128_t;
+
+//
+// Field elements mod p = 2^256 - 2^32 - 977, as five 52 bit limbs (the top
+// one 48 bits). Limbs may run above their width between reductions: a
+// magnitude m element has limbs of at most 2*m*(2^52-1) (2*m*(2^48-1) for
+// the top one). fe_mul accepts up to magnitude 16 and returns magnitude 1.
+//
+struct fe
+{
+    uint64_t n[5];
+};
+
+static const uint64_t M52 = 0xFFFFFFFFFFFFFULL;
+static const uint64_t M48 = 0xFFFFFFFFFFFFULL;
+
+static inline void fe_set_int(fe& r, uint64_t a)
+{
+    r.n[0] = a;
+    r.n[1] = r.n[2] = r.n[3] = r.n[4] = 0;
+}
+
+// Fully reduce to the unique representative below p
+static void fe_normalize(fe& r)
+{
+    uint64_t t0 = r.n[0], t1 = r.n[1], t2 = r.n[2], t3 = r.n[3], t4 = r.n[4];
+
+    // fold everything above 2^256 back in, 2^256 = 0x1000003D1 mod p
+    uint64_t x = t4 >> 48; t4 &= M48;
+    t0 += x * 0x1000003D1ULL;
+    t1 += (t0 >> 52); t0 &= M52;
+    t2 += (t1 >> 52); t1 &= M52; uint64_t m = t1;
+    t3 += (t2 >> 52); t2 &= M52; m &= t2;
+    t4 += (t3 >> 52); t3 &= M52; m &= t3;
+
+    // at most one more 2^256 or a value in [p, 2^256) remains
+    x = (t4 >> 48) | ((t4 == M48) & (m == M52) & (t0 >= 0xFFFFEFFFFFC2FULL));
+    t0 += x * 0x1000003D1ULL;
+    t1 += (t0 >> 52); t0 &= M52;
+    t2 += (t1 >> 52); t1 &= M52;
+    t3 += (t2 >> 52); t2 &= M52;
+    t4 += (t3 >> 52); t3 &= M52;
+    t4 &= M48;
+
+    r.n[0] = t0; r.n[1] = t1; r.n[2] = t2; r.n[3] = t3; r.n[4] = t4;
+}
+
+// Bring back to magnitude 1 without the final comparison against p
+static void fe_normalize_weak(fe& r)
+{
+    uint64_t t0 = r.n[0], t1 = r.n[1], t2 = r.n[2], t3 = r.n[3], t4 = r.n[4];
+    uint64_t x = t4 >> 48; t4 &= M48;
+    t0 += x * 0x1000003D1ULL;
+    t1 += (t0 >> 52); t0 &= M52;
+    t2 += (t1 >> 52); t1 &= M52;
+    t3 += (t2 >> 52); t2 &= M52;
+    t4 += (t3 >> 52); t3 &= M52;
+    r.n[0] = t0; r.n[1] = t1; r.n[2] = t2; r.n[3] = t3; r.n[4] = t4;
+}
+
+static bool fe_normalizes_to_zero(const fe& a)
+{
+    fe t = a;
+    fe_normalize(t);
+    return (t.n[0] | t.n[1] | t.n[2] | t.n[3] | t.n[4]) == 0;
+}
+
+// Both normalized
+static inline bool fe_equal(const fe& a, const fe& b)
+{
+    return ((a.n[0] ^ b.n[0]) | (a.n[1] ^ b.n[1]) | (a.n[2] ^ b.n[2]) | (a.n[3] ^ b.n[3]) | (a.n[4] ^ b.n[4])) == 0;
+}
+
+static bool fe_equal_var(const fe& a, const fe& b)
+{
+    fe ta = a, tb = b;
+    fe_normalize(ta);
+    fe_normalize(tb);
+    return fe_equal(ta, tb);
+}
+
+// Normalized
+static inline bool fe_is_odd(const fe& a)
+{
+    return a.n[0] & 1;
+}
+
+// Big-endian, fails for values >= p
+static bool fe_set_b32(fe& r, const unsigned char* a)
+{
+    r.n[0] = r.n[1] = r.n[2] = r.n[3] = r.n[4] = 0;
+    for (int i = 0; i < 32; i++)
+    {
+        int nBit = 8 * (31 - i);
+        int nLimb = nBit / 52, nShift = nBit % 52;
+        r.n[nLimb] |= ((uint64_t)a[i] << nShift) & M52;
+        if (nShift > 44)
+            r.n[nLimb + 1] |= (uint64_t)a[i] >> (52 - nShift);
+    }
+    return !(r.n[4] == M48 && (r.n[3] & r.n[2] & r.n[1]) == M52 && r.n[0] >= 0xFFFFEFFFFFC2FULL);
+}
+
+static inline void fe_add(fe& r, const fe& a)
+{
+    r.n[0] += a.n[0]; r.n[1] += a.n[1]; r.n[2] += a.n[2]; r.n[3] += a.n[3]; r.n[4] += a.n[4];
+}
+
+static inline void fe_mul_int(fe& r, uint64_t a)
+{
+    r.n[0] *= a; r.n[1] *= a; r.n[2] *= a; r.n[3] *= a; r.n[4] *= a;
+}
+
+// r = -a for a of magnitude m, the result has magnitude m+1
+static inline void fe_negate(fe& r, const fe& a, uint64_t m)
+{
+    r.n[0] = 0xFFFFEFFFFFC2FULL * 2 * (m + 1) - a.n[0];
+    r.n[1] = 0xFFFFFFFFFFFFFULL * 2 * (m + 1) - a.n[1];
+    r.n[2] = 0xFFFFFFFFFFFFFULL * 2 * (m + 1) - a.n[2];
+    r.n[3] = 0xFFFFFFFFFFFFFULL * 2 * (m + 1) - a.n[3];
+    r.n[4] = 0x0FFFFFFFFFFFFULL * 2 * (m + 1) - a.n[4];
+}
+
+static void fe_mul(fe& r, const fe& a, const fe& b)
+{
+    // 2^260 = 0x1000003D10 mod p
+    const uint64_t R = 0x1000003D10ULL;
+    const uint64_t* pa = a.n;
+    const uint64_t* pb = b.n;
+
+    uint128_t c[9];
+    c[0] = (uint128_t)pa[0] * pb[0];
+    c[1] = (uint128_t)pa[0] * pb[1] + (uint128_t)pa[1] * pb[0];
+    c[2] = (uint128_t)pa[0] * pb[2] + (uint128_t)pa[1] * pb[1] + (uint128_t)pa[2] * pb[0];
+    c[3] = (uint128_t)pa[0] * pb[3] + (uint128_t)pa[1] * pb[2] + (uint128_t)pa[2] * pb[1] + (uint128_t)pa[3] * pb[0];
+    c[4] = (uint128_t)pa[0] * pb[4] + (uint128_t)pa[1] * pb[3] + (uint128_t)pa[2] * pb[2] + (uint128_t)pa[3] * pb[1] + (uint128_t)pa[4] * pb[0];
+    c[5] = (uint128_t)pa[1] * pb[4] + (uint128_t)pa[2] * pb[3] + (uint128_t)pa[3] * pb[2] + (uint128_t)pa[4] * pb[1];
+    c[6] = (uint128_t)pa[2] * pb[4] + (uint128_t)pa[3] * pb[3] + (uint128_t)pa[4] * pb[2];
+    c[7] = (uint128_t)pa[3] * pb[4] + (uint128_t)pa[4] * pb[3];
+    c[8] = (uint128_t)pa[4] * pb[4];
+
+    // carry into 52 bit limbs
+    uint64_t t[9];
+    uint128_t acc = 0;
+    for (int i = 0; i < 9; i++)
+    {
+        acc += c[i];
+        t[i] = (uint64_t)acc & M52;
+        acc >>= 52;
+    }
+    uint128_t t9 = acc;
+
+    // fold limbs 5..9 onto 0..4
+    uint64_t d[5];
+    acc = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        acc += (uint128_t)t[i] + (uint128_t)t[i + 5] * R;
+        d[i] = (uint64_t)acc & M52;
+        acc >>= 52;
+    }
+    acc += (uint128_t)t[4] + t9 * R;
+    d[4] = (uint64_t)acc & M52;
+    acc >>= 52;
+
+    // whatever lies above 2^256 once more
+    uint128_t top = (acc << 4) | (d[4] >> 48);
+    d[4] &= M48;
+    acc = (uint128_t)d[0] + top * 0x1000003D1ULL;
+    r.n[0] = (uint64_t)acc & M52; acc >>= 52;
+    acc += d[1]; r.n[1] = (uint64_t)acc & M52; acc >>= 52;
+    acc += d[2]; r.n[2] = (uint64_t)acc & M52; acc >>= 52;
+    acc += d[3]; r.n[3] = (uint64_t)acc & M52; acc >>= 52;
+    r.n[4] = d[4] + (uint64_t)acc;
+}
+
+static inline void fe_sqr(fe& r, const fe& a)
+{
+    fe_mul(r, a, a);
+}
+
+// a^(2^n)
+static inline void fe_sqr_n(fe& r, const fe& a, int n)
+{
+    r = a;
+    for (int i = 0; i < n; i++)
+        fe_sqr(r, r);
+}
+
+// a^(2^223 - 1) along with the shorter runs of ones the callers need
+static void fe_pow_x223(fe& x223, fe& x22, fe& x2, const fe& a)
+{
+    fe x3, x6, x9, x11, x44, x88, x176, x220, t;
+    fe_sqr(x2, a);            fe_mul(x2, x2, a);
+    fe_sqr(x3, x2);           fe_mul(x3, x3, a);
+    fe_sqr_n(t, x3, 3);       fe_mul(x6, t, x3);
+    fe_sqr_n(t, x6, 3);       fe_mul(x9, t, x3);
+    fe_sqr_n(t, x9, 2);       fe_mul(x11, t, x2);
+    fe_sqr_n(t, x11, 11);     fe_mul(x22, t, x11);
+    fe_sqr_n(t, x22, 22);     fe_mul(x44, t, x22);
+    fe_sqr_n(t, x44, 44);     fe_mul(x88, t, x44);
+    fe_sqr_n(t, x88, 88);     fe_mul(x176, t, x88);
+    fe_sqr_n(t, x176, 44);    fe_mul(x220, t, x44);
+    fe_sqr_n(t, x220, 3);     fe_mul(x223, t, x3);
+}
+
+// a^(p-2)
+static void fe_inv(fe& r, const fe& a)
+{
+    fe x223, x22, x2, t;
+    fe_pow_x223(x223, x22, x2, a);
+    fe_sqr_n(t, x223, 23);    fe_mul(t, t, x22);
+    fe_sqr_n(t, t, 5);        fe_mul(t, t, a);
+    fe_sqr_n(t, t, 3);        fe_mul(t, t, x2);
+    fe_sqr_n(t, t, 2);        fe_mul(r, t, a);
+}
+
+// a^((p+1)/4), a square root if there is one
+static bool fe_sqrt(fe& r, const fe& a)
+{
+    fe x223, x22, x2, t;
+    fe_pow_x223(x223, x22, x2, a);
+    fe_sqr_n(t, x223, 23);    fe_mul(t, t, x22);
+    fe_sqr_n(t, t, 6);        fe_mul(t, t, x2);
+    fe_sqr_n(r, t, 2);
+
+    fe_sqr(t, r);
+    return fe_equal_var(t, a);
+}
+
+// r[i] = 1/a[i], one inversion for the lot
+static void fe_inv_all(fe* r, const fe* a, int n)
+{
+    if (n == 0)
+        return;
+    r[0] = a[0];
+    for (int i = 1; i < n; i++)
+        fe_mul(r[i], r[i - 1], a[i]);
+    fe u;
+    fe_inv(u, r[n - 1]);
+    for (int i = n - 1; i > 0; i--)
+    {
+        fe_mul(r[i], r[i - 1], u);
+        fe_mul(u, u, a[i]);
+    }
+    r[0] = u;
+}
+
+//
+// Scalars mod the group order n, four 64 bit limbs, least significant first
+//
+struct scalar
+{
+    uint64_t d[4];
+};
+
+static const uint64_t N[4] = {0xBFD25E8CD0364141ULL, 0xBAAEDCE6AF48A03BULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL};
+// 2^256 - n
+static const uint64_t NC[3] = {0x402DA1732FC9BEBFULL, 0x4551231950B75FC4ULL, 1};
+// (n-1)/2
+static const uint64_t NH[4] = {0xDFE92F46681B20A0ULL, 0x5D576E7357A4501DULL, 0xFFFFFFFFFFFFFFFFULL, 0x7FFFFFFFFFFFFFFFULL};
+// p - n, an x coordinate below this has two candidates mod n
+static const uint64_t PMN[4] = {0x402DA1722FC9BAEEULL, 0x4551231950B75FC4ULL, 1, 0};
+
+static int cmp4(const uint64_t* a, const uint64_t* b)
+{
+    for (int i = 3; i >= 0; i--)
+    {
+        if (a[i] < b[i])
+            return -1;
+        if (a[i] > b[i])
+            return 1;
+    }
+    return 0;
+}
+
+// r = a - b, returns the borrow
+static uint64_t sub4(uint64_t* r, const uint64_t* a, const uint64_t* b)
+{
+    uint64_t nBorrow = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint128_t t = (uint128_t)a[i] - b[i] - nBorrow;
+        r[i] = (uint64_t)t;
+        nBorrow = (uint64_t)(t >> 64) & 1;
+    }
+    return nBorrow;
+}
+
+// r = a + b, returns the carry
+static uint64_t add4(uint64_t* r, const uint64_t* a, const uint64_t* b)
+{
+    uint128_t t = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        t += (uint128_t)a[i] + b[i];
+        r[i] = (uint64_t)t;
+        t >>= 64;
+    }
+    return (uint64_t)t;
+}
+
+static inline bool scalar_is_zero(const scalar& a)
+{
+    return (a.d[0] | a.d[1] | a.d[2] | a.d[3]) == 0;
+}
+
+// Big-endian, reduced mod n; fOverflow reports whether it had to be
+static void scalar_set_b32(scalar& r, const unsigned char* a, bool& fOverflow)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t v = 0;
+        for (int j = 0; j < 8; j++)
+            v = (v << 8) | a[(3 - i) * 8 + j];
+        r.d[i] = v;
+    }
+    fOverflow = cmp4(r.d, N) >= 0;
+    if (fOverflow)
+        sub4(r.d, r.d, N);
+}
+
+static void scalar_negate(scalar& r, const scalar& a)
+{
+    if (scalar_is_zero(a))
+        r = a;
+    else
+        sub4(r.d, N, a.d);
+}
+
+static void scalar_add(scalar& r, const scalar& a, const scalar& b)
+{
+    uint64_t nCarry = add4(r.d, a.d, b.d);
+    if (nCarry || cmp4(r.d, N) >= 0)
+        sub4(r.d, r.d, N);
+}
+
+// Reduce a little-endian number of up to 8 limbs mod n by folding the part
+// above 2^256 back in times 2^256 - n until it fits
+static void scalar_reduce(scalar& r, const uint64_t* l, int nLen)
+{
+    uint64_t t[9];
+    memset(t, 0, sizeof(t));
+    memcpy(t, l, nLen * sizeof(uint64_t));
+    while (nLen > 4)
+    {
+        uint64_t u[9];
+        memset(u, 0, sizeof(u));
+        memcpy(u, t, 4 * sizeof(uint64_t));
+        for (int i = 4; i < nLen; i++)
+        {
+            uint128_t nCarry = 0;
+            int j = 0;
+            for (; j < 3; j++)
+            {
+                uint128_t v = (uint128_t)t[i] * NC[j] + u[i - 4 + j] + nCarry;
+                u[i - 4 + j] = (uint64_t)v;
+                nCarry = v >> 64;
+            }
+            for (int k = i - 4 + j; nCarry != 0; k++)
+            {
+                uint128_t v = (uint128_t)u[k] + nCarry;
+                u[k] = (uint64_t)v;
+                nCarry = v >> 64;
+            }
+        }
+        memcpy(t, u, sizeof(t));
+        nLen = 9;
+        while (nLen > 4 && t[nLen - 1] == 0)
+            nLen--;
+    }
+    memcpy(r.d, t, sizeof(r.d));
+    if (cmp4(r.d, N) >= 0)
+        sub4(r.d, r.d, N);
+}
+
+static void mul4(uint64_t* l, const uint64_t* a, const uint64_t* b)
+{
+    memset(l, 0, 8 * sizeof(uint64_t));
+    for (int i = 0; i < 4; i++)
+    {
+        uint128_t nCarry = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            uint128_t v = (uint128_t)a[i] * b[j] + l[i + j] + nCarry;
+            l[i + j] = (uint64_t)v;
+            nCarry = v >> 64;
+        }
+        l[i + 4] = (uint64_t)nCarry;
+    }
+}
+
+static void scalar_mul(scalar& r, const scalar& a, const scalar& b)
+{
+    uint64_t l[8];
+    mul4(l, a.d, b.d);
+    scalar_reduce(r, l, 8);
+}
+
+static inline void shr1(uint64_t* a, int nLen)
+{
+    for (int i = 0; i < nLen - 1; i++)
+        a[i] = (a[i] >> 1) | (a[i + 1] << 63);
+    a[nLen - 1] >>= 1;
+}
+
+static inline bool is_one4(const uint64_t* a)
+{
+    return a[0] == 1 && (a[1] | a[2] | a[3]) == 0;
+}
+
+// x/2 mod n for x < n
+static inline void halve_mod_n(uint64_t* x)
+{
+    if (x[0] & 1)
+    {
+        uint64_t nCarry = add4(x, x, N);
+        shr1(x, 4);
+        x[3] |= nCarry << 63;
+    }
+    else
+        shr1(x, 4);
+}
+
+// Binary extended gcd, variable time (all inputs here are public), a != 0
+static void scalar_inverse_var(scalar& r, const scalar& a)
+{
+    uint64_t u[4], v[4], x1[4] = {1, 0, 0, 0}, x2[4] = {0, 0, 0, 0};
+    memcpy(u, a.d, sizeof(u));
+    memcpy(v, N, sizeof(v));
+    // x1 * a = u, x2 * a = v (mod n)
+    while (!is_one4(u) && !is_one4(v))
+    {
+        while (!(u[0] & 1))
+        {
+            shr1(u, 4);
+            halve_mod_n(x1);
+        }
+        while (!(v[0] & 1))
+        {
+            shr1(v, 4);
+            halve_mod_n(x2);
+        }
+        if (cmp4(u, v) >= 0)
+        {
+            sub4(u, u, v);
+            if (sub4(x1, x1, x2))
+                add4(x1, x1, N);
+        }
+        else
+        {
+            sub4(v, v, u);
+            if (sub4(x2, x2, x1))
+                add4(x2, x2, N);
+        }
+    }
+    memcpy(r.d, is_one4(u) ? x1 : x2, sizeof(r.d));
+}
+
+// round(a * g / 2^384)
+static void scalar_mul_shift_384(scalar& r, const scalar& a, const uint64_t* g)
+{
+    uint64_t l[8];
+    mul4(l, a.d, g);
+    uint64_t nRound = l[5] >> 63;
+    r.d[0] = l[6] + nRound;
+    r.d[1] = l[7] + (r.d[0] < nRound);
+    r.d[2] = r.d[3] = 0;
+}
+
+static inline int scalar_get_bits(const scalar& a, int nOffset, int nCount)
+{
+    int nLimb = nOffset >> 6, nShift = nOffset & 63;
+    if (nLimb > 3)
+        return 0;
+    uint64_t v = a.d[nLimb] >> nShift;
+    if (nShift + nCount > 64 && nLimb < 3)
+        v |= a.d[nLimb + 1] << (64 - nShift);
+    return (int)(v & ((1ULL << nCount) - 1));
+}
+
+//
+// Endomorphism: (x, y) -> (beta*x, y) multiplies a point by lambda. A scalar
+// k is split into k1 + k2*lambda with k1, k2 about 128 bits each.
+//
+static const scalar LAMBDA = {{0xDF02967C1B23BD72ULL, 0x122E22EA20816678ULL, 0xA5261C028812645AULL, 0x5363AD4CC05C30E0ULL}};
+static const uint64_t G1[4] = {0xE893209A45DBB031ULL, 0x3DAA8A1471E8CA7FULL, 0xE86C90E49284EB15ULL, 0x3086D221A7D46BCDULL};
+static const uint64_t G2[4] = {0x1571B4AE8AC47F71ULL, 0x221208AC9DF506C6ULL, 0x6F547FA90ABFE4C4ULL, 0xE4437ED6010E8828ULL};
+static const scalar MINUS_B1 = {{0x6F547FA90ABFE4C3ULL, 0xE4437ED6010E8828ULL, 0, 0}};
+static const scalar B2 = {{0xE86C90E49284EB15ULL, 0x3086D221A7D46BCDULL, 0, 0}};
+
+static void scalar_split_lambda(scalar& k1, scalar& k2, const scalar& k)
+{
+    scalar c1, c2, t;
+    scalar_mul_shift_384(c1, k, G1);
+    scalar_mul_shift_384(c2, k, G2);
+    // k2 = c1*(-b1) - c2*b2
+    scalar_mul(c1, c1, MINUS_B1);
+    scalar_mul(c2, c2, B2);
+    scalar_negate(c2, c2);
+    scalar_add(k2, c1, c2);
+    // k1 = k - k2*lambda
+    scalar_mul(t, k2, LAMBDA);
+    scalar_negate(t, t);
+    scalar_add(k1, k, t);
+}
+
+// Small signed values come out of the split as n - |k|
+static bool scalar_make_small(scalar& a)
+{
+    if (cmp4(a.d, NH) > 0)
+    {
+        scalar_negate(a, a);
+        return true;
+    }
+    return false;
+}
+
+// Width w non-adjacent form of a value below 2^nBits: digits are zero or odd
+// and below 2^(w-1) in absolute value, no two nonzero within w positions.
+// Returns the number of positions used.
+static int scalar_wnaf(int* pnaf, int nLen, const scalar& a, int w, int nSign)
+{
+    memset(pnaf, 0, nLen * sizeof(int));
+    int nLast = -1, nCarry = 0, nBit = 0;
+    while (nBit < nLen)
+    {
+        if (scalar_get_bits(a, nBit, 1) == nCarry)
+        {
+            nBit++;
+            continue;
+        }
+        int nNow = w;
+        if (nNow > nLen - nBit)
+            nNow = nLen - nBit;
+        int nWord = scalar_get_bits(a, nBit, nNow) + nCarry;
+        nCarry = (nWord >> (w - 1)) & 1;
+        nWord -= nCarry << w;
+        pnaf[nBit] = nSign * nWord;
+        nLast = nBit;
+        nBit += nNow;
+    }
+    return nLast + 1;
+}
+
+//
+// Points: affine (ge) and Jacobian (gej, x = X/Z^2, y = Y/Z^3). Coordinates
+// of stored points are kept at magnitude 1.
+//
+struct ge
+{
+    fe x, y;
+    bool fInfinity;
+};
+
+struct gej
+{
+    fe x, y, z;
+    bool fInfinity;
+};
+
+static void gej_set_ge(gej& r, const ge& a)
+{
+    r.x = a.x;
+    r.y = a.y;
+    fe_set_int(r.z, 1);
+    r.fInfinity = a.fInfinity;
+}
+
+static void ge_neg(ge& r, const ge& a)
+{
+    r.x = a.x;
+    fe_negate(r.y, a.y, 1);
+    fe_normalize_weak(r.y);
+    r.fInfinity = a.fInfinity;
+}
+
+static void gej_double(gej& r, const gej& a)
+{
+    if (a.fInfinity || fe_normalizes_to_zero(a.y))
+    {
+        r.fInfinity = true;
+        return;
+    }
+    fe t1, y2, s, y4, x3, y3, z3, t;
+    fe_mul(z3, a.y, a.z);
+    fe_mul_int(z3, 2);               // 2
+    fe_sqr(t1, a.x);
+    fe_mul_int(t1, 3);               // 3
+    fe_sqr(y2, a.y);
+    fe_mul(s, a.x, y2);
+    fe_mul_int(s, 4);                // 4
+    fe_sqr(y4, y2);
+    fe_mul_int(y4, 8);               // 8
+    // x3 = t1^2 - 2s
+    fe_sqr(x3, t1);
+    fe_negate(t, s, 4);
+    fe_mul_int(t, 2);                // 10
+    fe_add(x3, t);                   // 11
+    fe_normalize_weak(x3);
+    // y3 = t1*(s - x3) - 8y^4
+    fe_negate(t, x3, 1);
+    fe_add(t, s);                    // 6
+    fe_mul(y3, t1, t);
+    fe_negate(t, y4, 8);
+    fe_add(y3, t);                   // 10
+    fe_normalize_weak(y3);
+    fe_normalize_weak(z3);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+// Shared tail of the additions: u1, s1 from a, h = u2 - u1, i = s2 - s1
+static void gej_add_finish(gej& r, const fe& u1, const fe& s1, const fe& h, const fe& i, const fe& z3)
+{
+    fe h2, h3, t, x3, y3, n;
+    fe_sqr(h2, h);
+    fe_mul(h3, h, h2);
+    fe_mul(t, u1, h2);
+    // x3 = i^2 - h^3 - 2*u1*h^2
+    fe_sqr(x3, i);
+    fe_negate(n, h3, 1);
+    fe_add(x3, n);                   // 3
+    fe_negate(n, t, 1);
+    fe_mul_int(n, 2);
+    fe_add(x3, n);                   // 7
+    fe_normalize_weak(x3);
+    // y3 = i*(u1*h^2 - x3) - s1*h^3
+    fe_negate(n, x3, 1);
+    fe_add(n, t);                    // 3
+    fe_mul(y3, i, n);
+    fe_mul(t, s1, h3);
+    fe_negate(n, t, 1);
+    fe_add(y3, n);                   // 3
+    fe_normalize_weak(y3);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+static void gej_add_ge(gej& r, const gej& a, const ge& b)
+{
+    if (a.fInfinity)
+    {
+        gej_set_ge(r, b);
+        return;
+    }
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    fe z12, u2, s2, h, i, z3;
+    fe_sqr(z12, a.z);
+    fe_mul(u2, b.x, z12);
+    fe_mul(s2, b.y, z12);
+    fe_mul(s2, s2, a.z);
+    fe_negate(h, a.x, 1);
+    fe_add(h, u2);                   // 3
+    fe_negate(i, a.y, 1);
+    fe_add(i, s2);                   // 3
+    if (fe_normalizes_to_zero(h))
+    {
+        if (fe_normalizes_to_zero(i))
+            gej_double(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+    fe_mul(z3, a.z, h);
+    fe u1 = a.x, s1 = a.y;
+    gej_add_finish(r, u1, s1, h, i, z3);
+}
+
+static void gej_add(gej& r, const gej& a, const gej& b)
+{
+    if (a.fInfinity)
+    {
+        r = b;
+        return;
+    }
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    fe z12, z22, u1, u2, s1, s2, h, i, z3;
+    fe_sqr(z12, a.z);
+    fe_sqr(z22, b.z);
+    fe_mul(u1, a.x, z22);
+    fe_mul(u2, b.x, z12);
+    fe_mul(s1, a.y, z22);
+    fe_mul(s1, s1, b.z);
+    fe_mul(s2, b.y, z12);
+    fe_mul(s2, s2, a.z);
+    fe_negate(h, u1, 1);
+    fe_add(h, u2);
+    fe_negate(i, s1, 1);
+    fe_add(i, s2);
+    if (fe_normalizes_to_zero(h))
+    {
+        if (fe_normalizes_to_zero(i))
+            gej_double(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+    fe_mul(z3, a.z, b.z);
+    fe_mul(z3, z3, h);
+    gej_add_finish(r, u1, s1, h, i, z3);
+}
+
+// Convert to affine, none of the points may be infinity
+static void ge_set_all_gej(ge* r, const gej* a, int n)
+{
+    fe* pz = new fe[n];
+    fe* pzi = new fe[n];
+    for (int i = 0; i < n; i++)
+        pz[i] = a[i].z;
+    fe_inv_all(pzi, pz, n);
+    for (int i = 0; i < n; i++)
+    {
+        fe zi2, zi3;
+        fe_sqr(zi2, pzi[i]);
+        fe_mul(zi3, zi2, pzi[i]);
+        fe_mul(r[i].x, a[i].x, zi2);
+        fe_mul(r[i].y, a[i].y, zi3);
+        fe_normalize(r[i].x);
+        fe_normalize(r[i].y);
+        r[i].fInfinity = false;
+    }
+    delete[] pz;
+    delete[] pzi;
+}
+
+// pre[i] = (2i+1)*a as Jacobian points
+static void gej_odd_multiples(gej* pre, const gej& a, int n)
+{
+    gej d;
+    gej_double(d, a);
+    pre[0] = a;
+    for (int i = 1; i < n; i++)
+        gej_add(pre[i], pre[i - 1], d);
+}
+
+static inline void table_get(ge& r, const ge* pre, int nDigit)
+{
+    if (nDigit > 0)
+        r = pre[(nDigit - 1) / 2];
+    else
+        ge_neg(r, pre[(-nDigit - 1) / 2]);
+}
+
+//
+// Generator tables: odd multiples of G and of 2^128*G, built once at startup
+//
+static const int WINDOW_A = 5;
+static const int WINDOW_G = 12;
+static const int TABLE_SIZE_A = 1 << (WINDOW_A - 2);
+static const int TABLE_SIZE_G = 1 << (WINDOW_G - 2);
+
+static const unsigned char GX[32] = {
+    0x79, 0xBE, 0x66, 0x7E, 0xF9, 0xDC, 0xBB, 0xAC, 0x55, 0xA0, 0x62, 0x95, 0xCE, 0x87, 0x0B, 0x07,
+    0x02, 0x9B, 0xFC, 0xDB, 0x2D, 0xCE, 0x28, 0xD9, 0x59, 0xF2, 0x81, 0x5B, 0x16, 0xF8, 0x17, 0x98};
+static const unsigned char GY[32] = {
+    0x48, 0x3A, 0xDA, 0x77, 0x26, 0xA3, 0xC4, 0x65, 0x5D, 0xA4, 0xFB, 0xFC, 0x0E, 0x11, 0x08, 0xA8,
+    0xFD, 0x17, 0xB4, 0x48, 0xA6, 0x85, 0x54, 0x19, 0x9C, 0x47, 0xD0, 0x8F, 0xFB, 0x10, 0xD4, 0xB8};
+static const unsigned char BETA[32] = {
+    0x7A, 0xE9, 0x6A, 0x2B, 0x65, 0x7C, 0x07, 0x10, 0x6E, 0x64, 0x47, 0x9E, 0xAC, 0x34, 0x34, 0xE9,
+    0x9C, 0xF0, 0x49, 0x75, 0x12, 0xF5, 0x89, 0x95, 0xC1, 0x39, 0x6C, 0x28, 0x71, 0x95, 0x01, 0xEE};
+
+static fe feBeta;
+static ge preG[TABLE_SIZE_G];
+static ge preG128[TABLE_SIZE_G];
+
+class CSecp256k1Init
+{
+public:
+    CSecp256k1Init()
+    {
+        fe_set_b32(feBeta, BETA);
+
+        ge g;
+        fe_set_b32(g.x, GX);
+        fe_set_b32(g.y, GY);
+        g.fInfinity = false;
+
+        gej* pre = new gej[TABLE_SIZE_G];
+        gej a;
+        gej_set_ge(a, g);
+        gej_odd_multiples(pre, a, TABLE_SIZE_G);
+        ge_set_all_gej(preG, pre, TABLE_SIZE_G);
+
+        for (int i = 0; i < 128; i++)
+            gej_double(a, a);
+        gej_odd_multiples(pre, a, TABLE_SIZE_G);
+        ge_set_all_gej(preG128, pre, TABLE_SIZE_G);
+        delete[] pre;
+    }
+}
+instance_of_csecp256k1init;
+
+// r = na*a + ng*G
+static void ecmult(gej& r, const ge& a, const scalar& na, const scalar& ng)
+{
+    const int nLen = 130;
+    int wnaf1[nLen], wnaf2[nLen], wnafg[nLen], wnafg128[nLen];
+
+    scalar k1, k2;
+    scalar_split_lambda(k1, k2, na);
+    bool fNeg1 = scalar_make_small(k1);
+    bool fNeg2 = scalar_make_small(k2);
+    int nBits1 = scalar_wnaf(wnaf1, nLen, k1, WINDOW_A, fNeg1 ? -1 : 1);
+    int nBits2 = scalar_wnaf(wnaf2, nLen, k2, WINDOW_A, fNeg2 ? -1 : 1);
+
+    scalar g1, g128;
+    g1.d[0] = ng.d[0]; g1.d[1] = ng.d[1]; g1.d[2] = g1.d[3] = 0;
+    g128.d[0] = ng.d[2]; g128.d[1] = ng.d[3]; g128.d[2] = g128.d[3] = 0;
+    int nBitsG = scalar_wnaf(wnafg, nLen, g1, WINDOW_G, 1);
+    int nBitsG128 = scalar_wnaf(wnafg128, nLen, g128, WINDOW_G, 1);
+
+    // odd multiples of a and of lambda*a
+    ge preA[TABLE_SIZE_A], preLam[TABLE_SIZE_A];
+    gej preJ[TABLE_SIZE_A], aj;
+    gej_set_ge(aj, a);
+    gej_odd_multiples(preJ, aj, TABLE_SIZE_A);
+    ge_set_all_gej(preA, preJ, TABLE_SIZE_A);
+    for (int i = 0; i < TABLE_SIZE_A; i++)
+    {
+        fe_mul(preLam[i].x, preA[i].x, feBeta);
+        preLam[i].y = preA[i].y;
+        preLam[i].fInfinity = false;
+    }
+
+    int nBits = nBits1;
+    if (nBits2 > nBits) nBits = nBits2;
+    if (nBitsG > nBits) nBits = nBitsG;
+    if (nBitsG128 > nBits) nBits = nBitsG128;
+
+    r.fInfinity = true;
+    ge t;
+    for (int i = nBits - 1; i >= 0; i--)
+    {
+        gej_double(r, r);
+        if (i < nBits1 && wnaf1[i])
+        {
+            table_get(t, preA, wnaf1[i]);
+            gej_add_ge(r, r, t);
+        }
+        if (i < nBits2 && wnaf2[i])
+        {
+            table_get(t, preLam, wnaf2[i]);
+            gej_add_ge(r, r, t);
+        }
+        if (i < nBitsG && wnafg[i])
+        {
+            table_get(t, preG, wnafg[i]);
+            gej_add_ge(r, r, t);
+        }
+        if (i < nBitsG128 && wnafg128[i])
+        {
+            table_get(t, preG128, wnafg128[i]);
+            gej_add_ge(r, r, t);
+        }
+    }
+}
+
+//
+// Encodings
+//
+
+// One DER INTEGER as a scalar in [1, n-1]; advances pch
+static bool ParseDERScalar(scalar& r, const unsigned char*& pch, const unsigned char* pend)
+{
+    if (pend - pch < 2 || pch[0] != 0x02)
+        return false;
+    size_t nLen = pch[1];
+    pch += 2;
+    if (nLen == 0 || nLen > 33 || (size_t)(pend - pch) < nLen)
+        return false;
+    // no negative values, no unnecessary leading zero
+    if (pch[0] & 0x80)
+        return false;
+    if (nLen > 1 && pch[0] == 0 && !(pch[1] & 0x80))
+        return false;
+    if (nLen == 33)
+    {
+        if (pch[0] != 0)
+            return false;
+        pch++;
+        nLen--;
+    }
+    unsigned char buf[32];
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf + 32 - nLen, pch, nLen);
+    pch += nLen;
+    bool fOverflow;
+    scalar_set_b32(r, buf, fOverflow);
+    return !fOverflow && !scalar_is_zero(r);
+}
+
+static bool ParseDERSignature(scalar& r, scalar& s, const unsigned char* pchSig, size_t nSigLen)
+{
+    if (nSigLen < 8 || pchSig[0] != 0x30 || pchSig[1] != nSigLen - 2)
+        return false;
+    const unsigned char* pch = pchSig + 2;
+    const unsigned char* pend = pchSig + nSigLen;
+    if (!ParseDERScalar(r, pch, pend))
+        return false;
+    if (!ParseDERScalar(s, pch, pend))
+        return false;
+    return pch == pend;
+}
+
+static bool ParsePubKey(ge& r, const unsigned char* pch, size_t nLen)
+{
+    r.fInfinity = false;
+    if (nLen == 33 && (pch[0] == 0x02 || pch[0] == 0x03))
+    {
+        if (!fe_set_b32(r.x, pch + 1))
+            return false;
+        fe c;
+        fe_sqr(c, r.x);
+        fe_mul(c, c, r.x);
+        fe seven;
+        fe_set_int(seven, 7);
+        fe_add(c, seven);
+        if (!fe_sqrt(r.y, c))
+            return false;
+        fe_normalize(r.y);
+        if (fe_is_odd(r.y) != (pch[0] == 0x03))
+        {
+            fe_negate(r.y, r.y, 1);
+            fe_normalize(r.y);
+        }
+        return true;
+    }
+    if (nLen == 65 && (pch[0] == 0x04 || pch[0] == 0x06 || pch[0] == 0x07))
+    {
+        if (!fe_set_b32(r.x, pch + 1) || !fe_set_b32(r.y, pch + 33))
+            return false;
+        // hybrid keys repeat the parity of y in the prefix
+        if (pch[0] != 0x04 && fe_is_odd(r.y) != (pch[0] == 0x07))
+            return false;
+        fe y2, c, seven;
+        fe_sqr(y2, r.y);
+        fe_sqr(c, r.x);
+        fe_mul(c, c, r.x);
+        fe_set_int(seven, 7);
+        fe_add(c, seven);
+        return fe_equal_var(y2, c);
+    }
+    return false;
+}
+
+bool Secp256k1Verify(const unsigned char* pchHash, const unsigned char* pchSig, size_t nSigLen,
+                     const unsigned char* pchPubKey, size_t nPubKeyLen)
+{
+    scalar r, s;
+    if (!ParseDERSignature(r, s, pchSig, nSigLen))
+        return false;
+    ge q;
+    if (!ParsePubKey(q, pchPubKey, nPubKeyLen))
+        return false;
+
+    scalar e, w, u1, u2;
+    bool fOverflow;
+    scalar_set_b32(e, pchHash, fOverflow);
+    scalar_inverse_var(w, s);
+    scalar_mul(u1, e, w);
+    scalar_mul(u2, r, w);
+
+    // R = u2*Q + u1*G, valid if x(R) mod n == r
+    gej pr;
+    ecmult(pr, q, u2, u1);
+    if (pr.fInfinity)
+        return false;
+
+    // compare r*Z^2 with X rather than converting to affine
+    unsigned char buf[32];
+    for (int i = 0; i < 32; i++)
+        buf[i] = r.d[3 - i / 8] >> (56 - 8 * (i % 8));
+    fe xr, z2, t, x = pr.x;
+    fe_set_b32(xr, buf);
+    fe_sqr(z2, pr.z);
+    fe_normalize(x);
+    fe_mul(t, xr, z2);
+    fe_normalize(t);
+    if (fe_equal(t, x))
+        return true;
+    if (cmp4(r.d, PMN) >= 0)
+        return false;
+    uint64_t rn[4];
+    add4(rn, r.d, N);
+    for (int i = 0; i < 32; i++)
+        buf[i] = rn[3 - i / 8] >> (56 - 8 * (i % 8));
+    fe_set_b32(xr, buf);
+    fe_mul(t, xr, z2);
+    fe_normalize(t);
+    return fe_equal(t, x);
+}
+
+#endif
@@ -0,0 +1,36 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SECP256K1_H
+#define BITCOIN_SECP256K1_H
+
+#include <stddef.h>
+
+//
+// Dedicated ECDSA verification over secp256k1, used by CKey::Verify in place
+// of OpenSSL's generic curve code (see -sigbackend). Only verification lives
+// here: every input is public, signing and key recovery stay with OpenSSL.
+//
+// Field elements are 5x52 bit limbs multiplied with 128 bit intermediates,
+// the public key half of a verification is split with the curve's
+// endomorphism and the generator half uses tables built at startup.
+//
+// The arithmetic needs a 128 bit integer type, without one the module
+// compiles to nothing and OpenSSL remains the only backend.
+//
+#if defined(__SIZEOF_INT128__)
+#define HAVE_SECP256K1_VERIFY 1
+#endif
+
+#ifdef HAVE_SECP256K1_VERIFY
+
+/** Verify a DER encoded signature of the 32 byte big-endian digest pchHash
+ *  (as handed to ECDSA_verify) against a serialized public key. Accepts the
+ *  same encodings OpenSSL does: strict DER signatures with r and s in
+ *  [1, n-1], and compressed, uncompressed or hybrid public keys. */
+bool Secp256k1Verify(const unsigned char* pchHash, const unsigned char* pchSig, size_t nSigLen,
+                     const unsigned char* pchPubKey, size_t nPubKeyLen);
+
+#endif
+
+#endif
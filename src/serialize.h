@@ -25,6 +25,8 @@
 class CAutoFile;
 class CDataStream;
 class CScript;
+class uint160;
+class uint256;
 
 static const unsigned int MAX_SIZE = 0x02000000;
 
@@ -277,6 +279,18 @@ public:
     }
 };
 
+/** Marks a type whose serialized size never depends on its contents, such
+ * as a hash or an outpoint. Vectors of it are sized from the first element
+ * instead of visiting every one.
+ */
+template<typename T> struct CFixedSerializeSize { enum { value = 0 }; };
+
+#define IMPLEMENT_FIXED_SERIALIZE_SIZE(T) \
+    template<> struct CFixedSerializeSize<T> { enum { value = 1 }; };
+
+IMPLEMENT_FIXED_SERIALIZE_SIZE(uint160)
+IMPLEMENT_FIXED_SERIALIZE_SIZE(uint256)
+
 //
 // Forward declarations
 //
@@ -400,6 +414,8 @@ template<typename T, typename A>
 unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, const boost::false_type&)
 {
     unsigned int nSize = GetSizeOfCompactSize(v.size());
+    if (CFixedSerializeSize<T>::value)
+        return v.empty() ? nSize : nSize + v.size() * GetSerializeSize(v[0], nType, nVersion);
     for (typename std::vector<T, A>::const_iterator vi = v.begin(); vi != v.end(); ++vi)
         nSize += GetSerializeSize((*vi), nType, nVersion);
     return nSize;
@@ -705,15 +721,22 @@ struct ser_streamplaceholder
 
 
 
+typedef std::vector<char, zero_after_free_allocator<char> > CSerializeData;
+typedef std::vector<char, pool_allocator<char> > CPlainSerializeData;
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
  * Fills with data in linear time; some stringstream implementations take N^2 time.
+ *
+ * Derived is the stream type handed back by the operators, VectorType holds
+ * the data and decides whether it is cleared when freed.
  */
-class CDataStream
+template<typename Derived, typename VectorType>
+class CBaseDataStream
 {
 protected:
-    typedef std::vector<char, zero_after_free_allocator<char> > vector_type;
+    typedef VectorType vector_type;
     vector_type vch;
     unsigned int nReadPos;
     short state;
@@ -722,44 +745,44 @@ public:
     int nType;
     int nVersion;
 
-    typedef vector_type::allocator_type   allocator_type;
-    typedef vector_type::size_type        size_type;
-    typedef vector_type::difference_type  difference_type;
-    typedef vector_type::reference        reference;
-    typedef vector_type::const_reference  const_reference;
-    typedef vector_type::value_type       value_type;
-    typedef vector_type::iterator         iterator;
-    typedef vector_type::const_iterator   const_iterator;
-    typedef vector_type::reverse_iterator reverse_iterator;
-
-    explicit CDataStream(int nTypeIn, int nVersionIn)
+    typedef typename vector_type::allocator_type   allocator_type;
+    typedef typename vector_type::size_type        size_type;
+    typedef typename vector_type::difference_type  difference_type;
+    typedef typename vector_type::reference        reference;
+    typedef typename vector_type::const_reference  const_reference;
+    typedef typename vector_type::value_type       value_type;
+    typedef typename vector_type::iterator         iterator;
+    typedef typename vector_type::const_iterator   const_iterator;
+    typedef typename vector_type::reverse_iterator reverse_iterator;
+
+    explicit CBaseDataStream(int nTypeIn, int nVersionIn)
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
+    CBaseDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
     {
         Init(nTypeIn, nVersionIn);
     }
 
 #if !defined(_MSC_VER) || _MSC_VER >= 1300
-    CDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
+    CBaseDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
     {
         Init(nTypeIn, nVersionIn);
     }
 #endif
 
-    CDataStream(const vector_type& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    CBaseDataStream(const vector_type& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    CBaseDataStream(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : vch((char*)&vchIn.begin()[0], (char*)&vchIn.end()[0])
+    CBaseDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : vch((char*)&vchIn.begin()[0], (char*)&vchIn.end()[0])
     {
         Init(nTypeIn, nVersionIn);
     }
@@ -773,15 +796,15 @@ public:
         exceptmask = std::ios::badbit | std::ios::failbit;
     }
 
-    CDataStream& operator+=(const CDataStream& b)
+    Derived& operator+=(const Derived& b)
     {
         vch.insert(vch.end(), b.begin(), b.end());
-        return *this;
+        return static_cast<Derived&>(*this);
     }
 
-    friend CDataStream operator+(const CDataStream& a, const CDataStream& b)
+    friend Derived operator+(const Derived& a, const Derived& b)
     {
-        CDataStream ret = a;
+        Derived ret = a;
         ret += b;
         return (ret);
     }
@@ -893,6 +916,16 @@ public:
         nReadPos = 0;
     }
 
+    // Move the unread data out into data (appending), leaving the stream empty
+    void GetAndClear(vector_type &data)
+    {
+        if (nReadPos == 0 && data.empty())
+            vch.swap(data);
+        else
+            data.insert(data.end(), begin(), end());
+        clear();
+    }
+
     bool Rewind(size_type n)
     {
         // Rewind by n characters if the buffer hasn't been compacted yet
@@ -919,7 +952,7 @@ public:
     void clear(short n)          { state = n; }  // name conflict with vector clear()
     short exceptions()           { return exceptmask; }
     short exceptions(short mask) { short prev = exceptmask; exceptmask = mask; setstate(0, "CDataStream"); return prev; }
-    CDataStream* rdbuf()         { return this; }
+    Derived* rdbuf()             { return static_cast<Derived*>(this); }
     int in_avail()               { return size(); }
 
     void SetType(int n)          { nType = n; }
@@ -929,7 +962,7 @@ public:
     void ReadVersion()           { *this >> nVersion; }
     void WriteVersion()          { *this << nVersion; }
 
-    CDataStream& read(char* pch, int nSize)
+    Derived& read(char* pch, int nSize)
     {
         // Read from the beginning of the buffer
         assert(nSize >= 0);
@@ -945,14 +978,14 @@ public:
             memcpy(pch, &vch[nReadPos], nSize);
             nReadPos = 0;
             vch.clear();
-            return (*this);
+            return static_cast<Derived&>(*this);
         }
         memcpy(pch, &vch[nReadPos], nSize);
         nReadPos = nReadPosNext;
-        return (*this);
+        return static_cast<Derived&>(*this);
     }
 
-    CDataStream& ignore(int nSize)
+    Derived& ignore(int nSize)
     {
         // Ignore from the beginning of the buffer
         assert(nSize >= 0);
@@ -963,18 +996,22 @@ public:
                 setstate(std::ios::failbit, "CDataStream::ignore() : end of data");
             nReadPos = 0;
             vch.clear();
-            return (*this);
+            return static_cast<Derived&>(*this);
         }
         nReadPos = nReadPosNext;
-        return (*this);
+        return static_cast<Derived&>(*this);
     }
 
-    CDataStream& write(const char* pch, int nSize)
+    Derived& write(const char* pch, int nSize)
     {
-        // Write to the end of the buffer
+        // Write to the end of the buffer. Copied with memcpy: vector::insert
+        // with a pooled allocator copies byte by byte
         assert(nSize >= 0);
-        vch.insert(vch.end(), pch, pch + nSize);
-        return (*this);
+        size_type nOldSize = vch.size();
+        vch.resize(nOldSize + nSize);
+        if (nSize > 0)
+            memcpy(&vch[nOldSize], pch, nSize);
+        return static_cast<Derived&>(*this);
     }
 
     template<typename Stream>
@@ -993,18 +1030,110 @@ public:
     }
 
     template<typename T>
-    CDataStream& operator<<(const T& obj)
+    Derived& operator<<(const T& obj)
     {
         // Serialize to this stream
-        ::Serialize(*this, obj, nType, nVersion);
-        return (*this);
+        ::Serialize(static_cast<Derived&>(*this), obj, nType, nVersion);
+        return static_cast<Derived&>(*this);
     }
 
     template<typename T>
-    CDataStream& operator>>(T& obj)
+    Derived& operator>>(T& obj)
     {
         // Unserialize from this stream
-        ::Unserialize(*this, obj, nType, nVersion);
+        ::Unserialize(static_cast<Derived&>(*this), obj, nType, nVersion);
+        return static_cast<Derived&>(*this);
+    }
+};
+
+/** Stream for anything that may hold secrets, such as wallet records. Its
+ * buffer is cleared when freed.
+ */
+class CDataStream : public CBaseDataStream<CDataStream, CSerializeData>
+{
+    typedef CBaseDataStream<CDataStream, CSerializeData> base;
+public:
+    explicit CDataStream(int nTypeIn, int nVersionIn) : base(nTypeIn, nVersionIn) {}
+    CDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) : base(pbegin, pend, nTypeIn, nVersionIn) {}
+#if !defined(_MSC_VER) || _MSC_VER >= 1300
+    CDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) : base(pbegin, pend, nTypeIn, nVersionIn) {}
+#endif
+    CDataStream(const vector_type& vchIn, int nTypeIn, int nVersionIn) : base(vchIn, nTypeIn, nVersionIn) {}
+    CDataStream(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn) : base(vchIn, nTypeIn, nVersionIn) {}
+    CDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : base(vchIn, nTypeIn, nVersionIn) {}
+};
+
+/** The same stream for data that is public anyway, such as block and
+ * transaction index records. Its buffer is not cleared.
+ */
+class CPlainDataStream : public CBaseDataStream<CPlainDataStream, CPlainSerializeData>
+{
+    typedef CBaseDataStream<CPlainDataStream, CPlainSerializeData> base;
+public:
+    explicit CPlainDataStream(int nTypeIn, int nVersionIn) : base(nTypeIn, nVersionIn) {}
+    CPlainDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) : base(pbegin, pend, nTypeIn, nVersionIn) {}
+#if !defined(_MSC_VER) || _MSC_VER >= 1300
+    CPlainDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) : base(pbegin, pend, nTypeIn, nVersionIn) {}
+#endif
+    CPlainDataStream(const vector_type& vchIn, int nTypeIn, int nVersionIn) : base(vchIn, nTypeIn, nVersionIn) {}
+    CPlainDataStream(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn) : base(vchIn, nTypeIn, nVersionIn) {}
+    CPlainDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : base(vchIn, nTypeIn, nVersionIn) {}
+};
+
+/** Write-only stream into a fixed buffer on the stack, for database keys and
+ * other small records that are built and used in one place. Output past N
+ * bytes moves to the heap, so N only has to fit the usual case.
+ */
+template<unsigned int N>
+class CFixedDataStream
+{
+protected:
+    char buf[N];
+    unsigned int nSize;
+    std::vector<char> vchOverflow;
+public:
+    int nType;
+    int nVersion;
+
+    explicit CFixedDataStream(int nTypeIn, int nVersionIn) : nSize(0), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    const char* data() const     { return vchOverflow.empty() ? buf : &vchOverflow[0]; }
+    unsigned int size() const    { return nSize; }
+    bool empty() const           { return nSize == 0; }
+    std::string str() const      { return std::string(data(), nSize); }
+    void clear()                 { nSize = 0; vchOverflow.clear(); }
+
+    int GetType()                { return nType; }
+    int GetVersion()             { return nVersion; }
+
+    CFixedDataStream& write(const char* pch, int nWrite)
+    {
+        // Write to the end of the buffer
+        assert(nWrite >= 0);
+        if (vchOverflow.empty() && nSize + nWrite <= N)
+            memcpy(buf + nSize, pch, nWrite);
+        else
+        {
+            if (vchOverflow.empty())
+                vchOverflow.assign(buf, buf + nSize);
+            vchOverflow.insert(vchOverflow.end(), pch, pch + nWrite);
+        }
+        nSize += nWrite;
+        return (*this);
+    }
+
+    template<typename T>
+    unsigned int GetSerializeSize(const T& obj)
+    {
+        // Tells the size of the object if serialized to this stream
+        return ::GetSerializeSize(obj, nType, nVersion);
+    }
+
+    template<typename T>
+    CFixedDataStream& operator<<(const T& obj)
+    {
+        // Serialize to this stream
+        ::Serialize(*this, obj, nType, nVersion);
         return (*this);
     }
 };
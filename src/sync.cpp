@@ -7,6 +7,98 @@
 
 #include <boost/foreach.hpp>
 
+#include <algorithm>
+
+//
+// Lock profiling. Sites count into their own CLockSite with atomic adds so
+// threads never meet on a shared lock to record; the list of sites is only
+// walked by GetLockStats.
+//
+
+bool fLockStats = false;
+
+static boost::mutex mutexLockSites;
+static CLockSite* pLockSites = NULL;
+
+int64_t GetLockStatsMicros()
+{
+#ifdef WIN32
+    return GetTimeMicros();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static void RegisterLockSite(CLockSite* pSite)
+{
+    boost::unique_lock<boost::mutex> lock(mutexLockSites);
+    if (pSite->fRegistered)
+        return;
+    pSite->pnext = pLockSites;
+    pLockSites = pSite;
+    pSite->fRegistered = true;
+}
+
+static void RaiseMax(int64_t* pnMax, int64_t nValue)
+{
+    int64_t nMax = *pnMax;
+    while (nValue > nMax)
+    {
+        int64_t nPrev = __sync_val_compare_and_swap(pnMax, nMax, nValue);
+        if (nPrev == nMax)
+            break;
+        nMax = nPrev;
+    }
+}
+
+void LockSiteWaited(CLockSite* pSite, int64_t nMicros)
+{
+    __sync_fetch_and_add(&pSite->nContentions, 1);
+    __sync_fetch_and_add(&pSite->nWaitMicros, nMicros);
+    RaiseMax(&pSite->nMaxWaitMicros, nMicros);
+}
+
+void LockSiteReleased(CLockSite* pSite, int64_t nMicros)
+{
+    if (!pSite->fRegistered)
+        RegisterLockSite(pSite);
+    __sync_fetch_and_add(&pSite->nLocks, 1);
+    __sync_fetch_and_add(&pSite->nHoldMicros, nMicros);
+    RaiseMax(&pSite->nMaxHoldMicros, nMicros);
+}
+
+static bool CompareLockSiteWait(const CLockSite& a, const CLockSite& b)
+{
+    return a.nWaitMicros > b.nWaitMicros;
+}
+
+std::vector<CLockSite> GetLockStats()
+{
+    // Copies of the counters, most waited on first. The copies are read
+    // while other threads count, so the fields of a site may be a lock apart
+    std::vector<CLockSite> vSites;
+    {
+        boost::unique_lock<boost::mutex> lock(mutexLockSites);
+        for (CLockSite* pSite = pLockSites; pSite; pSite = pSite->pnext)
+            vSites.push_back(*pSite);
+    }
+    std::stable_sort(vSites.begin(), vSites.end(), CompareLockSiteWait);
+    return vSites;
+}
+
+void PrintLockStats()
+{
+    std::vector<CLockSite> vSites = GetLockStats();
+    printf("Lock statistics, %"PRIszu" sites, by time waited:\n", vSites.size());
+    printf("%10s %10s %12s %10s %12s %10s  %s\n", "locks", "contended", "wait ms", "max wait", "hold ms", "max hold", "lock");
+    BOOST_FOREACH(const CLockSite& site, vSites)
+        printf("%10"PRIu64" %10"PRIu64" %12.1f %10.1f %12.1f %10.1f  %s  %s:%d\n",
+               site.nLocks, site.nContentions, site.nWaitMicros * 0.001, site.nMaxWaitMicros * 0.001,
+               site.nHoldMicros * 0.001, site.nMaxHoldMicros * 0.001, site.pszName, site.pszFile, site.nLine);
+}
+
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 {
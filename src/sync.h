@@ -10,6 +10,8 @@
 #include <boost/thread/locks.hpp>
 #include <boost/thread/condition_variable.hpp>
 
+#include <stdint.h>
+#include <vector>
 
 
 
@@ -31,12 +33,68 @@ void static inline LeaveCritical() {}
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/** Counters for one LOCK, LOCK2 or TRY_LOCK site, kept while -lockstats is
+ * on. Each site is a static in the function that locks, so it needs no
+ * constructor and joins the list the first time it is counted.
+ */
+struct CLockSite
+{
+    const char* pszName;
+    const char* pszFile;
+    int nLine;
+    bool fRegistered;
+    CLockSite* pnext;
+    uint64_t nLocks;
+    uint64_t nContentions;
+    int64_t nWaitMicros;
+    int64_t nMaxWaitMicros;
+    int64_t nHoldMicros;
+    int64_t nMaxHoldMicros;
+};
+
+extern bool fLockStats;
+int64_t GetLockStatsMicros();
+void LockSiteWaited(CLockSite* pSite, int64_t nMicros);
+void LockSiteReleased(CLockSite* pSite, int64_t nMicros);
+std::vector<CLockSite> GetLockStats();
+void PrintLockStats();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template<typename Mutex>
 class CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    CLockSite* pSite;
+    int64_t nLockedMicros;
+
+    void EnterCounted()
+    {
+        // Only a lock that is not free right away pays for timing the wait
+        if (!lock.try_lock())
+        {
+#ifdef DEBUG_LOCKCONTENTION
+            PrintLockContention(pSite->pszName, pSite->pszFile, pSite->nLine);
+#endif
+            int64_t nWaitStart = GetLockStatsMicros();
+            lock.lock();
+            nLockedMicros = GetLockStatsMicros();
+            LockSiteWaited(pSite, nLockedMicros - nWaitStart);
+        }
+        else
+            nLockedMicros = GetLockStatsMicros();
+    }
+
+    void Released()
+    {
+        // nLockedMicros is 0 if -lockstats was off when this lock was taken
+        if (nLockedMicros != 0)
+        {
+            LockSiteReleased(pSite, GetLockStatsMicros() - nLockedMicros);
+            nLockedMicros = 0;
+        }
+    }
+
 public:
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
@@ -44,6 +102,11 @@ public:
         if (!lock.owns_lock())
         {
             EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+            if (pSite && fLockStats)
+            {
+                EnterCounted();
+                return;
+            }
 #ifdef DEBUG_LOCKCONTENTION
             if (!lock.try_lock())
             {
@@ -61,6 +124,7 @@ public:
         if (lock.owns_lock())
         {
             lock.unlock();
+            Released();
             LeaveCritical();
         }
     }
@@ -73,11 +137,14 @@ public:
             lock.try_lock();
             if (!lock.owns_lock())
                 LeaveCritical();
+            else if (pSite && fLockStats)
+                nLockedMicros = GetLockStatsMicros();
         }
         return lock.owns_lock();
     }
 
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, CLockSite* pSiteIn = NULL) :
+        lock(mutexIn, boost::defer_lock), pSite(pSiteIn), nLockedMicros(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -88,7 +155,11 @@ public:
     ~CMutexLock()
     {
         if (lock.owns_lock())
+        {
+            // Timed before the unique_lock member unlocks
+            Released();
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -104,9 +175,12 @@ public:
 
 typedef CMutexLock<CCriticalSection> CCriticalBlock;
 
-#define LOCK(cs) CCriticalBlock criticalblock(cs, #cs, __FILE__, __LINE__)
-#define LOCK2(cs1,cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__),criticalblock2(cs2, #cs2, __FILE__, __LINE__)
-#define TRY_LOCK(cs,name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
+#define LOCK_SITE(site,cs) static CLockSite site = { #cs, __FILE__, __LINE__, false, NULL, 0, 0, 0, 0, 0, 0 }
+
+#define LOCK(cs) LOCK_SITE(lockSite, cs); CCriticalBlock criticalblock(cs, #cs, __FILE__, __LINE__, false, &lockSite)
+#define LOCK2(cs1,cs2) LOCK_SITE(lockSite1, cs1); LOCK_SITE(lockSite2, cs2); \
+    CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__, false, &lockSite1),criticalblock2(cs2, #cs2, __FILE__, __LINE__, false, &lockSite2)
+#define TRY_LOCK(cs,name) LOCK_SITE(lockSite_##name, cs); CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true, &lockSite_##name)
 
 #define ENTER_CRITICAL_SECTION(cs) \
     { \
@@ -2,6 +2,7 @@
 // Unit tests for denial-of-service detection/prevention code
 //
 #include <algorithm>
+#include <limits>
 
 #include <boost/assign/list_of.hpp> // for 'map_list_of()'
 #include <boost/date_time/posix_time/posix_time_types.hpp>
@@ -16,10 +17,12 @@
 #include <stdint.h>
 
 // Tests this internal-to-main.cpp method:
-extern bool AddOrphanTx(const CDataStream& vMsg);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
-extern std::map<uint256, CDataStream*> mapOrphanTransactions;
-extern std::map<uint256, std::map<uint256, CDataStream*> > mapOrphanTransactionsByPrev;
+extern bool AddOrphanTx(const CTransaction& tx, const CService& addrFrom);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, uint64_t nMaxBytes);
+extern std::map<uint256, COrphanTx> mapOrphanTransactions;
+extern std::map<COutPoint, std::set<uint256> > mapOrphanTransactionsByPrev;
+extern std::set<std::pair<int64_t, uint256> > setOrphanTransactionsByExpiry;
+extern uint64_t nOrphanTransactionsSize;
 
 CService ip(uint32_t i)
 {
@@ -134,14 +137,11 @@ BOOST_AUTO_TEST_CASE(DoS_checknbits)
 
 CTransaction RandomOrphan()
 {
-    std::map<uint256, CDataStream*>::iterator it;
+    std::map<uint256, COrphanTx>::iterator it;
     it = mapOrphanTransactions.lower_bound(GetRandHash());
     if (it == mapOrphanTransactions.end())
         it = mapOrphanTransactions.begin();
-    const CDataStream* pvMsg = it->second;
-    CTransaction tx;
-    CDataStream(*pvMsg) >> tx;
-    return tx;
+    return it->second.tx;
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
@@ -163,9 +163,7 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
 
-        CDataStream ds(SER_DISK, CLIENT_VERSION);
-        ds << tx;
-        AddOrphanTx(ds);
+        AddOrphanTx(tx, ip(1));
     }
 
     // ... and 50 that depend on other orphans:
@@ -182,9 +180,7 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
         SignSignature(keystore, txPrev, tx, 0);
 
-        CDataStream ds(SER_DISK, CLIENT_VERSION);
-        ds << tx;
-        AddOrphanTx(ds);
+        AddOrphanTx(tx, ip(1));
     }
 
     // This really-big orphan should be ignored:
@@ -208,19 +204,37 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        CDataStream ds(SER_DISK, CLIENT_VERSION);
-        ds << tx;
-        BOOST_CHECK(!AddOrphanTx(ds));
+        BOOST_CHECK(!AddOrphanTx(tx, ip(1)));
     }
 
+    // Dependants are found by the outpoint they spend
+    CTransaction txParent = RandomOrphan();
+    BOOST_CHECK(mapOrphanTransactionsByPrev.count(txParent.vin[0].prevout));
+    BOOST_CHECK(mapOrphanTransactionsByPrev[txParent.vin[0].prevout].count(txParent.GetHash()));
+
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    LimitOrphanTxSize(40, std::numeric_limits<uint64_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+    LimitOrphanTxSize(10, std::numeric_limits<uint64_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+
+    // ... and by total size
+    uint64_t nSize = 0;
+    for (std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it)
+        nSize += it->second.nTxSize;
+    BOOST_CHECK_EQUAL(nOrphanTransactionsSize, nSize);
+    LimitOrphanTxSize(10, nSize / 2);
+    BOOST_CHECK(nOrphanTransactionsSize <= nSize / 2);
+    BOOST_CHECK(!mapOrphanTransactions.empty());
+
+    // Orphans whose parents never come expire
+    SetMockTime(GetTime() + ORPHAN_TX_EXPIRE_TIME + 1);
+    LimitOrphanTxSize(10, std::numeric_limits<uint64_t>::max());
+    SetMockTime(0);
     BOOST_CHECK(mapOrphanTransactions.empty());
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK(setOrphanTransactionsByExpiry.empty());
+    BOOST_CHECK_EQUAL(nOrphanTransactionsSize, 0U);
 }
 
 BOOST_AUTO_TEST_CASE(DoS_checkSig)
@@ -246,9 +260,7 @@ BOOST_AUTO_TEST_CASE(DoS_checkSig)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
 
-        CDataStream ds(SER_DISK, CLIENT_VERSION);
-        ds << tx;
-        AddOrphanTx(ds);
+        AddOrphanTx(tx, ip(1));
     }
 
     // Create a transaction that depends on orphans:
@@ -278,7 +290,7 @@ BOOST_AUTO_TEST_CASE(DoS_checkSig)
     mst1 = boost::posix_time::microsec_clock::local_time();
     for (unsigned int i = 0; i < 5; i++)
         for (unsigned int j = 0; j < tx.vin.size(); j++)
-            BOOST_CHECK(VerifySignature(orphans[j], tx, j, true, SIGHASH_ALL));
+            BOOST_CHECK(VerifySignature(orphans[j], tx, j, SIGHASH_ALL));
     mst2 = boost::posix_time::microsec_clock::local_time();
     msdiff = mst2 - mst1;
     long nManyValidate = msdiff.total_milliseconds();
@@ -289,26 +301,30 @@ BOOST_AUTO_TEST_CASE(DoS_checkSig)
     // Empty a signature, validation should fail:
     CScript save = tx.vin[0].scriptSig;
     tx.vin[0].scriptSig = CScript();
-    BOOST_CHECK(!VerifySignature(orphans[0], tx, 0, true, SIGHASH_ALL));
+    BOOST_CHECK(!VerifySignature(orphans[0], tx, 0, SIGHASH_ALL));
     tx.vin[0].scriptSig = save;
 
     // Swap signatures, validation should fail:
     std::swap(tx.vin[0].scriptSig, tx.vin[1].scriptSig);
-    BOOST_CHECK(!VerifySignature(orphans[0], tx, 0, true, SIGHASH_ALL));
-    BOOST_CHECK(!VerifySignature(orphans[1], tx, 1, true, SIGHASH_ALL));
+    BOOST_CHECK(!VerifySignature(orphans[0], tx, 0, SIGHASH_ALL));
+    BOOST_CHECK(!VerifySignature(orphans[1], tx, 1, SIGHASH_ALL));
     std::swap(tx.vin[0].scriptSig, tx.vin[1].scriptSig);
 
-    // Exercise -maxsigcachesize code:
-    mapArgs["-maxsigcachesize"] = "10";
-    // Generate a new, different signature for vin[0] to trigger cache clear:
-    CScript oldSig = tx.vin[0].scriptSig;
-    BOOST_CHECK(SignSignature(keystore, orphans[0], tx, 0));
-    BOOST_CHECK(tx.vin[0].scriptSig != oldSig);
-    for (unsigned int j = 0; j < tx.vin.size(); j++)
-        BOOST_CHECK(VerifySignature(orphans[j], tx, j, true, SIGHASH_ALL));
-    mapArgs.erase("-maxsigcachesize");
-
-    LimitOrphanTxSize(0);
+    // Shrink the cache to one bucket per shard, too small for 100 signatures,
+    // so some are evicted and have to be checked again:
+    signatureCache.Resize(sizeof(uint256) * CSignatureCache::BUCKET_ENTRIES * CSignatureCache::SHARDS);
+    for (unsigned int i = 0; i < 2; i++)
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
+            BOOST_CHECK(VerifySignature(orphans[j], tx, j, SIGHASH_ALL));
+    uint64_t nEntries, nCapacity, nHits, nMisses;
+    signatureCache.GetStats(nEntries, nCapacity, nHits, nMisses);
+    BOOST_CHECK_EQUAL(nCapacity, (uint64_t)CSignatureCache::BUCKET_ENTRIES * CSignatureCache::SHARDS);
+    BOOST_CHECK(nEntries <= nCapacity);
+    BOOST_CHECK(nHits <= nCapacity);
+    BOOST_CHECK(nMisses >= 200 - nCapacity);
+    signatureCache.Resize(DEFAULT_MAX_SIG_CACHE_SIZE * 1000000);
+
+    LimitOrphanTxSize(0, 0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
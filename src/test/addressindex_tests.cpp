@@ -0,0 +1,50 @@
+#include <boost/test/unit_test.hpp>
+
+#include "addressindex.h"
+#include "main.h"
+
+using namespace std;
+
+template<typename K>
+static string SerializeKey(const K& key)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << make_pair(string("addrtx"), key);
+    return ssKey.str();
+}
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+BOOST_AUTO_TEST_CASE(addressindex_key_order)
+{
+    // LevelDB iterates keys in byte order, an address' entries must come
+    // out by height and position in the block
+    uint160 hashBytes = 12345;
+    string strLow = SerializeKey(CAddressIndexKey(ADDRESS_TYPE_PUBKEYHASH, hashBytes, 255, 7, 1, 0, false));
+    string strHigh = SerializeKey(CAddressIndexKey(ADDRESS_TYPE_PUBKEYHASH, hashBytes, 256, 0, 0, 0, false));
+    string strLater = SerializeKey(CAddressIndexKey(ADDRESS_TYPE_PUBKEYHASH, hashBytes, 256, 1, 0, 0, true));
+    BOOST_CHECK(strLow < strHigh);
+    BOOST_CHECK(strHigh < strLater);
+
+    // the seek key sorts before every entry at or above its height
+    string strSeek = SerializeKey(CAddressIndexIteratorKey(ADDRESS_TYPE_PUBKEYHASH, hashBytes, 256));
+    BOOST_CHECK(strLow < strSeek);
+    BOOST_CHECK(strSeek < strHigh);
+
+    // round trip
+    CAddressIndexKey key(ADDRESS_TYPE_SCRIPTHASH, hashBytes, 1000000, 3, 99, 2, true);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    BOOST_CHECK_EQUAL(ss.size(), key.GetSerializeSize(SER_DISK, CLIENT_VERSION));
+    CAddressIndexKey key2;
+    ss >> key2;
+    BOOST_CHECK_EQUAL(key2.nAddressType, ADDRESS_TYPE_SCRIPTHASH);
+    BOOST_CHECK(key2.hashBytes == hashBytes);
+    BOOST_CHECK_EQUAL(key2.nHeight, 1000000);
+    BOOST_CHECK_EQUAL(key2.nTxIndex, 3U);
+    BOOST_CHECK(key2.txhash == 99);
+    BOOST_CHECK_EQUAL(key2.nIndex, 2U);
+    BOOST_CHECK(key2.fSpending);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -112,4 +112,74 @@ BOOST_AUTO_TEST_CASE(test_LockedPageManagerBase)
     BOOST_CHECK((last_unlock_len & (test_page_size-1)) == 0); // always unlock entire pages
 }
 
+// Empties this thread's free list for a size, so the next block freed is
+// the next one handed out
+static void DrainBufferPool(size_t nSize, std::vector<void*>& vHeld)
+{
+    for (unsigned int i = 0; i < CBufferPool::MAX_FREE; i++)
+        vHeld.push_back(CBufferPool::Allocate(nSize));
+}
+
+BOOST_AUTO_TEST_CASE(test_BufferPool)
+{
+    std::vector<void*> vHeld;
+    uint64_t nAllocs, nHeapAllocs, nZeroed, nAllocs2, nHeapAllocs2, nZeroed2;
+
+    // blocks are shared within a size class
+    DrainBufferPool(256, vHeld);
+    CBufferPool::GetStats(nAllocs, nHeapAllocs, nZeroed);
+    void* p = CBufferPool::Allocate(100);
+    CBufferPool::Free(p, 100, false);
+    BOOST_CHECK(CBufferPool::Allocate(200) == p);
+    CBufferPool::GetStats(nAllocs2, nHeapAllocs2, nZeroed2);
+    BOOST_CHECK_EQUAL(nAllocs2 - nAllocs, 2U);
+    BOOST_CHECK_EQUAL(nHeapAllocs2 - nHeapAllocs, 1U);
+    BOOST_CHECK_EQUAL(nZeroed2, nZeroed);
+    vHeld.push_back(p);
+
+    // and cleared on request
+    DrainBufferPool(1000, vHeld);
+    p = CBufferPool::Allocate(1000);
+    memset(p, 0xff, 1000);
+    CBufferPool::Free(p, 1000, true);
+    BOOST_CHECK(CBufferPool::Allocate(1000) == p);
+    BOOST_CHECK(std::vector<char>((char*)p, (char*)p + 1000) == std::vector<char>(1000, 0));
+    CBufferPool::GetStats(nAllocs, nHeapAllocs, nZeroed);
+    BOOST_CHECK_EQUAL(nZeroed - nZeroed2, 1000U);
+    CBufferPool::Free(p, 1000, false);
+
+    // past the largest class every block comes from the heap
+    CBufferPool::GetStats(nAllocs, nHeapAllocs, nZeroed);
+    for (int i = 0; i < 10; i++)
+        CBufferPool::Free(CBufferPool::Allocate(1000000), 1000000, false);
+    CBufferPool::GetStats(nAllocs2, nHeapAllocs2, nZeroed2);
+    BOOST_CHECK_EQUAL(nHeapAllocs2 - nHeapAllocs, 10U);
+
+    for (unsigned int i = 0; i < vHeld.size(); i++)
+        CBufferPool::Free(vHeld[i], i < CBufferPool::MAX_FREE + 1 ? 256 : 1000, false);
+}
+
+BOOST_AUTO_TEST_CASE(test_streams)
+{
+    // all three streams write the same bytes
+    std::vector<uint256> vHash(3, GetRandHash());
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << std::string("blockindex") << vHash;
+    CPlainDataStream ssPlain(SER_DISK, CLIENT_VERSION);
+    ssPlain << std::string("blockindex") << vHash;
+    CFixedDataStream<64> ssFixed(SER_DISK, CLIENT_VERSION);
+    ssFixed << std::string("blockindex");
+    ssFixed << vHash;
+    BOOST_CHECK_EQUAL(ssFixed.size(), 1U + 10 + 1 + 3 * 32);
+    BOOST_CHECK(ss.str() == ssPlain.str());
+    BOOST_CHECK(ss.str() == ssFixed.str());
+
+    // and a plain stream reads back what it wrote
+    std::string str;
+    std::vector<uint256> vHashRead;
+    ssPlain >> str >> vHashRead;
+    BOOST_CHECK(str == "blockindex" && vHashRead == vHash);
+    BOOST_CHECK(ssPlain.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,89 @@
+#include <boost/test/unit_test.hpp>
+
+#include "blockencodings.h"
+#include "hash.h"
+#include "main.h"
+
+using namespace std;
+
+static CBlock BuildBlock(unsigned int nTx)
+{
+    CBlock block;
+    block.nBits = 0x1e0fffff;
+    block.nTime = 1400000000;
+    for (unsigned int i = 0; i < nTx; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = i + 1;
+        tx.vin[0].prevout.n = i;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i * COIN;
+        block.vtx.push_back(tx);
+    }
+    block.vtx[0].vin[0].prevout.SetNull();
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    // SipHash-2-4 reference vector for the 32-byte message 00 01 .. 1f
+    uint256 val;
+    for (unsigned int i = 0; i < 32; i++)
+        ((unsigned char*)&val)[i] = i;
+    BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, val), 0x7127512f72f27cceULL);
+}
+
+BOOST_AUTO_TEST_CASE(roundtrip_missing_txns)
+{
+    CBlock block = BuildBlock(4);
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    BOOST_CHECK_EQUAL(cmpctblock.vPrefilledTxn.size(), 1U);
+    BOOST_CHECK_EQUAL(cmpctblock.vShortTxIDs.size(), 3U);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << cmpctblock;
+    CBlockHeaderAndShortTxIDs cmpctblock2;
+    ss >> cmpctblock2;
+    BOOST_CHECK(cmpctblock2.header.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(cmpctblock2.vShortTxIDs[1].nID, cmpctblock.GetShortID(block.vtx[2].GetHash()));
+
+    // Nothing is in the mempool, so everything but the coinbase is missing
+    CTxMemPool pool;
+    CPartialBlock partial;
+    BOOST_CHECK(partial.InitData(cmpctblock2, pool) == READ_STATUS_OK);
+    BOOST_CHECK(partial.IsTxAvailable(0));
+    vector<unsigned short> vMissing;
+    partial.GetMissing(vMissing);
+    BOOST_CHECK_EQUAL(vMissing.size(), 3U);
+
+    vector<CTransaction> vtxMissing;
+    CBlock block2;
+    BOOST_CHECK(partial.FillBlock(block2, vtxMissing) == READ_STATUS_INVALID);
+
+    for (unsigned int i = 0; i < vMissing.size(); i++)
+        vtxMissing.push_back(block.vtx[vMissing[i]]);
+    BOOST_CHECK(partial.FillBlock(block2, vtxMissing) == READ_STATUS_OK);
+    BOOST_CHECK(block2.GetHash() == block.GetHash());
+    BOOST_CHECK(block2.BuildMerkleTree() == block.hashMerkleRoot);
+
+    // Transactions in the wrong order don't match the merkle root
+    swap(vtxMissing[0], vtxMissing[1]);
+    BOOST_CHECK(partial.FillBlock(block2, vtxMissing) == READ_STATUS_FAILED);
+}
+
+BOOST_AUTO_TEST_CASE(invalid_prefilled)
+{
+    CBlock block = BuildBlock(2);
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    cmpctblock.vPrefilledTxn[0].nIndex = 2;
+
+    CTxMemPool pool;
+    CPartialBlock partial;
+    BOOST_CHECK(partial.InitData(cmpctblock, pool) == READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,155 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bloom.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+static CBlock BuildBlock(unsigned int nTx)
+{
+    CBlock block;
+    for (unsigned int i = 0; i < nTx; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = i + 1;
+        tx.vin[0].prevout.n = 0;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = (i + 1) * COIN;
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_SUITE(bloom_tests)
+
+BOOST_AUTO_TEST_CASE(bloom_create_insert_serialize)
+{
+    CBloomFilter filter(3, 0.01, 0, BLOOM_UPDATE_ALL);
+
+    filter.insert(ParseHex("99108ad8ed9bb6274d3980bab5a85c048f0950c8"));
+    BOOST_CHECK_MESSAGE( filter.contains(ParseHex("99108ad8ed9bb6274d3980bab5a85c048f0950c8")), "BloomFilter doesn't contain just-inserted object!");
+    // One bit different in first byte
+    BOOST_CHECK_MESSAGE(!filter.contains(ParseHex("19108ad8ed9bb6274d3980bab5a85c048f0950c8")), "BloomFilter contains something it shouldn't!");
+
+    filter.insert(ParseHex("b5a2c786d9ef4658287ced5914b37a1b4aa32eee"));
+    BOOST_CHECK_MESSAGE(filter.contains(ParseHex("b5a2c786d9ef4658287ced5914b37a1b4aa32eee")), "BloomFilter doesn't contain just-inserted object (2)!");
+
+    filter.insert(ParseHex("b9300670b4c5366e95b2699e8b18bc75e5f729c5"));
+    BOOST_CHECK_MESSAGE(filter.contains(ParseHex("b9300670b4c5366e95b2699e8b18bc75e5f729c5")), "BloomFilter doesn't contain just-inserted object (3)!");
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << filter;
+
+    vector<unsigned char> vch = ParseHex("03614e9b050000000000000001");
+    vector<char> expected(vch.size());
+
+    for (unsigned int i = 0; i < vch.size(); i++)
+        expected[i] = (char)vch[i];
+
+    BOOST_CHECK_EQUAL_COLLECTIONS(stream.begin(), stream.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(bloom_empty_data)
+{
+    // A filter deserialized without any data must not divide by zero
+    CDataStream stream(ParseHex("00000000000000000000"), SER_NETWORK, PROTOCOL_VERSION);
+    CBloomFilter filter;
+    stream >> filter;
+    filter.UpdateEmptyFull();
+    filter.insert(ParseHex("00"));
+    BOOST_CHECK(filter.contains(ParseHex("00")));
+}
+
+BOOST_AUTO_TEST_CASE(pmt_test1)
+{
+    static const unsigned int nTxCounts[] = {1, 4, 7, 17, 56, 100, 127, 256, 312, 513, 1000, 4095};
+
+    for (int n = 0; n < 12; n++) {
+        unsigned int nTx = nTxCounts[n];
+
+        // build a block with some dummy transactions
+        CBlock block = BuildBlock(nTx);
+        uint256 merkleRoot1 = block.hashMerkleRoot;
+        std::vector<uint256> vTxid(nTx, 0);
+        for (unsigned int j=0; j<nTx; j++)
+            vTxid[j] = block.vtx[j].GetHash();
+        int nHeight = 1, nTx_ = nTx;
+        while (nTx_ > 1) {
+            nTx_ = (nTx_+1)/2;
+            nHeight++;
+        }
+
+        // check with random subsets with inclusion chances 1, 1/2, 1/4, ..., 1/128
+        for (int att = 1; att < 15; att++) {
+            // build random subset of txid's
+            std::vector<bool> vMatch(nTx, false);
+            std::vector<uint256> vMatchTxid1;
+            for (unsigned int j=0; j<nTx; j++) {
+                bool fInclude = (GetRandInt(1 << (att/2)) == 0);
+                vMatch[j] = fInclude;
+                if (fInclude)
+                    vMatchTxid1.push_back(vTxid[j]);
+            }
+
+            // build the partial merkle tree
+            CPartialMerkleTree pmt1(vTxid, vMatch);
+
+            // serialize
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << pmt1;
+
+            // verify CPartialMerkleTree's size guarantees
+            unsigned int n = std::min<unsigned int>(nTx, 1 + vMatchTxid1.size()*nHeight);
+            BOOST_CHECK(ss.size() <= 10 + (258*n+7)/8);
+
+            // deserialize into a tester copy
+            CPartialMerkleTree pmt2;
+            ss >> pmt2;
+
+            // extract merkle root and matched txids from copy
+            std::vector<uint256> vMatchTxid2;
+            uint256 merkleRoot2 = pmt2.ExtractMatches(vMatchTxid2);
+
+            // check that it has the same merkle root as the original, and a valid one
+            BOOST_CHECK(merkleRoot1 == merkleRoot2);
+            BOOST_CHECK(merkleRoot2 != 0);
+
+            // check that it contains the matched transactions (in the same order!)
+            BOOST_CHECK(vMatchTxid1 == vMatchTxid2);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(merkle_block_match)
+{
+    CBlock block = BuildBlock(5);
+
+    CBloomFilter filter(10, 0.000001, 0, BLOOM_UPDATE_ALL);
+    filter.insert(block.vtx[3].GetHash());
+
+    CMerkleBlock merkleBlock(block, filter);
+    BOOST_CHECK(merkleBlock.header.GetHash() == block.GetHash());
+
+    BOOST_CHECK(merkleBlock.vMatchedTxn.size() == 1);
+    pair<unsigned int, uint256> pair = merkleBlock.vMatchedTxn[0];
+    BOOST_CHECK(pair.first == 3);
+    BOOST_CHECK(pair.second == block.vtx[3].GetHash());
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << merkleBlock;
+    // 80 byte header followed by the partial merkle tree
+    CMerkleBlock merkleBlock2;
+    ss >> merkleBlock2;
+    BOOST_CHECK(merkleBlock2.header.GetHash() == block.GetHash());
+
+    vector<uint256> vMatched;
+    BOOST_CHECK(merkleBlock2.txn.ExtractMatches(vMatched) == block.hashMerkleRoot);
+    BOOST_CHECK(vMatched.size() == merkleBlock.vMatchedTxn.size());
+    for (unsigned int i = 0; i < vMatched.size(); i++)
+        BOOST_CHECK(vMatched[i] == merkleBlock.vMatchedTxn[i].second);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
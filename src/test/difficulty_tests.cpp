@@ -0,0 +1,139 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bignum.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+// A value of about nBits bits. Whole words of zeros and ones take the
+// division through its correction steps
+static uint256 RandomValue(unsigned int nBits)
+{
+    uint256 n = GetRandHash();
+    uint32_t* pn = (uint32_t*)n.begin();
+    for (int i = 0; i < 8; i++)
+        if (GetRand(3) == 0)
+            pn[i] = GetRand(2) ? 0 : 0xffffffff;
+    return nBits >= 256 ? n : n >> (256 - nBits);
+}
+
+// What the CBigNum version of CBlockIndex::GetBlockTrust returned
+static uint256 BigNumBlockTrust(unsigned int nBits)
+{
+    CBigNum bnTarget;
+    bnTarget.SetCompact(nBits);
+    if (bnTarget <= 0)
+        return 0;
+    return ((CBigNum(1)<<256) / (bnTarget+1)).getuint256();
+}
+
+// and of ComputeMinWork, for the main net limit
+static unsigned int BigNumMinWork(unsigned int nBase, int64_t nTime)
+{
+    CBigNum bnLimit(~uint256(0) >> 20);
+    CBigNum bnResult;
+    bnResult.SetCompact(nBase);
+    bnResult *= 2;
+    while (nTime > 0 && bnResult < bnLimit)
+    {
+        bnResult *= 2;
+        nTime -= 24 * 60 * 60;
+    }
+    if (bnResult > bnLimit)
+        bnResult = bnLimit;
+    return bnResult.GetCompact();
+}
+
+static vector<unsigned int> TestCompacts()
+{
+    // every size byte, with mantissas at each byte boundary and the sign bit
+    static const unsigned int mantissas[] = { 0, 1, 0x7f, 0x80, 0xff, 0x100, 0x7fff, 0x8000, 0xffff, 0x10000, 0x123456, 0x7fffff };
+    vector<unsigned int> vCompact;
+    for (unsigned int nSize = 0; nSize < 256; nSize++)
+        for (unsigned int i = 0; i < sizeof(mantissas) / sizeof(mantissas[0]); i++)
+        {
+            vCompact.push_back(nSize << 24 | mantissas[i]);
+            vCompact.push_back(nSize << 24 | mantissas[i] | 0x00800000);
+        }
+    for (int i = 0; i < 10000; i++)
+        vCompact.push_back(GetRand(4) ? 0x1a000000 + GetRand(0x08000000) : GetRand(0x100000000LL));
+    return vCompact;
+}
+
+BOOST_AUTO_TEST_SUITE(difficulty_tests)
+
+BOOST_AUTO_TEST_CASE(compact_encoding)
+{
+    CBigNum bnMax(~uint256(0));
+    vector<unsigned int> vCompact = TestCompacts();
+    for (unsigned int i = 0; i < vCompact.size(); i++)
+    {
+        bool fNegative, fOverflow;
+        uint256 n;
+        n.SetCompact(vCompact[i], &fNegative, &fOverflow);
+        CBigNum bn;
+        bn.SetCompact(vCompact[i]);
+
+        BOOST_CHECK_EQUAL(fNegative, bn < 0);
+        CBigNum bnAbs = fNegative ? -bn : bn;
+        BOOST_CHECK_EQUAL(fOverflow, bnAbs > bnMax);
+        if (!fOverflow)
+        {
+            BOOST_CHECK(n == bnAbs.getuint256());
+            BOOST_CHECK_EQUAL(n.GetCompact(), bnAbs.GetCompact());
+        }
+    }
+
+    // and from values of every length
+    for (unsigned int nBits = 0; nBits <= 256; nBits++)
+        for (int i = 0; i < 10; i++)
+        {
+            uint256 n = RandomValue(nBits);
+            BOOST_CHECK_EQUAL(n.GetCompact(), CBigNum(n).GetCompact());
+        }
+}
+
+BOOST_AUTO_TEST_CASE(arithmetic)
+{
+    for (int i = 0; i < 10000; i++)
+    {
+        uint256 a = RandomValue(GetRand(257)), b = RandomValue(GetRand(257));
+        CBigNum bnA(a), bnB(b);
+        unsigned int c = GetRand(0x100000000LL);
+
+        BOOST_CHECK_EQUAL(a.bits(), (unsigned int)BN_num_bits(&bnA));
+        BOOST_CHECK((a * b) == (bnA * bnB).getuint256());
+        BOOST_CHECK((uint512(a) * uint512(b)).trim256() == (bnA * bnB).getuint256());
+        BOOST_CHECK(uint512(a) * uint512(b) >> 256 == uint512((bnA * bnB >> 256).getuint256()));
+        uint256 ac = a;
+        ac *= c;
+        BOOST_CHECK(ac == (bnA * CBigNum(c)).getuint256());
+        if (b != 0)
+            BOOST_CHECK((a / b) == (bnA / bnB).getuint256());
+        if (c != 0)
+            BOOST_CHECK((a / uint256(c)) == (bnA / CBigNum(c)).getuint256());
+    }
+    BOOST_CHECK_THROW(uint256(1) / uint256(0), uint_error);
+}
+
+BOOST_AUTO_TEST_CASE(block_trust)
+{
+    vector<unsigned int> vCompact = TestCompacts();
+    for (unsigned int i = 0; i < vCompact.size(); i++)
+    {
+        CBlockIndex index;
+        index.nBits = vCompact[i];
+        BOOST_CHECK(index.GetBlockTrust() == BigNumBlockTrust(vCompact[i]));
+    }
+
+    // any base that is not negative, above the limit or too wide included
+    for (int i = 0; i < 10000; i++)
+    {
+        unsigned int nBase = vCompact[GetRand(vCompact.size())] & 0xff7fffff;
+        int64_t nTime = GetRand(60 * 24 * 60 * 60);
+        BOOST_CHECK_EQUAL(ComputeMinWork(nBase, nTime), BigNumMinWork(nBase, nTime));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
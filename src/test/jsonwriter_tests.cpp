@@ -0,0 +1,100 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bitcoinrpc.h"
+#include "jsonwriter.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+using namespace json_spirit;
+
+extern Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail);
+extern void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail, CJSONWriter& writer);
+
+static CBlock BuildBlock(unsigned int nTx)
+{
+    CBlock block;
+    block.nBits = 0x1e0fffff;
+    block.nTime = 1400000000;
+    block.nNonce = 0xfffffff0;
+    for (unsigned int i = 0; i < nTx; i++)
+    {
+        CTransaction tx;
+        tx.nTime = block.nTime;
+        tx.vin.resize(2);
+        tx.vin[0].prevout.hash = i + 1;
+        tx.vin[0].prevout.n = 0;
+        tx.vin[0].scriptSig << vector<unsigned char>(72, i & 0xff) << vector<unsigned char>(33, 2);
+        tx.vin[1].prevout.hash = i + 2;
+        tx.vin[1].prevout.n = 1;
+        tx.vout.resize(2);
+        tx.vout[0].nValue = i * COIN + 12345;
+        tx.vout[0].scriptPubKey << OP_DUP << OP_HASH160 << vector<unsigned char>(20, i & 0xff) << OP_EQUALVERIFY << OP_CHECKSIG;
+        tx.vout[1].nValue = 1;
+        tx.vout[1].scriptPubKey << OP_RETURN;
+        block.vtx.push_back(tx);
+    }
+    block.vtx[0].vin[0].prevout.SetNull();
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_SUITE(jsonwriter_tests)
+
+BOOST_AUTO_TEST_CASE(jsonwriter_matches_json_spirit)
+{
+    Object inner;
+    inner.push_back(Pair("quote\"back\\slash", "tab\tnew\nline\x01\x7f\xc3\xa9"));
+    inner.push_back(Pair("real", 1.5));
+    inner.push_back(Pair("amount", ValueFromAmount(-123456789)));
+    inner.push_back(Pair("int", -42));
+    inner.push_back(Pair("int64", (boost::int64_t)-9000000000000000000LL));
+    inner.push_back(Pair("uint64", (boost::uint64_t)18000000000000000000ULL));
+    inner.push_back(Pair("bool", false));
+    inner.push_back(Pair("null", Value::null));
+
+    Array a;
+    a.push_back(inner);
+    a.push_back(Array());
+    a.push_back(Object());
+    a.push_back("");
+
+    Object obj;
+    obj.push_back(Pair("a", a));
+    obj.push_back(Pair("b", true));
+
+    string strOut;
+    CJSONWriter writer(strOut);
+    writer.WriteValue(obj);
+    BOOST_CHECK_EQUAL(strOut, write_string(Value(obj), false));
+
+    // Typed calls give the same text as the equivalent values
+    strOut.clear();
+    writer.BeginArray();
+    writer.WriteAmount(-123456789);
+    writer.WriteUInt(18000000000000000000ULL);
+    const unsigned char vch[] = { 0x00, 0xab, 0xff };
+    writer.WriteHex(vch, vch + sizeof(vch));
+    writer.WriteRaw("{\"x\":1}");
+    writer.WriteNull();
+    writer.EndArray();
+    BOOST_CHECK_EQUAL(strOut, "[-1.23456789,18000000000000000000,\"00abff\",{\"x\":1},null]");
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_block)
+{
+    CBlock block = BuildBlock(3);
+    uint256 hash = block.GetHash();
+    CBlockIndex index(0, 0, block);
+    index.phashBlock = &hash;
+
+    for (int fDetail = 0; fDetail < 2; fDetail++)
+    {
+        string strOut;
+        CJSONWriter writer(strOut);
+        blockToJSON(block, &index, fDetail, writer);
+        BOOST_CHECK_EQUAL(strOut, write_string(Value(blockToJSON(block, &index, fDetail)), false));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,172 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "txdb.h"
+
+using namespace std;
+
+// tx spending output 0 of each parent, or a made up outpoint if none
+static CTransaction MakeTx(const vector<uint256>& vParents, unsigned int nSeed)
+{
+    CTransaction tx;
+    if (vParents.empty())
+    {
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(nSeed + 1000, 0);
+    }
+    for (unsigned int i = 0; i < vParents.size(); i++)
+    {
+        tx.vin.push_back(CTxIn());
+        tx.vin.back().prevout = COutPoint(vParents[i], 0);
+    }
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nSeed;
+    tx.vout[0].scriptPubKey << OP_TRUE;
+    return tx;
+}
+
+static uint256 AddTx(CTxMemPool& pool, CTransaction tx, int64_t nFee, int64_t nTime)
+{
+    uint256 hash = tx.GetHash();
+    LOCK(pool.cs);
+    pool.addUnchecked(hash, tx, CTxMemPoolEntry(nFee, ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION), nTime, 1));
+    return hash;
+}
+
+BOOST_AUTO_TEST_SUITE(mempool_tests)
+
+BOOST_AUTO_TEST_CASE(mempool_ancestors)
+{
+    CTxMemPool pool;
+    CTransaction txParent = MakeTx(vector<uint256>(), 1);
+    uint256 hashParent = AddTx(pool, txParent, 1000, 100);
+    CTransaction txChild = MakeTx(vector<uint256>(1, hashParent), 2);
+    uint256 hashChild = AddTx(pool, txChild, 3000, 101);
+    CTransaction txGrandChild = MakeTx(vector<uint256>(1, hashChild), 3);
+    uint256 hashGrandChild = AddTx(pool, txGrandChild, 5000, 102);
+
+    CTxMemPoolEntry entry;
+    BOOST_CHECK(pool.lookupEntry(hashGrandChild, entry));
+    BOOST_CHECK_EQUAL(entry.nCountWithAncestors, 3U);
+    BOOST_CHECK_EQUAL(entry.nFeesWithAncestors, 9000);
+    BOOST_CHECK_EQUAL(pool.nTotalTxSize, (uint64_t)entry.nSizeWithAncestors);
+
+    // Mining the parent leaves the others with one ancestor less
+    pool.remove(txParent);
+    BOOST_CHECK(pool.lookupEntry(hashGrandChild, entry));
+    BOOST_CHECK_EQUAL(entry.nCountWithAncestors, 2U);
+    BOOST_CHECK_EQUAL(entry.nFeesWithAncestors, 8000);
+    BOOST_CHECK(pool.lookupEntry(hashChild, entry));
+    BOOST_CHECK_EQUAL(entry.nCountWithAncestors, 1U);
+
+    pool.remove(txChild, true);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    BOOST_CHECK_EQUAL(pool.nTotalTxSize, 0U);
+    BOOST_CHECK(pool.setByFeeRate.empty());
+    BOOST_CHECK(pool.setByTime.empty());
+}
+
+BOOST_AUTO_TEST_CASE(mempool_parent_readded)
+{
+    // A reorganize puts a parent back after its child is already in the pool
+    CTxMemPool pool;
+    CTransaction txParent = MakeTx(vector<uint256>(), 1);
+    CTransaction txChild = MakeTx(vector<uint256>(1, txParent.GetHash()), 2);
+    uint256 hashChild = AddTx(pool, txChild, 3000, 101);
+    AddTx(pool, txParent, 1000, 100);
+
+    CTxMemPoolEntry entry;
+    BOOST_CHECK(pool.lookupEntry(hashChild, entry));
+    BOOST_CHECK_EQUAL(entry.nCountWithAncestors, 2U);
+    BOOST_CHECK_EQUAL(entry.nFeesWithAncestors, 4000);
+    BOOST_CHECK_EQUAL(pool.nTotalTxSize, (uint64_t)entry.nSizeWithAncestors);
+
+    // and mining it leaves the child counting only itself
+    pool.remove(txParent);
+    BOOST_CHECK(pool.lookupEntry(hashChild, entry));
+    BOOST_CHECK_EQUAL(entry.nCountWithAncestors, 1U);
+    BOOST_CHECK_EQUAL(entry.nFeesWithAncestors, 3000);
+    BOOST_CHECK_EQUAL((uint64_t)entry.nSizeWithAncestors, (uint64_t)entry.nTxSize);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_trim_expire)
+{
+    CTxMemPool pool;
+    uint256 hashLow = AddTx(pool, MakeTx(vector<uint256>(), 1), 100, 200);
+    uint256 hashHigh = AddTx(pool, MakeTx(vector<uint256>(), 2), 10000, 100);
+    // a well paying child does not save its parent from eviction
+    uint256 hashChild = AddTx(pool, MakeTx(vector<uint256>(1, hashLow), 3), 20000, 300);
+    uint256 hashMid = AddTx(pool, MakeTx(vector<uint256>(), 4), 1000, 400);
+
+    CTxMemPoolEntry entry;
+    BOOST_CHECK(pool.lookupEntry(hashMid, entry));
+    BOOST_CHECK_EQUAL(pool.TrimToSize(pool.nTotalTxSize - 1), 2);
+    BOOST_CHECK(!pool.exists(hashLow));
+    BOOST_CHECK(!pool.exists(hashChild));
+    BOOST_CHECK(pool.exists(hashMid));
+
+    BOOST_CHECK_EQUAL(pool.TrimToSize(entry.nTxSize), 1);
+    BOOST_CHECK(pool.exists(hashHigh));
+    BOOST_CHECK(!pool.exists(hashMid));
+
+    // Expiry goes by entry time, not fee
+    AddTx(pool, MakeTx(vector<uint256>(), 5), 1, 500);
+    BOOST_CHECK_EQUAL(pool.Expire(101), 1);
+    BOOST_CHECK(!pool.exists(hashHigh));
+    BOOST_CHECK_EQUAL(pool.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_priority_order)
+{
+    CTxMemPool pool;
+    CTransaction txOld = MakeTx(vector<uint256>(), 1);
+    CTransaction txNew = MakeTx(vector<uint256>(), 2);
+    unsigned int nSize = ::GetSerializeSize(txOld, SER_NETWORK, PROTOCOL_VERSION);
+    {
+        LOCK(pool.cs);
+        // txOld: old coins of little value, txNew: young coins of a lot
+        pool.addUnchecked(txOld.GetHash(), txOld, CTxMemPoolEntry(0, nSize, 100, 10, 1000.0 * COIN * 100 / nSize, 1000 * COIN));
+        pool.addUnchecked(txNew.GetHash(), txNew, CTxMemPoolEntry(0, nSize, 100, 10, 50000.0 * COIN * 1 / nSize, 50000 * COIN));
+    }
+
+    pool.UpdatePriorities(10);
+    BOOST_CHECK(pool.setByPriority.rbegin()->second == txOld.GetHash());
+    // two blocks later the young coins have caught up
+    pool.UpdatePriorities(12);
+    BOOST_CHECK(pool.setByPriority.rbegin()->second == txNew.GetHash());
+
+    // removal finds the entry under the priority it was ranked with
+    pool.remove(txOld);
+    BOOST_CHECK_EQUAL(pool.setByPriority.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_input_priority)
+{
+    // A parent still in the memory pool comes back from FetchInputs with a
+    // null position and has no confirmations to add
+    CTransaction txParent = MakeTx(vector<uint256>(), 1);
+    uint256 hashParent = AddTx(mempool, txParent, 1000, 100);
+    CTransaction txChild = MakeTx(vector<uint256>(1, hashParent), 2);
+
+    CTxDB txdb("r");
+    MapPrevTx mapInputs;
+    map<uint256, CTxIndex> mapUnused;
+    bool fInvalid;
+    BOOST_CHECK(txChild.FetchInputs(txdb, mapUnused, false, false, mapInputs, fInvalid));
+    BOOST_CHECK(mapInputs[hashParent].first.pos.IsNull());
+
+    double dPriority = -1;
+    int64_t nInChainInputValue = -1;
+    GetInputPriority(txChild, mapInputs, ::GetSerializeSize(txChild, SER_NETWORK, PROTOCOL_VERSION), dPriority, nInChainInputValue);
+    BOOST_CHECK_EQUAL(dPriority, 0.0);
+    BOOST_CHECK_EQUAL(nInChainInputValue, 0);
+
+    // as does one from the proposed-changes pool
+    mapInputs[hashParent].first.pos = CDiskTxPos(1,1,1);
+    GetInputPriority(txChild, mapInputs, ::GetSerializeSize(txChild, SER_NETWORK, PROTOCOL_VERSION), dPriority, nInChainInputValue);
+    BOOST_CHECK_EQUAL(nInChainInputValue, 0);
+
+    mempool.remove(txParent);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,90 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bignum.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+static const int64_t values[] = { 0, 1, -1, 2, 127, -127, 128, -128, 255, -255, 256, -256, 32767, -32767,
+                                  32768, -32768, 8388607, -8388608, 2147483647, -2147483647 };
+
+// What CastToBigNum and getvch made of the same bytes
+static vector<unsigned char> BigNumRoundTrip(const vector<unsigned char>& vch)
+{
+    return CBigNum(CBigNum(vch).getvch()).getvch();
+}
+
+static vector<unsigned char> RandomNumBytes()
+{
+    vector<unsigned char> vch(GetRand(CScriptNum::MAX_SIZE + 1));
+    for (unsigned int i = 0; i < vch.size(); i++)
+        vch[i] = GetRand(4) == 0 ? (GetRand(2) ? 0x80 : 0) : GetRand(256);
+    return vch;
+}
+
+BOOST_AUTO_TEST_SUITE(scriptnum_tests)
+
+BOOST_AUTO_TEST_CASE(scriptnum_encoding)
+{
+    for (unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        BOOST_CHECK(CScriptNum(values[i]).getvch() == CBigNum(values[i]).getvch());
+        CScriptValue vch = CScriptNum(values[i]).getvalue();
+        BOOST_CHECK_EQUAL(CScriptNum(vch).getint(), values[i]);
+    }
+
+    // including the non-minimal ones, negative zero and sign bytes
+    for (int i = 0; i < 10000; i++)
+    {
+        vector<unsigned char> vch = RandomNumBytes();
+        BOOST_CHECK(CScriptNum(CScriptValue(vch)).getvch() == BigNumRoundTrip(vch));
+    }
+
+    BOOST_CHECK_THROW(CScriptNum(CScriptValue(vector<unsigned char>(5, 1))), scriptnum_error);
+}
+
+BOOST_AUTO_TEST_CASE(scriptnum_arithmetic)
+{
+    for (int i = 0; i < 10000; i++)
+    {
+        vector<unsigned char> vch1 = RandomNumBytes(), vch2 = RandomNumBytes();
+        CScriptNum n1((CScriptValue(vch1))), n2((CScriptValue(vch2)));
+        CBigNum bn1(vch1), bn2(vch2);
+
+        // sums and differences of 4 byte operands can take 5 bytes
+        BOOST_CHECK((n1 + n2).getvch() == (bn1 + bn2).getvch());
+        BOOST_CHECK((n1 - n2).getvch() == (bn1 - bn2).getvch());
+        BOOST_CHECK((-n1).getvch() == (-bn1).getvch());
+        BOOST_CHECK_EQUAL(n1 == n2, bn1 == bn2);
+        BOOST_CHECK_EQUAL(n1 < n2, bn1 < bn2);
+        BOOST_CHECK_EQUAL(n1 >= n2, bn1 >= bn2);
+        BOOST_CHECK_EQUAL(n1.getint(), bn1.getint());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scriptvalue_copy)
+{
+    // either side of the inline size, copied into elements of both kinds
+    unsigned int sizes[] = { 0, 1, 33, CScriptValue::INLINE_SIZE, CScriptValue::INLINE_SIZE + 1, 520 };
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        vector<unsigned char> vch(sizes[i]);
+        for (unsigned int j = 0; j < vch.size(); j++)
+            vch[j] = GetRand(256);
+        CScriptValue value(vch);
+        BOOST_CHECK(value.getvch() == vch);
+
+        for (unsigned int j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+        {
+            CScriptValue other(vector<unsigned char>(sizes[j], 1));
+            other = value;
+            BOOST_CHECK(other == value);
+            BOOST_CHECK(other.getvch() == vch);
+        }
+        CScriptValue copy(value);
+        BOOST_CHECK(copy == value);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,138 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include "json/json_spirit_reader_template.h"
+
+#include "key.h"
+#include "main.h"
+#include "script.h"
+#include "secp256k1.h"
+
+using namespace std;
+using namespace json_spirit;
+
+// In script_tests.cpp
+extern Array read_json(const std::string& filename);
+extern CScript ParseScript(string s);
+
+#ifdef HAVE_SECP256K1_VERIFY
+
+// Run every signature in a set of script vectors through both backends,
+// the results themselves do not matter here
+static void CrossCheckScripts(const string& strFile)
+{
+    Array tests = read_json(strFile);
+    BOOST_FOREACH(Value& tv, tests)
+    {
+        Array test = tv.get_array();
+        if (test.size() < 2 || test[0].type() != str_type)
+            continue;
+        CTransaction tx;
+        try
+        {
+            VerifyScript(ParseScript(test[0].get_str()), ParseScript(test[1].get_str()), tx, 0, SIGHASH_NONE);
+        }
+        catch (std::exception& e)
+        {
+            // opcodes this tree's script parser does not know
+        }
+    }
+}
+
+static void CrossCheckTransactions(const string& strFile)
+{
+    Array tests = read_json(strFile);
+    BOOST_FOREACH(Value& tv, tests)
+    {
+        Array test = tv.get_array();
+        if (test.size() != 3 || test[0].type() != array_type)
+            continue;
+
+        // the vectors are in Bitcoin's format, which lacks nTime, so not all
+        // of them deserialize here
+        try
+        {
+            map<COutPoint, CScript> mapprevOutScriptPubKeys;
+            BOOST_FOREACH(Value& input, test[0].get_array())
+            {
+                Array vinput = input.get_array();
+                mapprevOutScriptPubKeys[COutPoint(uint256(vinput[0].get_str()), vinput[1].get_int())] = ParseScript(vinput[2].get_str());
+            }
+
+            CTransaction tx;
+            CDataStream stream(ParseHex(test[1].get_str()), SER_NETWORK, PROTOCOL_VERSION);
+            stream >> tx;
+            for (unsigned int i = 0; i < tx.vin.size(); i++)
+                if (mapprevOutScriptPubKeys.count(tx.vin[i].prevout))
+                    VerifyScript(tx.vin[i].scriptSig, mapprevOutScriptPubKeys[tx.vin[i].prevout], tx, i, 0);
+        }
+        catch (std::exception& e)
+        {
+            continue;
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(secp256k1_tests)
+
+BOOST_AUTO_TEST_CASE(secp256k1_sign_verify)
+{
+    int nBackendSave = nSigBackend;
+    for (int i = 0; i < 100; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        CPubKey pubkey = key.GetPubKey();
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+
+        vector<unsigned char> vchBadSig = vchSig;
+        vchBadSig[5 + GetRand(vchBadSig.size() - 5)] ^= 1 << GetRand(8);
+        uint256 hashBad = hash;
+        *hashBad.begin() ^= 1;
+
+        const int backends[] = {SIG_BACKEND_OPENSSL, SIG_BACKEND_SECP256K1};
+        BOOST_FOREACH(int nBackend, backends)
+        {
+            nSigBackend = nBackend;
+            BOOST_CHECK(key.Verify(hash, vchSig));
+            BOOST_CHECK(pubkey.Verify(hash, vchSig));
+            BOOST_CHECK(!pubkey.Verify(hashBad, vchSig));
+            BOOST_CHECK(!pubkey.Verify(hash, vchBadSig));
+            BOOST_CHECK(!pubkey.Verify(hash, vector<unsigned char>()));
+        }
+    }
+    nSigBackend = nBackendSave;
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_crosscheck)
+{
+    int nBackendSave = nSigBackend;
+    nSigBackend = SIG_BACKEND_CROSSCHECK;
+    nSigBackendMismatches = 0;
+
+    CrossCheckScripts("script_valid.json");
+    CrossCheckScripts("script_invalid.json");
+    CrossCheckTransactions("tx_valid.json");
+    CrossCheckTransactions("tx_invalid.json");
+
+    // and freshly made signatures, including ones for the wrong hash
+    for (int i = 0; i < 50; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig;
+        key.Sign(hash, vchSig);
+        BOOST_CHECK(key.Verify(hash, vchSig));
+        BOOST_CHECK(!key.Verify(~hash, vchSig));
+    }
+
+    BOOST_CHECK_EQUAL(nSigBackendMismatches, 0U);
+    nSigBackend = nBackendSave;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif
@@ -0,0 +1,91 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+// The old way: the whole object copied into a stream, then hashed
+template<typename T>
+static uint256 StreamHash(const T& obj)
+{
+    CDataStream ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << obj;
+    return Hash(ss.begin(), ss.end());
+}
+
+static CTransaction RandomTransaction(unsigned int nIn, unsigned int nOut)
+{
+    CTransaction tx;
+    tx.nTime = GetRand(0xffffffff);
+    tx.nLockTime = GetRand(2) ? 0 : GetRand(0xffffffff);
+    tx.vin.resize(nIn);
+    for (unsigned int i = 0; i < nIn; i++)
+    {
+        tx.vin[i].prevout = COutPoint(GetRandHash(), GetRand(10));
+        tx.vin[i].scriptSig << vector<unsigned char>(72, i) << vector<unsigned char>(33, i);
+    }
+    tx.vout.resize(nOut);
+    for (unsigned int i = 0; i < nOut; i++)
+    {
+        tx.vout[i].nValue = GetRand(21000000 * COIN);
+        tx.vout[i].scriptPubKey << OP_DUP << OP_HASH160 << vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return tx;
+}
+
+BOOST_AUTO_TEST_SUITE(serialize_tests)
+
+BOOST_AUTO_TEST_CASE(hashwriter)
+{
+    for (int i = 0; i < 100; i++)
+    {
+        CTransaction tx = RandomTransaction(GetRand(5), GetRand(5));
+        BOOST_CHECK(tx.GetHash() == StreamHash(tx));
+        BOOST_CHECK(tx.vin.empty() || SerializeHash(tx.vin[0]) == StreamHash(tx.vin[0]));
+    }
+
+    // several values written in turn, as the kernel hashes are
+    uint256 hash = GetRandHash();
+    uint64_t nModifier = GetRand(std::numeric_limits<uint64_t>::max());
+    unsigned int nTime = GetRand(0xffffffff);
+    CDataStream ss(SER_GETHASH, 0);
+    ss << nModifier << nTime << hash;
+    CHashWriter hw(SER_GETHASH, 0);
+    hw << nModifier << nTime << hash;
+    BOOST_CHECK(hw.GetHash() == Hash(ss.begin(), ss.end()));
+
+    // and nothing at all
+    CHashWriter hwEmpty(SER_GETHASH, 0);
+    CDataStream ssEmpty(SER_GETHASH, 0);
+    BOOST_CHECK(hwEmpty.GetHash() == Hash(ssEmpty.begin(), ssEmpty.end()));
+}
+
+BOOST_AUTO_TEST_CASE(fixed_serialize_size)
+{
+    for (unsigned int n = 0; n < 300; n += 37)
+    {
+        vector<uint256> vHash(n);
+        vector<COutPoint> vOutPoint(n, COutPoint(GetRandHash(), 1));
+        vector<CInv> vInv(n, CInv(MSG_TX, GetRandHash()));
+
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << vHash;
+        BOOST_CHECK_EQUAL(::GetSerializeSize(vHash, SER_NETWORK, PROTOCOL_VERSION), ss.size());
+        ss.clear();
+        ss << vOutPoint;
+        BOOST_CHECK_EQUAL(::GetSerializeSize(vOutPoint, SER_NETWORK, PROTOCOL_VERSION), ss.size());
+        ss.clear();
+        ss << vInv;
+        BOOST_CHECK_EQUAL(::GetSerializeSize(vInv, SER_NETWORK, PROTOCOL_VERSION), ss.size());
+    }
+
+    // types left off the list are still sized one by one
+    CTransaction tx = RandomTransaction(3, 2);
+    tx.vin[1].scriptSig = CScript();
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    BOOST_CHECK_EQUAL(::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION), ss.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
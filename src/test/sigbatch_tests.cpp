@@ -0,0 +1,96 @@
+#include <boost/test/unit_test.hpp>
+
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "script.h"
+
+using namespace std;
+
+// txTo spends output 0 of txFrom, paying to key
+static void MakeSpend(const CKey& key, CTransaction& txFrom, CTransaction& txTo)
+{
+    txFrom.vout.resize(1);
+    txFrom.vout[0].nValue = COIN;
+    txFrom.vout[0].scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
+
+    txTo.vin.resize(1);
+    txTo.vin[0].prevout = COutPoint(txFrom.GetHash(), 0);
+    txTo.vout.resize(1);
+    txTo.vout[0].nValue = COIN;
+    txTo.vout[0].scriptPubKey = txFrom.vout[0].scriptPubKey;
+}
+
+BOOST_AUTO_TEST_SUITE(sigbatch_tests)
+
+BOOST_AUTO_TEST_CASE(sigbatch_verify)
+{
+    int nThreadsSave = nScriptCheckThreads;
+    nScriptCheckThreads = 4;
+
+    CTransaction tx;
+    CScript script;
+    CSigBatch batch;
+    for (unsigned int i = 0; i < 100; i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig;
+        key.Sign(hash, vchSig);
+        batch.BeginInput(tx, i, script);
+        batch.Add(hash, vchSig, key.GetPubKey().Raw());
+    }
+    vector<unsigned int> vFailed;
+    BOOST_CHECK(batch.Verify(vFailed));
+    BOOST_CHECK(vFailed.empty());
+
+    // a bad signature is pinned to its input
+    batch.vChecks[37].sighash = ~batch.vChecks[37].sighash;
+    batch.vChecks[90].vchPubKey = batch.vChecks[91].vchPubKey;
+    BOOST_CHECK(!batch.Verify(vFailed));
+    BOOST_REQUIRE_EQUAL(vFailed.size(), 2U);
+    BOOST_CHECK_EQUAL(vFailed[0], 37U);
+    BOOST_CHECK_EQUAL(vFailed[1], 90U);
+
+    // aborting an input drops only its own checks
+    batch.BeginInput(tx, 100, script);
+    batch.Add(0, vector<unsigned char>(), vector<unsigned char>());
+    batch.Add(0, vector<unsigned char>(), vector<unsigned char>());
+    batch.AbortInput();
+    BOOST_CHECK_EQUAL(batch.vInputs.size(), 100U);
+    BOOST_CHECK_EQUAL(batch.vChecks.size(), 100U);
+
+    nScriptCheckThreads = nThreadsSave;
+}
+
+BOOST_AUTO_TEST_CASE(sigbatch_script)
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+
+    CTransaction txFrom, txTo;
+    MakeSpend(key, txFrom, txTo);
+    BOOST_CHECK(SignSignature(keystore, txFrom, txTo, 0));
+
+    // the check is queued rather than done
+    CSigBatch batch;
+    batch.BeginInput(txTo, 0, txFrom.vout[0].scriptPubKey);
+    BOOST_CHECK(VerifySignature(txFrom, txTo, 0, 0, &batch));
+    BOOST_CHECK_EQUAL(batch.vChecks.size(), 1U);
+    vector<unsigned int> vFailed;
+    BOOST_CHECK(batch.Verify(vFailed));
+
+    // a signature for another transaction passes the script but not the batch
+    CTransaction txOther = txTo;
+    txOther.vout[0].nValue = COIN / 2;
+    CSigBatch batch2;
+    batch2.BeginInput(txOther, 0, txFrom.vout[0].scriptPubKey);
+    BOOST_CHECK(VerifySignature(txFrom, txOther, 0, 0, &batch2));
+    BOOST_CHECK(!batch2.Verify(vFailed));
+    BOOST_CHECK(!VerifySignature(txFrom, txOther, 0, 0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,139 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "script.h"
+
+using namespace std;
+
+static vector<unsigned char> RandomBytes(unsigned int nSize)
+{
+    vector<unsigned char> vch(nSize);
+    for (unsigned int i = 0; i < nSize; i++)
+        vch[i] = GetRand(256);
+    return vch;
+}
+
+static void SetAndGet(CSignatureCache* pcache, unsigned int nCount, bool* pfAllFound)
+{
+    vector<uint256> vHash;
+    for (unsigned int i = 0; i < nCount; i++)
+    {
+        vHash.push_back(GetRandHash());
+        pcache->Set(vHash.back(), vector<unsigned char>(72, 1), vector<unsigned char>(33, 2));
+    }
+    *pfAllFound = true;
+    for (unsigned int i = 0; i < nCount; i++)
+        *pfAllFound &= pcache->Get(vHash[i], vector<unsigned char>(72, 1), vector<unsigned char>(33, 2));
+}
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+BOOST_AUTO_TEST_CASE(sigcache_lookup)
+{
+    CSignatureCache cache(1000000);
+    uint256 sighash = GetRandHash();
+    vector<unsigned char> vchSig = RandomBytes(71), vchPubKey = RandomBytes(33);
+
+    BOOST_CHECK(!cache.Get(sighash, vchSig, vchPubKey));
+    cache.Set(sighash, vchSig, vchPubKey);
+    cache.Set(sighash, vchSig, vchPubKey);
+    BOOST_CHECK(cache.Get(sighash, vchSig, vchPubKey));
+
+    // every part of the entry counts
+    vector<unsigned char> vchOther = vchSig;
+    vchOther[10] ^= 1;
+    BOOST_CHECK(!cache.Get(~sighash, vchSig, vchPubKey));
+    BOOST_CHECK(!cache.Get(sighash, vchOther, vchPubKey));
+    BOOST_CHECK(!cache.Get(sighash, vchSig, vchOther));
+    // and the boundary between signature and public key is not ambiguous
+    vector<unsigned char> vchSigShort(vchSig.begin(), vchSig.end() - 1), vchPubKeyLong(vchPubKey);
+    vchPubKeyLong.insert(vchPubKeyLong.begin(), vchSig.back());
+    BOOST_CHECK(!cache.Get(sighash, vchSigShort, vchPubKeyLong));
+
+    uint64_t nEntries, nCapacity, nHits, nMisses;
+    cache.GetStats(nEntries, nCapacity, nHits, nMisses);
+    BOOST_CHECK_EQUAL(nEntries, 1U);
+    BOOST_CHECK_EQUAL(nCapacity, 1000000U / 32 / (CSignatureCache::SHARDS * CSignatureCache::BUCKET_ENTRIES) * CSignatureCache::SHARDS * CSignatureCache::BUCKET_ENTRIES);
+    BOOST_CHECK_EQUAL(nHits, 1U);
+    BOOST_CHECK_EQUAL(nMisses, 5U);
+
+    // resizing starts over, size 0 turns the cache off
+    cache.Resize(0);
+    cache.Set(sighash, vchSig, vchPubKey);
+    BOOST_CHECK(!cache.Get(sighash, vchSig, vchPubKey));
+    cache.GetStats(nEntries, nCapacity, nHits, nMisses);
+    BOOST_CHECK_EQUAL(nEntries + nCapacity + nHits + nMisses, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_bounded)
+{
+    // 64 KB is 2048 slots, fill it several times over
+    CSignatureCache cache(64 * 1024);
+    uint256 sighash;
+    vector<unsigned char> vchSig(72, 0), vchPubKey(33, 0);
+    for (unsigned int i = 0; i < 10000; i++)
+    {
+        sighash = i;
+        cache.Set(sighash, vchSig, vchPubKey);
+    }
+    BOOST_CHECK(cache.Get(sighash, vchSig, vchPubKey));
+
+    uint64_t nEntries, nCapacity, nHits, nMisses;
+    cache.GetStats(nEntries, nCapacity, nHits, nMisses);
+    BOOST_CHECK_EQUAL(nCapacity, 2048U);
+    BOOST_CHECK(nEntries <= nCapacity);
+    // salted digests spread evenly, buckets only overflow near full
+    BOOST_CHECK(nEntries > nCapacity * 9 / 10);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_threads)
+{
+    CSignatureCache cache(32 * 1000000);
+    bool fAllFound[8];
+    boost::thread_group threads;
+    for (int i = 0; i < 8; i++)
+        threads.create_thread(boost::bind(&SetAndGet, &cache, 500, &fAllFound[i]));
+    threads.join_all();
+
+    // 4000 entries in a million slots, nothing should be evicted
+    for (int i = 0; i < 8; i++)
+        BOOST_CHECK(fAllFound[i]);
+    uint64_t nEntries, nCapacity, nHits, nMisses;
+    cache.GetStats(nEntries, nCapacity, nHits, nMisses);
+    BOOST_CHECK_EQUAL(nEntries, 4000U);
+    BOOST_CHECK_EQUAL(nHits, 4000U);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_block_after_mempool)
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+
+    CTransaction txFrom, txTo;
+    txFrom.vout.resize(1);
+    txFrom.vout[0].nValue = COIN;
+    txFrom.vout[0].scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
+    txTo.vin.resize(1);
+    txTo.vin[0].prevout = COutPoint(txFrom.GetHash(), 0);
+    txTo.vout.resize(1);
+    txTo.vout[0].nValue = COIN;
+    BOOST_CHECK(SignSignature(keystore, txFrom, txTo, 0));
+
+    // checked once as the memory pool does, the block's batch has nothing
+    // left to verify
+    int nBackendSave = nSigBackend;
+    nSigBackend = SIG_BACKEND_OPENSSL;
+    BOOST_CHECK(VerifySignature(txFrom, txTo, 0, 0));
+    CSigBatch batch;
+    batch.BeginInput(txTo, 0, txFrom.vout[0].scriptPubKey);
+    BOOST_CHECK(VerifySignature(txFrom, txTo, 0, 0, &batch));
+    BOOST_CHECK(batch.empty());
+    nSigBackend = nBackendSave;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,72 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+extern uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+
+static CScript RandomScript()
+{
+    static const opcodetype oplist[] = {OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR};
+    CScript script;
+    int nOps = GetRand(10);
+    for (int i = 0; i < nOps; i++)
+        script << oplist[GetRand(sizeof(oplist) / sizeof(oplist[0]))];
+    return script;
+}
+
+static CTransaction RandomTransaction(unsigned int nInputs, unsigned int nOutputs)
+{
+    CTransaction tx;
+    tx.nVersion = GetRand(3);
+    tx.nTime = GetRand(2000000000);
+    tx.nLockTime = GetRand(2) ? GetRand(500000000) : 0;
+    for (unsigned int i = 0; i < nInputs; i++)
+    {
+        CTxIn txin;
+        txin.prevout = COutPoint(GetRandHash(), GetRand(4));
+        txin.scriptSig = RandomScript();
+        txin.nSequence = GetRand(2) ? GetRand((uint64_t)1 << 32) : (unsigned int)-1;
+        tx.vin.push_back(txin);
+    }
+    for (unsigned int i = 0; i < nOutputs; i++)
+    {
+        CTxOut txout;
+        txout.nValue = GetRand(100000000);
+        txout.scriptPubKey = RandomScript();
+        tx.vout.push_back(txout);
+    }
+    return tx;
+}
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+BOOST_AUTO_TEST_CASE(sighash_cache)
+{
+    for (int i = 0; i < 200; i++)
+    {
+        // up to 300 inputs gets the input count past a one byte compact size
+        unsigned int nInputs = 1 + (i % 10 == 0 ? GetRand(300) : GetRand(5));
+        CTransaction tx = RandomTransaction(nInputs, GetRand(4));
+        CSigHashCache cache(tx);
+
+        // a script long enough for a three byte size now and then
+        CScript scriptCode = RandomScript();
+        if (i % 20 == 0)
+            scriptCode << vector<unsigned char>(300, 0x51);
+        int nHashType = GetRand(2) ? SIGHASH_ALL : (int)GetRand(256);
+        unsigned int nIn = GetRand(nInputs);
+
+        uint256 hash;
+        bool fCached = cache.SignatureHash(scriptCode, nIn, nHashType, hash);
+        int nBaseType = nHashType & 0x1f;
+        BOOST_CHECK_EQUAL(fCached, nBaseType != SIGHASH_NONE && nBaseType != SIGHASH_SINGLE && !(nHashType & SIGHASH_ANYONECANPAY));
+        if (fCached)
+            BOOST_CHECK(hash == SignatureHash(scriptCode, tx, nIn, nHashType));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,119 @@
+#include <boost/test/unit_test.hpp>
+
+#include "key.h"
+#include "keystore.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+typedef vector<unsigned char> valtype;
+
+// A push written with OP_PUSHDATA1 rather than the direct size byte
+static CScript PushData1(const valtype& vch)
+{
+    CScript script;
+    script.insert(script.end(), (unsigned char)OP_PUSHDATA1);
+    script.insert(script.end(), (unsigned char)vch.size());
+    script.insert(script.end(), vch.begin(), vch.end());
+    return script;
+}
+
+BOOST_AUTO_TEST_SUITE(solver_tests)
+
+BOOST_AUTO_TEST_CASE(solver_standard)
+{
+    CKey key[3];
+    for (int i = 0; i < 3; i++)
+        key[i].MakeNewKey(i != 0);
+    CKeyID keyID = key[0].GetPubKey().GetID();
+
+    txnouttype whichType;
+    vector<valtype> vSolutions;
+    CTxDestination dest;
+
+    CScript s;
+    s.SetDestination(keyID);
+    BOOST_CHECK(Solver(s, whichType, vSolutions));
+    BOOST_CHECK_EQUAL(whichType, TX_PUBKEYHASH);
+    BOOST_REQUIRE_EQUAL(vSolutions.size(), 1U);
+    BOOST_CHECK(vSolutions[0] == valtype(keyID.begin(), keyID.end()));
+    BOOST_CHECK(ExtractDestination(s, dest) && dest == CTxDestination(keyID));
+
+    // uncompressed and compressed keys
+    for (int i = 0; i < 2; i++)
+    {
+        s.clear();
+        s << key[i].GetPubKey() << OP_CHECKSIG;
+        BOOST_CHECK(Solver(s, whichType, vSolutions));
+        BOOST_CHECK_EQUAL(whichType, TX_PUBKEY);
+        BOOST_REQUIRE_EQUAL(vSolutions.size(), 1U);
+        BOOST_CHECK(vSolutions[0] == key[i].GetPubKey().Raw());
+        BOOST_CHECK(ExtractDestination(s, dest) && dest == CTxDestination(key[i].GetPubKey().GetID()));
+    }
+
+    CScript inner;
+    inner.SetMultisig(2, vector<CKey>(key, key + 3));
+    BOOST_CHECK(Solver(inner, whichType, vSolutions));
+    BOOST_CHECK_EQUAL(whichType, TX_MULTISIG);
+    BOOST_REQUIRE_EQUAL(vSolutions.size(), 5U);
+    BOOST_CHECK(vSolutions.front() == valtype(1, 2));
+    BOOST_CHECK(vSolutions[2] == key[1].GetPubKey().Raw());
+    BOOST_CHECK(vSolutions.back() == valtype(1, 3));
+    BOOST_CHECK(!ExtractDestination(inner, dest));
+    vector<CTxDestination> vDest;
+    int nRequired;
+    BOOST_CHECK(ExtractDestinations(inner, whichType, vDest, nRequired));
+    BOOST_CHECK_EQUAL(nRequired, 2);
+    BOOST_REQUIRE_EQUAL(vDest.size(), 3U);
+    BOOST_CHECK(vDest[2] == CTxDestination(key[2].GetPubKey().GetID()));
+
+    s.SetDestination(inner.GetID());
+    BOOST_CHECK(Solver(s, whichType, vSolutions));
+    BOOST_CHECK_EQUAL(whichType, TX_SCRIPTHASH);
+    BOOST_CHECK(ExtractDestination(s, dest) && dest == CTxDestination(inner.GetID()));
+}
+
+BOOST_AUTO_TEST_CASE(solver_other_encodings)
+{
+    // Forms the byte patterns leave to the template matcher
+    CKey key[2];
+    for (int i = 0; i < 2; i++)
+        key[i].MakeNewKey(true);
+    valtype vchPubKey = key[0].GetPubKey().Raw();
+    CBasicKeyStore keystore;
+    keystore.AddKey(key[0]);
+
+    txnouttype whichType;
+    vector<valtype> vSolutions;
+
+    CScript s = PushData1(vchPubKey) << OP_CHECKSIG;
+    BOOST_CHECK(Solver(s, whichType, vSolutions));
+    BOOST_CHECK_EQUAL(whichType, TX_PUBKEY);
+    BOOST_CHECK(vSolutions[0] == vchPubKey);
+    BOOST_CHECK(IsMine(keystore, s));
+
+    // any size from 33 to 120 bytes is taken as a key
+    s.clear();
+    s << valtype(40, 2) << OP_CHECKSIG;
+    BOOST_CHECK(Solver(s, whichType, vSolutions));
+    BOOST_CHECK_EQUAL(whichType, TX_PUBKEY);
+
+    s = (CScript() << OP_1) + PushData1(vchPubKey);
+    s << key[1].GetPubKey() << OP_2 << OP_CHECKMULTISIG;
+    BOOST_CHECK(Solver(s, whichType, vSolutions));
+    BOOST_CHECK_EQUAL(whichType, TX_MULTISIG);
+    BOOST_CHECK_EQUAL(vSolutions.size(), 4U);
+
+    // and what neither accepts
+    s = CScript() << OP_3 << key[0].GetPubKey() << key[1].GetPubKey() << OP_2 << OP_CHECKMULTISIG;
+    BOOST_CHECK(!Solver(s, whichType, vSolutions));
+    s = CScript() << OP_1 << key[0].GetPubKey() << key[1].GetPubKey() << OP_3 << OP_CHECKMULTISIG;
+    BOOST_CHECK(!Solver(s, whichType, vSolutions));
+    s = CScript() << OP_DUP << OP_HASH160 << valtype(21, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    BOOST_CHECK(!Solver(s, whichType, vSolutions));
+    BOOST_CHECK_EQUAL(whichType, TX_NONSTANDARD);
+    BOOST_CHECK(!IsStandard(s));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
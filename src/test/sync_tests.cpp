@@ -0,0 +1,100 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "sync.h"
+#include "util.h"
+
+using namespace std;
+
+static CCriticalSection cs_test;
+static boost::mutex mutexHeld;
+static boost::condition_variable condHeld;
+static bool fHeld = false;
+
+static void HoldTestLock(int nMillis)
+{
+    LOCK(cs_test);
+    {
+        boost::unique_lock<boost::mutex> lock(mutexHeld);
+        fHeld = true;
+    }
+    condHeld.notify_all();
+    MilliSleep(nMillis);
+}
+
+static bool FindSite(const char* pszName, CLockSite& siteRet)
+{
+    vector<CLockSite> vSites = GetLockStats();
+    for (unsigned int i = 0; i < vSites.size(); i++)
+        if (strcmp(vSites[i].pszName, pszName) == 0)
+        {
+            siteRet = vSites[i];
+            return true;
+        }
+    return false;
+}
+
+BOOST_AUTO_TEST_SUITE(sync_tests)
+
+BOOST_AUTO_TEST_CASE(lockstats_off)
+{
+    // Nothing is counted, or even listed, unless -lockstats is on
+    static CCriticalSection cs_uncounted;
+    {
+        LOCK(cs_uncounted);
+    }
+    CLockSite site;
+    BOOST_CHECK(!FindSite("cs_uncounted", site));
+}
+
+BOOST_AUTO_TEST_CASE(lockstats_contention)
+{
+    fLockStats = true;
+
+    // one thread holds the lock while this one waits for it
+    boost::thread holder(HoldTestLock, 100);
+    {
+        boost::unique_lock<boost::mutex> lock(mutexHeld);
+        while (!fHeld)
+            condHeld.wait(lock);
+    }
+    {
+        LOCK(cs_test);
+    }
+    holder.join();
+
+    // recursive and try locks are counted at their own sites
+    {
+        LOCK2(cs_test, cs_test);
+        TRY_LOCK(cs_test, lockTest);
+        BOOST_CHECK(lockTest.GetLock().owns_lock());
+    }
+
+    CLockSite site;
+    BOOST_REQUIRE(FindSite("cs_test", site));
+    vector<CLockSite> vSites = GetLockStats();
+    unsigned int nSites = 0;
+    uint64_t nLocks = 0, nContentions = 0;
+    int64_t nHoldMicros = 0;
+    for (unsigned int i = 0; i < vSites.size(); i++)
+        if (strcmp(vSites[i].pszName, "cs_test") == 0)
+        {
+            nSites++;
+            nLocks += vSites[i].nLocks;
+            nContentions += vSites[i].nContentions;
+            nHoldMicros += vSites[i].nHoldMicros;
+        }
+    BOOST_CHECK_EQUAL(nSites, 5U);
+    BOOST_CHECK_EQUAL(nLocks, 5U);
+    BOOST_CHECK_EQUAL(nContentions, 1U);
+    BOOST_CHECK(nHoldMicros > 0);
+
+    // the waiting site sorts first
+    BOOST_CHECK_EQUAL(site.nContentions, 1U);
+    BOOST_CHECK(site.nWaitMicros > 0);
+    BOOST_CHECK_EQUAL(site.nWaitMicros, site.nMaxWaitMicros);
+
+    fLockStats = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -16,6 +16,7 @@ struct TestingSetup {
         fPrintToDebugger = true; // don't want to write to debug.log file
         noui_connect();
         bitdb.MakeMock();
+        signatureCache.Resize(DEFAULT_MAX_SIG_CACHE_SIZE * 1000000);
         LoadBlockIndex(true);
         bool fFirstRun;
         pwalletMain = new CWallet("wallet.dat");
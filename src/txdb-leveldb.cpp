@@ -154,7 +154,7 @@ bool CTxDB::TxnCommit()
 
 class CBatchScanner : public leveldb::WriteBatch::Handler {
 public:
-    std::string needle;
+    leveldb::Slice needle;
     bool *deleted;
     std::string *foundValue;
     bool foundEntry;
@@ -162,7 +162,7 @@ public:
     CBatchScanner() : foundEntry(false) {}
 
     virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
-        if (key.ToString() == needle) {
+        if (key == needle) {
             foundEntry = true;
             *deleted = false;
             *foundValue = value.ToString();
@@ -170,7 +170,7 @@ public:
     }
 
     virtual void Delete(const leveldb::Slice& key) {
-        if (key.ToString() == needle) {
+        if (key == needle) {
             foundEntry = true;
             *deleted = true;
         }
@@ -182,11 +182,11 @@ public:
 // a database transaction begins reads are consistent with it. It would be good
 // to change that assumption in future and avoid the performance hit, though in
 // practice it does not appear to be large.
-bool CTxDB::ScanBatch(const CDataStream &key, string *value, bool *deleted) const {
+bool CTxDB::ScanBatch(const leveldb::Slice &key, string *value, bool *deleted) const {
     assert(activeBatch);
     *deleted = false;
     CBatchScanner scanner;
-    scanner.needle = key.str();
+    scanner.needle = key;
     scanner.deleted = deleted;
     scanner.foundValue = value;
     leveldb::Status status = activeBatch->Iterate(&scanner);
@@ -304,6 +304,164 @@ bool CTxDB::WriteCheckpointPubKey(const string& strPubKey)
     return Write(string("strCheckpointPubKey"), strPubKey);
 }
 
+bool CTxDB::ReadFlag(const string& strName, bool& fValue)
+{
+    fValue = false;
+    return Read(make_pair(string("flag"), strName), fValue);
+}
+
+bool CTxDB::WriteFlag(const string& strName, bool fValue)
+{
+    return Write(make_pair(string("flag"), strName), fValue);
+}
+
+bool CTxDB::WriteAddressIndex(const vector<pair<CAddressIndexKey, int64_t> >& vEntries)
+{
+    for (vector<pair<CAddressIndexKey, int64_t> >::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+        if (!Write(make_pair(string("addrtx"), it->first), it->second))
+            return false;
+    return true;
+}
+
+bool CTxDB::EraseAddressIndex(const vector<pair<CAddressIndexKey, int64_t> >& vEntries)
+{
+    for (vector<pair<CAddressIndexKey, int64_t> >::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+        if (!Erase(make_pair(string("addrtx"), it->first)))
+            return false;
+    return true;
+}
+
+// Serialized form of a key, to compare iterator positions against
+template<typename K>
+static string SerializeKey(const K& key)
+{
+    CFixedDataStream<128> ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << key;
+    return ssKey.str();
+}
+
+bool CTxDB::ReadAddressIndex(int nAddressType, const uint160& hashBytes,
+                             vector<pair<CAddressIndexKey, int64_t> >& vEntries, int nStart, int nEnd)
+{
+    string strPrefix = SerializeKey(make_pair(string("addrtx"), make_pair((unsigned char)nAddressType, hashBytes)));
+    string strSeek = SerializeKey(make_pair(string("addrtx"), CAddressIndexIteratorKey(nAddressType, hashBytes, nStart)));
+
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    for (iterator->Seek(strSeek); iterator->Valid() && iterator->key().starts_with(strPrefix); iterator->Next())
+    {
+        try {
+            CPlainDataStream ssKey(iterator->key().data(), iterator->key().data() + iterator->key().size(), SER_DISK, CLIENT_VERSION);
+            CPlainDataStream ssValue(iterator->value().data(), iterator->value().data() + iterator->value().size(), SER_DISK, CLIENT_VERSION);
+            string strType;
+            CAddressIndexKey key;
+            int64_t nValue;
+            ssKey >> strType >> key;
+            ssValue >> nValue;
+            if (nEnd > 0 && key.nHeight > nEnd)
+                break;
+            vEntries.push_back(make_pair(key, nValue));
+        }
+        catch (std::exception &e) {
+            delete iterator;
+            return error("ReadAddressIndex() : deserialize error");
+        }
+    }
+    delete iterator;
+    return true;
+}
+
+bool CTxDB::UpdateAddressUnspentIndex(const vector<pair<CAddressUnspentKey, CAddressUnspentValue> >& vEntries)
+{
+    for (vector<pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+    {
+        bool fOk;
+        if (it->second.IsNull())
+            fOk = Erase(make_pair(string("addrutxo"), it->first));
+        else
+            fOk = Write(make_pair(string("addrutxo"), it->first), it->second);
+        if (!fOk)
+            return false;
+    }
+    return true;
+}
+
+bool CTxDB::ReadAddressUnspentIndex(int nAddressType, const uint160& hashBytes,
+                                    vector<pair<CAddressUnspentKey, CAddressUnspentValue> >& vEntries)
+{
+    string strPrefix = SerializeKey(make_pair(string("addrutxo"), make_pair((unsigned char)nAddressType, hashBytes)));
+
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    for (iterator->Seek(strPrefix); iterator->Valid() && iterator->key().starts_with(strPrefix); iterator->Next())
+    {
+        try {
+            CPlainDataStream ssKey(iterator->key().data(), iterator->key().data() + iterator->key().size(), SER_DISK, CLIENT_VERSION);
+            CPlainDataStream ssValue(iterator->value().data(), iterator->value().data() + iterator->value().size(), SER_DISK, CLIENT_VERSION);
+            string strType;
+            CAddressUnspentKey key;
+            CAddressUnspentValue value;
+            ssKey >> strType >> key;
+            ssValue >> value;
+            vEntries.push_back(make_pair(key, value));
+        }
+        catch (std::exception &e) {
+            delete iterator;
+            return error("ReadAddressUnspentIndex() : deserialize error");
+        }
+    }
+    delete iterator;
+    return true;
+}
+
+bool CTxDB::WriteSpentIndex(const vector<pair<COutPoint, CSpentIndexValue> >& vEntries)
+{
+    for (vector<pair<COutPoint, CSpentIndexValue> >::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+        if (!Write(make_pair(string("spent"), it->first), it->second))
+            return false;
+    return true;
+}
+
+bool CTxDB::EraseSpentIndex(const vector<pair<COutPoint, CSpentIndexValue> >& vEntries)
+{
+    for (vector<pair<COutPoint, CSpentIndexValue> >::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+        if (!Erase(make_pair(string("spent"), it->first)))
+            return false;
+    return true;
+}
+
+bool CTxDB::ReadSpentIndex(const COutPoint& outpoint, CSpentIndexValue& value)
+{
+    return Read(make_pair(string("spent"), outpoint), value);
+}
+
+bool CTxDB::ErasePrefix(const string& strPrefix)
+{
+    assert(!activeBatch);
+    string strKeyPrefix = SerializeKey(strPrefix);
+
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    leveldb::WriteBatch batch;
+    unsigned int nErased = 0;
+    for (iterator->Seek(strKeyPrefix); iterator->Valid() && iterator->key().starts_with(strKeyPrefix); iterator->Next())
+    {
+        batch.Delete(iterator->key());
+        if (++nErased % 10000 == 0)
+        {
+            leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+            if (!status.ok())
+            {
+                delete iterator;
+                return error("ErasePrefix() : %s", status.ToString().c_str());
+            }
+            batch.Clear();
+        }
+    }
+    delete iterator;
+    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+    if (!status.ok())
+        return error("ErasePrefix() : %s", status.ToString().c_str());
+    return true;
+}
+
 static CBlockIndex *InsertBlockIndex(uint256 hash)
 {
     if (hash == 0)
@@ -336,16 +494,18 @@ bool CTxDB::LoadBlockIndex()
     // out of the DB and into mapBlockIndex.
     leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
     // Seek to start key.
-    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    CKeyStream ssStartKey(SER_DISK, CLIENT_VERSION);
     ssStartKey << make_pair(string("blockindex"), uint256(0));
-    iterator->Seek(ssStartKey.str());
-    // Now read each entry.
+    iterator->Seek(leveldb::Slice(ssStartKey.data(), ssStartKey.size()));
+    // Now read each entry, reusing the two buffers.
+    CPlainDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    CPlainDataStream ssValue(SER_DISK, CLIENT_VERSION);
     while (iterator->Valid())
     {
         // Unpack keys and values.
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.clear();
         ssKey.write(iterator->key().data(), iterator->key().size());
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.clear();
         ssValue.write(iterator->value().data(), iterator->value().size());
         string strType;
         ssKey >> strType;
@@ -428,6 +588,7 @@ bool CTxDB::LoadBlockIndex()
     pindexBest = mapBlockIndex[hashBestChain];
     nBestHeight = pindexBest->nHeight;
     nBestChainTrust = pindexBest->nChainTrust;
+    UpdateChainTip(pindexBest);
 
     printf("LoadBlockIndex(): hashBestChain=%s  height=%d  trust=%s  date=%s\n",
       hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, CBigNum(nBestChainTrust).ToString().c_str(),
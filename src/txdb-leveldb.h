@@ -7,6 +7,7 @@
 #define BITCOIN_LEVELDB_H
 
 #include "main.h"
+#include "addressindex.h"
 
 #include <map>
 #include <string>
@@ -54,14 +55,18 @@ protected:
     // Returns true and sets (value,false) if activeBatch contains the given key
     // or leaves value alone and sets deleted = true if activeBatch contains a
     // delete for it.
-    bool ScanBatch(const CDataStream &key, std::string *value, bool *deleted) const;
+    bool ScanBatch(const leveldb::Slice &key, std::string *value, bool *deleted) const;
+
+    // Keys are a type string and a hash or two, built on the stack; longer
+    // ones spill to the heap
+    typedef CFixedDataStream<128> CKeyStream;
 
     template<typename K, typename T>
     bool Read(const K& key, T& value)
     {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(1000);
+        CKeyStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey << key;
+        leveldb::Slice slKey(ssKey.data(), ssKey.size());
         std::string strValue;
 
         bool readFromDb = true;
@@ -69,14 +74,14 @@ protected:
             // First we must search for it in the currently pending set of
             // changes to the db. If not found in the batch, go on to read disk.
             bool deleted = false;
-            readFromDb = ScanBatch(ssKey, &strValue, &deleted) == false;
+            readFromDb = ScanBatch(slKey, &strValue, &deleted) == false;
             if (deleted) {
                 return false;
             }
         }
         if (readFromDb) {
             leveldb::Status status = pdb->Get(leveldb::ReadOptions(),
-                                              ssKey.str(), &strValue);
+                                              slKey, &strValue);
             if (!status.ok()) {
                 if (status.IsNotFound())
                     return false;
@@ -87,8 +92,8 @@ protected:
         }
         // Unserialize value
         try {
-            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(),
-                                SER_DISK, CLIENT_VERSION);
+            CPlainDataStream ssValue(strValue.data(), strValue.data() + strValue.size(),
+                                     SER_DISK, CLIENT_VERSION);
             ssValue >> value;
         }
         catch (std::exception &e) {
@@ -103,18 +108,19 @@ protected:
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
 
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(1000);
+        CKeyStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey << key;
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        leveldb::Slice slKey(ssKey.data(), ssKey.size());
+        CPlainDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
+        leveldb::Slice slValue(ssValue.empty() ? NULL : &ssValue[0], ssValue.size());
 
         if (activeBatch) {
-            activeBatch->Put(ssKey.str(), ssValue.str());
+            activeBatch->Put(slKey, slValue);
             return true;
         }
-        leveldb::Status status = pdb->Put(leveldb::WriteOptions(), ssKey.str(), ssValue.str());
+        leveldb::Status status = pdb->Put(leveldb::WriteOptions(), slKey, slValue);
         if (!status.ok()) {
             printf("LevelDB write failure: %s\n", status.ToString().c_str());
             return false;
@@ -130,34 +136,34 @@ protected:
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
 
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(1000);
+        CKeyStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey << key;
+        leveldb::Slice slKey(ssKey.data(), ssKey.size());
         if (activeBatch) {
-            activeBatch->Delete(ssKey.str());
+            activeBatch->Delete(slKey);
             return true;
         }
-        leveldb::Status status = pdb->Delete(leveldb::WriteOptions(), ssKey.str());
+        leveldb::Status status = pdb->Delete(leveldb::WriteOptions(), slKey);
         return (status.ok() || status.IsNotFound());
     }
 
     template<typename K>
     bool Exists(const K& key)
     {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.reserve(1000);
+        CKeyStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey << key;
+        leveldb::Slice slKey(ssKey.data(), ssKey.size());
         std::string unused;
 
         if (activeBatch) {
             bool deleted;
-            if (ScanBatch(ssKey, &unused, &deleted) && !deleted) {
+            if (ScanBatch(slKey, &unused, &deleted) && !deleted) {
                 return true;
             }
         }
 
 
-        leveldb::Status status = pdb->Get(leveldb::ReadOptions(), ssKey.str(), &unused);
+        leveldb::Status status = pdb->Get(leveldb::ReadOptions(), slKey, &unused);
         return status.IsNotFound() == false;
     }
 
@@ -202,6 +208,22 @@ public:
     bool ReadCheckpointPubKey(std::string& strPubKey);
     bool WriteCheckpointPubKey(const std::string& strPubKey);
     bool LoadBlockIndex();
+
+    // -addressindex and -spentindex
+    bool ReadFlag(const std::string& strName, bool& fValue);
+    bool WriteFlag(const std::string& strName, bool fValue);
+    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, int64_t> >& vEntries);
+    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, int64_t> >& vEntries);
+    bool ReadAddressIndex(int nAddressType, const uint160& hashBytes,
+                          std::vector<std::pair<CAddressIndexKey, int64_t> >& vEntries, int nStart = 0, int nEnd = 0);
+    bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vEntries);
+    bool ReadAddressUnspentIndex(int nAddressType, const uint160& hashBytes,
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vEntries);
+    bool WriteSpentIndex(const std::vector<std::pair<COutPoint, CSpentIndexValue> >& vEntries);
+    bool EraseSpentIndex(const std::vector<std::pair<COutPoint, CSpentIndexValue> >& vEntries);
+    bool ReadSpentIndex(const COutPoint& outpoint, CSpentIndexValue& value);
+    // Deletes every entry whose key starts with the given string, outside any batch
+    bool ErasePrefix(const std::string& strPrefix);
 private:
     bool LoadBlockIndexGuts();
 };
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_UINT256_H
 #define BITCOIN_UINT256_H
 
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -15,6 +16,12 @@
 
 inline int Testuint256AdHoc(std::vector<std::string> vArg);
 
+class uint_error : public std::runtime_error
+{
+public:
+    explicit uint_error(const std::string& str) : std::runtime_error(str) {}
+};
+
 
 /** Base class without constructors for uint256 and uint160.
  * This makes the compiler let u use it in a union.
@@ -175,6 +182,189 @@ public:
         return *this;
     }
 
+    base_uint& operator*=(uint32_t b32)
+    {
+        uint64_t carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64_t n = carry + (uint64_t)b32 * pn[i];
+            pn[i] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        return *this;
+    }
+
+    base_uint& operator*=(const base_uint& b)
+    {
+        // Schoolbook, dropping whatever passes BITS
+        base_uint a;
+        for (int i = 0; i < WIDTH; i++)
+            a.pn[i] = 0;
+        for (int j = 0; j < WIDTH; j++)
+        {
+            uint64_t carry = 0;
+            for (int i = 0; i + j < WIDTH; i++)
+            {
+                uint64_t n = carry + a.pn[i + j] + (uint64_t)pn[j] * b.pn[i];
+                a.pn[i + j] = n & 0xffffffff;
+                carry = n >> 32;
+            }
+        }
+        *this = a;
+        return *this;
+    }
+
+    base_uint& operator/=(const base_uint& b)
+    {
+        // Long division in 32 bit digits, Knuth's algorithm D (TAOCP 4.3.1)
+        int n = WIDTH;
+        while (n > 0 && b.pn[n-1] == 0)
+            n--;
+        if (n == 0)
+            throw uint_error("base_uint::operator/= : division by zero");
+        int m = WIDTH;
+        while (m > 0 && pn[m-1] == 0)
+            m--;
+        base_uint q;
+        for (int i = 0; i < WIDTH; i++)
+            q.pn[i] = 0;
+        if (m < n)
+        {
+            *this = q;
+            return *this;
+        }
+
+        if (n == 1)
+        {
+            uint64_t rem = 0;
+            for (int i = m - 1; i >= 0; i--)
+            {
+                uint64_t cur = (rem << 32) | pn[i];
+                q.pn[i] = cur / b.pn[0];
+                rem = cur % b.pn[0];
+            }
+            *this = q;
+            return *this;
+        }
+
+        // Shift both so the divisor's top digit has its high bit set, which
+        // keeps each estimated quotient digit at most two too large
+        int nShift = 0;
+        while (!(b.pn[n-1] & (0x80000000U >> nShift)))
+            nShift++;
+        uint32_t vn[WIDTH], un[WIDTH + 1];
+        for (int i = n - 1; i > 0; i--)
+            vn[i] = (b.pn[i] << nShift) | (nShift ? b.pn[i-1] >> (32 - nShift) : 0);
+        vn[0] = b.pn[0] << nShift;
+        un[m] = nShift ? pn[m-1] >> (32 - nShift) : 0;
+        for (int i = m - 1; i > 0; i--)
+            un[i] = (pn[i] << nShift) | (nShift ? pn[i-1] >> (32 - nShift) : 0);
+        un[0] = pn[0] << nShift;
+
+        for (int j = m - n; j >= 0; j--)
+        {
+            uint64_t num = ((uint64_t)un[j+n] << 32) | un[j+n-1];
+            uint64_t qhat = num / vn[n-1];
+            uint64_t rhat = num % vn[n-1];
+            while (qhat > 0xffffffff || qhat * vn[n-2] > ((rhat << 32) | un[j+n-2]))
+            {
+                qhat--;
+                rhat += vn[n-1];
+                if (rhat > 0xffffffff)
+                    break;
+            }
+
+            // Subtract qhat times the divisor, adding it back once if that
+            // went below zero
+            int64_t k = 0, t;
+            for (int i = 0; i < n; i++)
+            {
+                uint64_t p = qhat * vn[i];
+                t = un[i+j] - k - (int64_t)(p & 0xffffffff);
+                un[i+j] = (uint32_t)t;
+                k = (int64_t)(p >> 32) - (t >> 32);
+            }
+            t = un[j+n] - k;
+            un[j+n] = (uint32_t)t;
+            q.pn[j] = (uint32_t)qhat;
+            if (t < 0)
+            {
+                q.pn[j]--;
+                uint64_t c = 0;
+                for (int i = 0; i < n; i++)
+                {
+                    uint64_t sum = (uint64_t)un[i+j] + vn[i] + c;
+                    un[i+j] = (uint32_t)sum;
+                    c = sum >> 32;
+                }
+                un[j+n] += (uint32_t)c;
+            }
+        }
+        *this = q;
+        return *this;
+    }
+
+    // Position of the highest set bit plus one, 0 for zero
+    unsigned int bits() const
+    {
+        for (int i = WIDTH - 1; i >= 0; i--)
+            if (pn[i])
+                for (int nBit = 31; nBit >= 0; nBit--)
+                    if (pn[i] & (1U << nBit))
+                        return 32 * i + nBit + 1;
+        return 0;
+    }
+
+    /** Set from the compact form of nBits: a size byte and a 23 bit mantissa
+     * with a sign bit, read the same way as CBigNum::SetCompact. A negative
+     * value is set as its magnitude, and one that does not fit in BITS is
+     * cut; the flags tell the caller which of those happened.
+     */
+    base_uint& SetCompact(unsigned int nCompact, bool* pfNegative = NULL, bool* pfOverflow = NULL)
+    {
+        unsigned int nSize = nCompact >> 24;
+        uint32_t nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8 * (3 - nSize);
+            *this = nWord;
+        }
+        else
+        {
+            *this = nWord;
+            *this <<= 8 * (nSize - 3);
+        }
+        if (pfNegative)
+            *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
+        if (pfOverflow)
+            *pfOverflow = nWord != 0 && (nSize > BITS / 8 + 2 ||
+                                         (nWord > 0xff && nSize > BITS / 8 + 1) ||
+                                         (nWord > 0xffff && nSize > BITS / 8));
+        return *this;
+    }
+
+    // The compact form of a non-negative value, as CBigNum::GetCompact
+    unsigned int GetCompact() const
+    {
+        unsigned int nSize = (bits() + 7) / 8;
+        unsigned int nCompact;
+        if (nSize <= 3)
+            nCompact = Get64() << 8 * (3 - nSize);
+        else
+        {
+            base_uint bn = *this;
+            bn >>= 8 * (nSize - 3);
+            nCompact = bn.Get64();
+        }
+        // The top mantissa bit is the sign, so a value using it takes a byte more
+        if (nCompact & 0x00800000)
+        {
+            nCompact >>= 8;
+            nSize++;
+        }
+        return nCompact | nSize << 24;
+    }
+
 
     base_uint& operator++()
     {
@@ -468,6 +658,8 @@ inline const uint160 operator&(const base_uint160& a, const base_uint160& b) { r
 inline const uint160 operator|(const base_uint160& a, const base_uint160& b) { return uint160(a) |= b; }
 inline const uint160 operator+(const base_uint160& a, const base_uint160& b) { return uint160(a) += b; }
 inline const uint160 operator-(const base_uint160& a, const base_uint160& b) { return uint160(a) -= b; }
+inline const uint160 operator*(const base_uint160& a, const base_uint160& b) { return uint160(a) *= b; }
+inline const uint160 operator/(const base_uint160& a, const base_uint160& b) { return uint160(a) /= b; }
 
 inline bool operator<(const base_uint160& a, const uint160& b)          { return (base_uint160)a <  (base_uint160)b; }
 inline bool operator<=(const base_uint160& a, const uint160& b)         { return (base_uint160)a <= (base_uint160)b; }
@@ -480,6 +672,8 @@ inline const uint160 operator&(const base_uint160& a, const uint160& b) { return
 inline const uint160 operator|(const base_uint160& a, const uint160& b) { return (base_uint160)a |  (base_uint160)b; }
 inline const uint160 operator+(const base_uint160& a, const uint160& b) { return (base_uint160)a +  (base_uint160)b; }
 inline const uint160 operator-(const base_uint160& a, const uint160& b) { return (base_uint160)a -  (base_uint160)b; }
+inline const uint160 operator*(const base_uint160& a, const uint160& b) { return (base_uint160)a *  (base_uint160)b; }
+inline const uint160 operator/(const base_uint160& a, const uint160& b) { return (base_uint160)a /  (base_uint160)b; }
 
 inline bool operator<(const uint160& a, const base_uint160& b)          { return (base_uint160)a <  (base_uint160)b; }
 inline bool operator<=(const uint160& a, const base_uint160& b)         { return (base_uint160)a <= (base_uint160)b; }
@@ -492,6 +686,8 @@ inline const uint160 operator&(const uint160& a, const base_uint160& b) { return
 inline const uint160 operator|(const uint160& a, const base_uint160& b) { return (base_uint160)a |  (base_uint160)b; }
 inline const uint160 operator+(const uint160& a, const base_uint160& b) { return (base_uint160)a +  (base_uint160)b; }
 inline const uint160 operator-(const uint160& a, const base_uint160& b) { return (base_uint160)a -  (base_uint160)b; }
+inline const uint160 operator*(const uint160& a, const base_uint160& b) { return (base_uint160)a *  (base_uint160)b; }
+inline const uint160 operator/(const uint160& a, const base_uint160& b) { return (base_uint160)a /  (base_uint160)b; }
 
 inline bool operator<(const uint160& a, const uint160& b)               { return (base_uint160)a <  (base_uint160)b; }
 inline bool operator<=(const uint160& a, const uint160& b)              { return (base_uint160)a <= (base_uint160)b; }
@@ -504,6 +700,8 @@ inline const uint160 operator&(const uint160& a, const uint160& b)      { return
 inline const uint160 operator|(const uint160& a, const uint160& b)      { return (base_uint160)a |  (base_uint160)b; }
 inline const uint160 operator+(const uint160& a, const uint160& b)      { return (base_uint160)a +  (base_uint160)b; }
 inline const uint160 operator-(const uint160& a, const uint160& b)      { return (base_uint160)a -  (base_uint160)b; }
+inline const uint160 operator*(const uint160& a, const uint160& b)      { return (base_uint160)a *  (base_uint160)b; }
+inline const uint160 operator/(const uint160& a, const uint160& b)      { return (base_uint160)a /  (base_uint160)b; }
 
 
 
@@ -583,6 +781,8 @@ inline const uint256 operator&(const base_uint256& a, const base_uint256& b) { r
 inline const uint256 operator|(const base_uint256& a, const base_uint256& b) { return uint256(a) |= b; }
 inline const uint256 operator+(const base_uint256& a, const base_uint256& b) { return uint256(a) += b; }
 inline const uint256 operator-(const base_uint256& a, const base_uint256& b) { return uint256(a) -= b; }
+inline const uint256 operator*(const base_uint256& a, const base_uint256& b) { return uint256(a) *= b; }
+inline const uint256 operator/(const base_uint256& a, const base_uint256& b) { return uint256(a) /= b; }
 
 inline bool operator<(const base_uint256& a, const uint256& b)          { return (base_uint256)a <  (base_uint256)b; }
 inline bool operator<=(const base_uint256& a, const uint256& b)         { return (base_uint256)a <= (base_uint256)b; }
@@ -595,6 +795,8 @@ inline const uint256 operator&(const base_uint256& a, const uint256& b) { return
 inline const uint256 operator|(const base_uint256& a, const uint256& b) { return (base_uint256)a |  (base_uint256)b; }
 inline const uint256 operator+(const base_uint256& a, const uint256& b) { return (base_uint256)a +  (base_uint256)b; }
 inline const uint256 operator-(const base_uint256& a, const uint256& b) { return (base_uint256)a -  (base_uint256)b; }
+inline const uint256 operator*(const base_uint256& a, const uint256& b) { return (base_uint256)a *  (base_uint256)b; }
+inline const uint256 operator/(const base_uint256& a, const uint256& b) { return (base_uint256)a /  (base_uint256)b; }
 
 inline bool operator<(const uint256& a, const base_uint256& b)          { return (base_uint256)a <  (base_uint256)b; }
 inline bool operator<=(const uint256& a, const base_uint256& b)         { return (base_uint256)a <= (base_uint256)b; }
@@ -607,6 +809,8 @@ inline const uint256 operator&(const uint256& a, const base_uint256& b) { return
 inline const uint256 operator|(const uint256& a, const base_uint256& b) { return (base_uint256)a |  (base_uint256)b; }
 inline const uint256 operator+(const uint256& a, const base_uint256& b) { return (base_uint256)a +  (base_uint256)b; }
 inline const uint256 operator-(const uint256& a, const base_uint256& b) { return (base_uint256)a -  (base_uint256)b; }
+inline const uint256 operator*(const uint256& a, const base_uint256& b) { return (base_uint256)a *  (base_uint256)b; }
+inline const uint256 operator/(const uint256& a, const base_uint256& b) { return (base_uint256)a /  (base_uint256)b; }
 
 inline bool operator<(const uint256& a, const uint256& b)               { return (base_uint256)a <  (base_uint256)b; }
 inline bool operator<=(const uint256& a, const uint256& b)              { return (base_uint256)a <= (base_uint256)b; }
@@ -619,6 +823,8 @@ inline const uint256 operator&(const uint256& a, const uint256& b)      { return
 inline const uint256 operator|(const uint256& a, const uint256& b)      { return (base_uint256)a |  (base_uint256)b; }
 inline const uint256 operator+(const uint256& a, const uint256& b)      { return (base_uint256)a +  (base_uint256)b; }
 inline const uint256 operator-(const uint256& a, const uint256& b)      { return (base_uint256)a -  (base_uint256)b; }
+inline const uint256 operator*(const uint256& a, const uint256& b)      { return (base_uint256)a *  (base_uint256)b; }
+inline const uint256 operator/(const uint256& a, const uint256& b)      { return (base_uint256)a /  (base_uint256)b; }
 
 
 
@@ -647,6 +853,12 @@ public:
             pn[i] = b.pn[i];
     }
 
+    explicit uint512(const uint256& b)
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = i < uint256::WIDTH ? b.pn[i] : 0;
+    }
+
     uint512& operator=(const basetype& b)
     {
         for (int i = 0; i < WIDTH; i++)
@@ -706,6 +918,8 @@ inline const uint512 operator&(const base_uint512& a, const base_uint512& b) { r
 inline const uint512 operator|(const base_uint512& a, const base_uint512& b) { return uint512(a) |= b; }
 inline const uint512 operator+(const base_uint512& a, const base_uint512& b) { return uint512(a) += b; }
 inline const uint512 operator-(const base_uint512& a, const base_uint512& b) { return uint512(a) -= b; }
+inline const uint512 operator*(const base_uint512& a, const base_uint512& b) { return uint512(a) *= b; }
+inline const uint512 operator/(const base_uint512& a, const base_uint512& b) { return uint512(a) /= b; }
 
 inline bool operator<(const base_uint512& a, const uint512& b)          { return (base_uint512)a <  (base_uint512)b; }
 inline bool operator<=(const base_uint512& a, const uint512& b)         { return (base_uint512)a <= (base_uint512)b; }
@@ -718,6 +932,8 @@ inline const uint512 operator&(const base_uint512& a, const uint512& b) { return
 inline const uint512 operator|(const base_uint512& a, const uint512& b) { return (base_uint512)a |  (base_uint512)b; }
 inline const uint512 operator+(const base_uint512& a, const uint512& b) { return (base_uint512)a +  (base_uint512)b; }
 inline const uint512 operator-(const base_uint512& a, const uint512& b) { return (base_uint512)a -  (base_uint512)b; }
+inline const uint512 operator*(const base_uint512& a, const uint512& b) { return (base_uint512)a *  (base_uint512)b; }
+inline const uint512 operator/(const base_uint512& a, const uint512& b) { return (base_uint512)a /  (base_uint512)b; }
 
 inline bool operator<(const uint512& a, const base_uint512& b)          { return (base_uint512)a <  (base_uint512)b; }
 inline bool operator<=(const uint512& a, const base_uint512& b)         { return (base_uint512)a <= (base_uint512)b; }
@@ -730,6 +946,8 @@ inline const uint512 operator&(const uint512& a, const base_uint512& b) { return
 inline const uint512 operator|(const uint512& a, const base_uint512& b) { return (base_uint512)a |  (base_uint512)b; }
 inline const uint512 operator+(const uint512& a, const base_uint512& b) { return (base_uint512)a +  (base_uint512)b; }
 inline const uint512 operator-(const uint512& a, const base_uint512& b) { return (base_uint512)a -  (base_uint512)b; }
+inline const uint512 operator*(const uint512& a, const base_uint512& b) { return (base_uint512)a *  (base_uint512)b; }
+inline const uint512 operator/(const uint512& a, const base_uint512& b) { return (base_uint512)a /  (base_uint512)b; }
 
 inline bool operator<(const uint512& a, const uint512& b)               { return (base_uint512)a <  (base_uint512)b; }
 inline bool operator<=(const uint512& a, const uint512& b)              { return (base_uint512)a <= (base_uint512)b; }
@@ -742,6 +960,8 @@ inline const uint512 operator&(const uint512& a, const uint512& b)      { return
 inline const uint512 operator|(const uint512& a, const uint512& b)      { return (base_uint512)a |  (base_uint512)b; }
 inline const uint512 operator+(const uint512& a, const uint512& b)      { return (base_uint512)a +  (base_uint512)b; }
 inline const uint512 operator-(const uint512& a, const uint512& b)      { return (base_uint512)a -  (base_uint512)b; }
+inline const uint512 operator*(const uint512& a, const uint512& b)      { return (base_uint512)a *  (base_uint512)b; }
+inline const uint512 operator/(const uint512& a, const uint512& b)      { return (base_uint512)a /  (base_uint512)b; }
 
 
 
@@ -93,6 +93,133 @@ void locking_callback(int mode, int i, const char* file, int line)
 
 LockedPageManager LockedPageManager::instance;
 
+// Free lists and counters of one thread's buffer pool
+struct CBufferPoolThread
+{
+    std::vector<void*> vFree[CBufferPool::SIZE_CLASSES];
+    uint64_t nAllocs;
+    uint64_t nHeapAllocs;
+    uint64_t nZeroed;
+
+    CBufferPoolThread();
+    ~CBufferPoolThread();
+};
+
+struct CBufferPoolState
+{
+    boost::mutex mutex; // guards setThreads and the totals of exited threads
+    std::set<CBufferPoolThread*> setThreads;
+    uint64_t nAllocs;
+    uint64_t nHeapAllocs;
+    uint64_t nZeroed;
+    boost::thread_specific_ptr<CBufferPoolThread> threadPool;
+
+    CBufferPoolState() : nAllocs(0), nHeapAllocs(0), nZeroed(0) {}
+};
+
+// Streams can be built during static initialisation and destroyed after
+// exit, so the shared state is created on first use and never freed
+static CBufferPoolState& BufferPoolState()
+{
+    static CBufferPoolState* pstate = new CBufferPoolState();
+    return *pstate;
+}
+
+// Looked up on every allocation, so through a compiler thread-local rather
+// than the thread_specific_ptr, which is only there to free it at thread exit
+static __thread CBufferPoolThread* pthreadBufferPool = NULL;
+
+CBufferPoolThread::CBufferPoolThread() : nAllocs(0), nHeapAllocs(0), nZeroed(0)
+{
+    for (unsigned int i = 0; i < CBufferPool::SIZE_CLASSES; i++)
+        vFree[i].reserve(CBufferPool::MAX_FREE);
+    CBufferPoolState& state = BufferPoolState();
+    boost::mutex::scoped_lock lock(state.mutex);
+    state.setThreads.insert(this);
+}
+
+CBufferPoolThread::~CBufferPoolThread()
+{
+    pthreadBufferPool = NULL;
+    for (unsigned int i = 0; i < CBufferPool::SIZE_CLASSES; i++)
+        BOOST_FOREACH(void* p, vFree[i])
+            ::operator delete(p);
+    CBufferPoolState& state = BufferPoolState();
+    boost::mutex::scoped_lock lock(state.mutex);
+    state.setThreads.erase(this);
+    state.nAllocs += nAllocs;
+    state.nHeapAllocs += nHeapAllocs;
+    state.nZeroed += nZeroed;
+}
+
+static CBufferPoolThread& ThreadBufferPool()
+{
+    if (pthreadBufferPool == NULL)
+    {
+        pthreadBufferPool = new CBufferPoolThread();
+        BufferPoolState().threadPool.reset(pthreadBufferPool);
+    }
+    return *pthreadBufferPool;
+}
+
+// Returns SIZE_CLASSES for requests too large to pool
+static unsigned int BufferSizeClass(size_t nSize, size_t& nClassSizeRet)
+{
+    unsigned int nClass = 0;
+    for (nClassSizeRet = CBufferPool::MIN_CLASS_SIZE; nClassSizeRet < nSize && nClass < CBufferPool::SIZE_CLASSES; nClassSizeRet <<= 2)
+        nClass++;
+    return nClass;
+}
+
+void* CBufferPool::Allocate(size_t nSize)
+{
+    CBufferPoolThread& pool = ThreadBufferPool();
+    pool.nAllocs++;
+    size_t nClassSize;
+    unsigned int nClass = BufferSizeClass(nSize, nClassSize);
+    if (nClass < SIZE_CLASSES && !pool.vFree[nClass].empty())
+    {
+        void* p = pool.vFree[nClass].back();
+        pool.vFree[nClass].pop_back();
+        return p;
+    }
+    pool.nHeapAllocs++;
+    return ::operator new(nClass < SIZE_CLASSES ? nClassSize : nSize);
+}
+
+void CBufferPool::Free(void* p, size_t nSize, bool fZero)
+{
+    CBufferPoolThread& pool = ThreadBufferPool();
+    if (fZero)
+    {
+        memset(p, 0, nSize);
+        pool.nZeroed += nSize;
+    }
+    size_t nClassSize;
+    unsigned int nClass = BufferSizeClass(nSize, nClassSize);
+    if (nClass < SIZE_CLASSES && pool.vFree[nClass].size() < MAX_FREE)
+        pool.vFree[nClass].push_back(p);
+    else
+        ::operator delete(p);
+}
+
+void CBufferPool::GetStats(uint64_t& nAllocsRet, uint64_t& nHeapAllocsRet, uint64_t& nZeroedRet)
+{
+    CBufferPoolState& state = BufferPoolState();
+    boost::mutex::scoped_lock lock(state.mutex);
+    nAllocsRet = state.nAllocs;
+    nHeapAllocsRet = state.nHeapAllocs;
+    nZeroedRet = state.nZeroed;
+    // Counters of live threads are only written by their owners, a reading
+    // here can be a moment behind
+    BOOST_FOREACH(const CBufferPoolThread* pool, state.setThreads)
+    {
+        nAllocsRet += pool->nAllocs;
+        nHeapAllocsRet += pool->nHeapAllocs;
+        nZeroedRet += pool->nZeroed;
+    }
+}
+
 // Init
 class CInit
 {
@@ -64,13 +64,13 @@ bool VerifyMessage(CBitcoinAddress address, std::string strMessage, std::vector<
 
 bool VerifyMessage(CKeyID keyID, std::string strMessage, std::vector<unsigned char> vSignature, std::string& strErrorMessage)
 {
-    CDataStream ss(SER_GETHASH, 0);
+    CHashWriter ss(SER_GETHASH, 0);
     ss << strMessageMagic;
     ss << strMessage;
 
     CKey key;
 
-    if (!key.SetCompactSignature(Hash(ss.begin(), ss.end()), vSignature))
+    if (!key.SetCompactSignature(ss.GetHash(), vSignature))
     {
         strErrorMessage = "Signature invalid";
 
@@ -30,7 +30,7 @@ static const int DATABASE_VERSION = 70508;
 // network protocol versioning
 //
 
-static const int PROTOCOL_VERSION = 60014;
+static const int PROTOCOL_VERSION = 60015;
 
 // earlier versions not supported as of Feb 2012, and are disconnected
 static const int MIN_PROTO_VERSION = 209;
@@ -49,4 +49,7 @@ static const int BIP0031_VERSION = 60000;
 // "mempool" command, enhanced "getdata" behavior starts with this version:
 static const int MEMPOOL_GD_VERSION = 60002;
 
+// "sendcmpct", "cmpctblock", "getblocktxn" and "blocktxn" messages start with this version
+static const int COMPACTBLOCKS_VERSION = 60015;
+
 #endif